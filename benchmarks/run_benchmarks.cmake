@@ -0,0 +1,64 @@
+# Runs every program of BENCHMARKS RUNS times at -O3 with each of ENGINES and
+# prints the shortest wall-clock time of each run, in milliseconds. Every
+# engine must print the same as the tree-walking interpreter. The numbers only
+# mean something for a build with CMAKE_BUILD_TYPE=Release.
+
+# For the microseconds of string(TIMESTAMP)
+cmake_minimum_required(VERSION 3.23)
+
+if (NOT DEFINED RUNS)
+    set(RUNS 5)
+endif ()
+
+separate_arguments(engines UNIX_COMMAND "${ENGINES}")
+file(GLOB programs "${BENCHMARKS}/*.txt")
+
+function(current_time_us output_var)
+    string(TIMESTAMP now "%s%f" UTC)
+    set(${output_var} "${now}" PARENT_SCOPE)
+endfunction()
+
+message("program               engine   time")
+
+foreach (program ${programs})
+    get_filename_component(name ${program} NAME_WE)
+
+    execute_process(COMMAND ${CHADEVAL} -O3 --engine=tree ${program}
+            OUTPUT_VARIABLE reference_output
+            ERROR_VARIABLE error
+            RESULT_VARIABLE status)
+
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "${program} failed:\n${reference_output}${error}")
+    endif ()
+
+    foreach (engine ${engines})
+        set(best "")
+
+        foreach (run RANGE 1 ${RUNS})
+            current_time_us(start)
+            execute_process(COMMAND ${CHADEVAL} -O3 --engine=${engine} ${program}
+                    OUTPUT_VARIABLE output
+                    ERROR_QUIET)
+            current_time_us(end)
+
+            if (NOT output STREQUAL reference_output)
+                message(FATAL_ERROR "${program} prints with --engine=${engine}:\n${output}\nExpected:\n${reference_output}")
+            endif ()
+
+            math(EXPR elapsed "(${end} - ${start}) / 1000")
+
+            if (best STREQUAL "" OR elapsed LESS best)
+                set(best ${elapsed})
+            endif ()
+        endforeach ()
+
+        string(LENGTH "${name}" name_length)
+        string(LENGTH "${engine}" engine_length)
+        math(EXPR name_padding "22 - ${name_length}")
+        math(EXPR engine_padding "9 - ${engine_length}")
+        string(REPEAT " " ${name_padding} name_spaces)
+        string(REPEAT " " ${engine_padding} engine_spaces)
+        message("${name}${name_spaces}${engine}${engine_spaces}${best} ms")
+    endforeach ()
+endforeach ()
@@ -0,0 +1,268 @@
+#ifndef CHAD_INTERPRETER_AOT_RUNTIME_H
+#define CHAD_INTERPRETER_AOT_RUNTIME_H
+
+// Runtime of the programs translated to C by the C backend. Generated files
+// include it once with STB_DS_IMPLEMENTATION defined and link against the
+// interpreter library, of which only the values, frames and builtins are used.
+
+#include "builtins.h"
+#include "errors.h"
+#include "interpreter.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "str.h"
+
+static inline struct runtime_value aot_load_variable(struct context* context, const char* variable_name) {
+    const struct runtime_variable* variable = get_variable(context, variable_name);
+
+    if (variable == NULL) {
+        panic("ERROR: cannot find variable '%s'\n", variable_name);
+    }
+
+    return variable->content;
+}
+
+// Checked before the value of the declaration is evaluated
+static inline void aot_check_declaration(struct context* context, const char* variable_name) {
+    const struct runtime_variable* old_variable = get_variable(context, variable_name);
+
+    if (old_variable != NULL && old_variable->is_constant == true) {
+        panic("ERROR: declaration of '%s' is shadowing a constant variable\n", variable_name);
+    }
+}
+
+static inline void aot_declare_variable(struct context* context, const char* variable_name, bool is_constant, struct runtime_value value) {
+    declare_variable(context, variable_name, is_constant, value);
+}
+
+// Checked before the assigned value is evaluated, which leaves the variable
+// where it is on the stack
+// Returns the index of the variable, the stack may grow while the new
+// value is evaluated
+static inline size_t aot_check_assignment(struct context* context, const char* variable_name) {
+    struct runtime_variable* old_variable = get_mutable_variable(context, variable_name);
+
+    if (old_variable == NULL) {
+        panic("ERROR: cannot find variable '%s'\n", variable_name);
+    }
+
+    if (old_variable->is_constant) {
+        panic("ERROR: variable '%s' is constant\n", variable_name);
+    }
+
+    return old_variable - context->variables;
+}
+
+static inline void aot_assign_variable(struct context* context, size_t index, struct runtime_value new_content) {
+    struct runtime_variable* variable = &context->variables[index];
+
+    if (variable->content.type != new_content.type) {
+        panic("ERROR: cannot assign value of type %s to variable '%s' of type %s\n", runtime_type_to_string(new_content.type), variable->name, runtime_type_to_string(variable->content.type));
+    }
+
+    // The new content is retained first, it may hold the old one
+    retain_value(&new_content);
+    release_value(&variable->content);
+
+    variable->content = new_content;
+}
+
+static inline void aot_update_variable(struct context* context, const char* variable_name, enum binary_op_type op_type, long constant) {
+    struct runtime_variable* variable = get_mutable_variable(context, variable_name);
+
+    if (variable == NULL) {
+        panic("ERROR: cannot find variable '%s'\n", variable_name);
+    }
+
+    if (variable->is_constant) {
+        panic("ERROR: variable '%s' is constant\n", variable_name);
+    }
+
+    struct runtime_value constant_value = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = constant,
+    };
+
+    if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+        variable->content = apply_integer_op(op_type, variable->content.value.integer, constant);
+    } else {
+        apply_binary_op(op_type, variable->content, constant_value);
+    }
+}
+
+// The value of a match statement must have the type of its constants
+static inline void aot_check_match_type(struct runtime_value value, enum runtime_type constant_type) {
+    if (value.type != constant_type) {
+        panic("ERROR: type mismatch between %s and %s\n", runtime_type_to_string(value.type), runtime_type_to_string(constant_type));
+    }
+}
+
+static inline void aot_declare_function(struct context* context, struct statement* function) {
+    declare_function(context, function);
+}
+
+// Looks up a function and checks the number of arguments before they are evaluated
+static inline const struct statement* aot_get_function(struct context* context, const char* fn_name, size_t argument_count) {
+    const struct statement* fn = get_function(context, fn_name);
+
+    if (fn == NULL) {
+        panic("ERROR: cannot find function %s\n", fn_name);
+    }
+
+    size_t fn_decl_argument_size = arrlen(fn->op.function_declaration.arguments);
+
+    if (fn_decl_argument_size != argument_count) {
+        panic("ERROR: '%s' expects %zu arguments, but %zu were given\n", fn_name, fn_decl_argument_size, argument_count);
+    }
+
+    return fn;
+}
+
+// Called in the frame of the function once its arguments are evaluated
+static inline void aot_enter_function(struct context* context, const struct statement* fn, struct runtime_value* arguments) {
+    for (size_t i = 0; i < arrlen(fn->op.function_declaration.arguments); i++) {
+        declare_variable(context, fn->op.function_declaration.arguments[i], false, arguments[i]);
+    }
+
+    context->recursion_depth++;
+
+    if (context->recursion_depth >= MAX_RECURSION_DEPTH) {
+        panic("ERROR: max recursion depth exceeded\n");
+    }
+}
+
+static inline struct runtime_value aot_leave_function(struct context* context, enum completion completion) {
+    struct runtime_value return_value = {.type = RUNTIME_TYPE_NULL};
+
+    context->recursion_depth--;
+
+    if (completion == COMPLETION_RETURN) {
+        return_value = context->return_value;
+    }
+
+    pop_stack_frame(context);
+
+    // Handed to the caller like any other result, once no frame holds it
+    if (is_counted_string(&return_value))
+        (*return_value.value.string.reference_count)--;
+
+    return return_value;
+}
+
+// The operator is a constant in generated code, so the C compiler reduces
+// this to the operation for the types it is given
+static inline struct runtime_value aot_binary_op(enum binary_op_type op_type, struct runtime_value lhs, struct runtime_value rhs) {
+    bool is_division = op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO;
+
+    if (lhs.type == RUNTIME_TYPE_INTEGER && rhs.type == RUNTIME_TYPE_INTEGER && !is_logical_binary_op(op_type) && !(is_division && rhs.value.integer == 0)) {
+        return apply_integer_op(op_type, lhs.value.integer, rhs.value.integer);
+    }
+
+    return apply_binary_op(op_type, lhs, rhs);
+}
+
+// `variable = variable + rhs`, extending the string of the variable in place
+// when it is the only one holding it and evaluating rhs did not assign it. lhs
+// was retained before rhs was evaluated.
+static inline void aot_append_variable(struct context* context, size_t index, struct runtime_value lhs, struct runtime_value rhs) {
+    struct runtime_variable* variable = &context->variables[index];
+    bool is_assigned = !is_same_string(&variable->content, &lhs);
+
+    if (!is_assigned) {
+        release_value(&lhs);
+
+        if (append_string(&variable->content, &rhs)) {
+            destroy_value(&rhs);
+            return;
+        }
+    }
+
+    aot_assign_variable(context, index, aot_binary_op(BINARY_OP_ADD, lhs, rhs));
+
+    if (is_assigned) {
+        release_value(&lhs);
+    }
+}
+
+static inline struct runtime_value aot_unary_op(enum unary_op_type op_type, struct runtime_value arg) {
+    if (op_type == UNARY_OP_NOT && arg.type == RUNTIME_TYPE_BOOLEAN) {
+        arg.value.boolean = !arg.value.boolean;
+        return arg;
+    }
+
+    if (op_type == UNARY_OP_NEG && arg.type == RUNTIME_TYPE_INTEGER) {
+        arg.value.integer = -arg.value.integer;
+        return arg;
+    }
+
+    return apply_unary_op(op_type, arg);
+}
+
+static inline struct runtime_value aot_modulo_test(struct context* context, const char* variable_name, long modulus, long remainder, bool is_equal) {
+    struct runtime_value value = aot_load_variable(context, variable_name);
+    enum binary_op_type comparison = is_equal ? BINARY_OP_EQUAL : BINARY_OP_NOT_EQUAL;
+
+    if (value.type == RUNTIME_TYPE_INTEGER) {
+        return apply_integer_op(comparison, value.value.integer % modulus, remainder);
+    }
+
+    struct runtime_value modulus_value = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = modulus,
+    };
+    struct runtime_value remainder_value = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = remainder,
+    };
+
+    return apply_binary_op(comparison, apply_binary_op(BINARY_OP_MODULO, value, modulus_value), remainder_value);
+}
+
+static inline struct runtime_value aot_string(const char* literal) {
+    return copy_string_value(literal);
+}
+
+static inline bool aot_condition(struct runtime_value condition, const char* statement_name) {
+    if (condition.type != RUNTIME_TYPE_BOOLEAN) {
+        panic("ERROR: found a value of type %s in a %s condition\n", runtime_type_to_string(condition.type), statement_name);
+    }
+
+    return condition.value.boolean;
+}
+
+static inline void aot_print(struct runtime_value value) {
+    print_value(&value);
+    printf(" ");
+
+    destroy_value(&value);
+}
+
+// Returns true if the loop must stop after an iteration, resetting the
+// completion of the function to that of the loop when it is a break or
+// continue
+static inline bool aot_loop_should_stop(enum completion* completion) {
+    bool should_stop = is_loop_exit(*completion);
+
+    *completion = get_loop_completion(*completion);
+
+    return should_stop;
+}
+
+static inline void aot_cache_invariant(struct runtime_value* cached_value, bool* is_cached, struct runtime_value value) {
+    *cached_value = value;
+
+    // Keep the value alive until the loop releases it
+    retain_value(cached_value);
+
+    *is_cached = true;
+}
+
+static inline void aot_release_invariant(struct runtime_value* cached_value, bool* is_cached) {
+    if (!*is_cached) return;
+
+    release_value(cached_value);
+    *is_cached = false;
+}
+
+#endif
@@ -42,6 +42,7 @@ struct expr* make_binary_op(enum binary_op_type type, struct expr* lhs, struct e
     expr->op.binary.type = type;
     expr->op.binary.lhs = lhs;
     expr->op.binary.rhs = rhs;
+    expr->op.binary.is_polymorphic = false;
     return expr;
 }
 
@@ -91,6 +92,8 @@ struct expr* make_variable_use(const char* name) {
     struct expr* expr = xmalloc(sizeof(struct expr));
     expr->type = EXPR_VARIABLE_USE;
     expr->op.variable_use.name = xstrdup(name);
+    expr->op.variable_use.is_polymorphic = false;
+    expr->op.variable_use.slot = UNRESOLVED_SLOT;
     return expr;
 }
 
@@ -102,11 +105,125 @@ struct expr* make_function_call(const char* name) {
     return expr;
 }
 
+struct expr* make_loop_invariant(struct expr* value) {
+    struct expr* expr = xmalloc(sizeof(struct expr));
+    expr->type = EXPR_LOOP_INVARIANT;
+    expr->op.loop_invariant.value = value;
+    expr->op.loop_invariant.is_cached = false;
+    expr->op.loop_invariant.cached_value = NULL;
+    return expr;
+}
+
+struct expr* make_variable_constant_op(enum binary_op_type type, const char* name, long constant) {
+    struct expr* expr = xmalloc(sizeof(struct expr));
+    expr->type = EXPR_VARIABLE_CONSTANT_OPT;
+    expr->op.variable_constant.type = type;
+    expr->op.variable_constant.name = xstrdup(name);
+    expr->op.variable_constant.constant = constant;
+    expr->op.variable_constant.slot = UNRESOLVED_SLOT;
+    return expr;
+}
+
+struct expr* make_modulo_test(const char* name, long modulus, long remainder, bool is_equal) {
+    struct expr* expr = xmalloc(sizeof(struct expr));
+    expr->type = EXPR_MODULO_TEST;
+    expr->op.modulo_test.name = xstrdup(name);
+    expr->op.modulo_test.modulus = modulus;
+    expr->op.modulo_test.remainder = remainder;
+    expr->op.modulo_test.is_equal = is_equal;
+    expr->op.modulo_test.slot = UNRESOLVED_SLOT;
+    return expr;
+}
+
+struct expr* make_concat() {
+    struct expr* expr = xmalloc(sizeof(struct expr));
+    expr->type = EXPR_CONCAT;
+    expr->op.concat.operands = NULL;
+    return expr;
+}
+
+struct expr* clone_expr(const struct expr* expr) {
+    if (expr == NULL) return NULL;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            return make_binary_op(expr->op.binary.type, clone_expr(expr->op.binary.lhs), clone_expr(expr->op.binary.rhs));
+        case EXPR_UNARY_OPT:
+            return make_unary_op(expr->op.unary.type, clone_expr(expr->op.unary.arg));
+        case EXPR_BOOL_LITERAL:
+            return make_bool_literal(expr->op.bool_literal);
+        case EXPR_INT_LITERAL:
+            return make_integer_literal(expr->op.integer_literal);
+        case EXPR_FLOAT_LITERAL:
+            return make_float_literal(expr->op.float_literal);
+        case EXPR_STRING_LITERAL:
+            return make_string_literal(expr->op.string_literal);
+        case EXPR_NULL:
+            return make_null();
+        case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
+            return make_variable_use(expr->op.variable_use.name);
+        case EXPR_FUNCTION_CALL: {
+            struct expr* function_call = make_function_call(expr->op.function_call.name);
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                arrpush(function_call->op.function_call.arguments, clone_expr(*arg));
+            }
+            return function_call;
+        }
+        case EXPR_LOOP_INVARIANT:
+            // The copy is not registered in any loop, so it can't be cached
+            return clone_expr(expr->op.loop_invariant.value);
+        case EXPR_VARIABLE_CONSTANT_OPT:
+            return make_variable_constant_op(expr->op.variable_constant.type, expr->op.variable_constant.name, expr->op.variable_constant.constant);
+        case EXPR_MODULO_TEST:
+            return make_modulo_test(expr->op.modulo_test.name, expr->op.modulo_test.modulus, expr->op.modulo_test.remainder, expr->op.modulo_test.is_equal);
+        case EXPR_CONCAT: {
+            struct expr* concat = make_concat();
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                arrpush(concat->op.concat.operands, clone_expr(*operand));
+            }
+            return concat;
+        }
+    }
+
+    return NULL;
+}
+
+bool is_branch_expr(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return is_logical_binary_op(expr->op.binary.type);
+        case EXPR_UNARY_OPT:
+            return expr->op.unary.type == UNARY_OP_NOT && is_branch_expr(expr->op.unary.arg);
+        default:
+            return false;
+    }
+}
+
+bool is_append_assignment(const struct statement* statement) {
+    const struct expr* value = statement->op.variable_assignment.value;
+    const struct expr* lhs;
+
+    if (value->type == EXPR_CONCAT) {
+        lhs = value->op.concat.operands[0];
+    } else if ((value->type == EXPR_BINARY_OPT || value->type == EXPR_STRING_BINARY_OPT) && value->op.binary.type == BINARY_OP_ADD) {
+        lhs = value->op.binary.lhs;
+    } else {
+        return false;
+    }
+
+    return lhs->type == EXPR_VARIABLE_USE && strcmp(lhs->op.variable_use.name, statement->op.variable_assignment.variable_name) == 0;
+}
+
 void dump_expr(struct expr* expr, int indent) {
     switch (expr->type) {
         case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
             print_indent(indent);
-            fprintf(stderr, "BinaryOperation\n");
+            fprintf(stderr, "%sBinaryOperation\n", expr->type == EXPR_INT_BINARY_OPT ? "Int" : expr->type == EXPR_STRING_BINARY_OPT ? "String" : "");
             dump_expr(expr->op.binary.lhs, indent + indent_offset);
             print_indent(indent + indent_offset);
             fprintf(stderr, "%s\n", binary_op_to_symbol(expr->op.binary.type));
@@ -140,8 +257,9 @@ void dump_expr(struct expr* expr, int indent) {
             fprintf(stderr, "NullLiteral\n");
             break;
         case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
             print_indent(indent);
-            fprintf(stderr, "Variable %s\n", expr->op.variable_use.name);
+            fprintf(stderr, "%sVariable %s\n", expr->type == EXPR_INT_VARIABLE_USE ? "Int" : "", expr->op.variable_use.name);
             break;
         case EXPR_FUNCTION_CALL:
             print_indent(indent);
@@ -154,6 +272,57 @@ void dump_expr(struct expr* expr, int indent) {
                 }
             }
             break;
+        case EXPR_LOOP_INVARIANT:
+            print_indent(indent);
+            fprintf(stderr, "LoopInvariant\n");
+            dump_expr(expr->op.loop_invariant.value, indent + indent_offset);
+            break;
+        case EXPR_VARIABLE_CONSTANT_OPT:
+            print_indent(indent);
+            fprintf(stderr, "VariableConstantOperation %s %s %ld\n", expr->op.variable_constant.name, binary_op_to_symbol(expr->op.variable_constant.type), expr->op.variable_constant.constant);
+            break;
+        case EXPR_MODULO_TEST:
+            print_indent(indent);
+            fprintf(stderr, "ModuloTest %s %% %ld %s %ld\n", expr->op.modulo_test.name, expr->op.modulo_test.modulus, expr->op.modulo_test.is_equal ? "==" : "!=", expr->op.modulo_test.remainder);
+            break;
+        case EXPR_CONCAT:
+            print_indent(indent);
+            fprintf(stderr, "Concatenation\n");
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                dump_expr(*operand, indent + indent_offset);
+            }
+            break;
+    }
+}
+
+size_t count_expr_nodes(const struct expr* expr) {
+    if (expr == NULL) return 0;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            return 1 + count_expr_nodes(expr->op.binary.lhs) + count_expr_nodes(expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return 1 + count_expr_nodes(expr->op.unary.arg);
+        case EXPR_FUNCTION_CALL: {
+            size_t count = 1;
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                count += count_expr_nodes(*arg);
+            }
+            return count;
+        }
+        case EXPR_LOOP_INVARIANT:
+            return 1 + count_expr_nodes(expr->op.loop_invariant.value);
+        case EXPR_CONCAT: {
+            size_t count = 1;
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                count += count_expr_nodes(*operand);
+            }
+            return count;
+        }
+        default:
+            return 1;
     }
 }
 
@@ -165,6 +334,8 @@ void destroy_expr(struct expr* expr) {
             free(expr->op.string_literal);
             break;
         case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
             destroy_expr(expr->op.binary.lhs);
             destroy_expr(expr->op.binary.rhs);
             break;
@@ -172,6 +343,7 @@ void destroy_expr(struct expr* expr) {
             destroy_expr(expr->op.unary.arg);
             break;
         case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
             free(expr->op.variable_use.name);
             break;
         case EXPR_FUNCTION_CALL:
@@ -181,6 +353,22 @@ void destroy_expr(struct expr* expr) {
             }
             arrfree(expr->op.function_call.arguments);
             break;
+        case EXPR_LOOP_INVARIANT:
+            destroy_expr(expr->op.loop_invariant.value);
+            free(expr->op.loop_invariant.cached_value);
+            break;
+        case EXPR_VARIABLE_CONSTANT_OPT:
+            free(expr->op.variable_constant.name);
+            break;
+        case EXPR_MODULO_TEST:
+            free(expr->op.modulo_test.name);
+            break;
+        case EXPR_CONCAT:
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                destroy_expr(*operand);
+            }
+            arrfree(expr->op.concat.operands);
+            break;
         default:
             break;
     }
@@ -211,6 +399,8 @@ struct statement* make_variable_declaration(bool constant, const char* variable_
     statement->op.variable_declaration.is_constant = constant;
     statement->op.variable_declaration.variable_name = xstrdup(variable_name);
     statement->op.variable_declaration.value = NULL;
+    statement->op.variable_declaration.slot = UNRESOLVED_SLOT;
+    statement->op.variable_declaration.can_shadow_constant = true;
     return statement;
 }
 
@@ -228,6 +418,7 @@ struct statement* make_variable_assignment(const char* variable_name, struct exp
     statement->type = STATEMENT_VARIABLE_ASSIGN;
     statement->op.variable_assignment.variable_name = xstrdup(variable_name);
     statement->op.variable_assignment.value = value;
+    statement->op.variable_assignment.slot = UNRESOLVED_SLOT;
     return statement;
 }
 
@@ -243,6 +434,7 @@ struct statement* make_while_loop(struct expr* condition, struct statement* body
     statement->type = STATEMENT_WHILE_LOOP;
     statement->op.while_loop.condition = condition;
     statement->op.while_loop.body = body;
+    statement->op.while_loop.invariants = NULL;
     return statement;
 }
 
@@ -253,6 +445,9 @@ struct statement* make_for_loop(struct statement* initializer, struct expr* cond
     statement->op.for_loop.condition = condition;
     statement->op.for_loop.increment = increment;
     statement->op.for_loop.body = body;
+    statement->op.for_loop.invariants = NULL;
+    statement->op.for_loop.is_counted = false;
+    statement->op.for_loop.counted_step = 0;
     return statement;
 }
 
@@ -275,6 +470,140 @@ struct statement* make_return_statement() {
     return statement;
 }
 
+struct statement* make_variable_update(enum binary_op_type type, const char* variable_name, long constant) {
+    struct statement* statement = xmalloc(sizeof(struct statement));
+    statement->type = STATEMENT_VARIABLE_UPDATE;
+    statement->op.variable_update.type = type;
+    statement->op.variable_update.variable_name = xstrdup(variable_name);
+    statement->op.variable_update.constant = constant;
+    statement->op.variable_update.slot = UNRESOLVED_SLOT;
+    return statement;
+}
+
+struct statement* make_match_statement(struct expr* value) {
+    struct statement* statement = xmalloc(sizeof(struct statement));
+    statement->type = STATEMENT_MATCH;
+    statement->op.match.value = value;
+    statement->op.match.constants = NULL;
+    statement->op.match.constant_arms = NULL;
+    statement->op.match.arms = NULL;
+    statement->op.match.body_else = NULL;
+    statement->op.match.table_min = 0;
+    statement->op.match.jump_table = NULL;
+    statement->op.match.integer_arms = NULL;
+    statement->op.match.string_arms = NULL;
+    return statement;
+}
+
+int add_match_arm(struct statement* match, struct statement* body) {
+    arrpush(match->op.match.arms, body);
+    return (int) arrlen(match->op.match.arms) - 1;
+}
+
+void add_match_constant(struct statement* match, struct expr* constant, int arm) {
+    arrpush(match->op.match.constants, constant);
+    arrpush(match->op.match.constant_arms, arm);
+}
+
+// Integer constants spanning at most this many values per constant get a jump
+// table, sparser ones a binary search
+static const long MAX_JUMP_TABLE_SPREAD = 4;
+
+void finish_match_statement(struct statement* match) {
+    struct expr** constants = match->op.match.constants;
+    int* constant_arms = match->op.match.constant_arms;
+
+    // The first arm of a duplicated constant is the one selected
+    if (is_string_match(match)) {
+        shdefault(match->op.match.string_arms, -1);
+
+        for (size_t i = 0; i < arrlen(constants); i++) {
+            if (shgeti(match->op.match.string_arms, constants[i]->op.string_literal) < 0)
+                shput(match->op.match.string_arms, constants[i]->op.string_literal, constant_arms[i]);
+        }
+        return;
+    }
+
+    long min = constants[0]->op.integer_literal;
+    long max = min;
+
+    FOR_EACH(struct expr*, it, constants) {
+        if ((*it)->op.integer_literal < min) min = (*it)->op.integer_literal;
+        if ((*it)->op.integer_literal > max) max = (*it)->op.integer_literal;
+    }
+
+    // Unsigned to avoid overflowing on distant constants
+    unsigned long spread = (unsigned long) max - (unsigned long) min;
+
+    if (spread < (unsigned long) arrlen(constants) * MAX_JUMP_TABLE_SPREAD) {
+        match->op.match.table_min = min;
+        arrsetlen(match->op.match.jump_table, spread + 1);
+
+        for (unsigned long i = 0; i <= spread; i++) {
+            match->op.match.jump_table[i] = -1;
+        }
+
+        for (size_t i = 0; i < arrlen(constants); i++) {
+            int* entry = &match->op.match.jump_table[(unsigned long) constants[i]->op.integer_literal - (unsigned long) min];
+
+            if (*entry < 0) *entry = constant_arms[i];
+        }
+        return;
+    }
+
+    // Sorted for a binary search, by insertion as there are few constants
+    for (size_t i = 0; i < arrlen(constants); i++) {
+        struct match_integer_entry entry = {
+                .key = constants[i]->op.integer_literal,
+                .value = constant_arms[i],
+        };
+        struct match_integer_entry* integer_arms = match->op.match.integer_arms;
+        size_t position = arrlen(integer_arms);
+
+        while (position > 0 && integer_arms[position - 1].key > entry.key) {
+            position--;
+        }
+
+        if (position > 0 && integer_arms[position - 1].key == entry.key) continue;
+
+        arrins(match->op.match.integer_arms, position, entry);
+    }
+}
+
+int find_match_integer_arm(const struct statement* match, long value) {
+    int* jump_table = match->op.match.jump_table;
+
+    if (jump_table != NULL) {
+        unsigned long index = (unsigned long) value - (unsigned long) match->op.match.table_min;
+
+        return index < (unsigned long) arrlen(jump_table) ? jump_table[index] : -1;
+    }
+
+    const struct match_integer_entry* integer_arms = match->op.match.integer_arms;
+    size_t low = 0;
+    size_t high = arrlen(integer_arms);
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (integer_arms[middle].key == value) return integer_arms[middle].value;
+
+        if (integer_arms[middle].key < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return -1;
+}
+
+int find_match_string_arm(const struct statement* match, const char* value) {
+    struct match_string_entry* string_arms = match->op.match.string_arms;
+
+    return shget(string_arms, value);
+}
+
 void dump_statement(struct statement* statement, int indent) {
     switch (statement->type) {
         case STATEMENT_BLOCK: {
@@ -286,8 +615,9 @@ void dump_statement(struct statement* statement, int indent) {
             break;
         }
         case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
             print_indent(indent);
-            fprintf(stderr, "IfStatement\n");
+            fprintf(stderr, statement->type == STATEMENT_SIMPLE_IF ? "SimpleIfStatement\n" : "IfStatement\n");
             print_indent(indent);
             fprintf(stderr, "If\n");
             dump_expr(statement->op.if_condition.condition, indent + indent_offset);
@@ -344,7 +674,11 @@ void dump_statement(struct statement* statement, int indent) {
             break;
         case STATEMENT_FOR_LOOP:
             print_indent(indent);
-            fprintf(stderr, "For\n");
+            if (statement->op.for_loop.is_counted) {
+                fprintf(stderr, "CountedFor step %ld\n", statement->op.for_loop.counted_step);
+            } else {
+                fprintf(stderr, "For\n");
+            }
             dump_statement(statement->op.for_loop.initializer, indent + indent_offset);
             dump_expr(statement->op.for_loop.condition, indent + indent_offset);
             dump_statement(statement->op.for_loop.increment, indent + indent_offset);
@@ -365,6 +699,69 @@ void dump_statement(struct statement* statement, int indent) {
                 dump_expr(statement->op.return_statement.value, indent + indent_offset);
             }
             break;
+        case STATEMENT_VARIABLE_UPDATE:
+            print_indent(indent);
+            fprintf(stderr, "VariableUpdate %s %s= %ld\n", statement->op.variable_update.variable_name, binary_op_to_symbol(statement->op.variable_update.type), statement->op.variable_update.constant);
+            break;
+        case STATEMENT_MATCH:
+            print_indent(indent);
+            fprintf(stderr, statement->op.match.jump_table != NULL ? "Match (jump table)\n" : "Match\n");
+            dump_expr(statement->op.match.value, indent + indent_offset);
+            for (size_t i = 0; i < arrlen(statement->op.match.arms); i++) {
+                print_indent(indent);
+                fprintf(stderr, "Arm\n");
+                for (size_t j = 0; j < arrlen(statement->op.match.constants); j++) {
+                    if (statement->op.match.constant_arms[j] == (int) i)
+                        dump_expr(statement->op.match.constants[j], indent + indent_offset);
+                }
+                dump_statement(statement->op.match.arms[i], indent + indent_offset);
+            }
+            if (statement->op.match.body_else != NULL) {
+                print_indent(indent);
+                fprintf(stderr, "Else\n");
+                dump_statement(statement->op.match.body_else, indent + indent_offset);
+            }
+            break;
+    }
+}
+
+size_t count_statement_nodes(const struct statement* statement) {
+    if (statement == NULL) return 0;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK: {
+            size_t count = 1;
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                count += count_statement_nodes(*it);
+            }
+            return count;
+        }
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            return 1 + count_expr_nodes(statement->op.if_condition.condition) + count_statement_nodes(statement->op.if_condition.body) + count_statement_nodes(statement->op.if_condition.body_else);
+        case STATEMENT_VARIABLE_DECL:
+            return 1 + count_expr_nodes(statement->op.variable_declaration.value);
+        case STATEMENT_FUNCTION_DECL:
+            return 1 + count_statement_nodes(statement->op.function_declaration.body);
+        case STATEMENT_VARIABLE_ASSIGN:
+            return 1 + count_expr_nodes(statement->op.variable_assignment.value);
+        case STATEMENT_NAKED_FN_CALL:
+            return 1 + count_expr_nodes(statement->op.naked_fn_call.function_call);
+        case STATEMENT_WHILE_LOOP:
+            return 1 + count_expr_nodes(statement->op.while_loop.condition) + count_statement_nodes(statement->op.while_loop.body);
+        case STATEMENT_FOR_LOOP:
+            return 1 + count_statement_nodes(statement->op.for_loop.initializer) + count_expr_nodes(statement->op.for_loop.condition) + count_statement_nodes(statement->op.for_loop.increment) + count_statement_nodes(statement->op.for_loop.body);
+        case STATEMENT_RETURN:
+            return 1 + count_expr_nodes(statement->op.return_statement.value);
+        case STATEMENT_MATCH: {
+            size_t count = 1 + count_expr_nodes(statement->op.match.value) + arrlen(statement->op.match.constants) + count_statement_nodes(statement->op.match.body_else);
+            FOR_EACH(struct statement*, it, statement->op.match.arms) {
+                count += count_statement_nodes(*it);
+            }
+            return count;
+        }
+        default:
+            return 1;
     }
 }
 
@@ -391,6 +788,7 @@ void destroy_statement(struct statement* statement) {
             arrfree(statement->op.function_declaration.arguments);
             break;
         case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
             destroy_expr(statement->op.if_condition.condition);
             destroy_statement(statement->op.if_condition.body);
             destroy_statement(statement->op.if_condition.body_else);
@@ -405,15 +803,37 @@ void destroy_statement(struct statement* statement) {
         case STATEMENT_WHILE_LOOP:
             destroy_expr(statement->op.while_loop.condition);
             destroy_statement(statement->op.while_loop.body);
+            arrfree(statement->op.while_loop.invariants);
             break;
         case STATEMENT_FOR_LOOP:
             destroy_statement(statement->op.for_loop.initializer);
             destroy_expr(statement->op.for_loop.condition);
             destroy_statement(statement->op.for_loop.increment);
             destroy_statement(statement->op.for_loop.body);
+            arrfree(statement->op.for_loop.invariants);
             break;
         case STATEMENT_RETURN:
             destroy_expr(statement->op.return_statement.value);
+            break;
+        case STATEMENT_VARIABLE_UPDATE:
+            free(statement->op.variable_update.variable_name);
+            break;
+        case STATEMENT_MATCH:
+            destroy_expr(statement->op.match.value);
+            FOR_EACH(struct expr*, it, statement->op.match.constants) {
+                destroy_expr(*it);
+            }
+            FOR_EACH(struct statement*, it, statement->op.match.arms) {
+                destroy_statement(*it);
+            }
+            destroy_statement(statement->op.match.body_else);
+            arrfree(statement->op.match.constants);
+            arrfree(statement->op.match.constant_arms);
+            arrfree(statement->op.match.arms);
+            arrfree(statement->op.match.jump_table);
+            arrfree(statement->op.match.integer_arms);
+            shfree(statement->op.match.string_arms);
+            break;
         default:
             break;
     }
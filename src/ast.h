@@ -2,6 +2,10 @@
 #define CHAD_INTERPRETER_AST_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+// Longer chains of additions are fused into nested concatenations
+#define MAX_CONCAT_OPERANDS 16
 
 enum expr_type {
     EXPR_BINARY_OPT,
@@ -13,6 +17,15 @@ enum expr_type {
     EXPR_NULL,
     EXPR_VARIABLE_USE,
     EXPR_FUNCTION_CALL,
+    EXPR_LOOP_INVARIANT,
+    EXPR_VARIABLE_CONSTANT_OPT,
+    EXPR_MODULO_TEST,
+    EXPR_CONCAT,
+    // Variants rewritten in place by the tree-walking interpreter once it
+    // has seen the operand types, back to the generic node on other types
+    EXPR_INT_BINARY_OPT,
+    EXPR_STRING_BINARY_OPT,
+    EXPR_INT_VARIABLE_USE,
 };
 
 enum binary_op_type {
@@ -41,6 +54,33 @@ enum unary_op_type {
 
 const char* unary_op_to_symbol(enum unary_op_type op_type);
 
+struct runtime_value;
+
+enum variable_slot_kind {
+    // Looked up by name through every frame
+    SLOT_BY_NAME,
+    // Declared by a frame of the running function, depth frames below the
+    // current one
+    SLOT_LOCAL,
+    // Declared by the frame of the program, once it has been run that far
+    SLOT_GLOBAL,
+};
+
+// Where the variable a node names is found, set by the optimizer when the
+// declaration it resolves to is known from the code around it
+struct variable_slot {
+    enum variable_slot_kind kind;
+    int depth;
+    // Among the variables of the frame
+    int index;
+};
+
+static const struct variable_slot UNRESOLVED_SLOT = {
+        .kind = SLOT_BY_NAME,
+        .depth = 0,
+        .index = 0,
+};
+
 struct expr {
     enum expr_type type;
     union {
@@ -52,6 +92,9 @@ struct expr {
             enum binary_op_type type;
             struct expr* lhs;
             struct expr* rhs;
+            // Set once a quickened variant saw other types, the node then
+            // stays generic
+            bool is_polymorphic;
         } binary;
         struct {
             enum unary_op_type type;
@@ -59,11 +102,39 @@ struct expr {
         } unary;
         struct {
             char* name;
+            bool is_polymorphic;
+            struct variable_slot slot;
         } variable_use;
         struct {
             char* name;
             struct expr** arguments;
         } function_call;
+        struct {
+            struct expr* value;
+            // Computed on first use, released when the owning loop exits
+            bool is_cached;
+            struct runtime_value* cached_value;
+        } loop_invariant;
+        // Fused `variable <op> integer`
+        struct {
+            enum binary_op_type type;
+            char* name;
+            long constant;
+            struct variable_slot slot;
+        } variable_constant;
+        // Fused `variable % modulus == remainder` (or `!=`)
+        struct {
+            char* name;
+            long modulus;
+            long remainder;
+            bool is_equal;
+            struct variable_slot slot;
+        } modulo_test;
+        // Fused chain of string additions, evaluated in order, of at most
+        // MAX_CONCAT_OPERANDS operands
+        struct {
+            struct expr** operands;
+        } concat;
     } op;
 };
 
@@ -76,8 +147,19 @@ struct expr* make_string_literal(const char* value);
 struct expr* make_null();
 struct expr* make_variable_use(const char* name);
 struct expr* make_function_call(const char* name);
+struct expr* make_loop_invariant(struct expr* value);
+struct expr* make_variable_constant_op(enum binary_op_type type, const char* name, long constant);
+struct expr* make_modulo_test(const char* name, long modulus, long remainder, bool is_equal);
+struct expr* make_concat();
+
+struct expr* clone_expr(const struct expr* expr);
+
+// True for && and || and for negations of them, which are evaluated as
+// branches rather than as values
+bool is_branch_expr(const struct expr* expr);
 
 void dump_expr(struct expr* expr, int indent);
+size_t count_expr_nodes(const struct expr* expr);
 
 void destroy_expr(struct expr* expr);
 
@@ -93,6 +175,20 @@ enum statement_type {
     STATEMENT_BREAK,
     STATEMENT_CONTINUE,
     STATEMENT_RETURN,
+    STATEMENT_VARIABLE_UPDATE,
+    STATEMENT_SIMPLE_IF,
+    STATEMENT_MATCH,
+};
+
+// Arm of a match statement selected by a constant
+struct match_integer_entry {
+    long key;
+    int value;
+};
+
+struct match_string_entry {
+    char* key;
+    int value;
 };
 
 struct statement {
@@ -101,6 +197,8 @@ struct statement {
         struct {
             struct statement** statements;
         } block;
+        // Also used by STATEMENT_SIMPLE_IF, whose branches are single
+        // statements executed without opening a scope
         struct {
             struct expr* condition;
             struct statement* body;
@@ -110,6 +208,10 @@ struct statement {
             bool is_constant;
             char* variable_name;
             struct expr* value;
+            struct variable_slot slot;
+            // Cleared by the optimizer when no declaration of the name is a
+            // constant, which spares the lookup checking that
+            bool can_shadow_constant;
         } variable_declaration;
         struct {
             char* fn_name;
@@ -119,6 +221,7 @@ struct statement {
         struct {
             char* variable_name;
             struct expr* value;
+            struct variable_slot slot;
         } variable_assignment;
         struct {
             struct expr* function_call;
@@ -126,16 +229,48 @@ struct statement {
         struct {
             struct expr* condition;
             struct statement* body;
+            struct expr** invariants;
         } while_loop;
         struct {
             struct statement* initializer;
             struct expr* condition;
             struct statement* increment;
             struct statement* body;
+            struct expr** invariants;
+            // Set when the loop is `for (let i = a; i < b; i += step;)` with
+            // `i` untouched by the body and `b` invariant
+            bool is_counted;
+            long counted_step;
         } for_loop;
         struct {
             struct expr* value;
         } return_statement;
+        // Fused `variable = variable <op> integer`, as produced by `+=` and co
+        struct {
+            enum binary_op_type type;
+            char* variable_name;
+            long constant;
+            struct variable_slot slot;
+        } variable_update;
+        // `match (value) { 1, 2 -> { ... } else -> { ... } }`, also made by the
+        // optimizer from chains of `else if` comparing a variable with
+        // constants. The arm taken runs in a scope of its own.
+        struct {
+            struct expr* value;
+            // Literals, all integers or all strings, selecting the arm at the
+            // same index of constant_arms
+            struct expr** constants;
+            int* constant_arms;
+            struct statement** arms;
+            struct statement* body_else;
+            // Built by finish_match_statement: a table of arms indexed by
+            // value - table_min for dense integers, sorted entries for sparse
+            // ones and a hash map for strings
+            long table_min;
+            int* jump_table;
+            struct match_integer_entry* integer_arms;
+            struct match_string_entry* string_arms;
+        } match;
     } op;
 };
 
@@ -150,8 +285,31 @@ struct statement* make_for_loop(struct statement* initializer, struct expr* cond
 struct statement* make_break_statement();
 struct statement* make_continue_statement();
 struct statement* make_return_statement();
+struct statement* make_variable_update(enum binary_op_type type, const char* variable_name, long constant);
+struct statement* make_match_statement(struct expr* value);
+
+// Returns the index of the new arm, selected by the constants added for it
+int add_match_arm(struct statement* match, struct statement* body);
+void add_match_constant(struct statement* match, struct expr* constant, int arm);
+// Builds the dispatch of a match statement once all its arms were added
+void finish_match_statement(struct statement* match);
+
+// Assignments of the form `variable = variable + value`, which `+=` parses
+// to, or of a concatenation starting with the variable, and whose value may
+// be appended in place to a string variable
+bool is_append_assignment(const struct statement* statement);
+
+static inline bool is_string_match(const struct statement* match) {
+    return match->op.match.constants[0]->type == EXPR_STRING_LITERAL;
+}
+
+// Index of the arm selected by a value of the type of the constants, -1 if
+// none is and the else branch runs
+int find_match_integer_arm(const struct statement* match, long value);
+int find_match_string_arm(const struct statement* match, const char* value);
 
 void dump_statement(struct statement* statement, int indent);
+size_t count_statement_nodes(const struct statement* statement);
 
 void destroy_statement(struct statement* statement);
 
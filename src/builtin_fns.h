@@ -11,6 +11,8 @@ CHAD_INTERPRETER_BUILTIN_FN(TYPE, type)
 CHAD_INTERPRETER_BUILTIN_FN(AT, at)
 CHAD_INTERPRETER_BUILTIN_FN(INPUT, input)
 CHAD_INTERPRETER_BUILTIN_FN(LEN, len)
+CHAD_INTERPRETER_BUILTIN_FN(FORMAT, format)
+CHAD_INTERPRETER_BUILTIN_FN(SUBSTR, substr)
 
 #undef CHAD_INTERPRETER_BUILTIN_FN
 #undef CHAD_INTERPRETER_BUILTIN_FN_LAST
@@ -10,6 +10,7 @@
 #include "errors.h"
 #include "stb_ds.h"
 #include "stb_extra.h"
+#include "str.h"
 
 builtin_fn_t is_builtin_fn(const char* fn_name) {
 #define CHAD_INTERPRETER_BUILTIN_FN(A, B) \
@@ -20,15 +21,92 @@ builtin_fn_t is_builtin_fn(const char* fn_name) {
     return -1;
 }
 
+bool is_builtin_arity_valid(builtin_fn_t fn_type, size_t argument_count) {
+    switch (fn_type) {
+        case BUILTIN_FN_TYPE:
+        case BUILTIN_FN_LEN:
+            return argument_count == 1;
+        case BUILTIN_FN_INPUT:
+            return argument_count <= 1;
+        case BUILTIN_FN_AT:
+            return argument_count == 2;
+        case BUILTIN_FN_SUBSTR:
+            return argument_count == 3;
+        case BUILTIN_FN_FORMAT:
+            return argument_count >= 1 && argument_count <= MAX_BUILTIN_ARGUMENTS;
+        default:
+            return true;
+    }
+}
+
+void check_builtin_arity(builtin_fn_t fn_type, size_t argument_count) {
+    if (is_builtin_arity_valid(fn_type, argument_count)) return;
+
+    switch (fn_type) {
+        case BUILTIN_FN_TYPE:
+            panic("ERROR: 'type' function requires one argument\n");
+        case BUILTIN_FN_INPUT:
+            panic("ERROR: 'input' function requires zero or one argument(s)\n");
+        case BUILTIN_FN_LEN:
+            panic("ERROR: 'len' function requires one argument\n");
+        case BUILTIN_FN_AT:
+            panic("ERROR: 'len' function requires two argument\n");
+        case BUILTIN_FN_FORMAT:
+            panic("ERROR: 'format' function requires a template and at most %d values\n", MAX_BUILTIN_ARGUMENTS - 1);
+        case BUILTIN_FN_SUBSTR:
+            panic("ERROR: 'substr' function requires three arguments\n");
+        default:
+            break;
+    }
+}
+
 struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_type, struct expr** arguments) {
+    if (fn_type == BUILTIN_FN_PRINT) {
+        // Arguments are printed as soon as they are evaluated
+        FOR_EACH(struct expr*, arg, arguments) {
+            struct runtime_value value = evaluate_expr(context, *arg);
+            print_value(&value);
+            printf(" ");
+
+            destroy_value(&value);
+        }
+        printf("\n");
+
+        struct runtime_value return_value = { .type = RUNTIME_TYPE_NULL };
+
+        return return_value;
+    }
+
+    check_builtin_arity(fn_type, arrlen(arguments));
+
+    struct runtime_value argument_values[MAX_BUILTIN_ARGUMENTS];
+
+    for (size_t i = 0; i < arrlen(arguments); i++) {
+        argument_values[i] = evaluate_expr(context, arguments[i]);
+        retain_value(&argument_values[i]);
+    }
+
+    return call_held_builtin(fn_type, argument_values, arrlen(arguments));
+}
+
+struct runtime_value call_held_builtin(builtin_fn_t fn_type, struct runtime_value* arguments, size_t argument_count) {
+    struct runtime_value result = call_builtin(fn_type, arguments, argument_count);
+
+    for (size_t i = 0; i < argument_count; i++) {
+        release_value(&arguments[i]);
+    }
+
+    return result;
+}
+
+struct runtime_value call_builtin(builtin_fn_t fn_type, struct runtime_value* arguments, size_t argument_count) {
     switch (fn_type) {
         case BUILTIN_FN_PRINT: {
-            FOR_EACH(struct expr*, arg, arguments) {
-                struct runtime_value value = evaluate_expr(context, *arg);
-                print_value(&value);
+            for (size_t i = 0; i < argument_count; i++) {
+                print_value(&arguments[i]);
                 printf(" ");
 
-                destroy_value(&value);
+                destroy_value(&arguments[i]);
             }
             printf("\n");
 
@@ -37,18 +115,9 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             return return_value;
         }
         case BUILTIN_FN_TYPE: {
-            if (arrlen(arguments) != 1) {
-                panic("ERROR: 'type' function requires one argument\n");
-            }
+            struct runtime_value value = arguments[0];
 
-            struct expr* arg = arguments[0];
-            struct runtime_value value = evaluate_expr(context, arg);
-
-            struct runtime_value type_string = {
-                    .type = RUNTIME_TYPE_STRING,
-            };
-
-            init_ref_counted(&type_string.value.string, xstrdup(runtime_type_to_string(value.type)));
+            struct runtime_value type_string = copy_string_value(runtime_type_to_string(value.type));
 
             destroy_value(&value);
 
@@ -58,13 +127,9 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             struct runtime_value ps1_value;
             bool has_ps1 = false;
 
-            if (arrlen(arguments) > 1) {
-                panic("ERROR: 'input' function requires zero or one argument(s)\n");
-            }
-
-            if (arrlen(arguments) == 1) {
+            if (argument_count == 1) {
                 has_ps1 = true;
-                ps1_value = evaluate_expr(context, arguments[0]);
+                ps1_value = arguments[0];
 
                 if (ps1_value.type != RUNTIME_TYPE_STRING) {
                     panic("ERROR: 'input' can only accept str, not %s\n", runtime_type_to_string(ps1_value.type));
@@ -72,7 +137,7 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             }
 
             if (has_ps1)
-                printf("%s", (char*)ps1_value.value.string.data);
+                printf("%s", get_string_chars(&ps1_value));
 
             char* buffer = NULL;
             size_t len = 0;
@@ -84,13 +149,8 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             }
 
             // Remove newline
-            buffer[read - 1] = '\0';
-
-            struct runtime_value result = {
-                    .type = RUNTIME_TYPE_STRING,
-            };
-
-            init_ref_counted(&result.value.string, buffer);
+            struct runtime_value result = make_string_value(buffer, read - 1);
+            free(buffer);
 
             if (has_ps1)
                 destroy_value(&ps1_value);
@@ -98,17 +158,13 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             return result;
         }
         case BUILTIN_FN_LEN: {
-            if (arrlen(arguments) != 1) {
-                panic("ERROR: 'len' function requires one argument\n");
-            }
-
-            struct runtime_value input_value = evaluate_expr(context, arguments[0]);
+            struct runtime_value input_value = arguments[0];
 
             if (input_value.type != RUNTIME_TYPE_STRING) {
                 panic("ERROR: cannot use 'len' on type %s\n", runtime_type_to_string(input_value.type));
             }
 
-            long len = (long)strlen(input_value.value.string.data);
+            long len = (long) get_string_length(&input_value);
 
             struct runtime_value len_value = {
                     .type = RUNTIME_TYPE_INTEGER,
@@ -120,41 +176,68 @@ struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_ty
             return len_value;
         }
         case BUILTIN_FN_AT: {
-            if (arrlen(arguments) != 2) {
-                panic("ERROR: 'len' function requires two argument\n");
-            }
-
-            struct runtime_value target_value = evaluate_expr(context, arguments[0]);
+            struct runtime_value target_value = arguments[0];
 
             if (target_value.type != RUNTIME_TYPE_STRING) {
                 panic("ERROR: cannot use 'at' on type %s\n", runtime_type_to_string(target_value.type));
             }
 
-            struct runtime_value index_value = evaluate_expr(context, arguments[1]);
+            struct runtime_value index_value = arguments[1];
 
             if (index_value.type != RUNTIME_TYPE_INTEGER) {
                 panic("ERROR: type %s cannot be use as an index\n", runtime_type_to_string(target_value.type));
             }
 
             long index = index_value.value.integer;
-            char* origin = target_value.value.string.data;
-
-            if (strlen(origin) <= index || index < 0) {
+            if (get_string_length(&target_value) <= index || index < 0) {
                 panic("ERROR: index %ld is out of bound\n", index);
             }
 
-            char* chr = xmalloc(2);
-            chr[0] = origin[index];
-            chr[1] = '\0';
+            struct runtime_value result = make_string_value(get_string_data(&target_value) + index, 1);
 
-            struct runtime_value result = {
-                    .type = RUNTIME_TYPE_STRING,
-            };
+            destroy_value(&target_value);
+            destroy_value(&index_value);
+
+            return result;
+        }
+        case BUILTIN_FN_SUBSTR: {
+            struct runtime_value target_value = arguments[0];
 
-            init_ref_counted(&result.value.string, chr);
+            if (target_value.type != RUNTIME_TYPE_STRING) {
+                panic("ERROR: cannot use 'substr' on type %s\n", runtime_type_to_string(target_value.type));
+            }
+
+            for (size_t i = 1; i < argument_count; i++) {
+                if (arguments[i].type != RUNTIME_TYPE_INTEGER) {
+                    panic("ERROR: type %s cannot be use as an index\n", runtime_type_to_string(arguments[i].type));
+                }
+            }
+
+            long start = arguments[1].value.integer;
+            long length = arguments[2].value.integer;
+
+            if (start < 0 || length < 0 || (long) get_string_length(&target_value) - start < length) {
+                panic("ERROR: substring of length %ld at %ld is out of bound\n", length, start);
+            }
+
+            struct runtime_value result = make_substring(&target_value, start, length);
 
             destroy_value(&target_value);
-            destroy_value(&index_value);
+
+            return result;
+        }
+        case BUILTIN_FN_FORMAT: {
+            struct runtime_value template_value = arguments[0];
+
+            if (template_value.type != RUNTIME_TYPE_STRING) {
+                panic("ERROR: 'format' can only accept str as template, not %s\n", runtime_type_to_string(template_value.type));
+            }
+
+            struct runtime_value result = format_string(&template_value, arguments + 1, argument_count - 1);
+
+            for (size_t i = 0; i < argument_count; i++) {
+                destroy_value(&arguments[i]);
+            }
 
             return result;
         }
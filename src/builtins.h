@@ -4,6 +4,10 @@
 #include "interpreter.h"
 #include "ast.h"
 
+// Arguments of a call to a builtin other than print, format taking a
+// template and the values replacing its placeholders
+#define MAX_BUILTIN_ARGUMENTS 16
+
 typedef enum {
 #define CHAD_INTERPRETER_BUILTIN_FN(A, B) BUILTIN_FN_##A,
 #include "builtin_fns.h"
@@ -12,4 +16,12 @@ typedef enum {
 builtin_fn_t is_builtin_fn(const char* fn_name);
 struct runtime_value execute_builtin(struct context* context, builtin_fn_t fn_type, struct expr** arguments);
 
+// Arity is checked before any argument is evaluated
+bool is_builtin_arity_valid(builtin_fn_t fn_type, size_t argument_count);
+void check_builtin_arity(builtin_fn_t fn_type, size_t argument_count);
+struct runtime_value call_builtin(builtin_fn_t fn_type, struct runtime_value* arguments, size_t argument_count);
+// Same as call_builtin, then releases the arguments, retained while the next
+// ones were evaluated since that may assign the variables they were read from
+struct runtime_value call_held_builtin(builtin_fn_t fn_type, struct runtime_value* arguments, size_t argument_count);
+
 #endif
\ No newline at end of file
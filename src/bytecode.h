@@ -0,0 +1,97 @@
+#ifndef CHAD_INTERPRETER_BYTECODE_H
+#define CHAD_INTERPRETER_BYTECODE_H
+
+#include <stddef.h>
+
+#include "builtins.h"
+#include "interpreter.h"
+
+enum opcode {
+#define CHAD_INTERPRETER_OPCODE(X) OPCODE_##X,
+#include "opcodes.h"
+};
+
+struct instruction {
+    enum opcode opcode;
+    int a;
+    int b;
+    int c;
+};
+
+// Type check applied by the conditional jumps, mirroring the tree-walking
+// interpreter
+enum condition_check {
+    CONDITION_UNCHECKED,
+    CONDITION_IF,
+    CONDITION_WHILE,
+    CONDITION_FOR,
+    // Operand of && or ||
+    CONDITION_LOGICAL,
+};
+
+enum call_resolution {
+    // The callee is known at compile time
+    CALL_DIRECT,
+    // The callee is declared once, in the main frame
+    CALL_GLOBAL,
+    // The callee is looked up by name through every frame
+    CALL_DYNAMIC,
+    CALL_BUILTIN,
+};
+
+struct call_site {
+    int symbol;
+    enum call_resolution resolution;
+    // Function index for CALL_DIRECT, function slot of the main frame for CALL_GLOBAL
+    int target;
+    builtin_fn_t builtin;
+    int* arguments;
+    // Resolved by RESOLVE_FUNCTION when the arguments may fail or have side effects
+    bool is_resolved_early;
+};
+
+struct match_site {
+    const struct statement* statement;
+    // Instruction starting each arm
+    int* arm_targets;
+    // Start of the else branch, or end of the statement
+    int else_target;
+};
+
+struct bytecode_function {
+    // Position in the functions of the program
+    int index;
+    int symbol;
+    // Body in the AST, the whole program for the main function
+    struct statement* body;
+    struct instruction* code;
+    struct runtime_value* constants;
+    struct call_site* call_sites;
+    struct match_site* match_sites;
+    int* parameter_slots;
+    int register_count;
+    int function_slot_count;
+    // Variable and function slots are named for lookups from other frames,
+    // the candidates of each symbol are sorted innermost scope first
+    int* slot_symbols;
+    int** slots_by_symbol;
+    int** function_slots_by_symbol;
+};
+
+// State of a variable slot at runtime
+enum slot_flag {
+    SLOT_DECLARED = 1 << 0,
+    SLOT_CONSTANT = 1 << 1,
+};
+
+struct bytecode_program {
+    char** symbols;
+    // The main program is the first function
+    struct bytecode_function** functions;
+};
+
+size_t count_instructions(const struct bytecode_program* program);
+
+void destroy_bytecode_program(struct bytecode_program* program);
+
+#endif
@@ -0,0 +1,1013 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+#endif
+
+#include "builtins.h"
+#include "c_backend.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+
+#ifndef CHAD_RUNTIME_INCLUDE_DIR
+#define CHAD_RUNTIME_INCLUDE_DIR "src"
+#endif
+
+#ifndef CHAD_RUNTIME_LIBRARY
+#define CHAD_RUNTIME_LIBRARY "libchadinterpreter.a"
+#endif
+
+static const char* binary_op_names[] = {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) "BINARY_OP_" #X,
+#include "binary_ops.h"
+};
+
+static const char* unary_op_names[] = {
+#define CHAD_INTERPRETER_UNARY_OP(X, Y) "UNARY_OP_" #X,
+#include "unary_ops.h"
+};
+
+static const char* builtin_fn_names[] = {
+#define CHAD_INTERPRETER_BUILTIN_FN(A, B) "BUILTIN_FN_" #A,
+#include "builtin_fns.h"
+};
+
+struct node_index_entry {
+    void* key;
+    int value;
+};
+
+struct c_emitter {
+    FILE* out;
+    int indent;
+    // Temporaries of the C function being written
+    int temp_count;
+    // Every function declaration of the program, in order of appearance
+    struct statement** functions;
+    struct node_index_entry* function_indices;
+    // Loop invariants, whose cached values are global variables
+    struct node_index_entry* invariant_indices;
+    // Match statements on strings, dispatched through a global hash map
+    struct node_index_entry* string_match_indices;
+};
+
+static void emit_line(struct c_emitter* emitter, const char* format, ...) {
+    for (int i = 0; i < emitter->indent; i++) {
+        fprintf(emitter->out, "    ");
+    }
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(emitter->out, format, args);
+    va_end(args);
+
+    fprintf(emitter->out, "\n");
+}
+
+// Writes a string as a C literal
+static void emit_string_literal(struct c_emitter* emitter, const char* str) {
+    fputc('"', emitter->out);
+
+    for (const unsigned char* c = (const unsigned char*) str; *c != '\0'; c++) {
+        switch (*c) {
+            case '"':
+                fputs("\\\"", emitter->out);
+                break;
+            case '\\':
+                fputs("\\\\", emitter->out);
+                break;
+            case '\n':
+                fputs("\\n", emitter->out);
+                break;
+            case '\t':
+                fputs("\\t", emitter->out);
+                break;
+            default:
+                // Octal escapes are at most three digits long, unlike hexadecimal ones
+                if (*c < 0x20 || *c >= 0x7f || *c == '?') {
+                    fprintf(emitter->out, "\\%03o", *c);
+                } else {
+                    fputc(*c, emitter->out);
+                }
+                break;
+        }
+    }
+
+    fputc('"', emitter->out);
+}
+
+// Writes the indentation and a call whose first argument is a string literal,
+// `format` holding the rest of the arguments
+static void emit_call_with_name(struct c_emitter* emitter, const char* prefix, const char* name, const char* format, ...) {
+    for (int i = 0; i < emitter->indent; i++) {
+        fprintf(emitter->out, "    ");
+    }
+
+    fputs(prefix, emitter->out);
+    emit_string_literal(emitter, name);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(emitter->out, format, args);
+    va_end(args);
+
+    fprintf(emitter->out, "\n");
+}
+
+static int new_temp(struct c_emitter* emitter) {
+    return emitter->temp_count++;
+}
+
+static void emit_integer(struct c_emitter* emitter, int temp, long value) {
+    if (value == LONG_MIN) {
+        emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_INTEGER, .value.integer = LONG_MIN};", temp);
+    } else {
+        emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_INTEGER, .value.integer = %ldL};", temp, value);
+    }
+}
+
+static void collect_expr(struct c_emitter* emitter, struct expr* expr) {
+    if (expr == NULL) return;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            collect_expr(emitter, expr->op.binary.lhs);
+            collect_expr(emitter, expr->op.binary.rhs);
+            break;
+        case EXPR_UNARY_OPT:
+            collect_expr(emitter, expr->op.unary.arg);
+            break;
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                collect_expr(emitter, *arg);
+            }
+            break;
+        case EXPR_CONCAT:
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                collect_expr(emitter, *operand);
+            }
+            break;
+        case EXPR_LOOP_INVARIANT: {
+            int index = (int) hmlen(emitter->invariant_indices);
+            hmput(emitter->invariant_indices, (void*) expr, index);
+            collect_expr(emitter, expr->op.loop_invariant.value);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void collect_statement(struct c_emitter* emitter, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                collect_statement(emitter, *it);
+            }
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            collect_expr(emitter, statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            hmput(emitter->function_indices, (void*) statement, (int) arrlen(emitter->functions));
+            arrpush(emitter->functions, statement);
+            collect_statement(emitter, statement->op.function_declaration.body);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            collect_expr(emitter, statement->op.naked_fn_call.function_call);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            collect_expr(emitter, statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            collect_expr(emitter, statement->op.if_condition.condition);
+            collect_statement(emitter, statement->op.if_condition.body);
+            collect_statement(emitter, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            if (is_string_match(statement)) {
+                int index = (int) hmlen(emitter->string_match_indices);
+                hmput(emitter->string_match_indices, (void*) statement, index);
+            }
+
+            collect_expr(emitter, statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                collect_statement(emitter, *arm);
+            }
+            collect_statement(emitter, statement->op.match.body_else);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            collect_expr(emitter, statement->op.while_loop.condition);
+            collect_statement(emitter, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            collect_statement(emitter, statement->op.for_loop.initializer);
+            collect_expr(emitter, statement->op.for_loop.condition);
+            collect_statement(emitter, statement->op.for_loop.increment);
+            collect_statement(emitter, statement->op.for_loop.body);
+            break;
+        case STATEMENT_RETURN:
+            collect_expr(emitter, statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+static int emit_expr(struct c_emitter* emitter, struct expr* expr);
+static int emit_branch(struct c_emitter* emitter, struct expr* expr);
+
+// Evaluates the arguments of a call in order into an `arguments` array
+static void emit_arguments(struct c_emitter* emitter, struct expr** arguments) {
+    int* temps = NULL;
+
+    // Each argument is held while the next ones are evaluated, which may
+    // assign the variable it was read from
+    FOR_EACH(struct expr*, arg, arguments) {
+        int value = emit_expr(emitter, *arg);
+        emit_line(emitter, "retain_value(&t%d);", value);
+        arrpush(temps, value);
+    }
+
+    if (arrlen(temps) == 0) {
+        emit_line(emitter, "struct runtime_value* arguments = NULL;");
+    } else {
+        for (int i = 0; i < emitter->indent; i++) {
+            fprintf(emitter->out, "    ");
+        }
+
+        fprintf(emitter->out, "struct runtime_value arguments[] = {");
+        for (size_t i = 0; i < arrlen(temps); i++) {
+            fprintf(emitter->out, i == 0 ? "t%d" : ", t%d", temps[i]);
+        }
+        fprintf(emitter->out, "};\n");
+    }
+
+    arrfree(temps);
+}
+
+static void emit_function_call(struct c_emitter* emitter, int temp, struct expr* expr) {
+    const char* fn_name = expr->op.function_call.name;
+    struct expr** arguments = expr->op.function_call.arguments;
+    builtin_fn_t builtin = is_builtin_fn(fn_name);
+
+    emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_NULL};", temp);
+    emit_line(emitter, "{");
+    emitter->indent++;
+
+    if (builtin == BUILTIN_FN_PRINT) {
+        // Arguments are printed as soon as they are evaluated
+        FOR_EACH(struct expr*, arg, arguments) {
+            int value = emit_expr(emitter, *arg);
+            emit_line(emitter, "aot_print(t%d);", value);
+        }
+        emit_line(emitter, "printf(\"\\n\");");
+    } else if (builtin != -1) {
+        emit_line(emitter, "check_builtin_arity(%s, %zu);", builtin_fn_names[builtin], (size_t) arrlen(arguments));
+        emit_arguments(emitter, arguments);
+        emit_line(emitter, "t%d = call_held_builtin(%s, arguments, %zu);", temp, builtin_fn_names[builtin], (size_t) arrlen(arguments));
+    } else {
+        // Functions are scoped dynamically, the declaration called is one
+        // of those with the same name
+        struct statement** candidates = NULL;
+
+        FOR_EACH(struct statement*, it, emitter->functions) {
+            if (strcmp((*it)->op.function_declaration.fn_name, fn_name) == 0) {
+                arrpush(candidates, *it);
+            }
+        }
+
+        emit_call_with_name(emitter, "const struct statement* fn = aot_get_function(context, ", fn_name, ", %zu);", (size_t) arrlen(arguments));
+
+        if (arrlen(candidates) > 0) {
+            emit_line(emitter, "push_stack_frame(context);");
+            emit_arguments(emitter, arguments);
+            emit_line(emitter, "aot_enter_function(context, fn, arguments);");
+            emit_line(emitter, "enum completion fn_completion;");
+
+            if (arrlen(arguments) > 0) {
+                // Held by the parameters from now on
+                emit_line(emitter, "for (size_t i = 0; i < %zu; i++) release_value(&arguments[i]);", (size_t) arrlen(arguments));
+            }
+
+
+            for (size_t i = 0; i < arrlen(candidates); i++) {
+                int index = hmget(emitter->function_indices, (void*) candidates[i]);
+
+                if (i + 1 == arrlen(candidates)) {
+                    emit_line(emitter, "%sfn_completion = function_%d_body(context);", i == 0 ? "" : "else ", index);
+                } else {
+                    emit_line(emitter, "%sif (fn == &function_%d) fn_completion = function_%d_body(context);", i == 0 ? "" : "else ", index, index);
+                }
+            }
+
+            emit_line(emitter, "t%d = aot_leave_function(context, fn_completion);", temp);
+        }
+
+        arrfree(candidates);
+    }
+
+    emitter->indent--;
+    emit_line(emitter, "}");
+}
+
+// Writes the code evaluating && and || with short-circuit, and negations of
+// them, returns the temporary holding the result as a C bool
+static int emit_branch(struct c_emitter* emitter, struct expr* expr) {
+    int temp;
+
+    if (!is_branch_expr(expr)) {
+        int value = emit_expr(emitter, expr);
+        temp = new_temp(emitter);
+        emit_line(emitter, "bool t%d = get_logical_operand(t%d);", temp, value);
+    } else if (expr->type == EXPR_UNARY_OPT) {
+        int arg = emit_branch(emitter, expr->op.unary.arg);
+        temp = new_temp(emitter);
+        emit_line(emitter, "bool t%d = !t%d;", temp, arg);
+    } else {
+        int lhs = emit_branch(emitter, expr->op.binary.lhs);
+        temp = new_temp(emitter);
+        emit_line(emitter, "bool t%d = t%d;", temp, lhs);
+
+        emit_line(emitter, expr->op.binary.type == BINARY_OP_AND ? "if (t%d) {" : "if (!t%d) {", temp);
+        emitter->indent++;
+        int rhs = emit_branch(emitter, expr->op.binary.rhs);
+        emit_line(emitter, "t%d = t%d;", temp, rhs);
+        emitter->indent--;
+        emit_line(emitter, "}");
+    }
+
+    return temp;
+}
+
+// Writes the code evaluating the condition of a statement, returns the
+// temporary holding it as a C bool. A NULL statement name skips its check.
+static int emit_condition(struct c_emitter* emitter, struct expr* expr, const char* statement_name) {
+    if (is_branch_expr(expr)) {
+        return emit_branch(emitter, expr);
+    }
+
+    int value = emit_expr(emitter, expr);
+    int temp = new_temp(emitter);
+
+    if (statement_name != NULL) {
+        emit_line(emitter, "bool t%d = aot_condition(t%d, \"%s\");", temp, value, statement_name);
+    } else {
+        emit_line(emitter, "bool t%d = t%d.value.boolean;", temp, value);
+    }
+
+    return temp;
+}
+
+// Sets temp to the sum of the value of temporary first and count operands,
+// or of the operands alone for a suffix appended to first. Each operand is
+// checked as soon as it is evaluated, as by the additions they replace, and
+// held while the next ones are evaluated.
+static void emit_concat(struct c_emitter* emitter, int temp, int first, struct expr** operands, size_t count, bool is_suffix) {
+    emit_line(emitter, "struct runtime_value t%d;", temp);
+    emit_line(emitter, "{");
+    emitter->indent++;
+
+    int* values = NULL;
+
+    if (!is_suffix) {
+        emit_line(emitter, "retain_value(&t%d);", first);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int value = emit_expr(emitter, operands[i]);
+        emit_line(emitter, "retain_value(&t%d);", value);
+        emit_line(emitter, "check_concat_operand(&t%d, &t%d);", first, value);
+        arrpush(values, value);
+    }
+
+    for (int i = 0; i < emitter->indent; i++) {
+        fprintf(emitter->out, "    ");
+    }
+
+    fprintf(emitter->out, "struct runtime_value operands[] = {");
+    for (size_t i = 0; i < arrlen(values); i++) {
+        fprintf(emitter->out, i == 0 ? "t%d" : ", t%d", values[i]);
+    }
+    fprintf(emitter->out, "};\n");
+
+    if (is_suffix) {
+        emit_line(emitter, "t%d = apply_held_concat(operands, %zu);", temp, count);
+    } else {
+        emit_line(emitter, "t%d = apply_concat(&t%d, operands, %zu);", temp, first, count);
+        emit_line(emitter, "release_value(&t%d);", first);
+
+        for (size_t i = 0; i < count; i++) {
+            emit_line(emitter, "release_value(&operands[%zu]);", i);
+        }
+    }
+
+    arrfree(values);
+    emitter->indent--;
+    emit_line(emitter, "}");
+}
+
+// Writes the code evaluating an expression, returns the temporary holding its value
+static int emit_expr(struct c_emitter* emitter, struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL: {
+            int temp = new_temp(emitter);
+            emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_BOOLEAN, .value.boolean = %s};", temp, expr->op.bool_literal ? "true" : "false");
+            return temp;
+        }
+        case EXPR_INT_LITERAL: {
+            int temp = new_temp(emitter);
+            emit_integer(emitter, temp, expr->op.integer_literal);
+            return temp;
+        }
+        case EXPR_FLOAT_LITERAL: {
+            int temp = new_temp(emitter);
+            // Hexadecimal floats are exact
+            emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_FLOAT, .value.floating = %a};", temp, expr->op.float_literal);
+            return temp;
+        }
+        case EXPR_STRING_LITERAL: {
+            int temp = new_temp(emitter);
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "struct runtime_value t%d = aot_string(", temp);
+            emit_call_with_name(emitter, prefix, expr->op.string_literal, ");");
+            return temp;
+        }
+        case EXPR_NULL: {
+            int temp = new_temp(emitter);
+            emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_NULL};", temp);
+            return temp;
+        }
+        case EXPR_VARIABLE_USE: {
+            int temp = new_temp(emitter);
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "struct runtime_value t%d = aot_load_variable(context, ", temp);
+            emit_call_with_name(emitter, prefix, expr->op.variable_use.name, ");");
+            return temp;
+        }
+        case EXPR_BINARY_OPT: {
+            if (is_logical_binary_op(expr->op.binary.type)) {
+                int branch = emit_branch(emitter, expr);
+                int temp = new_temp(emitter);
+                emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_BOOLEAN, .value.boolean = t%d};", temp, branch);
+                return temp;
+            }
+
+            // lhs is held while rhs is evaluated, which may assign the
+            // variable lhs was read from
+            int lhs = emit_expr(emitter, expr->op.binary.lhs);
+            emit_line(emitter, "retain_value(&t%d);", lhs);
+            int rhs = emit_expr(emitter, expr->op.binary.rhs);
+            int temp = new_temp(emitter);
+            emit_line(emitter, "struct runtime_value t%d = aot_binary_op(%s, t%d, t%d);", temp, binary_op_names[expr->op.binary.type], lhs, rhs);
+            emit_line(emitter, "release_value(&t%d);", lhs);
+            return temp;
+        }
+        case EXPR_UNARY_OPT: {
+            int arg = emit_expr(emitter, expr->op.unary.arg);
+            int temp = new_temp(emitter);
+            emit_line(emitter, "struct runtime_value t%d = aot_unary_op(%s, t%d);", temp, unary_op_names[expr->op.unary.type], arg);
+            return temp;
+        }
+        case EXPR_FUNCTION_CALL: {
+            int temp = new_temp(emitter);
+            emit_function_call(emitter, temp, expr);
+            return temp;
+        }
+        case EXPR_CONCAT: {
+            struct expr** operands = expr->op.concat.operands;
+            int first = emit_expr(emitter, operands[0]);
+            int temp = new_temp(emitter);
+            emit_concat(emitter, temp, first, operands + 1, arrlen(operands) - 1, false);
+            return temp;
+        }
+        case EXPR_LOOP_INVARIANT: {
+            int index = hmget(emitter->invariant_indices, (void*) expr);
+            int temp = new_temp(emitter);
+
+            emit_line(emitter, "if (!invariant_%d_is_cached) {", index);
+            emitter->indent++;
+            int value = emit_expr(emitter, expr->op.loop_invariant.value);
+            emit_line(emitter, "aot_cache_invariant(&invariant_%d, &invariant_%d_is_cached, t%d);", index, index, value);
+            emitter->indent--;
+            emit_line(emitter, "}");
+            emit_line(emitter, "struct runtime_value t%d = invariant_%d;", temp, index);
+            return temp;
+        }
+        case EXPR_VARIABLE_CONSTANT_OPT: {
+            int constant = new_temp(emitter);
+            int temp = new_temp(emitter);
+            emit_integer(emitter, constant, expr->op.variable_constant.constant);
+
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "struct runtime_value t%d = aot_binary_op(%s, aot_load_variable(context, ", temp, binary_op_names[expr->op.variable_constant.type]);
+            emit_call_with_name(emitter, prefix, expr->op.variable_constant.name, "), t%d);", constant);
+            return temp;
+        }
+        case EXPR_MODULO_TEST: {
+            int temp = new_temp(emitter);
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "struct runtime_value t%d = aot_modulo_test(context, ", temp);
+            emit_call_with_name(emitter, prefix, expr->op.modulo_test.name, ", %ldL, %ldL, %s);", expr->op.modulo_test.modulus, expr->op.modulo_test.remainder, expr->op.modulo_test.is_equal ? "true" : "false");
+            return temp;
+        }
+        default:
+            fprintf(stderr, "ERROR: cannot translate expression to C\n");
+            abort();
+    }
+}
+
+static void emit_statement(struct c_emitter* emitter, struct statement* statement);
+
+static void emit_release_invariants(struct c_emitter* emitter, struct expr** invariants) {
+    FOR_EACH(struct expr*, it, invariants) {
+        int index = hmget(emitter->invariant_indices, (void*) *it);
+        emit_line(emitter, "aot_release_invariant(&invariant_%d, &invariant_%d_is_cached);", index, index);
+    }
+}
+
+// Same as the counted loops of the tree-walking interpreter, sets the
+// `is_counted` variable when the loop ran
+static void emit_counted_loop(struct c_emitter* emitter, struct statement* statement) {
+    struct expr* condition = statement->op.for_loop.condition;
+    char* counter_name = statement->op.for_loop.initializer->op.variable_declaration.variable_name;
+
+    emit_line(emitter, "{");
+    emitter->indent++;
+
+    // The counter is kept as an index, the body may grow the stack
+    emit_call_with_name(emitter, "size_t counter_index = get_mutable_variable(context, ", counter_name, ") - context->variables;");
+    emit_line(emitter, "if (context->variables[counter_index].content.type == RUNTIME_TYPE_INTEGER) {");
+    emitter->indent++;
+
+    int bound = emit_expr(emitter, condition->op.binary.rhs);
+
+    emit_line(emitter, "if (t%d.type == RUNTIME_TYPE_INTEGER) {", bound);
+    emitter->indent++;
+    emit_line(emitter, "is_counted = true;");
+    emit_line(emitter, "long counter = context->variables[counter_index].content.value.integer;");
+    emit_line(emitter, "for (; counter %s t%d.value.integer; counter += %ldL) {", binary_op_to_symbol(condition->op.binary.type), bound, statement->op.for_loop.counted_step);
+    emitter->indent++;
+    emit_line(emitter, "context->variables[counter_index].content.value.integer = counter;");
+    emit_statement(emitter, statement->op.for_loop.body);
+    emit_line(emitter, "if (aot_loop_should_stop(&completion)) break;");
+    emitter->indent--;
+    emit_line(emitter, "}");
+    emit_line(emitter, "context->variables[counter_index].content.value.integer = counter;");
+    emitter->indent--;
+    emit_line(emitter, "} else {");
+    emit_line(emitter, "    destroy_value(&t%d);", bound);
+    emit_line(emitter, "}");
+
+    emitter->indent--;
+    emit_line(emitter, "}");
+    emitter->indent--;
+    emit_line(emitter, "}");
+}
+
+// Case of the C switch of a match statement, run in a frame of its own
+static void emit_match_arm(struct c_emitter* emitter, struct statement* body) {
+    emit_line(emitter, "{");
+    emitter->indent++;
+    emit_line(emitter, "push_stack_frame(context);");
+    emit_statement(emitter, body);
+    emit_line(emitter, "pop_stack_frame(context);");
+    emit_line(emitter, "break;");
+    emitter->indent--;
+    emit_line(emitter, "}");
+}
+
+// Integer constants are the labels of a C switch, which the C compiler turns
+// into a jump table when they are dense. Strings select the arm through a
+// hash map filled when the program starts.
+static void emit_match(struct c_emitter* emitter, struct statement* statement) {
+    struct expr** constants = statement->op.match.constants;
+    int* constant_arms = statement->op.match.constant_arms;
+    int value = emit_expr(emitter, statement->op.match.value);
+
+    if (is_string_match(statement)) {
+        int arm = new_temp(emitter);
+
+        emit_line(emitter, "aot_check_match_type(t%d, RUNTIME_TYPE_STRING);", value);
+        emit_line(emitter, "int t%d = shget(match_%d, get_string_chars(&t%d));", arm, hmget(emitter->string_match_indices, (void*) statement), value);
+        emit_line(emitter, "destroy_value(&t%d);", value);
+        emit_line(emitter, "switch (t%d) {", arm);
+
+        for (size_t i = 0; i < arrlen(statement->op.match.arms); i++) {
+            emit_line(emitter, "case %zu:", i);
+            emit_match_arm(emitter, statement->op.match.arms[i]);
+        }
+    } else {
+        emit_line(emitter, "aot_check_match_type(t%d, RUNTIME_TYPE_INTEGER);", value);
+        emit_line(emitter, "switch (t%d.value.integer) {", value);
+
+        for (size_t i = 0; i < arrlen(statement->op.match.arms); i++) {
+            bool has_label = false;
+
+            for (size_t j = 0; j < arrlen(constants); j++) {
+                long constant = constants[j]->op.integer_literal;
+
+                // The first arm of a duplicated constant is the one selected
+                if (constant_arms[j] != (int) i || find_match_integer_arm(statement, constant) != (int) i)
+                    continue;
+
+                if (constant == LONG_MIN) {
+                    emit_line(emitter, "case LONG_MIN:");
+                } else {
+                    emit_line(emitter, "case %ldL:", constant);
+                }
+                has_label = true;
+            }
+
+            if (has_label) emit_match_arm(emitter, statement->op.match.arms[i]);
+        }
+    }
+
+    if (statement->op.match.body_else != NULL) {
+        emit_line(emitter, "default:");
+        emit_match_arm(emitter, statement->op.match.body_else);
+    }
+
+    emit_line(emitter, "}");
+}
+
+static void emit_statement(struct c_emitter* emitter, struct statement* statement) {
+    switch (statement->type) {
+        case STATEMENT_BLOCK: {
+            size_t count = arrlen(statement->op.block.statements);
+
+            if (count == 0) break;
+
+            emit_line(emitter, "do {");
+            emitter->indent++;
+
+            for (size_t i = 0; i < count; i++) {
+                emit_statement(emitter, statement->op.block.statements[i]);
+
+                if (i + 1 < count) {
+                    emit_line(emitter, "if (completion != COMPLETION_NORMAL) break;");
+                }
+            }
+
+            emitter->indent--;
+            emit_line(emitter, "} while (0);");
+            break;
+        }
+        case STATEMENT_VARIABLE_DECL: {
+            char* variable_name = statement->op.variable_declaration.variable_name;
+            emit_call_with_name(emitter, "aot_check_declaration(context, ", variable_name, ");");
+
+            int value;
+            if (statement->op.variable_declaration.value == NULL) {
+                value = new_temp(emitter);
+                emit_line(emitter, "struct runtime_value t%d = {.type = RUNTIME_TYPE_NULL};", value);
+            } else {
+                value = emit_expr(emitter, statement->op.variable_declaration.value);
+            }
+
+            emit_call_with_name(emitter, "aot_declare_variable(context, ", variable_name, ", %s, t%d);", statement->op.variable_declaration.is_constant ? "true" : "false", value);
+            break;
+        }
+        case STATEMENT_FUNCTION_DECL:
+            emit_line(emitter, "aot_declare_function(context, &function_%d);", hmget(emitter->function_indices, (void*) statement));
+            break;
+        case STATEMENT_NAKED_FN_CALL: {
+            int value = emit_expr(emitter, statement->op.naked_fn_call.function_call);
+            emit_line(emitter, "destroy_value(&t%d);", value);
+            break;
+        }
+        case STATEMENT_VARIABLE_ASSIGN: {
+            char* variable_name = statement->op.variable_assignment.variable_name;
+            int variable = new_temp(emitter);
+
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "size_t t%d = aot_check_assignment(context, ", variable);
+            emit_call_with_name(emitter, prefix, variable_name, ");");
+
+            struct expr* value_expr = statement->op.variable_assignment.value;
+
+            if (is_append_assignment(statement)) {
+                int lhs, rhs;
+                struct expr* lhs_expr = value_expr->type == EXPR_CONCAT ? value_expr->op.concat.operands[0] : value_expr->op.binary.lhs;
+
+                // Held while the suffix is evaluated, which may assign the variable
+                lhs = emit_expr(emitter, lhs_expr);
+                emit_line(emitter, "retain_value(&t%d);", lhs);
+
+                if (value_expr->type == EXPR_CONCAT) {
+                    struct expr** operands = value_expr->op.concat.operands;
+                    rhs = new_temp(emitter);
+                    emit_concat(emitter, rhs, lhs, operands + 1, arrlen(operands) - 1, true);
+                } else {
+                    rhs = emit_expr(emitter, value_expr->op.binary.rhs);
+                }
+
+                emit_line(emitter, "aot_append_variable(context, t%d, t%d, t%d);", variable, lhs, rhs);
+                break;
+            }
+
+            int value = emit_expr(emitter, value_expr);
+            emit_line(emitter, "aot_assign_variable(context, t%d, t%d);", variable, value);
+            break;
+        }
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF: {
+            bool has_frame = statement->type == STATEMENT_IF_CONDITION;
+            int condition = emit_condition(emitter, statement->op.if_condition.condition, "if");
+
+            emit_line(emitter, "{");
+            emitter->indent++;
+            emit_line(emitter, "bool condition = t%d;", condition);
+            if (has_frame) emit_line(emitter, "push_stack_frame(context);");
+
+            emit_line(emitter, "if (condition) {");
+            emitter->indent++;
+            emit_statement(emitter, statement->op.if_condition.body);
+            emitter->indent--;
+
+            if (statement->op.if_condition.body_else != NULL) {
+                emit_line(emitter, "} else {");
+                emitter->indent++;
+                emit_statement(emitter, statement->op.if_condition.body_else);
+                emitter->indent--;
+            }
+            emit_line(emitter, "}");
+
+            if (has_frame) emit_line(emitter, "pop_stack_frame(context);");
+            emitter->indent--;
+            emit_line(emitter, "}");
+            break;
+        }
+        case STATEMENT_MATCH:
+            emit_match(emitter, statement);
+            break;
+        case STATEMENT_WHILE_LOOP: {
+            int condition = emit_condition(emitter, statement->op.while_loop.condition, "while");
+
+            emit_line(emitter, "{");
+            emitter->indent++;
+            emit_line(emitter, "bool condition = t%d;", condition);
+            emit_line(emitter, "push_stack_frame(context);");
+            emit_line(emitter, "while (condition) {");
+            emitter->indent++;
+            emit_statement(emitter, statement->op.while_loop.body);
+            emit_line(emitter, "if (aot_loop_should_stop(&completion)) break;");
+            int next_condition = emit_condition(emitter, statement->op.while_loop.condition, NULL);
+            emit_line(emitter, "condition = t%d;", next_condition);
+            emitter->indent--;
+            emit_line(emitter, "}");
+            emit_release_invariants(emitter, statement->op.while_loop.invariants);
+            emit_line(emitter, "pop_stack_frame(context);");
+            emitter->indent--;
+            emit_line(emitter, "}");
+            break;
+        }
+        case STATEMENT_FOR_LOOP: {
+            emit_line(emitter, "{");
+            emitter->indent++;
+            emit_line(emitter, "push_stack_frame(context);");
+            emit_statement(emitter, statement->op.for_loop.initializer);
+            emit_line(emitter, "bool is_counted = false;");
+
+            if (statement->op.for_loop.is_counted) {
+                emit_counted_loop(emitter, statement);
+            }
+
+            emit_line(emitter, "if (!is_counted) {");
+            emitter->indent++;
+            int condition = emit_condition(emitter, statement->op.for_loop.condition, "for");
+            emit_line(emitter, "bool condition = t%d;", condition);
+            emit_line(emitter, "while (condition) {");
+            emitter->indent++;
+            emit_statement(emitter, statement->op.for_loop.body);
+            emit_line(emitter, "if (aot_loop_should_stop(&completion)) break;");
+            if (statement->op.for_loop.increment != NULL) {
+                emit_statement(emitter, statement->op.for_loop.increment);
+            }
+            int next_condition = emit_condition(emitter, statement->op.for_loop.condition, NULL);
+            emit_line(emitter, "condition = t%d;", next_condition);
+            emitter->indent--;
+            emit_line(emitter, "}");
+            emitter->indent--;
+            emit_line(emitter, "}");
+
+            emit_release_invariants(emitter, statement->op.for_loop.invariants);
+            emit_line(emitter, "pop_stack_frame(context);");
+            emitter->indent--;
+            emit_line(emitter, "}");
+            break;
+        }
+        case STATEMENT_VARIABLE_UPDATE:
+            emit_call_with_name(emitter, "aot_update_variable(context, ", statement->op.variable_update.variable_name, ", %s, %ldL);", binary_op_names[statement->op.variable_update.type], statement->op.variable_update.constant);
+            break;
+        case STATEMENT_BREAK:
+            emit_line(emitter, "completion = COMPLETION_BREAK;");
+            break;
+        case STATEMENT_CONTINUE:
+            emit_line(emitter, "completion = COMPLETION_CONTINUE;");
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL) {
+                int value = emit_expr(emitter, statement->op.return_statement.value);
+                emit_line(emitter, "retain_value(&t%d);", value);
+                emit_line(emitter, "context->return_value = t%d;", value);
+            } else {
+                emit_line(emitter, "context->return_value.type = RUNTIME_TYPE_NULL;");
+            }
+            emit_line(emitter, "completion = COMPLETION_RETURN;");
+            break;
+        default:
+            fprintf(stderr, "ERROR: cannot translate statement to C\n");
+            abort();
+    }
+}
+
+size_t emit_c_program(struct statement* program, const char* source_name, FILE* out) {
+    struct c_emitter emitter = {
+            .out = out,
+            .indent = 0,
+            .temp_count = 0,
+            .functions = NULL,
+            .function_indices = NULL,
+            .invariant_indices = NULL,
+            .string_match_indices = NULL,
+    };
+
+    collect_statement(&emitter, program);
+
+    fprintf(out, "// Generated by chadeval from ");
+    emit_string_literal(&emitter, source_name);
+    fprintf(out, "\n\n");
+    emit_line(&emitter, "#define STBDS_REALLOC(context,ptr,size) xrealloc(ptr, size)");
+    emit_line(&emitter, "#define STBDS_FREE(context,ptr)         free(ptr)");
+    emit_line(&emitter, "#define STB_DS_IMPLEMENTATION");
+    emit_line(&emitter, "#include \"aot_runtime.h\"");
+    emit_line(&emitter, "");
+
+    for (size_t i = 0; i < arrlen(emitter.functions); i++) {
+        emit_line(&emitter, "static struct statement function_%zu;", i);
+        emit_line(&emitter, "static enum completion function_%zu_body(struct context* context);", i);
+    }
+
+    for (ptrdiff_t i = 0; i < hmlen(emitter.invariant_indices); i++) {
+        emit_line(&emitter, "static struct runtime_value invariant_%td;", i);
+        emit_line(&emitter, "static bool invariant_%td_is_cached;", i);
+    }
+
+    for (ptrdiff_t i = 0; i < hmlen(emitter.string_match_indices); i++) {
+        emit_line(&emitter, "static struct match_string_entry* match_%td;", i);
+    }
+
+    for (size_t i = 0; i < arrlen(emitter.functions); i++) {
+        emitter.temp_count = 0;
+
+        emit_line(&emitter, "");
+        emit_line(&emitter, "static enum completion function_%zu_body(struct context* context) {", i);
+        emitter.indent++;
+        // Break, continue or return having ended the statements run, kept
+        // in a local for the C compiler to hold it in a register
+        emit_line(&emitter, "enum completion completion = COMPLETION_NORMAL;");
+        emit_statement(&emitter, emitter.functions[i]->op.function_declaration.body);
+        emit_line(&emitter, "return completion;");
+        emitter.indent--;
+        emit_line(&emitter, "}");
+    }
+
+    // Declarations are only used to look functions up and check their arity
+    emit_line(&emitter, "");
+    emit_line(&emitter, "static void init_functions(void) {");
+    emitter.indent++;
+    for (size_t i = 0; i < arrlen(emitter.functions); i++) {
+        struct statement* function = emitter.functions[i];
+
+        emit_line(&emitter, "function_%zu.type = STATEMENT_FUNCTION_DECL;", i);
+
+        char prefix[128];
+        snprintf(prefix, sizeof(prefix), "function_%zu.op.function_declaration.fn_name = ", i);
+        emit_call_with_name(&emitter, prefix, function->op.function_declaration.fn_name, ";");
+
+        FOR_EACH(char*, argument, function->op.function_declaration.arguments) {
+            snprintf(prefix, sizeof(prefix), "arrpush(function_%zu.op.function_declaration.arguments, ", i);
+            emit_call_with_name(&emitter, prefix, *argument, ");");
+        }
+    }
+
+    for (ptrdiff_t i = 0; i < hmlen(emitter.string_match_indices); i++) {
+        struct statement* match = emitter.string_match_indices[i].key;
+        struct match_string_entry* string_arms = match->op.match.string_arms;
+
+        emit_line(&emitter, "shdefault(match_%td, -1);", i);
+
+        for (ptrdiff_t j = 0; j < shlen(string_arms); j++) {
+            char prefix[128];
+            snprintf(prefix, sizeof(prefix), "shput(match_%td, ", i);
+            emit_call_with_name(&emitter, prefix, string_arms[j].key, ", %d);", string_arms[j].value);
+        }
+    }
+    emitter.indent--;
+    emit_line(&emitter, "}");
+
+    emitter.temp_count = 0;
+
+    emit_line(&emitter, "");
+    emit_line(&emitter, "int main(void) {");
+    emitter.indent++;
+    emit_line(&emitter, "struct context program_context;");
+    emit_line(&emitter, "struct context* context = &program_context;");
+    emit_line(&emitter, "init_functions();");
+    emit_line(&emitter, "init_context(context);");
+    emit_line(&emitter, "enum completion completion = COMPLETION_NORMAL;");
+    emit_line(&emitter, "push_stack_frame(context);");
+    emit_statement(&emitter, program);
+    emit_line(&emitter, "pop_stack_frame(context);");
+    emit_line(&emitter, "destroy_context(context);");
+    emit_line(&emitter, "return 0;");
+    emitter.indent--;
+    emit_line(&emitter, "}");
+
+    size_t function_count = arrlen(emitter.functions) + 2;
+
+    arrfree(emitter.functions);
+    hmfree(emitter.function_indices);
+    hmfree(emitter.invariant_indices);
+    hmfree(emitter.string_match_indices);
+
+    return function_count;
+}
+
+// Runs the command directly rather than through a shell, which would
+// interpret the quotes and substitutions in the paths
+static bool run_command(char** argv) {
+#ifdef _WIN32
+    return _spawnvp(_P_WAIT, argv[0], (const char* const*) argv) == 0;
+#else
+    pid_t pid;
+
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+        return false;
+
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+bool build_c_program(const char* c_path, const char* executable_path) {
+    const char* compiler = getenv("CC");
+
+    if (compiler == NULL || compiler[0] == '\0') {
+        compiler = "cc";
+    }
+
+    // $CC may hold a command with its own options, like `ccache gcc -m64`
+    char* compiler_words = xstrdup(compiler);
+    char** argv = NULL;
+
+    for (char* word = strtok(compiler_words, " \t"); word != NULL; word = strtok(NULL, " \t")) {
+        arrpush(argv, word);
+    }
+
+    if (argv == NULL) {
+        arrpush(argv, "cc");
+    }
+
+    char* include_option = xmalloc(strlen(CHAD_RUNTIME_INCLUDE_DIR) + 3);
+    sprintf(include_option, "-I%s", CHAD_RUNTIME_INCLUDE_DIR);
+
+    arrpush(argv, "-O2");
+    arrpush(argv, include_option);
+    arrpush(argv, "-o");
+    arrpush(argv, (char*) executable_path);
+    arrpush(argv, (char*) c_path);
+    arrpush(argv, CHAD_RUNTIME_LIBRARY);
+    arrpush(argv, NULL);
+
+    bool is_built = run_command(argv);
+
+    if (!is_built) {
+        fprintf(stderr, "ERROR: cannot compile '%s' with '%s'\n", c_path, compiler);
+    }
+
+    arrfree(argv);
+    free(include_option);
+    free(compiler_words);
+
+    return is_built;
+}
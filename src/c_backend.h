@@ -0,0 +1,16 @@
+#ifndef CHAD_INTERPRETER_C_BACKEND_H
+#define CHAD_INTERPRETER_C_BACKEND_H
+
+#include <stdio.h>
+
+#include "ast.h"
+
+// Translates a program into C using the runtime of aot_runtime.h, returns the
+// number of C functions written
+size_t emit_c_program(struct statement* program, const char* source_name, FILE* out);
+
+// Compiles a C file written by emit_c_program into an executable with the
+// system C compiler, returns false if the compiler failed
+bool build_c_program(const char* c_path, const char* executable_path);
+
+#endif
@@ -0,0 +1,1058 @@
+#include "closure.h"
+#include "errors.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "str.h"
+#include "tiering.h"
+
+// Same semantics as the tree-walking interpreter, with the dispatch on node
+// types and operators done once when the closures are built
+
+// Same lookup as get_slot_variable, the variables of the running function
+// being read inline from the slot the optimizer resolved
+static inline struct runtime_variable* lookup_variable(struct context* context, const char* variable_name, struct variable_slot slot) {
+    if (slot.kind == SLOT_LOCAL) {
+        const struct stack_frame* frame = &context->frames[arrlen(context->frames) - 1 - slot.depth];
+        return &context->variables[frame->variable_base + slot.index];
+    }
+
+    struct runtime_variable* variable = get_slot_variable(context, variable_name, slot);
+
+    if (variable == NULL) {
+        panic("ERROR: cannot find variable '%s'\n", variable_name);
+    }
+
+    return variable;
+}
+
+static inline struct runtime_value evaluate(struct context* context, const struct expr_closure* closure) {
+    return closure->evaluate(context, closure);
+}
+
+static inline enum completion execute(struct context* context, const struct statement_closure* closure) {
+    return closure->execute(context, closure);
+}
+
+static struct runtime_value evaluate_literal(struct context* context, const struct expr_closure* closure) {
+    return closure->op.literal;
+}
+
+static struct runtime_value evaluate_string_literal(struct context* context, const struct expr_closure* closure) {
+    return copy_string_value(closure->op.string_literal);
+}
+
+static struct runtime_value evaluate_variable(struct context* context, const struct expr_closure* closure) {
+    return lookup_variable(context, closure->op.variable.name, closure->op.variable.slot)->content;
+}
+
+// Operator known when the closure is built, so the checks below and the
+// switch of apply_integer_op are resolved by the C compiler
+static inline struct runtime_value apply_specialized_op(enum binary_op_type op_type, struct runtime_value lhs, struct runtime_value rhs) {
+    bool is_division = op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO;
+
+    if (lhs.type == RUNTIME_TYPE_INTEGER && rhs.type == RUNTIME_TYPE_INTEGER && !is_logical_binary_op(op_type) && !(is_division && rhs.value.integer == 0)) {
+        return apply_integer_op(op_type, lhs.value.integer, rhs.value.integer);
+    }
+
+    return apply_binary_op(op_type, lhs, rhs);
+}
+
+// Same as apply_specialized_op, for an lhs retained while rhs was evaluated
+// since that may assign the variable lhs was read from
+static inline struct runtime_value apply_held_specialized_op(enum binary_op_type op_type, struct runtime_value lhs, struct runtime_value rhs) {
+    struct runtime_value result = apply_specialized_op(op_type, lhs, rhs);
+
+    release_value(&lhs);
+
+    return result;
+}
+
+#define CHAD_INTERPRETER_BINARY_OP(X, Y)                                                                                       \
+    static struct runtime_value evaluate_binary_##X(struct context* context, const struct expr_closure* closure) {            \
+        struct runtime_value lhs = evaluate(context, closure->op.binary.lhs);                                                  \
+        retain_value(&lhs);                                                                                                    \
+        struct runtime_value rhs = evaluate(context, closure->op.binary.rhs);                                                  \
+                                                                                                                               \
+        return apply_held_specialized_op(BINARY_OP_##X, lhs, rhs);                                                             \
+    }                                                                                                                          \
+                                                                                                                               \
+    static struct runtime_value evaluate_variable_constant_##X(struct context* context, const struct expr_closure* closure) { \
+        const struct runtime_variable* variable = lookup_variable(context, closure->op.variable_constant.name,                  \
+                                                                  closure->op.variable_constant.slot);                        \
+        struct runtime_value constant = {                                                                                      \
+                .type = RUNTIME_TYPE_INTEGER,                                                                                  \
+                .value.integer = closure->op.variable_constant.constant,                                                       \
+        };                                                                                                                     \
+                                                                                                                               \
+        return apply_specialized_op(BINARY_OP_##X, variable->content, constant);                                               \
+    }                                                                                                                          \
+                                                                                                                               \
+    static struct runtime_value evaluate_variables_##X(struct context* context, const struct expr_closure* closure) {         \
+        struct runtime_value lhs = lookup_variable(context, closure->op.variables.lhs, closure->op.variables.lhs_slot)->content; \
+        struct runtime_value rhs = lookup_variable(context, closure->op.variables.rhs, closure->op.variables.rhs_slot)->content; \
+                                                                                                                               \
+        return apply_specialized_op(BINARY_OP_##X, lhs, rhs);                                                                  \
+    }
+#include "binary_ops.h"
+
+static const expr_closure_fn binary_closures[] = {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) evaluate_binary_##X,
+#include "binary_ops.h"
+};
+
+static const expr_closure_fn variable_constant_closures[] = {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) evaluate_variable_constant_##X,
+#include "binary_ops.h"
+};
+
+static const expr_closure_fn variables_closures[] = {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) evaluate_variables_##X,
+#include "binary_ops.h"
+};
+
+// Operands of && and || which are not themselves branches must be booleans
+static inline bool test(struct context* context, const struct expr_closure* closure) {
+    if (closure->test != NULL) {
+        return closure->test(context, closure);
+    }
+
+    return get_logical_operand(evaluate(context, closure));
+}
+
+static bool test_and(struct context* context, const struct expr_closure* closure) {
+    return test(context, closure->op.binary.lhs) && test(context, closure->op.binary.rhs);
+}
+
+static bool test_or(struct context* context, const struct expr_closure* closure) {
+    return test(context, closure->op.binary.lhs) || test(context, closure->op.binary.rhs);
+}
+
+static bool test_not(struct context* context, const struct expr_closure* closure) {
+    return !closure->op.unary_arg->test(context, closure->op.unary_arg);
+}
+
+// A branch used as a value
+static struct runtime_value evaluate_branch(struct context* context, const struct expr_closure* closure) {
+    struct runtime_value value = {
+            .type = RUNTIME_TYPE_BOOLEAN,
+            .value.boolean = closure->test(context, closure),
+    };
+
+    return value;
+}
+
+static struct runtime_value evaluate_not(struct context* context, const struct expr_closure* closure) {
+    struct runtime_value arg = evaluate(context, closure->op.unary_arg);
+
+    if (arg.type == RUNTIME_TYPE_BOOLEAN) {
+        arg.value.boolean = !arg.value.boolean;
+        return arg;
+    }
+
+    return apply_unary_op(UNARY_OP_NOT, arg);
+}
+
+static struct runtime_value evaluate_negation(struct context* context, const struct expr_closure* closure) {
+    struct runtime_value arg = evaluate(context, closure->op.unary_arg);
+
+    if (arg.type == RUNTIME_TYPE_INTEGER) {
+        arg.value.integer = -arg.value.integer;
+        return arg;
+    }
+
+    return apply_unary_op(UNARY_OP_NEG, arg);
+}
+
+static struct runtime_value evaluate_loop_invariant(struct context* context, const struct expr_closure* closure) {
+    struct expr* expr = closure->op.loop_invariant.expr;
+    struct runtime_value* cached_value = expr->op.loop_invariant.cached_value;
+
+    if (!expr->op.loop_invariant.is_cached) {
+        if (cached_value == NULL) {
+            cached_value = xmalloc(sizeof(struct runtime_value));
+            expr->op.loop_invariant.cached_value = cached_value;
+        }
+
+        *cached_value = evaluate(context, closure->op.loop_invariant.value);
+
+        // Keep the value alive until the loop releases it
+        retain_value(cached_value);
+
+        expr->op.loop_invariant.is_cached = true;
+    }
+
+    return *cached_value;
+}
+
+static struct runtime_value evaluate_modulo_test(struct context* context, const struct expr_closure* closure) {
+    const struct runtime_variable* variable = lookup_variable(context, closure->op.modulo_test.name, closure->op.modulo_test.slot);
+    struct runtime_value modulo = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = closure->op.modulo_test.modulus,
+    };
+    struct runtime_value remainder = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = closure->op.modulo_test.remainder,
+    };
+    enum binary_op_type comparison = closure->op.modulo_test.is_equal ? BINARY_OP_EQUAL : BINARY_OP_NOT_EQUAL;
+
+    if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+        long value = variable->content.value.integer % modulo.value.integer;
+        return apply_integer_op(comparison, value, remainder.value.integer);
+    }
+
+    return apply_binary_op(comparison, apply_binary_op(BINARY_OP_MODULO, variable->content, modulo), remainder);
+}
+
+static struct runtime_value evaluate_concat(struct context* context, const struct expr_closure* closure) {
+    struct expr_closure** operands = closure->op.concat_operands;
+    struct runtime_value values[MAX_CONCAT_OPERANDS];
+
+    for (size_t i = 0; i < arrlen(operands); i++) {
+        values[i] = evaluate(context, operands[i]);
+        retain_value(&values[i]);
+        if (i > 0) check_concat_operand(&values[0], &values[i]);
+    }
+
+    return apply_held_concat(values, arrlen(operands));
+}
+
+static struct runtime_value evaluate_print(struct context* context, const struct expr_closure* closure) {
+    // Arguments are printed as soon as they are evaluated
+    FOR_EACH(struct expr_closure*, arg, closure->op.function_call.arguments) {
+        struct runtime_value value = evaluate(context, *arg);
+        print_value(&value);
+        printf(" ");
+
+        destroy_value(&value);
+    }
+    printf("\n");
+
+    struct runtime_value return_value = {.type = RUNTIME_TYPE_NULL};
+
+    return return_value;
+}
+
+static struct runtime_value evaluate_builtin(struct context* context, const struct expr_closure* closure) {
+    struct expr_closure** arguments = closure->op.function_call.arguments;
+
+    check_builtin_arity(closure->op.function_call.builtin, arrlen(arguments));
+
+    struct runtime_value argument_values[MAX_BUILTIN_ARGUMENTS];
+
+    for (size_t i = 0; i < arrlen(arguments); i++) {
+        argument_values[i] = evaluate(context, arguments[i]);
+        retain_value(&argument_values[i]);
+    }
+
+    return call_held_builtin(closure->op.function_call.builtin, argument_values, arrlen(arguments));
+}
+
+static struct runtime_value evaluate_call(struct context* context, const struct expr_closure* closure) {
+    const char* fn_name = closure->op.function_call.name;
+    struct expr_closure** arguments = closure->op.function_call.arguments;
+
+    const struct statement* fn = get_function(context, fn_name);
+
+    if (fn == NULL) {
+        panic("ERROR: cannot find function %s\n", fn_name);
+    }
+
+    size_t fn_decl_argument_size = arrlen(fn->op.function_declaration.arguments);
+    size_t fn_call_argument_size = arrlen(arguments);
+
+    if (fn_decl_argument_size != fn_call_argument_size) {
+        panic("ERROR: '%s' expects %zu arguments, but %zu were given\n", fn_name, fn_decl_argument_size, fn_call_argument_size);
+    }
+
+    push_stack_frame(context);
+
+    size_t parameters = reserve_parameters(context, fn_call_argument_size);
+
+    for (size_t i = 0; i < fn_call_argument_size; i++) {
+        set_parameter(context, parameters + i, evaluate(context, arguments[i]));
+    }
+
+    // Functions declared outside of the closures are called through their tier
+    if (context->tiers != NULL) {
+        return call_tiered_function(context->tiers, context, fn, parameters);
+    }
+
+    enter_function(context, fn, parameters);
+
+    const struct statement_closure* body = closure->op.function_call.body;
+
+    if (fn != closure->op.function_call.fn) {
+        body = hmget(closure->op.function_call.program->functions, (struct statement*) fn);
+    }
+
+    return leave_function(context, execute(context, body));
+}
+
+static enum completion execute_block(struct context* context, const struct statement_closure* closure) {
+    FOR_EACH(struct statement_closure*, it, closure->op.block) {
+        enum completion completion = execute(context, *it);
+
+        if (completion != COMPLETION_NORMAL)
+            return completion;
+    }
+
+    return COMPLETION_NORMAL;
+}
+
+static enum completion execute_declaration(struct context* context, const struct statement_closure* closure) {
+    struct statement* statement = closure->statement;
+    char* variable_name = statement->op.variable_declaration.variable_name;
+
+    // Check if this declaration is shadowing a constant variable
+    if (statement->op.variable_declaration.can_shadow_constant) {
+        const struct runtime_variable* old_variable = get_variable(context, variable_name);
+
+        if (old_variable != NULL && old_variable->is_constant == true) {
+            panic("ERROR: declaration of '%s' is shadowing a constant variable\n", variable_name);
+        }
+    }
+
+    struct runtime_value content = {
+            .type = RUNTIME_TYPE_NULL,
+    };
+
+    if (closure->op.value != NULL) {
+        content = evaluate(context, closure->op.value);
+    }
+
+    declare_slot_variable(context, variable_name, statement->op.variable_declaration.slot, statement->op.variable_declaration.is_constant, content);
+
+    return COMPLETION_NORMAL;
+}
+
+static enum completion execute_function_declaration(struct context* context, const struct statement_closure* closure) {
+    declare_function(context, closure->statement);
+
+    return COMPLETION_NORMAL;
+}
+
+static enum completion execute_naked_call(struct context* context, const struct statement_closure* closure) {
+    struct runtime_value discarded_return_value = evaluate(context, closure->op.value);
+
+    destroy_value(&discarded_return_value);
+
+    return COMPLETION_NORMAL;
+}
+
+static void assign_variable(struct context* context, const struct statement_closure* closure, const struct expr_closure* value) {
+    char* variable_name = closure->statement->op.variable_assignment.variable_name;
+    struct runtime_variable* old_variable = lookup_variable(context, variable_name, closure->statement->op.variable_assignment.slot);
+
+    if (old_variable->is_constant) {
+        panic("ERROR: variable '%s' is constant\n", variable_name);
+    }
+
+    // The stack may grow while the value is evaluated
+    size_t index = old_variable - context->variables;
+    struct runtime_value new_content = evaluate(context, value);
+
+    old_variable = &context->variables[index];
+
+    if (old_variable->content.type != new_content.type) {
+        panic("ERROR: cannot assign value of type %s to variable '%s' of type %s\n", runtime_type_to_string(new_content.type), variable_name, runtime_type_to_string(old_variable->content.type));
+    }
+
+    // The new content is retained first, it may hold the old one
+    retain_value(&new_content);
+    release_value(&old_variable->content);
+
+    old_variable->content = new_content;
+}
+
+static enum completion execute_assignment(struct context* context, const struct statement_closure* closure) {
+    assign_variable(context, closure, closure->op.value);
+
+    return COMPLETION_NORMAL;
+}
+
+// Extends the string of the variable in place when it is the only one holding
+// it, and when evaluating the suffix did not assign the variable
+static enum completion execute_append(struct context* context, const struct statement_closure* closure) {
+    struct statement* statement = closure->statement;
+    struct runtime_variable* variable = get_slot_variable(context, statement->op.variable_assignment.variable_name, statement->op.variable_assignment.slot);
+
+    if (variable == NULL || variable->is_constant || variable->content.type != RUNTIME_TYPE_STRING) {
+        assign_variable(context, closure, closure->op.append.value);
+        return COMPLETION_NORMAL;
+    }
+
+    size_t index = variable - context->variables;
+    struct runtime_value lhs_value = variable->content;
+    struct expr_closure** operands = closure->op.append.suffix;
+    struct runtime_value suffix;
+
+    // Held while the suffix is evaluated, which may assign the variable
+    retain_value(&lhs_value);
+
+    if (arrlen(operands) == 1) {
+        suffix = evaluate(context, operands[0]);
+    } else {
+        struct runtime_value values[MAX_CONCAT_OPERANDS];
+
+        for (size_t i = 0; i < arrlen(operands); i++) {
+            values[i] = evaluate(context, operands[i]);
+            retain_value(&values[i]);
+            check_concat_operand(&lhs_value, &values[i]);
+        }
+
+        suffix = apply_held_concat(values, arrlen(operands));
+    }
+
+    variable = &context->variables[index];
+
+    // Previous string of a variable assigned by the suffix
+    struct runtime_value held = {
+            .type = RUNTIME_TYPE_NULL,
+    };
+
+    if (is_same_string(&variable->content, &lhs_value)) {
+        release_value(&lhs_value);
+
+        if (append_string(&variable->content, &suffix)) {
+            destroy_value(&suffix);
+            return COMPLETION_NORMAL;
+        }
+    } else {
+        held = lhs_value;
+    }
+
+    struct runtime_value new_content = apply_binary_op(BINARY_OP_ADD, lhs_value, suffix);
+
+    retain_value(&new_content);
+    release_value(&variable->content);
+    release_value(&held);
+    variable->content = new_content;
+
+    return COMPLETION_NORMAL;
+}
+
+// A NULL statement name skips the check of the condition
+static inline bool evaluate_condition(struct context* context, const struct expr_closure* closure, const char* statement_name) {
+    if (closure->test != NULL) {
+        return closure->test(context, closure);
+    }
+
+    struct runtime_value condition = evaluate(context, closure);
+
+    if (statement_name != NULL && condition.type != RUNTIME_TYPE_BOOLEAN) {
+        panic("ERROR: found a value of type %s in a %s condition\n", runtime_type_to_string(condition.type), statement_name);
+    }
+
+    return condition.value.boolean;
+}
+
+static enum completion execute_if(struct context* context, const struct statement_closure* closure) {
+    bool condition = evaluate_condition(context, closure->op.if_condition.condition, "if");
+    enum completion completion = COMPLETION_NORMAL;
+
+    push_stack_frame(context);
+    if (condition) {
+        completion = execute(context, closure->op.if_condition.body);
+    } else if (closure->op.if_condition.body_else != NULL) {
+        completion = execute(context, closure->op.if_condition.body_else);
+    }
+    pop_stack_frame(context);
+
+    return completion;
+}
+
+static enum completion execute_simple_if(struct context* context, const struct statement_closure* closure) {
+    bool condition = evaluate_condition(context, closure->op.if_condition.condition, "if");
+
+    if (condition) {
+        return execute(context, closure->op.if_condition.body);
+    } else if (closure->op.if_condition.body_else != NULL) {
+        return execute(context, closure->op.if_condition.body_else);
+    }
+
+    return COMPLETION_NORMAL;
+}
+
+static enum completion execute_match(struct context* context, const struct statement_closure* closure) {
+    struct runtime_value value = evaluate(context, closure->op.match.value);
+    int arm = select_match_arm(closure->statement, value);
+
+    destroy_value(&value);
+
+    const struct statement_closure* body = arm >= 0 ? closure->op.match.arms[arm] : closure->op.match.body_else;
+
+    if (body == NULL) return COMPLETION_NORMAL;
+
+    push_stack_frame(context);
+    enum completion completion = execute(context, body);
+    pop_stack_frame(context);
+
+    return completion;
+}
+
+static enum completion run_while_loop(struct context* context, const struct statement_closure* closure, bool condition, struct loop_run* run) {
+    enum completion completion = COMPLETION_NORMAL;
+
+    while (condition) {
+        completion = execute(context, closure->op.while_loop.body);
+        run->iteration_count++;
+
+        if (is_loop_exit(completion)) break;
+
+        if (run->iteration_count == run->iteration_limit) {
+            run->is_stopped = true;
+            return COMPLETION_NORMAL;
+        }
+
+        condition = evaluate_condition(context, closure->op.while_loop.condition, NULL);
+    }
+
+    return get_loop_completion(completion);
+}
+
+static enum completion run_while(struct context* context, const struct statement_closure* closure, struct loop_run* run) {
+    // The condition is always evaluated in the frame of the loop, as the
+    // slots of its variables expect
+    push_stack_frame(context);
+    bool condition = evaluate_condition(context, closure->op.while_loop.condition, "while");
+    enum completion completion = run_while_loop(context, closure, condition, run);
+    release_loop_invariants(closure->statement->op.while_loop.invariants);
+    pop_stack_frame(context);
+
+    return completion;
+}
+
+static enum completion execute_while(struct context* context, const struct statement_closure* closure) {
+    struct loop_run run = UNLIMITED_LOOP_RUN;
+
+    return run_while(context, closure, &run);
+}
+
+// Runs a counted loop from the given value of its counter, the variable of
+// the counter being in the current frame
+static enum completion run_counted_loop(struct context* context, const struct statement_closure* closure, long counter, long bound, struct loop_run* run) {
+    struct statement* statement = closure->statement;
+    struct statement* initializer = statement->op.for_loop.initializer;
+
+    // Index of the counter, the body may grow the stack
+    size_t counter_index = lookup_variable(context, initializer->op.variable_declaration.variable_name, initializer->op.variable_declaration.slot) - context->variables;
+    enum binary_op_type op_type = statement->op.for_loop.condition->op.binary.type;
+    long step = statement->op.for_loop.counted_step;
+    enum completion completion = COMPLETION_NORMAL;
+
+    for (; apply_integer_op(op_type, counter, bound).value.boolean; counter += step) {
+        context->variables[counter_index].content.value.integer = counter;
+
+        completion = execute(context, closure->op.for_loop.body);
+        run->iteration_count++;
+
+        if (is_loop_exit(completion)) break;
+
+        if (run->iteration_count == run->iteration_limit) {
+            run->is_stopped = true;
+            run->counter = counter;
+            return COMPLETION_NORMAL;
+        }
+    }
+
+    context->variables[counter_index].content.value.integer = counter;
+
+    return get_loop_completion(completion);
+}
+
+// Same as the counted loops of the tree-walking interpreter
+static bool execute_counted_loop(struct context* context, const struct statement_closure* closure, struct loop_run* run, enum completion* completion) {
+    struct statement* initializer = closure->statement->op.for_loop.initializer;
+    struct runtime_value counter = lookup_variable(context, initializer->op.variable_declaration.variable_name, initializer->op.variable_declaration.slot)->content;
+
+    if (counter.type != RUNTIME_TYPE_INTEGER)
+        return false;
+
+    struct runtime_value bound = evaluate(context, closure->op.for_loop.bound);
+
+    if (bound.type != RUNTIME_TYPE_INTEGER) {
+        destroy_value(&bound);
+        return false;
+    }
+
+    *completion = run_counted_loop(context, closure, counter.value.integer, bound.value.integer, run);
+
+    return true;
+}
+
+static enum completion run_for_loop(struct context* context, const struct statement_closure* closure, bool condition, struct loop_run* run) {
+    enum completion completion = COMPLETION_NORMAL;
+
+    while (condition) {
+        completion = execute(context, closure->op.for_loop.body);
+        run->iteration_count++;
+
+        if (is_loop_exit(completion)) break;
+
+        if (run->iteration_count == run->iteration_limit) {
+            run->is_stopped = true;
+            return COMPLETION_NORMAL;
+        }
+
+        execute(context, closure->op.for_loop.increment);
+        condition = evaluate_condition(context, closure->op.for_loop.condition, NULL);
+    }
+
+    return get_loop_completion(completion);
+}
+
+static enum completion run_for(struct context* context, const struct statement_closure* closure, struct loop_run* run) {
+    enum completion completion;
+
+    push_stack_frame(context);
+    execute(context, closure->op.for_loop.initializer);
+
+    if (closure->op.for_loop.bound == NULL || !execute_counted_loop(context, closure, run, &completion)) {
+        completion = run_for_loop(context, closure, evaluate_condition(context, closure->op.for_loop.condition, "for"), run);
+    }
+
+    release_loop_invariants(closure->statement->op.for_loop.invariants);
+    pop_stack_frame(context);
+
+    return completion;
+}
+
+static enum completion execute_for(struct context* context, const struct statement_closure* closure) {
+    struct loop_run run = UNLIMITED_LOOP_RUN;
+
+    return run_for(context, closure, &run);
+}
+
+static enum completion execute_variable_update(struct context* context, const struct statement_closure* closure) {
+    struct statement* statement = closure->statement;
+    char* variable_name = statement->op.variable_update.variable_name;
+    struct runtime_variable* variable = lookup_variable(context, variable_name, statement->op.variable_update.slot);
+
+    if (variable->is_constant) {
+        panic("ERROR: variable '%s' is constant\n", variable_name);
+    }
+
+    if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+        variable->content = apply_integer_op(statement->op.variable_update.type, variable->content.value.integer, statement->op.variable_update.constant);
+    } else {
+        struct runtime_value constant = {
+                .type = RUNTIME_TYPE_INTEGER,
+                .value.integer = statement->op.variable_update.constant,
+        };
+
+        apply_binary_op(statement->op.variable_update.type, variable->content, constant);
+    }
+
+    return COMPLETION_NORMAL;
+}
+
+static enum completion execute_break(struct context* context, const struct statement_closure* closure) {
+    return COMPLETION_BREAK;
+}
+
+static enum completion execute_continue(struct context* context, const struct statement_closure* closure) {
+    return COMPLETION_CONTINUE;
+}
+
+static enum completion execute_return(struct context* context, const struct statement_closure* closure) {
+    struct runtime_value return_value = {.type = RUNTIME_TYPE_NULL};
+
+    if (closure->op.value != NULL) {
+        return_value = evaluate(context, closure->op.value);
+
+        // Kept alive while the frames of the function are popped
+        retain_value(&return_value);
+    }
+
+    context->return_value = return_value;
+    return COMPLETION_RETURN;
+}
+
+static enum completion execute_nothing(struct context* context, const struct statement_closure* closure) {
+    return COMPLETION_NORMAL;
+}
+
+static void* allocate_closure(struct closure_program* program, size_t size) {
+    void* closure = xcalloc(1, size);
+    arrpush(program->allocations, closure);
+
+    return closure;
+}
+
+static struct expr_closure* build_expr(struct closure_program* program, struct expr* expr);
+
+// Nodes quickened by the tree-walking interpreter are built as the generic
+// ones, the tiered engine building closures for code that already ran
+static inline bool is_variable_use(const struct expr* expr) {
+    return expr->type == EXPR_VARIABLE_USE || expr->type == EXPR_INT_VARIABLE_USE;
+}
+
+static struct expr_closure* build_binary_op(struct closure_program* program, struct expr_closure* closure, struct expr* expr) {
+    enum binary_op_type op_type = expr->op.binary.type;
+    struct expr* lhs = expr->op.binary.lhs;
+    struct expr* rhs = expr->op.binary.rhs;
+
+    if (is_logical_binary_op(op_type)) {
+        closure->evaluate = evaluate_branch;
+        closure->test = op_type == BINARY_OP_AND ? test_and : test_or;
+        closure->op.binary.lhs = build_expr(program, lhs);
+        closure->op.binary.rhs = build_expr(program, rhs);
+        return closure;
+    }
+
+    if (is_variable_use(lhs) && rhs->type == EXPR_INT_LITERAL) {
+        bool is_division = op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO;
+
+        // Divisions by zero are left to the generic closure to report
+        if (!is_division || rhs->op.integer_literal != 0) {
+            closure->evaluate = variable_constant_closures[op_type];
+            closure->op.variable_constant.name = lhs->op.variable_use.name;
+            closure->op.variable_constant.constant = rhs->op.integer_literal;
+            closure->op.variable_constant.slot = lhs->op.variable_use.slot;
+            return closure;
+        }
+    }
+
+    if (is_variable_use(lhs) && is_variable_use(rhs)) {
+        closure->evaluate = variables_closures[op_type];
+        closure->op.variables.lhs = lhs->op.variable_use.name;
+        closure->op.variables.rhs = rhs->op.variable_use.name;
+        closure->op.variables.lhs_slot = lhs->op.variable_use.slot;
+        closure->op.variables.rhs_slot = rhs->op.variable_use.slot;
+        return closure;
+    }
+
+    closure->evaluate = binary_closures[op_type];
+    closure->op.binary.lhs = build_expr(program, lhs);
+    closure->op.binary.rhs = build_expr(program, rhs);
+
+    return closure;
+}
+
+static struct expr_closure* build_expr(struct closure_program* program, struct expr* expr) {
+    struct expr_closure* closure = allocate_closure(program, sizeof(struct expr_closure));
+
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+            closure->evaluate = evaluate_literal;
+            closure->op.literal.type = RUNTIME_TYPE_BOOLEAN;
+            closure->op.literal.value.boolean = expr->op.bool_literal;
+            break;
+        case EXPR_INT_LITERAL:
+            closure->evaluate = evaluate_literal;
+            closure->op.literal.type = RUNTIME_TYPE_INTEGER;
+            closure->op.literal.value.integer = expr->op.integer_literal;
+            break;
+        case EXPR_FLOAT_LITERAL:
+            closure->evaluate = evaluate_literal;
+            closure->op.literal.type = RUNTIME_TYPE_FLOAT;
+            closure->op.literal.value.floating = expr->op.float_literal;
+            break;
+        case EXPR_NULL:
+            closure->evaluate = evaluate_literal;
+            closure->op.literal.type = RUNTIME_TYPE_NULL;
+            break;
+        case EXPR_STRING_LITERAL:
+            closure->evaluate = evaluate_string_literal;
+            closure->op.string_literal = expr->op.string_literal;
+            break;
+        case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
+            closure->evaluate = evaluate_variable;
+            closure->op.variable.name = expr->op.variable_use.name;
+            closure->op.variable.slot = expr->op.variable_use.slot;
+            break;
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            return build_binary_op(program, closure, expr);
+        case EXPR_UNARY_OPT:
+            if (is_branch_expr(expr)) {
+                closure->evaluate = evaluate_branch;
+                closure->test = test_not;
+            } else {
+                closure->evaluate = expr->op.unary.type == UNARY_OP_NOT ? evaluate_not : evaluate_negation;
+            }
+            closure->op.unary_arg = build_expr(program, expr->op.unary.arg);
+            break;
+        case EXPR_FUNCTION_CALL: {
+            builtin_fn_t builtin = is_builtin_fn(expr->op.function_call.name);
+
+            if (builtin == BUILTIN_FN_PRINT) {
+                closure->evaluate = evaluate_print;
+            } else if (builtin != -1) {
+                closure->evaluate = evaluate_builtin;
+            } else {
+                closure->evaluate = evaluate_call;
+            }
+
+            closure->op.function_call.name = expr->op.function_call.name;
+            closure->op.function_call.builtin = builtin;
+            closure->op.function_call.arguments = NULL;
+            closure->op.function_call.program = program;
+            closure->op.function_call.fn = NULL;
+            closure->op.function_call.body = NULL;
+
+            if (builtin == -1) {
+                arrpush(program->calls, closure);
+            }
+
+            FOR_EACH(struct expr*, argument, expr->op.function_call.arguments) {
+                arrpush(closure->op.function_call.arguments, build_expr(program, *argument));
+            }
+            arrpush(program->arrays, (void*) closure->op.function_call.arguments);
+            break;
+        }
+        case EXPR_LOOP_INVARIANT:
+            closure->evaluate = evaluate_loop_invariant;
+            closure->op.loop_invariant.expr = expr;
+            closure->op.loop_invariant.value = build_expr(program, expr->op.loop_invariant.value);
+            break;
+        case EXPR_VARIABLE_CONSTANT_OPT:
+            closure->evaluate = variable_constant_closures[expr->op.variable_constant.type];
+            closure->op.variable_constant.name = expr->op.variable_constant.name;
+            closure->op.variable_constant.constant = expr->op.variable_constant.constant;
+            closure->op.variable_constant.slot = expr->op.variable_constant.slot;
+            break;
+        case EXPR_CONCAT:
+            closure->evaluate = evaluate_concat;
+            closure->op.concat_operands = NULL;
+
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                arrpush(closure->op.concat_operands, build_expr(program, *operand));
+            }
+            arrpush(program->arrays, (void*) closure->op.concat_operands);
+            break;
+        case EXPR_MODULO_TEST:
+            closure->evaluate = evaluate_modulo_test;
+            closure->op.modulo_test.name = expr->op.modulo_test.name;
+            closure->op.modulo_test.modulus = expr->op.modulo_test.modulus;
+            closure->op.modulo_test.remainder = expr->op.modulo_test.remainder;
+            closure->op.modulo_test.is_equal = expr->op.modulo_test.is_equal;
+            closure->op.modulo_test.slot = expr->op.modulo_test.slot;
+            break;
+        default:
+            fprintf(stderr, "ERROR: cannot build expression closure\n");
+            abort();
+    }
+
+    return closure;
+}
+
+static struct expr_closure* build_optional_expr(struct closure_program* program, struct expr* expr) {
+    return expr == NULL ? NULL : build_expr(program, expr);
+}
+
+static struct statement_closure* build_statement(struct closure_program* program, struct statement* statement) {
+    struct statement_closure* closure = allocate_closure(program, sizeof(struct statement_closure));
+    closure->statement = statement;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            closure->execute = execute_block;
+            closure->op.block = NULL;
+
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                arrpush(closure->op.block, build_statement(program, *it));
+            }
+            arrpush(program->arrays, (void*) closure->op.block);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            closure->execute = execute_declaration;
+            closure->op.value = build_optional_expr(program, statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_FUNCTION_DECL: {
+            closure->execute = execute_function_declaration;
+
+            struct statement_closure* body = build_statement(program, statement->op.function_declaration.body);
+            hmput(program->functions, statement, body);
+
+            char* fn_name = statement->op.function_declaration.fn_name;
+            bool is_redeclared = shgeti(program->declarations, fn_name) >= 0;
+            shput(program->declarations, fn_name, is_redeclared ? NULL : statement);
+            break;
+        }
+        case STATEMENT_NAKED_FN_CALL:
+            closure->execute = execute_naked_call;
+            closure->op.value = build_expr(program, statement->op.naked_fn_call.function_call);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            if (is_append_assignment(statement)) {
+                closure->execute = execute_append;
+                closure->op.append.value = build_expr(program, statement->op.variable_assignment.value);
+                closure->op.append.suffix = NULL;
+
+                struct expr* value = statement->op.variable_assignment.value;
+
+                if (value->type == EXPR_CONCAT) {
+                    for (size_t i = 1; i < arrlen(value->op.concat.operands); i++) {
+                        arrpush(closure->op.append.suffix, build_expr(program, value->op.concat.operands[i]));
+                    }
+                } else {
+                    arrpush(closure->op.append.suffix, build_expr(program, value->op.binary.rhs));
+                }
+                arrpush(program->arrays, (void*) closure->op.append.suffix);
+            } else {
+                closure->execute = execute_assignment;
+                closure->op.value = build_expr(program, statement->op.variable_assignment.value);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            closure->execute = statement->type == STATEMENT_IF_CONDITION ? execute_if : execute_simple_if;
+            closure->op.if_condition.condition = build_expr(program, statement->op.if_condition.condition);
+            closure->op.if_condition.body = build_statement(program, statement->op.if_condition.body);
+            closure->op.if_condition.body_else = statement->op.if_condition.body_else == NULL ? NULL : build_statement(program, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            closure->execute = execute_match;
+            closure->op.match.value = build_expr(program, statement->op.match.value);
+            closure->op.match.arms = NULL;
+
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                arrpush(closure->op.match.arms, build_statement(program, *arm));
+            }
+            arrpush(program->arrays, (void*) closure->op.match.arms);
+
+            closure->op.match.body_else = statement->op.match.body_else == NULL ? NULL : build_statement(program, statement->op.match.body_else);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            closure->execute = execute_while;
+            closure->op.while_loop.condition = build_expr(program, statement->op.while_loop.condition);
+            closure->op.while_loop.body = build_statement(program, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            closure->execute = execute_for;
+            closure->op.for_loop.initializer = build_statement(program, statement->op.for_loop.initializer);
+            closure->op.for_loop.condition = build_expr(program, statement->op.for_loop.condition);
+            closure->op.for_loop.bound = statement->op.for_loop.is_counted ? build_expr(program, statement->op.for_loop.condition->op.binary.rhs) : NULL;
+            closure->op.for_loop.body = build_statement(program, statement->op.for_loop.body);
+
+            if (statement->op.for_loop.increment != NULL) {
+                closure->op.for_loop.increment = build_statement(program, statement->op.for_loop.increment);
+            } else {
+                closure->op.for_loop.increment = allocate_closure(program, sizeof(struct statement_closure));
+                closure->op.for_loop.increment->execute = execute_nothing;
+            }
+            break;
+        case STATEMENT_VARIABLE_UPDATE:
+            closure->execute = execute_variable_update;
+            break;
+        case STATEMENT_BREAK:
+            closure->execute = execute_break;
+            break;
+        case STATEMENT_CONTINUE:
+            closure->execute = execute_continue;
+            break;
+        case STATEMENT_RETURN:
+            closure->execute = execute_return;
+            closure->op.value = build_optional_expr(program, statement->op.return_statement.value);
+            break;
+        default:
+            fprintf(stderr, "ERROR: cannot build statement closure\n");
+            abort();
+    }
+
+    return closure;
+}
+
+struct closure_program* create_closure_program() {
+    struct closure_program* closures = xmalloc(sizeof(struct closure_program));
+    closures->root = NULL;
+    closures->functions = NULL;
+    closures->declarations = NULL;
+    closures->calls = NULL;
+    closures->allocations = NULL;
+    closures->arrays = NULL;
+
+    return closures;
+}
+
+struct statement_closure* build_statement_closure(struct closure_program* program, struct statement* statement) {
+    return build_statement(program, statement);
+}
+
+// Points the calls of functions declared once to their body, a call finding
+// no other function when it runs
+static void resolve_calls(struct closure_program* program) {
+    FOR_EACH(struct expr_closure*, it, program->calls) {
+        struct statement* fn = shget(program->declarations, (*it)->op.function_call.name);
+
+        if (fn != NULL) {
+            (*it)->op.function_call.fn = fn;
+            (*it)->op.function_call.body = hmget(program->functions, fn);
+        }
+    }
+
+    arrfree(program->calls);
+    shfree(program->declarations);
+}
+
+struct closure_program* build_closures(struct statement* program) {
+    struct closure_program* closures = create_closure_program();
+    closures->root = build_statement(closures, program);
+
+    resolve_calls(closures);
+
+    return closures;
+}
+
+enum completion execute_statement_closure(struct context* context, const struct statement_closure* closure) {
+    return execute(context, closure);
+}
+
+enum completion run_loop_closure(struct context* context, const struct statement_closure* closure, struct loop_run* run) {
+    if (closure->statement->type == STATEMENT_WHILE_LOOP) {
+        return run_while(context, closure, run);
+    }
+
+    return run_for(context, closure, run);
+}
+
+enum completion resume_loop_closure(struct context* context, const struct statement_closure* closure, struct loop_run* run) {
+    if (closure->statement->type == STATEMENT_WHILE_LOOP) {
+        return run_while_loop(context, closure, evaluate_condition(context, closure->op.while_loop.condition, NULL), run);
+    }
+
+    execute(context, closure->op.for_loop.increment);
+
+    return run_for_loop(context, closure, evaluate_condition(context, closure->op.for_loop.condition, NULL), run);
+}
+
+enum completion resume_counted_loop_closure(struct context* context, const struct statement_closure* closure, long counter, long bound, struct loop_run* run) {
+    return run_counted_loop(context, closure, counter + closure->statement->op.for_loop.counted_step, bound, run);
+}
+
+size_t count_closures(const struct closure_program* program) {
+    return arrlen(program->allocations);
+}
+
+void run_closure_program(struct closure_program* program) {
+    struct context context;
+    init_context(&context);
+
+    push_stack_frame(&context);
+    execute(&context, program->root);
+    pop_stack_frame(&context);
+
+    destroy_context(&context);
+}
+
+void destroy_closure_program(struct closure_program* program) {
+    FOR_EACH(void*, it, program->allocations) {
+        free(*it);
+    }
+
+    for (size_t i = 0; i < arrlen(program->arrays); i++) {
+        arrfree(program->arrays[i]);
+    }
+
+    arrfree(program->allocations);
+    arrfree(program->arrays);
+    arrfree(program->calls);
+    shfree(program->declarations);
+    hmfree(program->functions);
+    free(program);
+}
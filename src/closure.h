@@ -0,0 +1,178 @@
+#ifndef CHAD_INTERPRETER_CLOSURE_H
+#define CHAD_INTERPRETER_CLOSURE_H
+
+#include "ast.h"
+#include "builtins.h"
+#include "interpreter.h"
+
+struct expr_closure;
+struct statement_closure;
+struct closure_program;
+
+typedef struct runtime_value (*expr_closure_fn)(struct context* context, const struct expr_closure* closure);
+typedef bool (*branch_closure_fn)(struct context* context, const struct expr_closure* closure);
+typedef enum completion (*statement_closure_fn)(struct context* context, const struct statement_closure* closure);
+
+// An expression converted once into the function evaluating it, specialized
+// by operator and operand kinds, and the operands it needs
+struct expr_closure {
+    expr_closure_fn evaluate;
+    // Set for && and || and negations of them, which conditions run without
+    // building a runtime value, NULL otherwise
+    branch_closure_fn test;
+    union {
+        // Literals other than strings
+        struct runtime_value literal;
+        const char* string_literal;
+        struct {
+            const char* name;
+            struct variable_slot slot;
+        } variable;
+        struct {
+            struct expr_closure* lhs;
+            struct expr_closure* rhs;
+        } binary;
+        // Fused `variable <op> integer`, and binary operations of that shape
+        struct {
+            const char* name;
+            long constant;
+            struct variable_slot slot;
+        } variable_constant;
+        // Binary operations between two variables
+        struct {
+            const char* lhs;
+            const char* rhs;
+            struct variable_slot lhs_slot;
+            struct variable_slot rhs_slot;
+        } variables;
+        struct expr_closure* unary_arg;
+        struct expr_closure** concat_operands;
+        struct {
+            const char* name;
+            builtin_fn_t builtin;
+            struct expr_closure** arguments;
+            struct closure_program* program;
+            // Function the call finds when its name is declared once, and the
+            // closure of its body, set once the whole program is built
+            const struct statement* fn;
+            const struct statement_closure* body;
+        } function_call;
+        struct {
+            // Node holding the cached value, released by its loop
+            struct expr* expr;
+            struct expr_closure* value;
+        } loop_invariant;
+        struct {
+            const char* name;
+            long modulus;
+            long remainder;
+            bool is_equal;
+            struct variable_slot slot;
+        } modulo_test;
+    } op;
+};
+
+struct statement_closure {
+    statement_closure_fn execute;
+    struct statement* statement;
+    union {
+        struct statement_closure** block;
+        // Value of declarations, assignments and returns, or naked call
+        struct expr_closure* value;
+        // Assignment `variable = variable + suffix`, value being the whole sum,
+        // the suffix being several operands for a concatenation
+        struct {
+            struct expr_closure* value;
+            struct expr_closure** suffix;
+        } append;
+        struct {
+            struct expr_closure* condition;
+            struct statement_closure* body;
+            struct statement_closure* body_else;
+        } if_condition;
+        struct {
+            struct expr_closure* condition;
+            struct statement_closure* body;
+        } while_loop;
+        struct {
+            struct statement_closure* initializer;
+            struct expr_closure* condition;
+            // Bound of a counted loop
+            struct expr_closure* bound;
+            struct statement_closure* increment;
+            struct statement_closure* body;
+        } for_loop;
+        struct {
+            struct expr_closure* value;
+            // At the index of the arm selected by the match statement
+            struct statement_closure** arms;
+            struct statement_closure* body_else;
+        } match;
+    } op;
+};
+
+struct function_closure_entry {
+    struct statement* key;
+    struct statement_closure* value;
+};
+
+struct function_name_entry {
+    char* key;
+    struct statement* value;
+};
+
+struct closure_program {
+    // NULL for programs built statement by statement
+    struct statement_closure* root;
+    // Bodies of the declared functions
+    struct function_closure_entry* functions;
+    // While the program is built, its function declarations by name, NULL
+    // for names declared more than once, and its calls of user functions
+    struct function_name_entry* declarations;
+    struct expr_closure** calls;
+    void** allocations;
+    // Arrays of the blocks and call arguments
+    void** arrays;
+};
+
+struct closure_program* build_closures(struct statement* program);
+size_t count_closures(const struct closure_program* program);
+
+void run_closure_program(struct closure_program* program);
+
+// Program without a root, to which statements are added as they are needed
+struct closure_program* create_closure_program();
+struct statement_closure* build_statement_closure(struct closure_program* program, struct statement* statement);
+
+enum completion execute_statement_closure(struct context* context, const struct statement_closure* closure);
+
+// Iterations run by the closures of a loop. Once iteration_count reaches
+// iteration_limit the loop stops at the end of that iteration, in its frame,
+// setting is_stopped and, for counted loops, the counter of that iteration.
+struct loop_run {
+    long iteration_count;
+    long iteration_limit;
+    bool is_stopped;
+    long counter;
+};
+
+static const struct loop_run UNLIMITED_LOOP_RUN = {
+        .iteration_count = 0,
+        .iteration_limit = -1,
+        .is_stopped = false,
+        .counter = 0,
+};
+
+// Runs a whole loop, counting its iterations. Returns its completion.
+enum completion run_loop_closure(struct context* context, const struct statement_closure* closure, struct loop_run* run);
+
+// Continue a loop run by the tree-walking interpreter at the end of one of its
+// iterations, in the frame pushed for the loop which is left to the caller.
+// Counted loops take the counter of that iteration and the bound. Returns the
+// completion of the loop, normal when it was stopped.
+enum completion resume_loop_closure(struct context* context, const struct statement_closure* closure, struct loop_run* run);
+enum completion resume_counted_loop_closure(struct context* context, const struct statement_closure* closure, long counter, long bound, struct loop_run* run);
+
+void destroy_closure_program(struct closure_program* program);
+
+#endif
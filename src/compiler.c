@@ -0,0 +1,1447 @@
+#include "compiler.h"
+#include "errors.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "str.h"
+
+// Variables are dynamically scoped: a name resolves to the innermost
+// declaration of any live frame, callers included. The compiler gives every
+// (scope, name) pair of a function a register slot and accesses it directly
+// when the declaration is known to be the visible one, otherwise the access
+// goes through a lookup by name at runtime.
+
+struct symbol_entry {
+    char* key;
+    int value;
+};
+
+// Program-wide facts about a name
+struct declaration_info {
+    int count;
+    // Set when the only declaration is in the main scope
+    bool is_global;
+    bool is_ever_constant;
+};
+
+struct declaration_entry {
+    char* key;
+    struct declaration_info value;
+};
+
+enum declaration_state {
+    DECLARATION_UNDECLARED,
+    // Declared on some paths only, e.g. later in the body of a loop
+    DECLARATION_MAYBE,
+    DECLARATION_DECLARED,
+};
+
+struct compiler_slot {
+    int symbol;
+    int depth;
+    bool is_open;
+    enum declaration_state state;
+    // Known for declared slots only
+    bool is_constant;
+    int function_index;
+};
+
+struct compiler_scope {
+    int first_slot;
+    int first_function_slot;
+};
+
+struct loop_target {
+    int scope_index;
+    size_t* break_jumps;
+    size_t* continue_jumps;
+};
+
+struct program_compiler {
+    struct bytecode_program* program;
+    struct symbol_entry* symbols;
+    struct declaration_entry* variables;
+    struct declaration_entry* functions;
+    // Slot of the main frame for names declared once in the main scope, or -1
+    int* global_slots;
+    int* global_function_slots;
+};
+
+struct function_compiler {
+    struct program_compiler* program;
+    struct bytecode_function* function;
+    bool is_main;
+    struct compiler_slot* slots;
+    struct compiler_slot* function_slots;
+    struct compiler_scope* scopes;
+    struct loop_target* loops;
+    // Temporaries are allocated as a stack above the variable slots
+    int temp_base;
+    int temp_count;
+    int max_temp_count;
+};
+
+enum access_kind {
+    ACCESS_LOCAL,
+    ACCESS_GLOBAL,
+    ACCESS_DYNAMIC,
+};
+
+struct variable_access {
+    enum access_kind kind;
+    // Slot for local and global accesses, symbol for dynamic ones
+    int index;
+};
+
+static int intern_symbol(struct program_compiler* compiler, const char* name) {
+    struct symbol_entry* entry = shgetp_null(compiler->symbols, name);
+
+    if (entry != NULL) return entry->value;
+
+    int symbol = (int) arrlen(compiler->program->symbols);
+    char* key = xstrdup(name);
+
+    arrpush(compiler->program->symbols, key);
+    arrpush(compiler->global_slots, -1);
+    arrpush(compiler->global_function_slots, -1);
+    shput(compiler->symbols, key, symbol);
+
+    return symbol;
+}
+
+static void record_declaration(struct declaration_entry** table, char* name, bool is_global, bool is_constant) {
+    struct declaration_entry* entry = shgetp_null(*table, name);
+
+    if (entry == NULL) {
+        struct declaration_info info = {
+                .count = 0,
+                .is_global = false,
+                .is_ever_constant = false,
+        };
+
+        shput(*table, name, info);
+        entry = shgetp_null(*table, name);
+    }
+
+    entry->value.count++;
+    entry->value.is_global = is_global;
+    entry->value.is_ever_constant |= is_constant;
+}
+
+static bool is_global_declaration(struct declaration_entry** table, const char* name) {
+    struct declaration_entry* entry = shgetp_null(*table, name);
+
+    return entry != NULL && entry->value.count == 1 && entry->value.is_global;
+}
+
+static bool is_ever_constant(struct declaration_entry** table, const char* name) {
+    struct declaration_entry* entry = shgetp_null(*table, name);
+
+    return entry != NULL && entry->value.is_ever_constant;
+}
+
+static void scan_declarations(struct program_compiler* compiler, struct statement* statement, bool is_main_scope) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            // Blocks do not open a scope
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                scan_declarations(compiler, *it, is_main_scope);
+            }
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            record_declaration(&compiler->variables, statement->op.variable_declaration.variable_name, is_main_scope, statement->op.variable_declaration.is_constant);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            record_declaration(&compiler->functions, statement->op.function_declaration.fn_name, is_main_scope, false);
+
+            FOR_EACH(char*, argument, statement->op.function_declaration.arguments) {
+                record_declaration(&compiler->variables, *argument, false, false);
+            }
+
+            scan_declarations(compiler, statement->op.function_declaration.body, false);
+            break;
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            scan_declarations(compiler, statement->op.if_condition.body, false);
+            scan_declarations(compiler, statement->op.if_condition.body_else, false);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                scan_declarations(compiler, *arm, false);
+            }
+            scan_declarations(compiler, statement->op.match.body_else, false);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            scan_declarations(compiler, statement->op.while_loop.body, false);
+            break;
+        case STATEMENT_FOR_LOOP:
+            scan_declarations(compiler, statement->op.for_loop.initializer, false);
+            scan_declarations(compiler, statement->op.for_loop.increment, false);
+            scan_declarations(compiler, statement->op.for_loop.body, false);
+            break;
+        default:
+            break;
+    }
+}
+
+// Upper bound of the variable slots of a function body
+static int count_variable_declarations(struct statement* statement) {
+    if (statement == NULL) return 0;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK: {
+            int count = 0;
+
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                count += count_variable_declarations(*it);
+            }
+
+            return count;
+        }
+        case STATEMENT_VARIABLE_DECL:
+            return 1;
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            return count_variable_declarations(statement->op.if_condition.body) + count_variable_declarations(statement->op.if_condition.body_else);
+        case STATEMENT_MATCH: {
+            int count = count_variable_declarations(statement->op.match.body_else);
+
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                count += count_variable_declarations(*arm);
+            }
+
+            return count;
+        }
+        case STATEMENT_WHILE_LOOP:
+            return count_variable_declarations(statement->op.while_loop.body);
+        case STATEMENT_FOR_LOOP:
+            return count_variable_declarations(statement->op.for_loop.initializer) + count_variable_declarations(statement->op.for_loop.increment) + count_variable_declarations(statement->op.for_loop.body);
+        default:
+            return 0;
+    }
+}
+
+// Names declared directly in the scope of a statement list
+static void collect_scope_declarations(struct statement* statement, char*** variables, char*** functions) {
+    if (statement == NULL) return;
+
+    if (statement->type == STATEMENT_BLOCK) {
+        FOR_EACH(struct statement*, it, statement->op.block.statements) {
+            collect_scope_declarations(*it, variables, functions);
+        }
+    } else if (statement->type == STATEMENT_VARIABLE_DECL) {
+        arrpush(*variables, statement->op.variable_declaration.variable_name);
+    } else if (statement->type == STATEMENT_FUNCTION_DECL) {
+        arrpush(*functions, statement->op.function_declaration.fn_name);
+    }
+}
+
+static bool expr_calls_functions(struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            return expr_calls_functions(expr->op.binary.lhs) || expr_calls_functions(expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return expr_calls_functions(expr->op.unary.arg);
+        case EXPR_LOOP_INVARIANT:
+            return expr_calls_functions(expr->op.loop_invariant.value);
+        case EXPR_CONCAT:
+            FOR_EACH(struct expr*, it, expr->op.concat.operands) {
+                if (expr_calls_functions(*it)) return true;
+            }
+
+            return false;
+        case EXPR_FUNCTION_CALL:
+            // Builtins cannot modify variables
+            if (is_builtin_fn(expr->op.function_call.name) == -1) return true;
+
+            FOR_EACH(struct expr*, it, expr->op.function_call.arguments) {
+                if (expr_calls_functions(*it)) return true;
+            }
+
+            return false;
+        default:
+            return false;
+    }
+}
+
+static size_t emit(struct function_compiler* compiler, enum opcode opcode, int a, int b, int c) {
+    struct instruction instruction = {
+            .opcode = opcode,
+            .a = a,
+            .b = b,
+            .c = c,
+    };
+
+    arrpush(compiler->function->code, instruction);
+
+    return arrlen(compiler->function->code) - 1;
+}
+
+static int current_position(struct function_compiler* compiler) {
+    return (int) arrlen(compiler->function->code);
+}
+
+static void patch_jump(struct function_compiler* compiler, size_t jump, int target) {
+    struct instruction* instruction = &compiler->function->code[jump];
+
+    if (instruction->opcode == OPCODE_JUMP) {
+        instruction->a = target;
+    } else {
+        instruction->b = target;
+    }
+}
+
+static int add_constant(struct function_compiler* compiler, struct runtime_value value) {
+    for (int i = 0; i < arrlen(compiler->function->constants); i++) {
+        struct runtime_value* constant = &compiler->function->constants[i];
+
+        if (constant->type != value.type) continue;
+
+        if ((value.type == RUNTIME_TYPE_INTEGER && constant->value.integer == value.value.integer) ||
+            (value.type == RUNTIME_TYPE_BOOLEAN && constant->value.boolean == value.value.boolean) ||
+            value.type == RUNTIME_TYPE_NULL)
+            return i;
+    }
+
+    arrpush(compiler->function->constants, value);
+
+    return (int) arrlen(compiler->function->constants) - 1;
+}
+
+static int add_integer_constant(struct function_compiler* compiler, long integer) {
+    struct runtime_value value = {
+            .type = RUNTIME_TYPE_INTEGER,
+            .value.integer = integer,
+    };
+
+    return add_constant(compiler, value);
+}
+
+static int add_literal_constant(struct function_compiler* compiler, struct expr* expr) {
+    struct runtime_value value;
+
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+            value.type = RUNTIME_TYPE_BOOLEAN;
+            value.value.boolean = expr->op.bool_literal;
+            break;
+        case EXPR_INT_LITERAL:
+            value.type = RUNTIME_TYPE_INTEGER;
+            value.value.integer = expr->op.integer_literal;
+            break;
+        case EXPR_FLOAT_LITERAL:
+            // Floats are not deduplicated as NaN never compares equal
+            value.type = RUNTIME_TYPE_FLOAT;
+            value.value.floating = expr->op.float_literal;
+            arrpush(compiler->function->constants, value);
+            return (int) arrlen(compiler->function->constants) - 1;
+        case EXPR_STRING_LITERAL:
+            // The constant pool holds a reference, so the string is shared
+            // by every load instead of being copied
+            value.type = RUNTIME_TYPE_STRING;
+            value = copy_string_value(expr->op.string_literal);
+            retain_value(&value);
+            arrpush(compiler->function->constants, value);
+            return (int) arrlen(compiler->function->constants) - 1;
+        default:
+            value.type = RUNTIME_TYPE_NULL;
+            break;
+    }
+
+    return add_constant(compiler, value);
+}
+
+static int allocate_temp(struct function_compiler* compiler) {
+    int reg = compiler->temp_base + compiler->temp_count;
+
+    compiler->temp_count++;
+
+    if (compiler->temp_count > compiler->max_temp_count)
+        compiler->max_temp_count = compiler->temp_count;
+
+    return reg;
+}
+
+static int target_or_temp(struct function_compiler* compiler, int target) {
+    return target >= 0 ? target : allocate_temp(compiler);
+}
+
+static bool is_variable_slot(struct function_compiler* compiler, int reg) {
+    return reg < compiler->temp_base;
+}
+
+static int current_depth(struct function_compiler* compiler) {
+    return (int) arrlen(compiler->scopes) - 1;
+}
+
+static void open_scope(struct function_compiler* compiler) {
+    struct compiler_scope scope = {
+            .first_slot = (int) arrlen(compiler->slots),
+            .first_function_slot = (int) arrlen(compiler->function_slots),
+    };
+
+    arrpush(compiler->scopes, scope);
+}
+
+// Undeclares every slot allocated since the given ones, which belong to the
+// scopes being left
+static void emit_kills(struct function_compiler* compiler, int first_slot, int first_function_slot) {
+    int slot_count = (int) arrlen(compiler->slots) - first_slot;
+    int function_slot_count = (int) arrlen(compiler->function_slots) - first_function_slot;
+
+    if (slot_count > 0)
+        emit(compiler, OPCODE_KILL, first_slot, slot_count, 0);
+
+    if (function_slot_count > 0)
+        emit(compiler, OPCODE_KILL_FUNCTIONS, first_function_slot, function_slot_count, 0);
+}
+
+static void close_scope(struct function_compiler* compiler) {
+    struct compiler_scope scope = arrpop(compiler->scopes);
+
+    emit_kills(compiler, scope.first_slot, scope.first_function_slot);
+
+    for (int i = scope.first_slot; i < arrlen(compiler->slots); i++) {
+        compiler->slots[i].is_open = false;
+    }
+
+    for (int i = scope.first_function_slot; i < arrlen(compiler->function_slots); i++) {
+        compiler->function_slots[i].is_open = false;
+    }
+}
+
+// Slot of a name in the current scope, allocated on first use
+static int scope_slot(struct function_compiler* compiler, struct compiler_slot** slots, int symbol) {
+    int depth = current_depth(compiler);
+
+    for (int i = 0; i < arrlen(*slots); i++) {
+        struct compiler_slot* slot = &(*slots)[i];
+
+        if (slot->is_open && slot->symbol == symbol && slot->depth == depth)
+            return i;
+    }
+
+    struct compiler_slot slot = {
+            .symbol = symbol,
+            .depth = depth,
+            .is_open = true,
+            .state = DECLARATION_UNDECLARED,
+            .is_constant = false,
+            .function_index = -1,
+    };
+
+    arrpush(*slots, slot);
+
+    return (int) arrlen(*slots) - 1;
+}
+
+// Innermost slot of a name which may be declared, or -1
+static int visible_slot(struct compiler_slot* slots, int symbol) {
+    int visible = -1;
+
+    for (int i = 0; i < arrlen(slots); i++) {
+        struct compiler_slot* slot = &slots[i];
+
+        if (!slot->is_open || slot->symbol != symbol || slot->state == DECLARATION_UNDECLARED)
+            continue;
+
+        if (visible == -1 || slot->depth > slots[visible].depth)
+            visible = i;
+    }
+
+    return visible;
+}
+
+static void set_scope_declarations(struct function_compiler* compiler, struct statement* statement, enum declaration_state state) {
+    char** variables = NULL;
+    char** functions = NULL;
+
+    collect_scope_declarations(statement, &variables, &functions);
+
+    FOR_EACH(char*, name, variables) {
+        int slot = scope_slot(compiler, &compiler->slots, intern_symbol(compiler->program, *name));
+        compiler->slots[slot].state = state;
+    }
+
+    FOR_EACH(char*, name, functions) {
+        int slot = scope_slot(compiler, &compiler->function_slots, intern_symbol(compiler->program, *name));
+        compiler->function_slots[slot].state = state;
+    }
+
+    arrfree(variables);
+    arrfree(functions);
+}
+
+static struct variable_access resolve_variable(struct function_compiler* compiler, int symbol) {
+    struct variable_access access = {
+            .kind = ACCESS_DYNAMIC,
+            .index = symbol,
+    };
+
+    int slot = visible_slot(compiler->slots, symbol);
+
+    if (slot >= 0) {
+        if (compiler->slots[slot].state == DECLARATION_DECLARED) {
+            access.kind = ACCESS_LOCAL;
+            access.index = slot;
+        }
+    } else if (!compiler->is_main && compiler->program->global_slots[symbol] >= 0) {
+        access.kind = ACCESS_GLOBAL;
+        access.index = compiler->program->global_slots[symbol];
+    }
+
+    return access;
+}
+
+static int compile_expr(struct function_compiler* compiler, struct expr* expr, int target);
+static void compile_statement(struct function_compiler* compiler, struct statement* statement);
+static int compile_function(struct program_compiler* compiler, struct statement* body, char** parameters, int symbol, bool is_main);
+
+static enum opcode binary_op_to_opcode(enum binary_op_type op_type, bool is_immediate) {
+    switch (op_type) {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) \
+    case BINARY_OP_##X:                  \
+        return is_immediate ? OPCODE_##X##_IMM : OPCODE_##X;
+#include "binary_ops.h"
+    }
+
+    return OPCODE_ADD;
+}
+
+static int compile_variable_load(struct function_compiler* compiler, int symbol, int target) {
+    struct variable_access access = resolve_variable(compiler, symbol);
+
+    if (access.kind == ACCESS_LOCAL) {
+        if (target < 0) return access.index;
+
+        emit(compiler, OPCODE_MOVE, target, access.index, 0);
+        return target;
+    }
+
+    int destination = target_or_temp(compiler, target);
+    emit(compiler, access.kind == ACCESS_GLOBAL ? OPCODE_LOAD_GLOBAL : OPCODE_LOAD_NAME, destination, access.index, 0);
+
+    return destination;
+}
+
+static int compile_binary_op(struct function_compiler* compiler, enum binary_op_type op_type, struct expr* lhs, struct expr* rhs, int target) {
+    int mark = compiler->temp_count;
+    int lhs_register = compile_expr(compiler, lhs, -1);
+
+    // The left operand is read when the instruction runs, so it must be
+    // copied if evaluating the right one may assign it
+    if (is_variable_slot(compiler, lhs_register) && expr_calls_functions(rhs)) {
+        int copy = allocate_temp(compiler);
+        emit(compiler, OPCODE_MOVE, copy, lhs_register, 0);
+        lhs_register = copy;
+    }
+
+    bool is_immediate = rhs->type == EXPR_INT_LITERAL;
+    int rhs_operand = is_immediate ? add_integer_constant(compiler, rhs->op.integer_literal) : compile_expr(compiler, rhs, -1);
+
+    compiler->temp_count = mark;
+    int destination = target_or_temp(compiler, target);
+
+    emit(compiler, binary_op_to_opcode(op_type, is_immediate), destination, lhs_register, rhs_operand);
+
+    return destination;
+}
+
+// Operands read without side effects nor errors, which can all be evaluated
+// before the types of the ones before them are checked
+static bool is_concat_operand_safe(struct function_compiler* compiler, const struct expr* expr) {
+    if (expr->type == EXPR_STRING_LITERAL) return true;
+    if (expr->type != EXPR_VARIABLE_USE && expr->type != EXPR_INT_VARIABLE_USE) return false;
+
+    return resolve_variable(compiler, intern_symbol(compiler->program, expr->op.variable_use.name)).kind == ACCESS_LOCAL;
+}
+
+// The operands of a concatenation after the first are evaluated into
+// consecutive registers when none of them can fail, the sum being then built
+// at once. Otherwise they are added one at a time to a register, which the VM
+// extends in place.
+static int compile_concat(struct function_compiler* compiler, struct expr** operands, int target) {
+    int mark = compiler->temp_count;
+    bool is_safe = true;
+
+    for (size_t i = 1; i < arrlen(operands); i++) {
+        is_safe = is_safe && is_concat_operand_safe(compiler, operands[i]);
+    }
+
+    int base = allocate_temp(compiler);
+    compile_expr(compiler, operands[0], base);
+
+    for (size_t i = 1; i < arrlen(operands); i++) {
+        if (is_safe) {
+            compile_expr(compiler, operands[i], allocate_temp(compiler));
+            continue;
+        }
+
+        int operand_mark = compiler->temp_count;
+        emit(compiler, OPCODE_ADD, base, base, compile_expr(compiler, operands[i], -1));
+        compiler->temp_count = operand_mark;
+    }
+
+    compiler->temp_count = mark;
+    int destination = target_or_temp(compiler, target);
+
+    if (is_safe) {
+        emit(compiler, OPCODE_CONCAT, destination, base, (int) arrlen(operands));
+    } else if (destination != base) {
+        emit(compiler, OPCODE_MOVE, destination, base, 0);
+    }
+
+    return destination;
+}
+
+// Appends the operands of a concatenation after the variable it starts with
+// to its slot, when they can all be evaluated first
+static bool compile_append(struct function_compiler* compiler, struct expr** operands, int slot) {
+    for (size_t i = 1; i < arrlen(operands); i++) {
+        if (!is_concat_operand_safe(compiler, operands[i])) return false;
+    }
+
+    int base = compiler->temp_base + compiler->temp_count;
+
+    for (size_t i = 1; i < arrlen(operands); i++) {
+        compile_expr(compiler, operands[i], allocate_temp(compiler));
+    }
+
+    emit(compiler, OPCODE_APPEND, slot, base, (int) arrlen(operands) - 1);
+    return true;
+}
+
+// Expressions whose value is a boolean whenever their evaluation succeeds
+static bool is_boolean_expr(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+        case EXPR_MODULO_TEST:
+            return true;
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            return !is_arithmetic_binary_op(expr->op.binary.type);
+        case EXPR_UNARY_OPT:
+            return expr->op.unary.type == UNARY_OP_NOT;
+        case EXPR_LOOP_INVARIANT:
+            return is_boolean_expr(expr->op.loop_invariant.value);
+        default:
+            return false;
+    }
+}
+
+// The value of && and || is the operand which decided it, the rhs being only
+// evaluated, into the same register, when the lhs did not
+static int compile_logical_op(struct function_compiler* compiler, enum binary_op_type op_type, struct expr* lhs, struct expr* rhs, int target) {
+    int mark = compiler->temp_count;
+    int result = allocate_temp(compiler);
+
+    compile_expr(compiler, lhs, result);
+    size_t to_end = emit(compiler, op_type == BINARY_OP_AND ? OPCODE_JUMP_IF_FALSE : OPCODE_JUMP_IF_TRUE, result, -1, CONDITION_LOGICAL);
+
+    compile_expr(compiler, rhs, result);
+
+    if (!is_boolean_expr(rhs)) {
+        emit(compiler, OPCODE_CHECK_LOGICAL, result, 0, 0);
+    }
+
+    patch_jump(compiler, to_end, current_position(compiler));
+
+    if (target < 0) {
+        compiler->temp_count = mark + 1;
+        return result;
+    }
+
+    compiler->temp_count = mark;
+    emit(compiler, OPCODE_MOVE, target, result, 0);
+
+    return target;
+}
+
+// Arguments which can be evaluated before their callee is resolved
+static bool arguments_are_trivial(struct function_compiler* compiler, struct expr** arguments) {
+    FOR_EACH(struct expr*, it, arguments) {
+        struct expr* argument = *it;
+
+        if (argument->type == EXPR_VARIABLE_USE || argument->type == EXPR_INT_VARIABLE_USE) {
+            int symbol = intern_symbol(compiler->program, argument->op.variable_use.name);
+
+            if (resolve_variable(compiler, symbol).kind != ACCESS_LOCAL) return false;
+        } else if (argument->type != EXPR_BOOL_LITERAL && argument->type != EXPR_INT_LITERAL &&
+                   argument->type != EXPR_FLOAT_LITERAL && argument->type != EXPR_STRING_LITERAL &&
+                   argument->type != EXPR_NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void resolve_call_site(struct function_compiler* compiler, struct call_site* site) {
+    int slot = visible_slot(compiler->function_slots, site->symbol);
+
+    if (slot >= 0 && compiler->function_slots[slot].state == DECLARATION_DECLARED) {
+        site->resolution = CALL_DIRECT;
+        site->target = compiler->function_slots[slot].function_index;
+    } else if (slot < 0 && !compiler->is_main && compiler->program->global_function_slots[site->symbol] >= 0) {
+        site->resolution = CALL_GLOBAL;
+        site->target = compiler->program->global_function_slots[site->symbol];
+    } else {
+        site->resolution = CALL_DYNAMIC;
+    }
+}
+
+static int compile_function_call(struct function_compiler* compiler, const char* fn_name, struct expr** arguments, int target) {
+    int mark = compiler->temp_count;
+    builtin_fn_t builtin = is_builtin_fn(fn_name);
+
+    if (builtin == BUILTIN_FN_PRINT) {
+        // Each argument is printed as soon as it is evaluated
+        FOR_EACH(struct expr*, it, arguments) {
+            int value = compile_expr(compiler, *it, -1);
+            emit(compiler, OPCODE_PRINT, value, 0, 0);
+            compiler->temp_count = mark;
+        }
+
+        int destination = target_or_temp(compiler, target);
+        emit(compiler, OPCODE_PRINT_NEWLINE, destination, 0, 0);
+
+        return destination;
+    }
+
+    struct call_site site = {
+            .symbol = intern_symbol(compiler->program, fn_name),
+            .resolution = CALL_BUILTIN,
+            .target = -1,
+            .builtin = builtin,
+            .arguments = NULL,
+            .is_resolved_early = false,
+    };
+
+    // Nested calls add their own sites while the arguments are compiled
+    int site_index = (int) arrlen(compiler->function->call_sites);
+    arrpush(compiler->function->call_sites, site);
+
+    if (builtin != -1) {
+        if (!is_builtin_arity_valid(builtin, arrlen(arguments)))
+            emit(compiler, OPCODE_CHECK_BUILTIN, site_index, 0, 0);
+    } else {
+        resolve_call_site(compiler, &site);
+
+        bool may_fail = site.resolution != CALL_DIRECT ||
+                        arrlen(compiler->program->program->functions[site.target]->parameter_slots) != arrlen(arguments);
+
+        // The tree-walking interpreter looks the callee up first
+        if (may_fail && !arguments_are_trivial(compiler, arguments)) {
+            site.is_resolved_early = true;
+            emit(compiler, OPCODE_RESOLVE_FUNCTION, site_index, 0, 0);
+        }
+    }
+
+    for (size_t i = 0; i < arrlen(arguments); i++) {
+        int value = compile_expr(compiler, arguments[i], -1);
+
+        if (is_variable_slot(compiler, value)) {
+            for (size_t j = i + 1; j < arrlen(arguments); j++) {
+                if (expr_calls_functions(arguments[j])) {
+                    int copy = allocate_temp(compiler);
+                    emit(compiler, OPCODE_MOVE, copy, value, 0);
+                    value = copy;
+                    break;
+                }
+            }
+        }
+
+        arrpush(site.arguments, value);
+    }
+
+    compiler->temp_count = mark;
+    int destination = target_or_temp(compiler, target);
+
+    emit(compiler, builtin != -1 ? OPCODE_CALL_BUILTIN : OPCODE_CALL, destination, site_index, 0);
+    compiler->function->call_sites[site_index] = site;
+
+    return destination;
+}
+
+// Returns the register holding the value, which is target if given
+static int compile_expr(struct function_compiler* compiler, struct expr* expr, int target) {
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+        case EXPR_INT_LITERAL:
+        case EXPR_FLOAT_LITERAL:
+        case EXPR_STRING_LITERAL:
+        case EXPR_NULL: {
+            int destination = target_or_temp(compiler, target);
+            emit(compiler, OPCODE_LOAD_CONST, destination, add_literal_constant(compiler, expr), 0);
+            return destination;
+        }
+        // Nodes quickened by the tree-walking interpreter are compiled as the
+        // generic ones when the tiered engine compiles a running program
+        case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
+            return compile_variable_load(compiler, intern_symbol(compiler->program, expr->op.variable_use.name), target);
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            if (is_logical_binary_op(expr->op.binary.type))
+                return compile_logical_op(compiler, expr->op.binary.type, expr->op.binary.lhs, expr->op.binary.rhs, target);
+
+            return compile_binary_op(compiler, expr->op.binary.type, expr->op.binary.lhs, expr->op.binary.rhs, target);
+        case EXPR_UNARY_OPT: {
+            int mark = compiler->temp_count;
+            int arg = compile_expr(compiler, expr->op.unary.arg, -1);
+
+            compiler->temp_count = mark;
+            int destination = target_or_temp(compiler, target);
+
+            emit(compiler, expr->op.unary.type == UNARY_OP_NEG ? OPCODE_NEG : OPCODE_NOT, destination, arg, 0);
+            return destination;
+        }
+        case EXPR_FUNCTION_CALL:
+            return compile_function_call(compiler, expr->op.function_call.name, expr->op.function_call.arguments, target);
+        case EXPR_LOOP_INVARIANT:
+            // Registers make the recomputation cheap
+            return compile_expr(compiler, expr->op.loop_invariant.value, target);
+        case EXPR_CONCAT:
+            return compile_concat(compiler, expr->op.concat.operands, target);
+        case EXPR_VARIABLE_CONSTANT_OPT: {
+            int mark = compiler->temp_count;
+            int variable = compile_variable_load(compiler, intern_symbol(compiler->program, expr->op.variable_constant.name), -1);
+
+            compiler->temp_count = mark;
+            int destination = target_or_temp(compiler, target);
+
+            emit(compiler, binary_op_to_opcode(expr->op.variable_constant.type, true), destination, variable, add_integer_constant(compiler, expr->op.variable_constant.constant));
+            return destination;
+        }
+        case EXPR_MODULO_TEST: {
+            int mark = compiler->temp_count;
+            int variable = compile_variable_load(compiler, intern_symbol(compiler->program, expr->op.modulo_test.name), -1);
+
+            compiler->temp_count = mark;
+            int destination = target_or_temp(compiler, target);
+            enum opcode comparison = expr->op.modulo_test.is_equal ? OPCODE_EQUAL_IMM : OPCODE_NOT_EQUAL_IMM;
+
+            emit(compiler, OPCODE_MODULO_IMM, destination, variable, add_integer_constant(compiler, expr->op.modulo_test.modulus));
+            emit(compiler, comparison, destination, destination, add_integer_constant(compiler, expr->op.modulo_test.remainder));
+            return destination;
+        }
+        default:
+            fprintf(stderr, "ERROR: cannot compile expression\n");
+            abort();
+    }
+}
+
+static void compile_variable_declaration(struct function_compiler* compiler, struct statement* statement) {
+    char* variable_name = statement->op.variable_declaration.variable_name;
+    bool is_constant = statement->op.variable_declaration.is_constant;
+    int symbol = intern_symbol(compiler->program, variable_name);
+    int mark = compiler->temp_count;
+
+    // A declaration may not shadow a constant
+    int visible = visible_slot(compiler->slots, symbol);
+
+    if (visible >= 0 && compiler->slots[visible].state == DECLARATION_DECLARED) {
+        if (compiler->slots[visible].is_constant)
+            emit(compiler, OPCODE_CHECK_SHADOW, symbol, 0, 0);
+    } else if (is_ever_constant(&compiler->program->variables, variable_name)) {
+        emit(compiler, OPCODE_CHECK_SHADOW, symbol, 0, 0);
+    }
+
+    // The initializer still sees the previous declaration
+    int value = -1;
+
+    if (statement->op.variable_declaration.value != NULL)
+        value = compile_expr(compiler, statement->op.variable_declaration.value, -1);
+
+    int slot = scope_slot(compiler, &compiler->slots, symbol);
+
+    if (value < 0) {
+        emit(compiler, OPCODE_DECLARE_NULL, slot, 0, is_constant);
+    } else {
+        emit(compiler, OPCODE_DECLARE, slot, value, is_constant);
+    }
+
+    compiler->slots[slot].state = DECLARATION_DECLARED;
+    compiler->slots[slot].is_constant = is_constant;
+
+    compiler->temp_count = mark;
+}
+
+static void compile_variable_assignment(struct function_compiler* compiler, struct statement* statement) {
+    struct expr* value = statement->op.variable_assignment.value;
+    int symbol = intern_symbol(compiler->program, statement->op.variable_assignment.variable_name);
+    struct variable_access access = resolve_variable(compiler, symbol);
+    int mark = compiler->temp_count;
+
+    switch (access.kind) {
+        case ACCESS_LOCAL: {
+            if (compiler->slots[access.index].is_constant)
+                emit(compiler, OPCODE_CHECK_MUTABLE, access.index, 0, 0);
+
+            // A sum has the type of its lhs, so `variable = variable + value`
+            // is computed into the slot without checking the assignment. The
+            // VM then appends to a string held by no other register in place.
+            if (is_append_assignment(statement)) {
+                if (value->type == EXPR_CONCAT && compile_append(compiler, value->op.concat.operands, access.index)) break;
+
+                compile_expr(compiler, value, access.index);
+                break;
+            }
+
+            int new_value = compile_expr(compiler, value, -1);
+            emit(compiler, OPCODE_ASSIGN, access.index, new_value, 0);
+            break;
+        }
+        case ACCESS_GLOBAL: {
+            emit(compiler, OPCODE_CHECK_ASSIGN_GLOBAL, access.index, 0, 0);
+
+            int new_value = compile_expr(compiler, value, -1);
+            emit(compiler, OPCODE_STORE_GLOBAL, access.index, new_value, 0);
+            break;
+        }
+        case ACCESS_DYNAMIC: {
+            emit(compiler, OPCODE_CHECK_ASSIGN_NAME, symbol, 0, 0);
+
+            int new_value = compile_expr(compiler, value, -1);
+            emit(compiler, OPCODE_STORE_NAME, symbol, new_value, 0);
+            break;
+        }
+    }
+
+    compiler->temp_count = mark;
+}
+
+static void compile_variable_update(struct function_compiler* compiler, struct statement* statement) {
+    int symbol = intern_symbol(compiler->program, statement->op.variable_update.variable_name);
+    struct variable_access access = resolve_variable(compiler, symbol);
+    enum opcode opcode = binary_op_to_opcode(statement->op.variable_update.type, true);
+    int constant = add_integer_constant(compiler, statement->op.variable_update.constant);
+
+    if (access.kind == ACCESS_LOCAL) {
+        if (compiler->slots[access.index].is_constant)
+            emit(compiler, OPCODE_CHECK_MUTABLE, access.index, 0, 0);
+
+        // An integer operation keeps the type of an integer variable, any
+        // other type is rejected by the operation itself
+        emit(compiler, opcode, access.index, access.index, constant);
+        return;
+    }
+
+    int mark = compiler->temp_count;
+    int value = allocate_temp(compiler);
+
+    if (access.kind == ACCESS_GLOBAL) {
+        emit(compiler, OPCODE_CHECK_ASSIGN_GLOBAL, access.index, 0, 0);
+        emit(compiler, OPCODE_LOAD_GLOBAL, value, access.index, 0);
+        emit(compiler, opcode, value, value, constant);
+        emit(compiler, OPCODE_STORE_GLOBAL, access.index, value, 0);
+    } else {
+        emit(compiler, OPCODE_CHECK_ASSIGN_NAME, symbol, 0, 0);
+        emit(compiler, OPCODE_LOAD_NAME, value, symbol, 0);
+        emit(compiler, opcode, value, value, constant);
+        emit(compiler, OPCODE_STORE_NAME, symbol, value, 0);
+    }
+
+    compiler->temp_count = mark;
+}
+
+static void patch_jumps(struct function_compiler* compiler, size_t* jumps, int target) {
+    FOR_EACH(size_t, jump, jumps) {
+        patch_jump(compiler, *jump, target);
+    }
+}
+
+// Compiles jumps taken when a condition evaluates to jump_when, added to jumps
+// for the caller to patch, the code falling through otherwise. && and || and
+// their negations become chains of jumps on their operands, only the other
+// conditions being evaluated into a register and checked as check.
+static void compile_branch(struct function_compiler* compiler, struct expr* condition, bool jump_when, enum condition_check check, size_t** jumps) {
+    if (!is_branch_expr(condition)) {
+        int mark = compiler->temp_count;
+        int value = compile_expr(compiler, condition, -1);
+
+        compiler->temp_count = mark;
+        arrpush(*jumps, emit(compiler, jump_when ? OPCODE_JUMP_IF_TRUE : OPCODE_JUMP_IF_FALSE, value, -1, check));
+        return;
+    }
+
+    if (condition->type == EXPR_UNARY_OPT) {
+        compile_branch(compiler, condition->op.unary.arg, !jump_when, CONDITION_LOGICAL, jumps);
+        return;
+    }
+
+    // The lhs decides the result when it is false for && and true for ||
+    bool is_decided_when = condition->op.binary.type == BINARY_OP_OR;
+
+    if (is_decided_when == jump_when) {
+        compile_branch(compiler, condition->op.binary.lhs, jump_when, CONDITION_LOGICAL, jumps);
+        compile_branch(compiler, condition->op.binary.rhs, jump_when, CONDITION_LOGICAL, jumps);
+    } else {
+        size_t* to_end = NULL;
+
+        compile_branch(compiler, condition->op.binary.lhs, is_decided_when, CONDITION_LOGICAL, &to_end);
+        compile_branch(compiler, condition->op.binary.rhs, jump_when, CONDITION_LOGICAL, jumps);
+
+        patch_jumps(compiler, to_end, current_position(compiler));
+        arrfree(to_end);
+    }
+}
+
+// Branches sharing a scope don't see the declarations of each other, as only
+// one of them runs
+static void forget_branch_declarations(struct function_compiler* compiler, int first_slot, int first_function_slot) {
+    for (int i = first_slot; i < arrlen(compiler->slots); i++) {
+        compiler->slots[i].state = DECLARATION_UNDECLARED;
+    }
+
+    for (int i = first_function_slot; i < arrlen(compiler->function_slots); i++) {
+        compiler->function_slots[i].state = DECLARATION_UNDECLARED;
+    }
+}
+
+static void compile_if_condition(struct function_compiler* compiler, struct statement* statement, bool opens_scope) {
+    size_t* to_else = NULL;
+
+    compile_branch(compiler, statement->op.if_condition.condition, false, CONDITION_IF, &to_else);
+
+    if (opens_scope) open_scope(compiler);
+
+    int first_slot = (int) arrlen(compiler->slots);
+    int first_function_slot = (int) arrlen(compiler->function_slots);
+
+    compile_statement(compiler, statement->op.if_condition.body);
+
+    if (statement->op.if_condition.body_else != NULL) {
+        size_t to_end = emit(compiler, OPCODE_JUMP, -1, 0, 0);
+
+        forget_branch_declarations(compiler, first_slot, first_function_slot);
+
+        patch_jumps(compiler, to_else, current_position(compiler));
+        compile_statement(compiler, statement->op.if_condition.body_else);
+
+        patch_jump(compiler, to_end, current_position(compiler));
+    } else {
+        patch_jumps(compiler, to_else, current_position(compiler));
+    }
+
+    arrfree(to_else);
+
+    if (opens_scope) close_scope(compiler);
+}
+
+// The arms share the scope of the statement like the branches of an if
+static void compile_match(struct function_compiler* compiler, struct statement* statement) {
+    int mark = compiler->temp_count;
+    int value = compile_expr(compiler, statement->op.match.value, -1);
+
+    struct match_site site = {
+            .statement = statement,
+            .arm_targets = NULL,
+            .else_target = -1,
+    };
+
+    // Arms may contain other match statements, the site is filled in last
+    int site_index = (int) arrlen(compiler->function->match_sites);
+    arrpush(compiler->function->match_sites, site);
+
+    emit(compiler, OPCODE_MATCH, value, site_index, 0);
+    compiler->temp_count = mark;
+
+    open_scope(compiler);
+
+    int first_slot = (int) arrlen(compiler->slots);
+    int first_function_slot = (int) arrlen(compiler->function_slots);
+    size_t* to_end = NULL;
+
+    FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+        forget_branch_declarations(compiler, first_slot, first_function_slot);
+
+        arrpush(site.arm_targets, current_position(compiler));
+        compile_statement(compiler, *arm);
+        arrpush(to_end, emit(compiler, OPCODE_JUMP, -1, 0, 0));
+    }
+
+    forget_branch_declarations(compiler, first_slot, first_function_slot);
+
+    site.else_target = current_position(compiler);
+
+    if (statement->op.match.body_else != NULL)
+        compile_statement(compiler, statement->op.match.body_else);
+
+    patch_jumps(compiler, to_end, current_position(compiler));
+    arrfree(to_end);
+
+    compiler->function->match_sites[site_index] = site;
+
+    close_scope(compiler);
+}
+
+static void push_loop(struct function_compiler* compiler) {
+    struct loop_target loop = {
+            .scope_index = current_depth(compiler),
+            .break_jumps = NULL,
+            .continue_jumps = NULL,
+    };
+
+    arrpush(compiler->loops, loop);
+}
+
+static void patch_loop_jumps(struct function_compiler* compiler, size_t* jumps) {
+    patch_jumps(compiler, jumps, current_position(compiler));
+}
+
+// Jumps back to the start of the body of a loop while its condition holds
+static void compile_back_edge(struct function_compiler* compiler, struct expr* condition, int body_start) {
+    size_t* to_body = NULL;
+
+    compile_branch(compiler, condition, true, CONDITION_UNCHECKED, &to_body);
+    patch_jumps(compiler, to_body, body_start);
+
+    arrfree(to_body);
+}
+
+static void compile_while_loop(struct function_compiler* compiler, struct statement* statement) {
+    // The first condition is evaluated before the scope of the loop is opened
+    size_t* to_exit = NULL;
+
+    compile_branch(compiler, statement->op.while_loop.condition, false, CONDITION_WHILE, &to_exit);
+
+    open_scope(compiler);
+    push_loop(compiler);
+
+    // Declarations of the body are visible from the next iteration on
+    set_scope_declarations(compiler, statement->op.while_loop.body, DECLARATION_MAYBE);
+
+    int body_start = current_position(compiler);
+    compile_statement(compiler, statement->op.while_loop.body);
+    set_scope_declarations(compiler, statement->op.while_loop.body, DECLARATION_MAYBE);
+
+    struct loop_target loop = arrpop(compiler->loops);
+
+    patch_loop_jumps(compiler, loop.continue_jumps);
+    compile_back_edge(compiler, statement->op.while_loop.condition, body_start);
+
+    patch_loop_jumps(compiler, to_exit);
+    patch_loop_jumps(compiler, loop.break_jumps);
+
+    arrfree(to_exit);
+    arrfree(loop.break_jumps);
+    arrfree(loop.continue_jumps);
+
+    close_scope(compiler);
+}
+
+static void compile_for_loop(struct function_compiler* compiler, struct statement* statement) {
+    open_scope(compiler);
+
+    compile_statement(compiler, statement->op.for_loop.initializer);
+
+    push_loop(compiler);
+    set_scope_declarations(compiler, statement->op.for_loop.body, DECLARATION_MAYBE);
+
+    // Only the first condition is checked, as for while loops
+    size_t* to_exit = NULL;
+
+    compile_branch(compiler, statement->op.for_loop.condition, false, CONDITION_FOR, &to_exit);
+
+    int body_start = current_position(compiler);
+    compile_statement(compiler, statement->op.for_loop.body);
+    set_scope_declarations(compiler, statement->op.for_loop.body, DECLARATION_MAYBE);
+
+    struct loop_target loop = arrpop(compiler->loops);
+
+    patch_loop_jumps(compiler, loop.continue_jumps);
+
+    if (statement->op.for_loop.increment != NULL)
+        compile_statement(compiler, statement->op.for_loop.increment);
+
+    compile_back_edge(compiler, statement->op.for_loop.condition, body_start);
+
+    patch_loop_jumps(compiler, to_exit);
+    patch_loop_jumps(compiler, loop.break_jumps);
+
+    arrfree(to_exit);
+    arrfree(loop.break_jumps);
+    arrfree(loop.continue_jumps);
+
+    close_scope(compiler);
+}
+
+static void compile_statement(struct function_compiler* compiler, struct statement* statement) {
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                compile_statement(compiler, *it);
+            }
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            compile_variable_declaration(compiler, statement);
+            break;
+        case STATEMENT_FUNCTION_DECL: {
+            int symbol = intern_symbol(compiler->program, statement->op.function_declaration.fn_name);
+            int index = compile_function(compiler->program, statement->op.function_declaration.body, statement->op.function_declaration.arguments, symbol, false);
+            int slot = scope_slot(compiler, &compiler->function_slots, symbol);
+
+            emit(compiler, OPCODE_DECLARE_FUNCTION, slot, index, 0);
+
+            compiler->function_slots[slot].state = DECLARATION_DECLARED;
+            compiler->function_slots[slot].function_index = index;
+            break;
+        }
+        case STATEMENT_NAKED_FN_CALL: {
+            int mark = compiler->temp_count;
+            compile_expr(compiler, statement->op.naked_fn_call.function_call, -1);
+            compiler->temp_count = mark;
+            break;
+        }
+        case STATEMENT_VARIABLE_ASSIGN:
+            compile_variable_assignment(compiler, statement);
+            break;
+        case STATEMENT_VARIABLE_UPDATE:
+            compile_variable_update(compiler, statement);
+            break;
+        case STATEMENT_IF_CONDITION:
+            compile_if_condition(compiler, statement, true);
+            break;
+        case STATEMENT_SIMPLE_IF:
+            compile_if_condition(compiler, statement, false);
+            break;
+        case STATEMENT_MATCH:
+            compile_match(compiler, statement);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            compile_while_loop(compiler, statement);
+            break;
+        case STATEMENT_FOR_LOOP:
+            compile_for_loop(compiler, statement);
+            break;
+        case STATEMENT_BREAK: {
+            if (arrlen(compiler->loops) == 0) {
+                // Nothing runs after a break outside of a loop
+                emit(compiler, OPCODE_RETURN_NULL, 0, 0, 0);
+                break;
+            }
+
+            size_t jump = emit(compiler, OPCODE_JUMP, -1, 0, 0);
+            arrpush(arrlast(compiler->loops).break_jumps, jump);
+            break;
+        }
+        case STATEMENT_CONTINUE: {
+            if (arrlen(compiler->loops) == 0) {
+                emit(compiler, OPCODE_RETURN_NULL, 0, 0, 0);
+                break;
+            }
+
+            // Leave the scopes opened inside of the loop body
+            int inner_scope = arrlast(compiler->loops).scope_index + 1;
+
+            if (inner_scope < arrlen(compiler->scopes))
+                emit_kills(compiler, compiler->scopes[inner_scope].first_slot, compiler->scopes[inner_scope].first_function_slot);
+
+            size_t jump = emit(compiler, OPCODE_JUMP, -1, 0, 0);
+            arrpush(arrlast(compiler->loops).continue_jumps, jump);
+            break;
+        }
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL) {
+                int mark = compiler->temp_count;
+                int value = compile_expr(compiler, statement->op.return_statement.value, -1);
+
+                emit(compiler, OPCODE_RETURN, value, 0, 0);
+                compiler->temp_count = mark;
+            } else {
+                emit(compiler, OPCODE_RETURN_NULL, 0, 0, 0);
+            }
+            break;
+        default:
+            fprintf(stderr, "ERROR: cannot compile statement\n");
+            abort();
+    }
+}
+
+static int** slots_by_symbol(struct program_compiler* compiler, struct compiler_slot* slots) {
+    int** by_symbol = NULL;
+    int max_depth = 0;
+
+    for (size_t i = 0; i < arrlen(compiler->program->symbols); i++) {
+        arrpush(by_symbol, NULL);
+    }
+
+    FOR_EACH(struct compiler_slot, slot, slots) {
+        if (slot->depth > max_depth) max_depth = slot->depth;
+    }
+
+    // Innermost scopes first, so the first declared slot is the visible one
+    for (int depth = max_depth; depth >= 0; depth--) {
+        for (int i = 0; i < arrlen(slots); i++) {
+            if (slots[i].depth == depth)
+                arrpush(by_symbol[slots[i].symbol], i);
+        }
+    }
+
+    return by_symbol;
+}
+
+static int compile_function(struct program_compiler* compiler, struct statement* body, char** parameters, int symbol, bool is_main) {
+    struct bytecode_function* function = xcalloc(1, sizeof(struct bytecode_function));
+    function->symbol = symbol;
+    function->body = body;
+
+    int index = (int) arrlen(compiler->program->functions);
+    function->index = index;
+    arrpush(compiler->program->functions, function);
+
+    struct function_compiler function_compiler = {
+            .program = compiler,
+            .function = function,
+            .is_main = is_main,
+            .slots = NULL,
+            .function_slots = NULL,
+            .scopes = NULL,
+            .loops = NULL,
+            .temp_base = (int) arrlen(parameters) + count_variable_declarations(body),
+            .temp_count = 0,
+            .max_temp_count = 0,
+    };
+
+    open_scope(&function_compiler);
+
+    FOR_EACH(char*, parameter, parameters) {
+        int slot = scope_slot(&function_compiler, &function_compiler.slots, intern_symbol(compiler, *parameter));
+
+        function_compiler.slots[slot].state = DECLARATION_DECLARED;
+        arrpush(function->parameter_slots, slot);
+    }
+
+    if (is_main) {
+        // Names declared once in the main scope can be accessed from any
+        // function through their slot in the main frame
+        char** variables = NULL;
+        char** functions = NULL;
+
+        collect_scope_declarations(body, &variables, &functions);
+
+        FOR_EACH(char*, name, variables) {
+            int variable_symbol = intern_symbol(compiler, *name);
+            int slot = scope_slot(&function_compiler, &function_compiler.slots, variable_symbol);
+
+            if (is_global_declaration(&compiler->variables, *name))
+                compiler->global_slots[variable_symbol] = slot;
+        }
+
+        FOR_EACH(char*, name, functions) {
+            int function_symbol = intern_symbol(compiler, *name);
+            int slot = scope_slot(&function_compiler, &function_compiler.function_slots, function_symbol);
+
+            if (is_global_declaration(&compiler->functions, *name))
+                compiler->global_function_slots[function_symbol] = slot;
+        }
+
+        arrfree(variables);
+        arrfree(functions);
+    }
+
+    compile_statement(&function_compiler, body);
+    emit(&function_compiler, OPCODE_RETURN_NULL, 0, 0, 0);
+
+    // The outermost scope is released with the frame
+    (void) arrpop(function_compiler.scopes);
+
+    function->register_count = function_compiler.temp_base + function_compiler.max_temp_count;
+    function->function_slot_count = (int) arrlen(function_compiler.function_slots);
+
+    FOR_EACH(struct compiler_slot, slot, function_compiler.slots) {
+        arrpush(function->slot_symbols, slot->symbol);
+    }
+
+    function->slots_by_symbol = slots_by_symbol(compiler, function_compiler.slots);
+    function->function_slots_by_symbol = slots_by_symbol(compiler, function_compiler.function_slots);
+
+    arrfree(function_compiler.slots);
+    arrfree(function_compiler.function_slots);
+    arrfree(function_compiler.scopes);
+    arrfree(function_compiler.loops);
+
+    return index;
+}
+
+struct bytecode_program* compile_program(struct statement* program) {
+    struct program_compiler compiler = {
+            .program = xcalloc(1, sizeof(struct bytecode_program)),
+            .symbols = NULL,
+            .variables = NULL,
+            .functions = NULL,
+            .global_slots = NULL,
+            .global_function_slots = NULL,
+    };
+
+    scan_declarations(&compiler, program, true);
+    compile_function(&compiler, program, NULL, -1, true);
+
+    shfree(compiler.symbols);
+    shfree(compiler.variables);
+    shfree(compiler.functions);
+    arrfree(compiler.global_slots);
+    arrfree(compiler.global_function_slots);
+
+    return compiler.program;
+}
+
+size_t count_instructions(const struct bytecode_program* program) {
+    size_t count = 0;
+
+    FOR_EACH(struct bytecode_function*, it, program->functions) {
+        count += arrlen((*it)->code);
+    }
+
+    return count;
+}
+
+static void free_slots_by_symbol(int** by_symbol) {
+    FOR_EACH(int*, it, by_symbol) {
+        arrfree(*it);
+    }
+    arrfree(by_symbol);
+}
+
+void destroy_bytecode_program(struct bytecode_program* program) {
+    FOR_EACH(struct bytecode_function*, it, program->functions) {
+        struct bytecode_function* function = *it;
+
+        FOR_EACH(struct runtime_value, constant, function->constants) {
+            release_value(constant);
+        }
+
+        FOR_EACH(struct call_site, site, function->call_sites) {
+            arrfree(site->arguments);
+        }
+
+        FOR_EACH(struct match_site, site, function->match_sites) {
+            arrfree(site->arm_targets);
+        }
+
+        arrfree(function->code);
+        arrfree(function->constants);
+        arrfree(function->call_sites);
+        arrfree(function->match_sites);
+        arrfree(function->parameter_slots);
+        arrfree(function->slot_symbols);
+        free_slots_by_symbol(function->slots_by_symbol);
+        free_slots_by_symbol(function->function_slots_by_symbol);
+        free(function);
+    }
+
+    FOR_EACH(char*, symbol, program->symbols) {
+        free(*symbol);
+    }
+
+    arrfree(program->functions);
+    arrfree(program->symbols);
+    free(program);
+}
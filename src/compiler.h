@@ -0,0 +1,9 @@
+#ifndef CHAD_INTERPRETER_COMPILER_H
+#define CHAD_INTERPRETER_COMPILER_H
+
+#include "ast.h"
+#include "bytecode.h"
+
+struct bytecode_program* compile_program(struct statement* program);
+
+#endif
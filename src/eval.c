@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -9,11 +10,19 @@
 #endif
 
 
+#include "c_backend.h"
+#include "closure.h"
+#include "compiler.h"
 #include "interpreter.h"
 #include "lexer.h"
 #include "mem.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "pool.h"
+#include "tiering.h"
 #include "errors.h"
+#include "timing.h"
+#include "vm.h"
 
 #define STBDS_REALLOC(context,ptr,size) xrealloc(ptr, size)
 #define STBDS_FREE(context,ptr)         free(ptr)
@@ -46,30 +55,181 @@ void print_usage() {
     printf("  -h: print help\n");
     printf("  -v: print version\n");
     printf("  -a: dump AST\n");
+    printf("  -O<level>: optimization level from 0 to %d (default %d)\n", MAX_OPTIMIZATION_LEVEL, DEFAULT_OPTIMIZATION_LEVEL);
+    printf("  --time-passes: print the time spent in each compilation pass\n");
+    printf("  --alloc-stats: print the blocks allocated for strings once the program ends\n");
+    printf("  --emit-c <file>: translate the program to C instead of running it\n");
+    printf("  --build <file>: compile the program to an executable with the system C compiler\n");
+#ifdef HAVE_JIT
+    printf("  --engine=<name>: execution engine, 'tree', 'closure', 'tiered', 'vm' or 'jit' (default 'tree')\n");
+#else
+    printf("  --engine=<name>: execution engine, 'tree', 'closure', 'tiered' or 'vm' (default 'tree')\n");
+#endif
+    printf("  --closure-threshold=<n>: calls or loop iterations before the tiered engine compiles code to closures (default %d)\n", DEFAULT_CLOSURE_THRESHOLD);
+    printf("  --native-threshold=<n>: calls before a function is compiled to machine code (default %d)\n", DEFAULT_JIT_CALL_THRESHOLD);
+}
+
+enum engine {
+    // Tree-walking interpreter
+    ENGINE_TREE,
+    // Tree converted once into specialized closures
+    ENGINE_CLOSURE,
+    // Tree-walking interpreter moving warm code to closures and hot code to
+    // machine code
+    ENGINE_TIERED,
+    // Register-based virtual machine
+    ENGINE_VM,
+    // Virtual machine compiling hot functions to machine code
+    ENGINE_JIT,
+};
+
+static const struct {
+    const char* name;
+    enum engine engine;
+} engines[] = {
+        {"tree", ENGINE_TREE},
+        {"closure", ENGINE_CLOSURE},
+        {"tiered", ENGINE_TIERED},
+        {"vm", ENGINE_VM},
+#ifdef HAVE_JIT
+        {"jit", ENGINE_JIT},
+#endif
+};
+
+struct eval_options {
+    bool should_print_ast;
+    bool should_time_passes;
+    bool should_print_alloc_stats;
+    int optimization_level;
+    enum engine engine;
+    int closure_threshold;
+    int native_threshold;
+    // Set when the program is compiled ahead of time instead of run
+    const char* emit_c_path;
+    const char* build_path;
+};
+
+static bool parse_engine(const char* name, enum engine* engine) {
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(engines[i].name, name) == 0) {
+            *engine = engines[i].engine;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int parse_threshold(const char* option, const char* value) {
+    char* end;
+    long threshold = strtol(value, &end, 10);
+
+    if (*value == '\0' || *end != '\0' || threshold < 0 || threshold > INT_MAX) {
+        fprintf(stderr, "ERROR: invalid value '%s' for option '%s'\n", value, option);
+        print_usage();
+        exit(1);
+    }
+
+    return (int) threshold;
+}
+
+// getopt only handles short options, long ones are removed from argv first.
+// Returns the new argument count.
+static int parse_long_options(int argc, char** argv, struct eval_options* options) {
+    int kept = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--time-passes") == 0) {
+            options->should_time_passes = true;
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            options->should_print_alloc_stats = true;
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (!parse_engine(argv[i] + 9, &options->engine)) {
+                fprintf(stderr, "ERROR: unknown engine '%s'\n", argv[i] + 9);
+                print_usage();
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--closure-threshold=", 20) == 0) {
+            options->closure_threshold = parse_threshold("--closure-threshold", argv[i] + 20);
+        } else if (strncmp(argv[i], "--native-threshold=", 19) == 0) {
+            options->native_threshold = parse_threshold("--native-threshold", argv[i] + 19);
+        } else if (strcmp(argv[i], "--emit-c") == 0 || strcmp(argv[i], "--build") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERROR: option '%s' requires a file\n", argv[i]);
+                print_usage();
+                exit(1);
+            }
+
+            if (strcmp(argv[i], "--emit-c") == 0) {
+                options->emit_c_path = argv[++i];
+            } else {
+                options->build_path = argv[++i];
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0 && argv[i][2] != '\0') {
+            fprintf(stderr, "ERROR: unknown option '%s'\n", argv[i]);
+            print_usage();
+            exit(1);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+
+    argv[kept] = NULL;
+
+    return kept;
 }
 
 int main(int argc, char** argv) {
+    struct eval_options options = {
+            .should_print_ast = false,
+            .should_time_passes = false,
+            .should_print_alloc_stats = false,
+            .optimization_level = DEFAULT_OPTIMIZATION_LEVEL,
+            .engine = ENGINE_TREE,
+            .closure_threshold = DEFAULT_CLOSURE_THRESHOLD,
+            .native_threshold = DEFAULT_JIT_CALL_THRESHOLD,
+            .emit_c_path = NULL,
+            .build_path = NULL,
+    };
+
+    argc = parse_long_options(argc, argv, &options);
+
     if (argc < 2) {
         fprintf(stderr, "ERROR: no file specified\n");
         print_usage();
         return 1;
     }
 
-    bool should_print_ast = false;
-
     int opt;
 
-    while ((opt = getopt(argc, argv, ":hva")) != -1) {
+    while ((opt = getopt(argc, argv, ":hvaO:")) != -1) {
         switch (opt) {
             case 'a':
-                should_print_ast = true;
+                options.should_print_ast = true;
                 break;
+            case 'O': {
+                char* end;
+                long level = strtol(optarg, &end, 10);
+
+                if (*end != '\0' || level < 0 || level > MAX_OPTIMIZATION_LEVEL) {
+                    fprintf(stderr, "ERROR: invalid optimization level '%s'\n", optarg);
+                    print_usage();
+                    return 1;
+                }
+
+                options.optimization_level = (int) level;
+                break;
+            }
             case 'h':
                 print_usage();
                 return 0;
             case 'v':
                 printf("%s %s\n", APP_NAME, APP_VERSION);
                 return 0;
+            case ':':
+                fprintf(stderr, "ERROR: option '%c' requires a value\n", optopt);
+                print_usage();
+                return 1;
             case '?':
                 fprintf(stderr, "ERROR: unknown option '%c'\n", optopt);
                 print_usage();
@@ -79,18 +239,38 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (optind >= argc) {
+        fprintf(stderr, "ERROR: no file specified\n");
+        print_usage();
+        return 1;
+    }
+
     char* content = read_file_content(argv[optind]);
 
+    if (options.should_time_passes) {
+        fprintf(stderr, "--- Pass timing ---\n");
+    }
+
     // Lexing
+    double start = current_time_ms();
     struct token* tokens = tokenize(content);
     free(content);
     // print_tokens(tokens);
 
+    if (options.should_time_passes) {
+        print_pass_timing("lexer", current_time_ms() - start, "tokens", 0, arrlen(tokens));
+    }
+
     // Parsing
+    start = current_time_ms();
     struct parser parser;
     init_parser(&parser, tokens);
     struct statement* root = parse_block(&parser);
 
+    if (options.should_time_passes) {
+        print_pass_timing("parser", current_time_ms() - start, "nodes", 0, count_statement_nodes(root));
+    }
+
     FOR_EACH(struct token, token, tokens) {
         if (token->type == TOKEN_IDENTIFIER || token->type == TOKEN_STR_LITERAL) {
             free(token->value.str);
@@ -98,22 +278,121 @@ int main(int argc, char** argv) {
     }
     arrfree(tokens);
 
-    if (should_print_ast) {
+    // Optimization
+    optimize_program(root, options.optimization_level, options.should_time_passes);
+
+    bool is_ahead_of_time = options.emit_c_path != NULL || options.build_path != NULL;
+    bool is_bytecode_engine = !is_ahead_of_time && (options.engine == ENGINE_VM || options.engine == ENGINE_JIT);
+    struct bytecode_program* program = NULL;
+    struct closure_program* closures = NULL;
+    char* c_path = NULL;
+
+    if (is_ahead_of_time) {
+        start = current_time_ms();
+
+        // Without --emit-c, the C file is only kept until it is compiled
+        if (options.emit_c_path != NULL) {
+            c_path = xstrdup(options.emit_c_path);
+        } else {
+            c_path = xmalloc(strlen(options.build_path) + 3);
+            sprintf(c_path, "%s.c", options.build_path);
+        }
+
+        FILE* c_file = fopen(c_path, "w");
+
+        if (c_file == NULL) {
+            fprintf(stderr, "ERROR: cannot open file %s: %s\n", c_path, strerror(errno));
+            return 1;
+        }
+
+        size_t function_count = emit_c_program(root, argv[optind], c_file);
+        fclose(c_file);
+
+        if (options.should_time_passes) {
+            print_pass_timing("C backend", current_time_ms() - start, "functions", 0, function_count);
+        }
+    } else if (is_bytecode_engine) {
+        start = current_time_ms();
+        program = compile_program(root);
+
+        if (options.should_time_passes) {
+            print_pass_timing("bytecode compiler", current_time_ms() - start, "instructions", 0, count_instructions(program));
+        }
+    } else if (options.engine == ENGINE_CLOSURE) {
+        start = current_time_ms();
+        closures = build_closures(root);
+
+        if (options.should_time_passes) {
+            print_pass_timing("closure builder", current_time_ms() - start, "closures", 0, count_closures(closures));
+        }
+    }
+
+    if (options.should_time_passes) {
+        fprintf(stderr, "-------------------\n");
+    }
+
+    if (options.should_print_ast) {
         fprintf(stderr, "--- AST dump ---\n");
         dump_statement(root, 0);
         fprintf(stderr, "----------------\n");
     }
 
+    if (is_ahead_of_time) {
+        bool is_built = true;
+
+        if (options.build_path != NULL) {
+            is_built = build_c_program(c_path, options.build_path);
+
+            if (options.emit_c_path == NULL) {
+                remove(c_path);
+            }
+        }
+
+        free(c_path);
+        destroy_statement(root);
+
+        return is_built ? 0 : 1;
+    }
+
     // Runtime
-    struct context context;
-    init_context(&context);
+    if (is_bytecode_engine) {
+        struct vm_options vm_options = {
+                .is_jit_enabled = options.engine == ENGINE_JIT,
+                .jit_call_threshold = options.native_threshold,
+        };
+
+        run_bytecode_program(program, &vm_options);
+        destroy_bytecode_program(program);
+        destroy_statement(root);
+    } else if (options.engine == ENGINE_CLOSURE) {
+        run_closure_program(closures);
+        destroy_closure_program(closures);
+        destroy_statement(root);
+    } else if (options.engine == ENGINE_TIERED) {
+        struct tier_options tier_options = {
+                .closure_threshold = options.closure_threshold,
+                .native_threshold = options.native_threshold,
+        };
 
-    push_stack_frame(&context);
-    execute_statement(&context, root);
-    pop_stack_frame(&context);
+        run_tiered_program(root, &tier_options, options.should_time_passes);
+        destroy_statement(root);
+    } else {
+        struct context context;
+        init_context(&context);
 
-    destroy_statement(root);
-    destroy_context(&context);
+        push_stack_frame(&context);
+        execute_statement(&context, root);
+        pop_stack_frame(&context);
+
+        destroy_statement(root);
+        destroy_context(&context);
+    }
+
+    if (options.should_print_alloc_stats) {
+        fprintf(stderr, "--- Allocations ---\n");
+        print_pool_stats(stderr);
+        fprintf(stderr, "-------------------\n");
+    }
 
     return 0;
 }
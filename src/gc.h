@@ -1,7 +1,7 @@
 #ifndef CHAD_INTERPRETER_GC_H
 #define CHAD_INTERPRETER_GC_H
 
-#include "mem.h"
+#include "pool.h"
 
 struct ref_counted {
     int* reference_count;
@@ -10,7 +10,7 @@ struct ref_counted {
 
 static inline void init_ref_counted(struct ref_counted* rc, void* data) {
     rc->data = data;
-    rc->reference_count = xmalloc(sizeof(int));
+    rc->reference_count = pool_malloc(sizeof(int));
     *rc->reference_count = 0;
 }
 
@@ -4,23 +4,78 @@
 #include "mem.h"
 #include "stb_ds.h"
 #include "stb_extra.h"
+#include "str.h"
+#include "tiering.h"
 
 void init_context(struct context* context) {
     context->frames = NULL;
-    context->should_break_loop = false;
-    context->should_continue_loop = false;
-    context->should_return_fn = false;
+    context->variables = xmalloc(INITIAL_STACK_VARIABLES * sizeof(struct runtime_variable));
+    context->variable_count = 0;
+    context->variable_capacity = INITIAL_STACK_VARIABLES;
+    context->functions = NULL;
     context->recursion_depth = 0;
+    context->tiers = NULL;
 }
 
 static struct stack_frame* get_current_stack_frame(struct context* context) {
     return context->frames + arrlen(context->frames) - 1;
 }
 
+// Searches the variables from the top of the stack down to the given index
+static struct runtime_variable* find_variable(struct context* context, const char* variable_name, size_t base) {
+    for (size_t i = context->variable_count; i > base; i--) {
+        struct runtime_variable* variable = &context->variables[i - 1];
+
+        if (strcmp(variable->name, variable_name) == 0) return variable;
+    }
+
+    return NULL;
+}
+
+// Variables declared by the frame of the program
+static inline size_t get_global_variable_count(struct context* context) {
+    return arrlen(context->frames) > 1 ? context->frames[1].variable_base : context->variable_count;
+}
+
+static inline struct runtime_variable* find_slot_variable(struct context* context, const char* variable_name, struct variable_slot slot) {
+    if (slot.kind == SLOT_LOCAL) {
+        const struct stack_frame* frame = context->frames + arrlen(context->frames) - 1 - slot.depth;
+        return &context->variables[frame->variable_base + slot.index];
+    }
+
+    // Until the program declares it, the lookup by name reports the variable
+    // as missing
+    if (slot.kind == SLOT_GLOBAL && (size_t) slot.index < get_global_variable_count(context))
+        return &context->variables[slot.index];
+
+    return find_variable(context, variable_name, 0);
+}
+
+// Makes room for count more variables on the stack
+static void reserve_variables(struct context* context, size_t count) {
+    if (context->variable_count + count <= context->variable_capacity) return;
+
+    while (context->variable_count + count > context->variable_capacity) {
+        context->variable_capacity *= 2;
+    }
+
+    context->variables = xrealloc(context->variables, context->variable_capacity * sizeof(struct runtime_variable));
+}
+
+static struct runtime_function* find_function(struct context* context, const char* fn_name, size_t base, size_t top) {
+    for (size_t i = top; i > base; i--) {
+        struct runtime_function* function = &context->functions[i - 1];
+
+        if (strcmp(function->name, fn_name) == 0) return function;
+    }
+
+    return NULL;
+}
+
 void print_value(const struct runtime_value* value) {
     switch (value->type) {
         case RUNTIME_TYPE_STRING:
-            printf("%s", value->value.string.data ? (char*) value->value.string.data : "(empty)");
+            fwrite(get_string_data(value), 1, get_string_length(value), stdout);
             break;
         case RUNTIME_TYPE_INTEGER:
             printf("%ld", value->value.integer);
@@ -39,54 +94,157 @@ void print_value(const struct runtime_value* value) {
 
 void destroy_value(const struct runtime_value* value) {
     // Destroy the content if no reference are held anymore
-    if (value->type == RUNTIME_TYPE_STRING && *value->value.string.reference_count <= 0) {
-        free(value->value.string.data);
-        free(value->value.string.reference_count);
+    if (is_counted_string(value) && *value->value.string.reference_count <= 0) {
+        free_string(value->value.string);
     }
 }
 
 void destroy_context(struct context* context) {
-    for (int i = 0; i < arrlen(context->frames); i++) {
+    while (arrlen(context->frames) > 0) {
         pop_stack_frame(context);
     }
     arrfree(context->frames);
+    arrfree(context->functions);
+    free(context->variables);
 }
 
 void push_stack_frame(struct context* context) {
     struct stack_frame frame = {
-            .variables = NULL,
-            .functions = NULL,
+            .variable_base = context->variable_count,
+            .function_base = arrlen(context->functions),
     };
 
     arrpush(context->frames, frame);
 }
 
 void pop_stack_frame(struct context* context) {
-    struct stack_frame* frame = get_current_stack_frame(context);
+    struct stack_frame frame = arrpop(context->frames);
     // Free variables
-    for (size_t i = 0; i < shlen(frame->variables); i++) {
-        const struct runtime_variable_entry entry = frame->variables[i];
-        free(entry.value.name);
+    for (size_t i = frame.variable_base; i < context->variable_count; i++) {
+        release_value(&context->variables[i].content);
+    }
+    context->variable_count = frame.variable_base;
+    // Functions are freed during AST destruction
+    arrsetlen(context->functions, frame.function_base);
+}
 
-        if (entry.value.content.type == RUNTIME_TYPE_STRING)
-            (*entry.value.content.value.string.reference_count)--;
+void release_loop_invariants(struct expr** invariants) {
+    FOR_EACH(struct expr*, it, invariants) {
+        struct expr* invariant = *it;
 
-        destroy_value(&entry.value.content);
+        if (!invariant->op.loop_invariant.is_cached) continue;
+
+        struct runtime_value* cached_value = invariant->op.loop_invariant.cached_value;
+
+        release_value(cached_value);
+        invariant->op.loop_invariant.is_cached = false;
     }
-    shfree(frame->variables);
-    // Functions are freed during AST destruction
-    shfree(frame->functions);
-    (void)arrpop(context->frames);
 }
 
-void execute_statement(struct context* context, struct statement* statement) {
+static inline bool counted_loop_continues(enum binary_op_type op_type, long counter, long bound) {
+    switch (op_type) {
+        case BINARY_OP_LESS:
+            return counter < bound;
+        case BINARY_OP_LESS_EQUAL:
+            return counter <= bound;
+        case BINARY_OP_GREATER:
+            return counter > bound;
+        case BINARY_OP_GREATER_EQUAL:
+            return counter >= bound;
+        default:
+            return false;
+    }
+}
+
+// Runs a loop marked as counted by the optimizer with a native counter, the
+// bound is evaluated once and the counter is only copied into its variable.
+// Returns false without running anything if the counter or bound are not integers.
+// The loop may be replaced once iteration_count reaches osr_iteration. The
+// completion of the last iteration is stored in completion.
+static bool execute_counted_loop(struct context* context, struct statement* statement, long* iteration_count, long osr_iteration, enum completion* completion) {
+    struct expr* condition = statement->op.for_loop.condition;
+    struct statement* initializer = statement->op.for_loop.initializer;
+
+    struct runtime_variable* counter_variable = find_slot_variable(context, initializer->op.variable_declaration.variable_name, initializer->op.variable_declaration.slot);
+
+    if (counter_variable->content.type != RUNTIME_TYPE_INTEGER)
+        return false;
+
+    // The body may grow the stack
+    size_t counter_index = counter_variable - context->variables;
+
+    struct runtime_value bound = evaluate_expr(context, condition->op.binary.rhs);
+
+    if (bound.type != RUNTIME_TYPE_INTEGER) {
+        destroy_value(&bound);
+        return false;
+    }
+
+    enum binary_op_type op_type = condition->op.binary.type;
+    long step = statement->op.for_loop.counted_step;
+    long counter = counter_variable->content.value.integer;
+
+    for (; counted_loop_continues(op_type, counter, bound.value.integer); counter += step) {
+        context->variables[counter_index].content.value.integer = counter;
+
+        *completion = execute_statement(context, statement->op.for_loop.body);
+        (*iteration_count)++;
+
+        if (is_loop_exit(*completion)) break;
+
+        if (*iteration_count == osr_iteration && replace_counted_loop(context->tiers, context, statement, &counter, bound.value.integer, &osr_iteration, completion))
+            return true;
+    }
+
+    context->variables[counter_index].content.value.integer = counter;
+
+    return true;
+}
+
+// Evaluates && and || with short-circuit, and negations of them, without
+// building a runtime value for the intermediate results
+static bool evaluate_branch(struct context* context, struct expr* expr) {
+    if (!is_branch_expr(expr)) {
+        return get_logical_operand(evaluate_expr(context, expr));
+    }
+
+    if (expr->type == EXPR_UNARY_OPT) {
+        return !evaluate_branch(context, expr->op.unary.arg);
+    }
+
+    bool lhs = evaluate_branch(context, expr->op.binary.lhs);
+
+    if (expr->op.binary.type == BINARY_OP_AND ? !lhs : lhs) {
+        return lhs;
+    }
+
+    return evaluate_branch(context, expr->op.binary.rhs);
+}
+
+// The condition of an if, while or for statement must be a boolean, a NULL
+// statement name skips the check
+static bool evaluate_condition(struct context* context, struct expr* expr, const char* statement_name) {
+    if (is_branch_expr(expr)) {
+        return evaluate_branch(context, expr);
+    }
+
+    struct runtime_value condition = evaluate_expr(context, expr);
+
+    if (statement_name != NULL && condition.type != RUNTIME_TYPE_BOOLEAN) {
+        panic("ERROR: found a value of type %s in a %s condition\n", runtime_type_to_string(condition.type), statement_name);
+    }
+
+    return condition.value.boolean;
+}
+
+enum completion execute_statement(struct context* context, struct statement* statement) {
     switch (statement->type) {
         case STATEMENT_BLOCK: {
             FOR_EACH(struct statement*, it, statement->op.block.statements) {
-                execute_statement(context, *it);
+                enum completion completion = execute_statement(context, *it);
 
-                if (context->should_break_loop || context->should_continue_loop || context->should_return_fn)
-                    break;
+                if (completion != COMPLETION_NORMAL)
+                    return completion;
             }
             break;
         }
@@ -95,7 +253,7 @@ void execute_statement(struct context* context, struct statement* statement) {
             break;
         }
         case STATEMENT_FUNCTION_DECL:
-            shput(get_current_stack_frame(context)->functions, statement->op.function_declaration.fn_name, statement);
+            declare_function(context, statement);
             break;
         case STATEMENT_NAKED_FN_CALL: {
             struct runtime_value discarded_return_value = evaluate_expr(context, statement->op.naked_fn_call.function_call);
@@ -108,93 +266,196 @@ void execute_statement(struct context* context, struct statement* statement) {
             break;
         }
         case STATEMENT_IF_CONDITION: {
-            struct runtime_value condition = evaluate_expr(context, statement->op.if_condition.condition);
-
-            if (condition.type != RUNTIME_TYPE_BOOLEAN) {
-                panic("ERROR: found a value of type %s in a if condition\n", runtime_type_to_string(condition.type));
-            }
+            bool condition = evaluate_condition(context, statement->op.if_condition.condition, "if");
 
             struct statement* body = statement->op.if_condition.body;
             struct statement* body_else = statement->op.if_condition.body_else;
+            enum completion completion = COMPLETION_NORMAL;
 
             push_stack_frame(context);
-            if (condition.value.boolean) {
-                execute_statement(context, body);
+            if (condition) {
+                completion = execute_statement(context, body);
             } else if (body_else != NULL) {
-                execute_statement(context, body_else);
+                completion = execute_statement(context, body_else);
             }
             pop_stack_frame(context);
-            break;
+            return completion;
         }
         case STATEMENT_WHILE_LOOP: {
-            struct runtime_value condition = evaluate_expr(context, statement->op.while_loop.condition);
+            long iteration_count = 0;
+            // Never reached without tiers
+            long osr_iteration = -1;
+            enum completion completion = COMPLETION_NORMAL;
 
-            if (condition.type != RUNTIME_TYPE_BOOLEAN) {
-                panic("ERROR: found a value of type %s in a while condition\n", runtime_type_to_string(condition.type));
-            }
+            if (context->tiers != NULL && execute_tiered_loop(context->tiers, context, statement, &osr_iteration, &completion))
+                return completion;
 
+            // The condition is always evaluated in the frame of the loop, empty
+            // the first time
             push_stack_frame(context);
-            while (condition.value.boolean) {
-                execute_statement(context, statement->op.while_loop.body);
+            bool condition = evaluate_condition(context, statement->op.while_loop.condition, "while");
+
+            while (condition) {
+                completion = execute_statement(context, statement->op.while_loop.body);
+                iteration_count++;
+
+                if (is_loop_exit(completion)) break;
 
-                if (context->should_break_loop) {
-                    context->should_break_loop = false;
+                if (iteration_count == osr_iteration && replace_loop(context->tiers, context, statement, &osr_iteration, &completion))
                     break;
-                } else if (context->should_continue_loop) {
-                    context->should_continue_loop = false;
-                }
 
-                condition = evaluate_expr(context, statement->op.while_loop.condition);
+                condition = evaluate_condition(context, statement->op.while_loop.condition, NULL);
             }
+            release_loop_invariants(statement->op.while_loop.invariants);
             pop_stack_frame(context);
-            break;
+
+            if (context->tiers != NULL) {
+                record_loop_iterations(context->tiers, statement, iteration_count);
+            }
+            return get_loop_completion(completion);
         }
         case STATEMENT_FOR_LOOP: {
+            long iteration_count = 0;
+            // Never reached without tiers
+            long osr_iteration = -1;
+            enum completion completion = COMPLETION_NORMAL;
+
+            if (context->tiers != NULL && execute_tiered_loop(context->tiers, context, statement, &osr_iteration, &completion))
+                return completion;
+
             push_stack_frame(context);
-            for (execute_statement(context, statement->op.for_loop.initializer);
-                evaluate_expr(context, statement->op.for_loop.condition).value.boolean;
-                execute_statement(context, statement->op.for_loop.increment)) {
+            execute_statement(context, statement->op.for_loop.initializer);
 
-                execute_statement(context, statement->op.for_loop.body);
+            if (!statement->op.for_loop.is_counted || !execute_counted_loop(context, statement, &iteration_count, osr_iteration, &completion)) {
+                bool condition = evaluate_condition(context, statement->op.for_loop.condition, "for");
 
-                if (context->should_break_loop) {
-                    context->should_break_loop = false;
-                    break;
-                } else if (context->should_continue_loop) {
-                    context->should_continue_loop = false;
+                while (condition) {
+                    completion = execute_statement(context, statement->op.for_loop.body);
+                    iteration_count++;
+
+                    if (is_loop_exit(completion)) break;
+
+                    if (iteration_count == osr_iteration && replace_loop(context->tiers, context, statement, &osr_iteration, &completion))
+                        break;
+
+                    execute_statement(context, statement->op.for_loop.increment);
+                    condition = evaluate_condition(context, statement->op.for_loop.condition, NULL);
                 }
             }
 
+            release_loop_invariants(statement->op.for_loop.invariants);
             pop_stack_frame(context);
+
+            if (context->tiers != NULL) {
+                record_loop_iterations(context->tiers, statement, iteration_count);
+            }
+            return get_loop_completion(completion);
+        }
+        case STATEMENT_VARIABLE_UPDATE: {
+            char* variable_name = statement->op.variable_update.variable_name;
+            struct runtime_variable* variable = find_slot_variable(context, variable_name, statement->op.variable_update.slot);
+
+            if (variable == NULL) {
+                panic("ERROR: cannot find variable '%s'\n", variable_name);
+            }
+
+            if (variable->is_constant) {
+                panic("ERROR: variable '%s' is constant\n", variable_name);
+            }
+
+            if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+                variable->content = apply_integer_op(statement->op.variable_update.type, variable->content.value.integer, statement->op.variable_update.constant);
+            } else {
+                // Any other type mixed with an integer is an error, let the
+                // generic path report it
+                struct runtime_value constant = {
+                        .type = RUNTIME_TYPE_INTEGER,
+                        .value.integer = statement->op.variable_update.constant,
+                };
+
+                apply_binary_op(statement->op.variable_update.type, variable->content, constant);
+            }
             break;
         }
-        case STATEMENT_BREAK:
-            context->should_break_loop = true;
+        case STATEMENT_SIMPLE_IF: {
+            bool condition = evaluate_condition(context, statement->op.if_condition.condition, "if");
+
+            if (condition) {
+                return execute_statement(context, statement->op.if_condition.body);
+            } else if (statement->op.if_condition.body_else != NULL) {
+                return execute_statement(context, statement->op.if_condition.body_else);
+            }
             break;
+        }
+        case STATEMENT_MATCH: {
+            struct runtime_value value = evaluate_expr(context, statement->op.match.value);
+            int arm = select_match_arm(statement, value);
+
+            destroy_value(&value);
+
+            struct statement* body = arm >= 0 ? statement->op.match.arms[arm] : statement->op.match.body_else;
+
+            if (body == NULL) break;
+
+            push_stack_frame(context);
+            enum completion completion = execute_statement(context, body);
+            pop_stack_frame(context);
+
+            return completion;
+        }
+        case STATEMENT_BREAK:
+            return COMPLETION_BREAK;
         case STATEMENT_CONTINUE:
-            context->should_continue_loop = true;
-            break;
-        case STATEMENT_RETURN:
+            return COMPLETION_CONTINUE;
+        case STATEMENT_RETURN: {
+            struct runtime_value return_value = {
+                    .type = RUNTIME_TYPE_NULL,
+            };
+
             if (statement->op.return_statement.value != NULL) {
-                struct runtime_value return_value = evaluate_expr(context, statement->op.return_statement.value);
+                return_value = evaluate_expr(context, statement->op.return_statement.value);
 
-                context->has_return_value = true;
-                context->return_value = return_value;
+                // Kept alive while the frames of the function are popped
+                retain_value(&return_value);
             }
-            context->should_return_fn = true;
-            break;
+
+            context->return_value = return_value;
+            return COMPLETION_RETURN;
+        }
         default:
             fprintf(stderr, "ERROR: cannot execute statement\n");
             abort();
     }
+
+    return COMPLETION_NORMAL;
+}
+
+// What an append assignment adds to the string of its variable
+static struct runtime_value evaluate_suffix(struct context* context, struct expr* value, const struct runtime_value* string) {
+    if (value->type != EXPR_CONCAT) return evaluate_expr(context, value->op.binary.rhs);
+
+    // Operands after the string of the variable, at least two in a chain
+    struct expr** operands = value->op.concat.operands + 1;
+    size_t count = arrlen(value->op.concat.operands) - 1;
+    struct runtime_value values[MAX_CONCAT_OPERANDS];
+
+    values[0] = evaluate_expr(context, operands[0]);
+    retain_value(&values[0]);
+    check_concat_operand(string, &values[0]);
+
+    for (size_t i = 1; i < count; i++) {
+        values[i] = evaluate_expr(context, operands[i]);
+        retain_value(&values[i]);
+        check_concat_operand(string, &values[i]);
+    }
+
+    return apply_held_concat(values, count);
 }
 
 void execute_variable_assignment(struct context* context, struct statement* statement) {
     char* variable_name = statement->op.variable_assignment.variable_name;
 
-    int stack_index;
-
-    const struct runtime_variable* old_variable = get_variable(context, variable_name, &stack_index);
+    struct runtime_variable* old_variable = find_slot_variable(context, variable_name, statement->op.variable_assignment.slot);
 
     if (old_variable == NULL) {
         panic("ERROR: cannot find variable '%s'\n", variable_name);
@@ -204,89 +465,252 @@ void execute_variable_assignment(struct context* context, struct statement* stat
         panic("ERROR: variable '%s' is constant\n", variable_name);
     }
 
-    struct runtime_value new_content = evaluate_expr(context, statement->op.variable_assignment.value);
+    // The variable stays at its index while the value is evaluated, but the
+    // stack may grow
+    size_t index = old_variable - context->variables;
+    struct runtime_value new_content;
+    // Previous string of a variable assigned by the suffix of an append
+    struct runtime_value held = {
+            .type = RUNTIME_TYPE_NULL,
+    };
 
-    if (old_variable->content.type != new_content.type) {
-        panic("ERROR: cannot assign value of type %s to variable '%s' of type %s\n", runtime_type_to_string(new_content.type), variable_name, runtime_type_to_string(old_variable->content.type));
+    if (old_variable->content.type == RUNTIME_TYPE_STRING && is_append_assignment(statement)) {
+        struct runtime_value lhs_value = old_variable->content;
+
+        // Held while the suffix is evaluated, which may assign the variable
+        retain_value(&lhs_value);
+        struct runtime_value suffix = evaluate_suffix(context, statement->op.variable_assignment.value, &lhs_value);
+
+        old_variable = &context->variables[index];
+
+        // Unless the suffix assigned the variable, its string is extended
+        // in place when the variable is the only one holding it
+        if (is_same_string(&old_variable->content, &lhs_value)) {
+            release_value(&lhs_value);
+
+            if (append_string(&old_variable->content, &suffix)) {
+                destroy_value(&suffix);
+                return;
+            }
+        } else {
+            held = lhs_value;
+        }
+
+        new_content = apply_binary_op(BINARY_OP_ADD, lhs_value, suffix);
+    } else {
+        new_content = evaluate_expr(context, statement->op.variable_assignment.value);
+        old_variable = &context->variables[index];
     }
 
-    // Increment reference count if value content is reference-counted
-    if (new_content.type == RUNTIME_TYPE_STRING) {
-        (*new_content.value.string.reference_count)++;
+    if (old_variable->content.type != new_content.type) {
+        panic("ERROR: cannot assign value of type %s to variable '%s' of type %s\n", runtime_type_to_string(new_content.type), variable_name, runtime_type_to_string(old_variable->content.type));
     }
 
-    struct runtime_variable variable = {
-            .name = old_variable->name,
-            .content = new_content,
-            .is_constant = false,
-    };
+    // The new content is retained first, it may hold the old one
+    retain_value(&new_content);
+    release_value(&old_variable->content);
+    release_value(&held);
 
-    shput(context->frames[stack_index].variables, variable.name, variable);
+    old_variable->content = new_content;
 }
 
 void execute_variable_declaration(struct context* context, struct statement* statement) {
     char* variable_name = statement->op.variable_declaration.variable_name;
 
     // Check if this declaration is shadowing a constant variable
-    const struct runtime_variable* old_variable = get_variable(context, variable_name, NULL);
+    if (statement->op.variable_declaration.can_shadow_constant) {
+        const struct runtime_variable* old_variable = get_variable(context, variable_name);
 
-    if (old_variable != NULL && old_variable->is_constant == true) {
-        panic("ERROR: declaration of '%s' is shadowing a constant variable\n", variable_name);
+        if (old_variable != NULL && old_variable->is_constant == true) {
+            panic("ERROR: declaration of '%s' is shadowing a constant variable\n", variable_name);
+        }
     }
 
-    struct runtime_variable variable = {
-            .name = xstrdup(variable_name),
-            .is_constant = statement->op.variable_declaration.is_constant,
+    struct runtime_value content = {
+            .type = RUNTIME_TYPE_NULL,
     };
 
-    if (statement->op.variable_declaration.value == NULL) {
-        variable.content.type = RUNTIME_TYPE_NULL;
+    if (statement->op.variable_declaration.value != NULL) {
+        content = evaluate_expr(context, statement->op.variable_declaration.value);
+    }
+
+    declare_slot_variable(context, variable_name, statement->op.variable_declaration.slot, statement->op.variable_declaration.is_constant, content);
+}
+
+void declare_variable(struct context* context, const char* variable_name, bool is_constant, struct runtime_value content) {
+    declare_slot_variable(context, variable_name, UNRESOLVED_SLOT, is_constant, content);
+}
+
+void declare_slot_variable(struct context* context, const char* variable_name, struct variable_slot slot, bool is_constant, struct runtime_value content) {
+    size_t base = get_current_stack_frame(context)->variable_base;
+    struct runtime_variable* variable;
+
+    // A resolved slot is either the variable declared there by a previous
+    // run of the declaration or the next one of the frame
+    if (slot.kind == SLOT_LOCAL) {
+        variable = base + slot.index < context->variable_count ? &context->variables[base + slot.index] : NULL;
     } else {
-        struct runtime_value value = evaluate_expr(context, statement->op.variable_declaration.value);
+        variable = find_variable(context, variable_name, base);
+    }
+
+    retain_value(&content);
 
-        variable.content = value;
+    if (variable != NULL) {
+        release_value(&variable->content);
+    } else {
+        reserve_variables(context, 1);
+
+        variable = &context->variables[context->variable_count++];
+        variable->name = variable_name;
     }
 
-    // Increment reference count if value content is reference-counted
-    if (variable.content.type == RUNTIME_TYPE_STRING) {
-        (*variable.content.value.string.reference_count)++;
+    variable->is_constant = is_constant;
+    variable->content = content;
+}
+
+void declare_function(struct context* context, struct statement* function) {
+    char* fn_name = function->op.function_declaration.fn_name;
+    struct runtime_function* declared = find_function(context, fn_name, get_current_stack_frame(context)->function_base, arrlen(context->functions));
+
+    if (declared != NULL) {
+        declared->statement = function;
+        return;
     }
 
-    shput(get_current_stack_frame(context)->variables, variable.name, variable);
+    struct runtime_function declaration = {
+            .name = fn_name,
+            .statement = function,
+    };
+
+    arrpush(context->functions, declaration);
+}
+
+const struct runtime_variable* get_variable(struct context* context, const char* variable_name) {
+    return find_variable(context, variable_name, 0);
 }
 
-const struct runtime_variable* get_variable(struct context* context, const char* variable_name, int* stack_index) {
-    int i = arrlen(context->frames) - 1;
+struct runtime_variable* get_mutable_variable(struct context* context, const char* variable_name) {
+    return find_variable(context, variable_name, 0);
+}
 
-    REVERSE_FOR_EACH(struct stack_frame, it, context->frames) {
-        const struct runtime_variable_entry* entry = shgetp_null(it->variables, variable_name);
+struct runtime_variable* get_slot_variable(struct context* context, const char* variable_name, struct variable_slot slot) {
+    return find_slot_variable(context, variable_name, slot);
+}
 
-        if (entry != NULL) {
-            if (stack_index != NULL) *stack_index = i;
-            return &entry->value;
-        }
+const struct statement* get_function(struct context* context, const char* fn_name) {
+    const struct runtime_function* function = find_function(context, fn_name, 0, arrlen(context->functions));
+
+    return function != NULL ? function->statement : NULL;
+}
+
+const struct statement* get_global_function(struct context* context, const char* fn_name) {
+    size_t top = arrlen(context->frames) > 1 ? context->frames[1].function_base : arrlen(context->functions);
+    const struct runtime_function* function = find_function(context, fn_name, 0, top);
+
+    return function != NULL ? function->statement : NULL;
+}
+
+// Rewrites a generic binary operation into the variant for the operand types
+// seen on its first run, if there is one
+static void quicken_binary_op(struct expr* expr, enum runtime_type lhs_type, enum runtime_type rhs_type) {
+    enum binary_op_type op_type = expr->op.binary.type;
 
-        i--;
+    if (lhs_type == RUNTIME_TYPE_INTEGER && rhs_type == RUNTIME_TYPE_INTEGER && !is_logical_binary_op(op_type)) {
+        expr->type = EXPR_INT_BINARY_OPT;
+    } else if (lhs_type == RUNTIME_TYPE_STRING && rhs_type == RUNTIME_TYPE_STRING && (op_type == BINARY_OP_ADD || is_comparison_binary_op(op_type))) {
+        expr->type = EXPR_STRING_BINARY_OPT;
     }
+}
 
-    return NULL;
+// Called when the guard of a quickened variant fails
+static void deoptimize_binary_op(struct expr* expr) {
+    expr->type = EXPR_BINARY_OPT;
+    expr->op.binary.is_polymorphic = true;
 }
 
-const struct statement* get_function(struct context* context, const char* fn_name, int* stack_index) {
-    int i = arrlen(context->frames) - 1;
+// Integer literals and variables are read without going through evaluate_expr,
+// other operands may be of any type and are checked by the caller
+static inline struct runtime_value evaluate_integer_operand(struct context* context, struct expr* expr) {
+    if (expr->type == EXPR_INT_LITERAL) {
+        struct runtime_value value = {
+                .type = RUNTIME_TYPE_INTEGER,
+                .value.integer = expr->op.integer_literal,
+        };
+
+        return value;
+    }
 
-    REVERSE_FOR_EACH(struct stack_frame, it, context->frames) {
-        const struct function_entry* entry = shgetp_null(it->functions, fn_name);
+    if (expr->type == EXPR_INT_VARIABLE_USE) {
+        const struct runtime_variable* variable = find_slot_variable(context, expr->op.variable_use.name, expr->op.variable_use.slot);
 
-        if (entry != NULL) {
-            if (stack_index != NULL) *stack_index = i;
-            return entry->value;
+        if (variable != NULL && variable->content.type == RUNTIME_TYPE_INTEGER) {
+            return variable->content;
         }
+    }
+
+    return evaluate_expr(context, expr);
+}
 
-        i--;
+// Equality does not order the strings, it tells most of them apart from
+// their lengths or hashes alone
+static bool compare_string_values(enum binary_op_type op_type, const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    switch (op_type) {
+        case BINARY_OP_EQUAL:
+            return is_equal_string(lhs, rhs);
+        case BINARY_OP_NOT_EQUAL:
+            return !is_equal_string(lhs, rhs);
+        case BINARY_OP_GREATER:
+            return compare_strings(lhs, rhs) > 0;
+        case BINARY_OP_GREATER_EQUAL:
+            return compare_strings(lhs, rhs) >= 0;
+        case BINARY_OP_LESS:
+            return compare_strings(lhs, rhs) < 0;
+        case BINARY_OP_LESS_EQUAL:
+            return compare_strings(lhs, rhs) <= 0;
+        default:
+            return false;
     }
+}
 
-    return NULL;
+// String concatenation and comparisons, for EXPR_STRING_BINARY_OPT
+static struct runtime_value apply_string_op(enum binary_op_type op_type, struct runtime_value lhs_value, struct runtime_value rhs_value) {
+    struct runtime_value result_value;
+
+    if (op_type == BINARY_OP_ADD) {
+        result_value = concat_strings(&lhs_value, &rhs_value);
+    } else {
+        result_value.type = RUNTIME_TYPE_BOOLEAN;
+        result_value.value.boolean = compare_string_values(op_type, &lhs_value, &rhs_value);
+    }
+
+    destroy_value(&lhs_value);
+    destroy_value(&rhs_value);
+
+    return result_value;
+}
+
+// Runs EXPR_INT_BINARY_OPT, the node goes back to the generic one when an
+// operand is not an integer
+static struct runtime_value evaluate_int_binary_op(struct context* context, struct expr* expr) {
+    enum binary_op_type op_type = expr->op.binary.type;
+    struct runtime_value lhs_value = evaluate_integer_operand(context, expr->op.binary.lhs);
+    // Held while rhs is evaluated, which may assign the variable lhs was
+    // read from
+    retain_value(&lhs_value);
+    struct runtime_value rhs_value = evaluate_integer_operand(context, expr->op.binary.rhs);
+
+    if (lhs_value.type == RUNTIME_TYPE_INTEGER && rhs_value.type == RUNTIME_TYPE_INTEGER) {
+        bool is_division = op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO;
+
+        // Divisions by zero are reported by the generic path
+        if (!is_division || rhs_value.value.integer != 0) {
+            return apply_integer_op(op_type, lhs_value.value.integer, rhs_value.value.integer);
+        }
+    } else {
+        deoptimize_binary_op(expr);
+    }
+
+    return apply_held_op(op_type, lhs_value, rhs_value);
 }
 
 struct runtime_value evaluate_expr(struct context* context, struct expr* expr) {
@@ -313,13 +737,7 @@ struct runtime_value evaluate_expr(struct context* context, struct expr* expr) {
             return value;
         }
         case EXPR_STRING_LITERAL: {
-            struct runtime_value value = {
-                    .type = RUNTIME_TYPE_STRING,
-            };
-
-            init_ref_counted(&value.value.string, xstrdup(expr->op.string_literal));
-
-            return value;
+            return copy_string_value(expr->op.string_literal);
         }
         case EXPR_NULL: {
             struct runtime_value value = {
@@ -331,21 +749,156 @@ struct runtime_value evaluate_expr(struct context* context, struct expr* expr) {
         case EXPR_VARIABLE_USE: {
             char* variable_name = expr->op.variable_use.name;
 
-            const struct runtime_variable* variable = get_variable(context, variable_name, NULL);
+            const struct runtime_variable* variable = find_slot_variable(context, variable_name, expr->op.variable_use.slot);
 
             if (variable == NULL) {
                 panic("ERROR: cannot find variable '%s'\n", variable_name);
             }
 
+            if (variable->content.type == RUNTIME_TYPE_INTEGER && !expr->op.variable_use.is_polymorphic) {
+                expr->type = EXPR_INT_VARIABLE_USE;
+            }
+
+            return variable->content;
+        }
+        case EXPR_INT_VARIABLE_USE: {
+            char* variable_name = expr->op.variable_use.name;
+
+            const struct runtime_variable* variable = find_slot_variable(context, variable_name, expr->op.variable_use.slot);
+
+            if (variable == NULL) {
+                panic("ERROR: cannot find variable '%s'\n", variable_name);
+            }
+
+            if (variable->content.type != RUNTIME_TYPE_INTEGER) {
+                expr->type = EXPR_VARIABLE_USE;
+                expr->op.variable_use.is_polymorphic = true;
+            }
+
             return variable->content;
         }
         case EXPR_FUNCTION_CALL: {
             return evaluate_function_call(context, expr->op.function_call.name, expr->op.function_call.arguments);
         }
-        case EXPR_BINARY_OPT:
-            return evaluate_binary_op(context, expr->op.binary.type, expr->op.binary.lhs, expr->op.binary.rhs);
+        case EXPR_BINARY_OPT: {
+            if (is_logical_binary_op(expr->op.binary.type)) {
+                struct runtime_value value = {
+                        .type = RUNTIME_TYPE_BOOLEAN,
+                        .value.boolean = evaluate_branch(context, expr),
+                };
+
+                return value;
+            }
+
+            struct runtime_value lhs_value = evaluate_expr(context, expr->op.binary.lhs);
+            retain_value(&lhs_value);
+            struct runtime_value rhs_value = evaluate_expr(context, expr->op.binary.rhs);
+
+            if (!expr->op.binary.is_polymorphic) {
+                quicken_binary_op(expr, lhs_value.type, rhs_value.type);
+            }
+
+            return apply_held_op(expr->op.binary.type, lhs_value, rhs_value);
+        }
+        case EXPR_INT_BINARY_OPT:
+            return evaluate_int_binary_op(context, expr);
+        case EXPR_STRING_BINARY_OPT: {
+            struct runtime_value lhs_value = evaluate_expr(context, expr->op.binary.lhs);
+            retain_value(&lhs_value);
+            struct runtime_value rhs_value = evaluate_expr(context, expr->op.binary.rhs);
+
+            if (lhs_value.type == RUNTIME_TYPE_STRING && rhs_value.type == RUNTIME_TYPE_STRING) {
+                struct runtime_value result_value = apply_string_op(expr->op.binary.type, lhs_value, rhs_value);
+
+                release_value(&lhs_value);
+
+                return result_value;
+            }
+
+            deoptimize_binary_op(expr);
+
+            return apply_held_op(expr->op.binary.type, lhs_value, rhs_value);
+        }
         case EXPR_UNARY_OPT:
             return evaluate_unary_op(context, expr->op.unary.type, expr->op.unary.arg);
+        case EXPR_CONCAT: {
+            struct expr** operands = expr->op.concat.operands;
+            struct runtime_value values[MAX_CONCAT_OPERANDS];
+
+            values[0] = evaluate_expr(context, operands[0]);
+            retain_value(&values[0]);
+
+            for (int i = 1; i < arrlen(operands); i++) {
+                values[i] = evaluate_expr(context, operands[i]);
+                retain_value(&values[i]);
+                check_concat_operand(&values[0], &values[i]);
+            }
+
+            return apply_held_concat(values, arrlen(operands));
+        }
+        case EXPR_LOOP_INVARIANT: {
+            struct runtime_value* cached_value = expr->op.loop_invariant.cached_value;
+
+            if (!expr->op.loop_invariant.is_cached) {
+                if (cached_value == NULL) {
+                    cached_value = xmalloc(sizeof(struct runtime_value));
+                    expr->op.loop_invariant.cached_value = cached_value;
+                }
+
+                *cached_value = evaluate_expr(context, expr->op.loop_invariant.value);
+
+                // Keep the value alive until the loop releases it
+                retain_value(cached_value);
+
+                expr->op.loop_invariant.is_cached = true;
+            }
+
+            return *cached_value;
+        }
+        case EXPR_VARIABLE_CONSTANT_OPT: {
+            char* variable_name = expr->op.variable_constant.name;
+            const struct runtime_variable* variable = find_slot_variable(context, variable_name, expr->op.variable_constant.slot);
+
+            if (variable == NULL) {
+                panic("ERROR: cannot find variable '%s'\n", variable_name);
+            }
+
+            if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+                return apply_integer_op(expr->op.variable_constant.type, variable->content.value.integer, expr->op.variable_constant.constant);
+            }
+
+            struct runtime_value constant = {
+                    .type = RUNTIME_TYPE_INTEGER,
+                    .value.integer = expr->op.variable_constant.constant,
+            };
+
+            return apply_binary_op(expr->op.variable_constant.type, variable->content, constant);
+        }
+        case EXPR_MODULO_TEST: {
+            char* variable_name = expr->op.modulo_test.name;
+            const struct runtime_variable* variable = find_slot_variable(context, variable_name, expr->op.modulo_test.slot);
+
+            if (variable == NULL) {
+                panic("ERROR: cannot find variable '%s'\n", variable_name);
+            }
+
+            struct runtime_value modulo = {
+                    .type = RUNTIME_TYPE_INTEGER,
+                    .value.integer = expr->op.modulo_test.modulus,
+            };
+            struct runtime_value remainder = {
+                    .type = RUNTIME_TYPE_INTEGER,
+                    .value.integer = expr->op.modulo_test.remainder,
+            };
+            enum binary_op_type comparison = expr->op.modulo_test.is_equal ? BINARY_OP_EQUAL : BINARY_OP_NOT_EQUAL;
+
+            if (variable->content.type == RUNTIME_TYPE_INTEGER) {
+                long value = variable->content.value.integer % modulo.value.integer;
+                return apply_integer_op(comparison, value, remainder.value.integer);
+            }
+
+            return apply_binary_op(comparison, apply_binary_op(BINARY_OP_MODULO, variable->content, modulo), remainder);
+        }
         default:
             fprintf(stderr, "ERROR: cannot evaluate expression\n");
             abort();
@@ -354,8 +907,23 @@ struct runtime_value evaluate_expr(struct context* context, struct expr* expr) {
 
 struct runtime_value evaluate_binary_op(struct context* context, enum binary_op_type op_type, struct expr* lhs, struct expr* rhs) {
     struct runtime_value lhs_value = evaluate_expr(context, lhs);
+    // Held while rhs is evaluated, which may assign the variable lhs was
+    // read from
+    retain_value(&lhs_value);
     struct runtime_value rhs_value = evaluate_expr(context, rhs);
 
+    return apply_held_op(op_type, lhs_value, rhs_value);
+}
+
+struct runtime_value apply_held_op(enum binary_op_type op_type, struct runtime_value lhs_value, struct runtime_value rhs_value) {
+    struct runtime_value result_value = apply_binary_op(op_type, lhs_value, rhs_value);
+
+    release_value(&lhs_value);
+
+    return result_value;
+}
+
+struct runtime_value apply_binary_op(enum binary_op_type op_type, struct runtime_value lhs_value, struct runtime_value rhs_value) {
     if (lhs_value.type != rhs_value.type) {
         panic("ERROR: type mismatch between %s and %s\n", runtime_type_to_string(lhs_value.type), runtime_type_to_string(rhs_value.type));
     }
@@ -367,15 +935,7 @@ struct runtime_value evaluate_binary_op(struct context* context, enum binary_op_
     if (is_arithmetic_binary_op(op_type)) {
         if (op_type == BINARY_OP_ADD && value_type == RUNTIME_TYPE_STRING) {
             // String concat
-            size_t new_size = strlen(lhs_value.value.string.data) + strlen(rhs_value.value.string.data) + 1;
-            char* buffer = xmalloc(new_size);
-            memset(buffer, 0, new_size);
-            strcat(buffer, lhs_value.value.string.data);
-            strcat(buffer, rhs_value.value.string.data);
-
-            result_value.type = RUNTIME_TYPE_STRING;
-
-            init_ref_counted(&result_value.value.string, buffer);
+            result_value = concat_strings(&lhs_value, &rhs_value);
         } else if (value_type == RUNTIME_TYPE_INTEGER) {
             // Arithmetic operations with integers
             result_value.type = RUNTIME_TYPE_INTEGER;
@@ -451,11 +1011,7 @@ struct runtime_value evaluate_binary_op(struct context* context, enum binary_op_
         result_value.type = RUNTIME_TYPE_BOOLEAN;
 
         if (value_type == RUNTIME_TYPE_STRING) {
-            // String comparison
-            int cmp_result = strcmp(lhs_value.value.string.data, rhs_value.value.string.data);
-
-            result_value.type = RUNTIME_TYPE_BOOLEAN;
-            result_value.value.integer = cmp_result == 0;
+            result_value.value.boolean = compare_string_values(op_type, &lhs_value, &rhs_value);
         } else if (value_type == RUNTIME_TYPE_INTEGER) {
             // Comparison operations with integers
             switch (op_type) {
@@ -518,9 +1074,79 @@ struct runtime_value evaluate_binary_op(struct context* context, enum binary_op_
     return result_value;
 }
 
+void check_concat_operand(const struct runtime_value* first, const struct runtime_value* operand) {
+    // Fails as adding them does, the sum of values of another type than
+    // strings has the type of the first one
+    if (first->type != RUNTIME_TYPE_STRING || operand->type != RUNTIME_TYPE_STRING) {
+        apply_binary_op(BINARY_OP_ADD, *first, *operand);
+    }
+}
+
+struct runtime_value apply_held_concat(const struct runtime_value* values, size_t count) {
+    struct runtime_value result = apply_concat(&values[0], values + 1, count - 1);
+
+    for (size_t i = 0; i < count; i++) {
+        release_value(&values[i]);
+    }
+
+    return result;
+}
+
+struct runtime_value apply_concat(const struct runtime_value* first, const struct runtime_value* rest, size_t count) {
+    if (first->type != RUNTIME_TYPE_STRING) {
+        // Reports the error of the first addition that fails
+        struct runtime_value result = *first;
+
+        for (size_t i = 0; i < count; i++) {
+            result = apply_binary_op(BINARY_OP_ADD, result, rest[i]);
+        }
+
+        return result;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        check_concat_operand(first, &rest[i]);
+    }
+
+    struct runtime_value result = concat_string_values(first, rest, count);
+
+    destroy_value(first);
+    for (size_t i = 0; i < count; i++) {
+        destroy_value(&rest[i]);
+    }
+
+    return result;
+}
+
+int select_match_arm(const struct statement* match, struct runtime_value value) {
+    enum runtime_type constant_type = is_string_match(match) ? RUNTIME_TYPE_STRING : RUNTIME_TYPE_INTEGER;
+
+    if (value.type != constant_type) {
+        panic("ERROR: type mismatch between %s and %s\n", runtime_type_to_string(value.type), runtime_type_to_string(constant_type));
+    }
+
+    if (constant_type == RUNTIME_TYPE_STRING) {
+        return find_match_string_arm(match, get_string_chars(&value));
+    }
+
+    return find_match_integer_arm(match, value.value.integer);
+}
+
+bool get_logical_operand(struct runtime_value value) {
+    if (value.type != RUNTIME_TYPE_BOOLEAN) {
+        panic("ERROR: cannot use logical operator on type %s\n", runtime_type_to_string(value.type));
+    }
+
+    return value.value.boolean;
+}
+
 struct runtime_value evaluate_unary_op(struct context* context, enum unary_op_type op_type, struct expr* arg) {
     struct runtime_value arg_value = evaluate_expr(context, arg);
 
+    return apply_unary_op(op_type, arg_value);
+}
+
+struct runtime_value apply_unary_op(enum unary_op_type op_type, struct runtime_value arg_value) {
     struct runtime_value result_value;
 
     if (op_type == UNARY_OP_NOT) {
@@ -560,15 +1186,12 @@ struct runtime_value evaluate_unary_op(struct context* context, enum unary_op_ty
 }
 
 struct runtime_value evaluate_function_call(struct context* context, const char* fn_name, struct expr** arguments) {
-    struct runtime_value return_value = {
-            .type = RUNTIME_TYPE_NULL};
-
     builtin_fn_t fn_type;
     if ((fn_type = is_builtin_fn(fn_name)) != -1) {
         return execute_builtin(context, fn_type, arguments);
     }
 
-    const struct statement* fn = get_function(context, fn_name, NULL);
+    const struct statement* fn = get_function(context, fn_name);
 
     if (fn == NULL) {
         panic("ERROR: cannot find function %s\n", fn_name);
@@ -584,49 +1207,73 @@ struct runtime_value evaluate_function_call(struct context* context, const char*
     push_stack_frame(context);
 
     // Evaluate arguments
-    struct runtime_value* evaluated_arguments = NULL;
-    arrsetcap(evaluated_arguments, fn_call_argument_size);
+    size_t parameters = reserve_parameters(context, fn_call_argument_size);
 
-    FOR_EACH(struct expr*, arg_value, arguments)  {
-        struct runtime_value value = evaluate_expr(context, *arg_value);
-        arrpush(evaluated_arguments, value);
+    for (size_t i = 0; i < fn_call_argument_size; i++) {
+        set_parameter(context, parameters + i, evaluate_expr(context, arguments[i]));
     }
 
-    // Inject arguments values into stack frame
-    for (size_t i = 0; i < arrlen(evaluated_arguments); i++) {
-        struct runtime_value value = evaluated_arguments[i];
-        if (value.type == RUNTIME_TYPE_STRING) {
-            (*value.value.string.reference_count)++;
-        }
-        struct runtime_variable variable = {
-                .name = xstrdup(fn->op.function_declaration.arguments[i]),
-                .is_constant = false,
-                .content = value,
-        };
-        shput(get_current_stack_frame(context)->variables, variable.name, variable);
+    if (context->tiers != NULL) {
+        return call_tiered_function(context->tiers, context, fn, parameters);
     }
 
-    arrfree(evaluated_arguments);
+    enter_function(context, fn, parameters);
+
+    enum completion completion = execute_statement(context, fn->op.function_declaration.body);
+
+    return leave_function(context, completion);
+}
+
+size_t reserve_parameters(struct context* context, size_t count) {
+    reserve_variables(context, count);
+
+    size_t parameters = context->variable_count;
+
+    for (size_t i = parameters; i < parameters + count; i++) {
+        // Matches no variable name
+        context->variables[i].name = "";
+        context->variables[i].is_constant = false;
+        context->variables[i].content.type = RUNTIME_TYPE_NULL;
+    }
+
+    context->variable_count += count;
+
+    return parameters;
+}
+
+void set_parameter(struct context* context, size_t parameter, struct runtime_value value) {
+    retain_value(&value);
+    context->variables[parameter].content = value;
+}
+
+void enter_function(struct context* context, const struct statement* fn, size_t parameters) {
+    for (size_t i = 0; i < arrlen(fn->op.function_declaration.arguments); i++) {
+        context->variables[parameters + i].name = fn->op.function_declaration.arguments[i];
+    }
 
     context->recursion_depth++;
 
     if (context->recursion_depth >= MAX_RECURSION_DEPTH) {
         panic("ERROR: max recursion depth exceeded\n");
     }
+}
 
-    execute_statement(context, fn->op.function_declaration.body);
-    context->recursion_depth--;
+struct runtime_value leave_function(struct context* context, enum completion completion) {
+    struct runtime_value return_value = {
+            .type = RUNTIME_TYPE_NULL};
 
-    if (context->should_return_fn) {
-        context->should_return_fn = false;
+    context->recursion_depth--;
 
-        if (context->has_return_value) {
-            return_value = context->return_value;
-            context->has_return_value = false;
-        }
+    if (completion == COMPLETION_RETURN) {
+        return_value = context->return_value;
     }
 
     pop_stack_frame(context);
+
+    // Handed to the caller like any other result, once no frame holds it
+    if (is_counted_string(&return_value))
+        (*return_value.value.string.reference_count)--;
+
     return return_value;
 }
 
@@ -7,16 +7,26 @@
 #include "gc.h"
 
 static const int MAX_RECURSION_DEPTH = 1000;
+// Variables the stack holds before it first grows
+static const size_t INITIAL_STACK_VARIABLES = 256;
 
 enum runtime_type {
 #define CHAD_INTERPRETER_RUNTIME_TYPE(A, B) RUNTIME_TYPE_##A,
 #include "runtime_types.h"
 };
 
+// Strings up to this length are stored in the value, allocating nothing
+#define MAX_SHORT_STRING_LENGTH 15
+
 struct runtime_value {
     enum runtime_type type;
+    // Only meaningful for strings, set when one is stored in short_string
+    bool is_short;
+    unsigned char short_length;
     union {
         struct ref_counted string;
+        // NUL-terminated
+        char short_string[MAX_SHORT_STRING_LENGTH + 1];
         long integer;
         bool boolean;
         double floating;
@@ -24,34 +34,60 @@ struct runtime_value {
 };
 
 struct runtime_variable {
-    char* name;
+    // Name in the declaration, not copied since the program outlives its frames
+    const char* name;
     bool is_constant;
     struct runtime_value content;
 };
 
-struct runtime_variable_entry {
-    char* key;
-    struct runtime_variable value;
+struct runtime_function {
+    char* name;
+    struct statement* statement;
 };
 
-struct function_entry {
-    char* key;
-    struct statement* value;
+// Window of the variable and function stacks of the context, the variables
+// and functions declared by a frame following those of the frames below it
+struct stack_frame {
+    size_t variable_base;
+    size_t function_base;
 };
 
-struct stack_frame {
-    struct runtime_variable_entry* variables;
-    struct function_entry* functions;
+// How the execution of a statement ends, the body of a loop or function
+// handing it to the statement running it
+enum completion {
+    COMPLETION_NORMAL,
+    COMPLETION_BREAK,
+    COMPLETION_CONTINUE,
+    // The value returned is left in the return_value of the context
+    COMPLETION_RETURN,
 };
 
+// Whether a loop stops after an iteration of its body ending this way
+static inline bool is_loop_exit(enum completion completion) {
+    return completion == COMPLETION_BREAK || completion == COMPLETION_RETURN;
+}
+
+// Completion of a loop once its last iteration ended this way, breaks and
+// continues not going past the loop
+static inline enum completion get_loop_completion(enum completion completion) {
+    return completion == COMPLETION_RETURN ? COMPLETION_RETURN : COMPLETION_NORMAL;
+}
+
+struct tier_manager;
+
 struct context {
     struct stack_frame* frames;
-    bool should_break_loop;
-    bool should_continue_loop;
-    bool should_return_fn;
-    bool has_return_value;
+    // Grown when full, so a variable is referred to by index rather than by
+    // pointer while code that may declare others runs
+    struct runtime_variable* variables;
+    size_t variable_count;
+    size_t variable_capacity;
+    struct runtime_function* functions;
+    // Set by a return statement, retained until its function is left
     struct runtime_value return_value;
     int recursion_depth;
+    // Set when functions and loops move between tiers, see tiering.h
+    struct tier_manager* tiers;
 };
 
 void init_context(struct context* context);
@@ -63,18 +99,143 @@ void pop_stack_frame(struct context* context);
 void print_value(const struct runtime_value* value);
 void destroy_value(const struct runtime_value* value);
 
-const struct runtime_variable* get_variable(struct context* context, const char* variable_name, int* stack_index);
-const struct statement* get_function(struct context* context, const char* fn_name, int* stack_index);
-
-void execute_statement(struct context* context, struct statement* statement);
+// Short strings are copied with the values holding them instead
+static inline bool is_counted_string(const struct runtime_value* value) {
+    return value->type == RUNTIME_TYPE_STRING && !value->is_short;
+}
+
+// Taken by the variables, registers and rope nodes holding a string
+static inline void retain_value(const struct runtime_value* value) {
+    if (is_counted_string(value))
+        (*value->value.string.reference_count)++;
+}
+
+static inline void release_value(const struct runtime_value* value) {
+    if (is_counted_string(value)) {
+        (*value->value.string.reference_count)--;
+        destroy_value(value);
+    }
+}
+
+// Variables and functions are scoped dynamically, the one found is the last
+// declared with that name by the frames on the stack
+const struct runtime_variable* get_variable(struct context* context, const char* variable_name);
+struct runtime_variable* get_mutable_variable(struct context* context, const char* variable_name);
+// Same as get_mutable_variable, going straight to the variable when the
+// optimizer resolved its slot
+struct runtime_variable* get_slot_variable(struct context* context, const char* variable_name, struct variable_slot slot);
+const struct statement* get_function(struct context* context, const char* fn_name);
+// Function declared with that name by the bottom frame
+const struct statement* get_global_function(struct context* context, const char* fn_name);
+
+// Declares a variable in the current frame, replacing the one declared there
+// with the same name if any. The content is retained.
+void declare_variable(struct context* context, const char* variable_name, bool is_constant, struct runtime_value content);
+// Same as declare_variable, for a declaration whose slot the optimizer resolved
+void declare_slot_variable(struct context* context, const char* variable_name, struct variable_slot slot, bool is_constant, struct runtime_value content);
+void declare_function(struct context* context, struct statement* function);
+
+enum completion execute_statement(struct context* context, struct statement* statement);
 void execute_variable_declaration(struct context* context, struct statement* statement);
 void execute_variable_assignment(struct context* context, struct statement* statement);
 
+// Releases the values cached by the invariants of a loop that exits
+void release_loop_invariants(struct expr** invariants);
+
 struct runtime_value evaluate_expr(struct context* context, struct expr* expr);
 struct runtime_value evaluate_binary_op(struct context*, enum binary_op_type op_type, struct expr* lhs, struct expr* rhs);
+struct runtime_value apply_binary_op(enum binary_op_type op_type, struct runtime_value lhs_value, struct runtime_value rhs_value);
+// Same as apply_binary_op, then releases lhs, retained while rhs was evaluated
+// since that may assign the variable lhs was read from
+struct runtime_value apply_held_op(enum binary_op_type op_type, struct runtime_value lhs_value, struct runtime_value rhs_value);
+// Operands of a fused concatenation have the type of its first one, as they
+// would when added one at a time
+void check_concat_operand(const struct runtime_value* first, const struct runtime_value* operand);
+// Adds count values after first, into a single string when it is one
+struct runtime_value apply_concat(const struct runtime_value* first, const struct runtime_value* rest, size_t count);
+// Same as apply_concat of the count values, then releases them, retained
+// while the next ones were evaluated
+struct runtime_value apply_held_concat(const struct runtime_value* values, size_t count);
 struct runtime_value evaluate_unary_op(struct context*, enum unary_op_type op_type, struct expr* arg);
+struct runtime_value apply_unary_op(enum unary_op_type op_type, struct runtime_value arg_value);
 struct runtime_value evaluate_function_call(struct context* context, const char* fn_name, struct expr** arguments);
 
+// Index of the arm of a match statement selected by a value, -1 for its else
+// branch. A value of another type than the constants is an error, as when
+// comparing it with them.
+int select_match_arm(const struct statement* match, struct runtime_value value);
+
+// Reads an operand of && or ||. Each operand is checked on its own since the
+// rhs is only evaluated when the lhs does not decide the result.
+bool get_logical_operand(struct runtime_value value);
+
+// Reserves the variables of the parameters of a call in the frame pushed for
+// it, its arguments being evaluated into their contents. They are named by
+// enter_function once all are, so that the arguments see the variables of
+// the caller rather than the parameters. Returns the index of the first one.
+size_t reserve_parameters(struct context* context, size_t count);
+// Stores the value of an argument, once evaluated, into its parameter
+void set_parameter(struct context* context, size_t parameter, struct runtime_value value);
+// Names the parameters of a call once its arguments are evaluated
+void enter_function(struct context* context, const struct statement* fn, size_t parameters);
+// Pops the frame of a call once its body ran with the given completion,
+// returns its return value. A break or continue outside of a loop ends the
+// function like a return without a value.
+struct runtime_value leave_function(struct context* context, enum completion completion);
+
+// Integer fast path of apply_binary_op, never used for logical operators nor
+// a division or modulo by zero
+static inline struct runtime_value apply_integer_op(enum binary_op_type op_type, long lhs, long rhs) {
+    struct runtime_value result = {
+            .type = RUNTIME_TYPE_BOOLEAN,
+    };
+
+    switch (op_type) {
+        case BINARY_OP_ADD:
+            result.type = RUNTIME_TYPE_INTEGER;
+            result.value.integer = lhs + rhs;
+            break;
+        case BINARY_OP_SUB:
+            result.type = RUNTIME_TYPE_INTEGER;
+            result.value.integer = lhs - rhs;
+            break;
+        case BINARY_OP_MUL:
+            result.type = RUNTIME_TYPE_INTEGER;
+            result.value.integer = lhs * rhs;
+            break;
+        case BINARY_OP_DIV:
+            result.type = RUNTIME_TYPE_INTEGER;
+            result.value.integer = lhs / rhs;
+            break;
+        case BINARY_OP_MODULO:
+            result.type = RUNTIME_TYPE_INTEGER;
+            result.value.integer = lhs % rhs;
+            break;
+        case BINARY_OP_EQUAL:
+            result.value.boolean = lhs == rhs;
+            break;
+        case BINARY_OP_NOT_EQUAL:
+            result.value.boolean = lhs != rhs;
+            break;
+        case BINARY_OP_GREATER:
+            result.value.boolean = lhs > rhs;
+            break;
+        case BINARY_OP_GREATER_EQUAL:
+            result.value.boolean = lhs >= rhs;
+            break;
+        case BINARY_OP_LESS:
+            result.value.boolean = lhs < rhs;
+            break;
+        case BINARY_OP_LESS_EQUAL:
+            result.value.boolean = lhs <= rhs;
+            break;
+        default:
+            break;
+    }
+
+    return result;
+}
+
 enum runtime_type string_to_runtime_type(const char* str);
 const char* runtime_type_to_string(enum runtime_type type);
 
@@ -0,0 +1,1253 @@
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "errors.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+
+// Baseline compiler from bytecode to x86-64, one machine code template per
+// instruction. Only functions computing on integers and booleans, whose
+// variables are never seen by other frames, are compiled: every register of
+// the function then lives in its native stack frame.
+//
+// Hot loops are also compiled, as traces of the instructions run by one of
+// their iterations.
+
+long jit_recursion_depth = 0;
+
+enum value_type {
+    VALUE_UNSET,
+    VALUE_INTEGER,
+    VALUE_BOOLEAN,
+    // Holds values of different types depending on the path taken
+    VALUE_CONFLICT,
+};
+
+enum x86_register {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+};
+
+static const enum x86_register parameter_registers[JIT_MAX_PARAMETERS] = {RDI, RSI, RDX, RCX, R8, R9};
+
+static void jit_panic_recursion(void) {
+    panic("ERROR: max recursion depth exceeded\n");
+}
+
+static void jit_panic_division(void) {
+    panic("ERROR: cannot divide by zero\n");
+}
+
+static bool is_arithmetic_op(enum binary_op_type op_type) {
+    return op_type == BINARY_OP_ADD || op_type == BINARY_OP_SUB || op_type == BINARY_OP_MUL || op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO;
+}
+
+static bool is_logical_op(enum binary_op_type op_type) {
+    return op_type == BINARY_OP_AND || op_type == BINARY_OP_OR;
+}
+
+static enum value_type constant_type(const struct runtime_value* constant) {
+    switch (constant->type) {
+        case RUNTIME_TYPE_INTEGER:
+            return VALUE_INTEGER;
+        case RUNTIME_TYPE_BOOLEAN:
+            return VALUE_BOOLEAN;
+        default:
+            return VALUE_CONFLICT;
+    }
+}
+
+static enum value_type binary_op_result(enum binary_op_type op_type, enum value_type lhs, enum value_type rhs) {
+    if (is_logical_op(op_type)) {
+        return lhs == VALUE_BOOLEAN && rhs == VALUE_BOOLEAN ? VALUE_BOOLEAN : VALUE_CONFLICT;
+    }
+
+    if (lhs != VALUE_INTEGER || rhs != VALUE_INTEGER) return VALUE_CONFLICT;
+
+    return is_arithmetic_op(op_type) ? VALUE_INTEGER : VALUE_BOOLEAN;
+}
+
+static enum binary_op_type opcode_to_binary_op(enum opcode opcode, bool* is_immediate) {
+    switch (opcode) {
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) \
+    case OPCODE_##X:                     \
+        *is_immediate = false;           \
+        return BINARY_OP_##X;            \
+    case OPCODE_##X##_IMM:               \
+        *is_immediate = true;            \
+        return BINARY_OP_##X;
+#include "binary_ops.h"
+        default:
+            return (enum binary_op_type) -1;
+    }
+}
+
+static const struct bytecode_function* global_callee(const struct call_site* site, const struct bytecode_function** global_function_slots) {
+    if (site->resolution != CALL_GLOBAL) return NULL;
+
+    // A function declared once in the main frame is never undeclared
+    const struct bytecode_function* callee = global_function_slots[site->target];
+
+    if (callee == NULL || arrlen(callee->parameter_slots) != arrlen(site->arguments)) return NULL;
+
+    return callee;
+}
+
+static bool analyze_function(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots);
+
+// Types of the registers after an instruction, false if it cannot be compiled
+static bool transfer_types(struct jit* jit, const struct bytecode_function* function, const struct instruction* instruction, enum value_type* types, enum value_type* return_type, const struct bytecode_function** global_function_slots) {
+    bool is_immediate;
+    enum binary_op_type op_type = opcode_to_binary_op(instruction->opcode, &is_immediate);
+
+    if (op_type != (enum binary_op_type) -1) {
+        enum value_type rhs = is_immediate ? constant_type(&function->constants[instruction->c]) : types[instruction->c];
+        enum value_type result = binary_op_result(op_type, types[instruction->b], rhs);
+
+        types[instruction->a] = result;
+        return result != VALUE_CONFLICT;
+    }
+
+    switch (instruction->opcode) {
+        case OPCODE_LOAD_CONST:
+            types[instruction->a] = constant_type(&function->constants[instruction->b]);
+            return types[instruction->a] != VALUE_CONFLICT;
+        case OPCODE_MOVE:
+        case OPCODE_DECLARE:
+            types[instruction->a] = types[instruction->b];
+            return types[instruction->a] == VALUE_INTEGER || types[instruction->a] == VALUE_BOOLEAN;
+        case OPCODE_ASSIGN:
+            // A change of type would fail at runtime
+            if (types[instruction->a] != types[instruction->b]) return false;
+            return types[instruction->a] == VALUE_INTEGER || types[instruction->a] == VALUE_BOOLEAN;
+        case OPCODE_NEG:
+            types[instruction->a] = types[instruction->b] == VALUE_INTEGER ? VALUE_INTEGER : VALUE_CONFLICT;
+            return types[instruction->a] != VALUE_CONFLICT;
+        case OPCODE_NOT:
+            types[instruction->a] = types[instruction->b] == VALUE_BOOLEAN ? VALUE_BOOLEAN : VALUE_CONFLICT;
+            return types[instruction->a] != VALUE_CONFLICT;
+        case OPCODE_CHECK_LOGICAL:
+        case OPCODE_JUMP_IF_TRUE:
+        case OPCODE_JUMP_IF_FALSE:
+            return types[instruction->a] == VALUE_BOOLEAN;
+        case OPCODE_JUMP:
+            return true;
+        case OPCODE_MATCH:
+            return !is_string_match(function->match_sites[instruction->b].statement) && types[instruction->a] == VALUE_INTEGER;
+        case OPCODE_KILL:
+            for (int i = instruction->a; i < instruction->a + instruction->b; i++) {
+                types[i] = VALUE_UNSET;
+            }
+            return true;
+        case OPCODE_RESOLVE_FUNCTION:
+            return global_callee(&function->call_sites[instruction->a], global_function_slots) != NULL;
+        case OPCODE_CALL: {
+            const struct call_site* site = &function->call_sites[instruction->b];
+            const struct bytecode_function* callee = global_callee(site, global_function_slots);
+
+            if (callee == NULL) return false;
+
+            FOR_EACH(int, argument, site->arguments) {
+                if (types[*argument] != VALUE_INTEGER) return false;
+            }
+
+            if (!analyze_function(jit, callee, global_function_slots)) return false;
+
+            // Functions being analyzed are assumed to return integers
+            struct jit_function* compiled = &jit->functions[callee->index];
+            types[instruction->a] = compiled->status == JIT_IN_PROGRESS || compiled->return_type == RUNTIME_TYPE_INTEGER ? VALUE_INTEGER : VALUE_BOOLEAN;
+            return true;
+        }
+        case OPCODE_RETURN: {
+            enum value_type type = types[instruction->a];
+
+            if (type != VALUE_INTEGER && type != VALUE_BOOLEAN) return false;
+            if (*return_type != VALUE_UNSET && *return_type != type) return false;
+
+            *return_type = type;
+            return true;
+        }
+        default:
+            // Anything else looks at other frames, handles strings or nulls
+            return false;
+    }
+}
+
+static bool merge_types(enum value_type* destination, const enum value_type* source, int count) {
+    bool is_changed = false;
+
+    for (int i = 0; i < count; i++) {
+        enum value_type merged = destination[i];
+
+        if (merged == VALUE_UNSET) {
+            merged = source[i];
+        } else if (source[i] != VALUE_UNSET && source[i] != merged) {
+            merged = VALUE_CONFLICT;
+        }
+
+        if (merged != destination[i]) {
+            destination[i] = merged;
+            is_changed = true;
+        }
+    }
+
+    return is_changed;
+}
+
+// Infers the type of each register before each reachable instruction
+static bool infer_types(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots, enum value_type* return_type) {
+    int instruction_count = (int) arrlen(function->code);
+    int register_count = function->register_count;
+    enum value_type* types = xcalloc((size_t) instruction_count * register_count + 1, sizeof(enum value_type));
+    enum value_type* current = xcalloc((size_t) register_count + 1, sizeof(enum value_type));
+    bool* is_reachable = xcalloc(instruction_count, sizeof(bool));
+    int* worklist = NULL;
+    int* successors = NULL;
+    bool fits = true;
+
+    // Compiled code is only entered with integer arguments
+    FOR_EACH(int, slot, function->parameter_slots) {
+        types[*slot] = VALUE_INTEGER;
+    }
+
+    is_reachable[0] = true;
+    arrpush(worklist, 0);
+
+    while (fits && arrlen(worklist) > 0) {
+        int index = arrpop(worklist);
+        const struct instruction* instruction = &function->code[index];
+
+        memcpy(current, types + (size_t) index * register_count, register_count * sizeof(enum value_type));
+
+        if (instruction->opcode == OPCODE_RETURN_NULL || !transfer_types(jit, function, instruction, current, return_type, global_function_slots)) {
+            fits = false;
+            break;
+        }
+
+        arrsetlen(successors, 0);
+
+        switch (instruction->opcode) {
+            case OPCODE_JUMP:
+                arrpush(successors, instruction->a);
+                break;
+            case OPCODE_JUMP_IF_TRUE:
+            case OPCODE_JUMP_IF_FALSE:
+                arrpush(successors, index + 1);
+                arrpush(successors, instruction->b);
+                break;
+            case OPCODE_MATCH: {
+                const struct match_site* site = &function->match_sites[instruction->b];
+
+                FOR_EACH(int, target, site->arm_targets) {
+                    arrpush(successors, *target);
+                }
+                arrpush(successors, site->else_target);
+                break;
+            }
+            case OPCODE_RETURN:
+                break;
+            default:
+                arrpush(successors, index + 1);
+                break;
+        }
+
+        FOR_EACH(int, it, successors) {
+            int successor = *it;
+            bool is_changed = merge_types(types + (size_t) successor * register_count, current, register_count);
+
+            if (is_changed || !is_reachable[successor]) {
+                is_reachable[successor] = true;
+                arrpush(worklist, successor);
+            }
+        }
+    }
+
+    free(types);
+    free(current);
+    free(is_reachable);
+    arrfree(worklist);
+    arrfree(successors);
+
+    return fits;
+}
+
+static bool analyze_function(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots) {
+    struct jit_function* compiled = &jit->functions[function->index];
+
+    switch (compiled->status) {
+        case JIT_IN_PROGRESS:
+            compiled->is_called_recursively = true;
+            return true;
+        case JIT_ANALYZED:
+        case JIT_COMPILED:
+            return true;
+        case JIT_REJECTED:
+            return false;
+        default:
+            break;
+    }
+
+    // Nested functions are looked up through the frames
+    if (function->index == 0 || function->function_slot_count > 0 || arrlen(function->parameter_slots) > JIT_MAX_PARAMETERS) {
+        compiled->status = JIT_REJECTED;
+        return false;
+    }
+
+    compiled->status = JIT_IN_PROGRESS;
+
+    enum value_type return_type = VALUE_UNSET;
+    bool fits = infer_types(jit, function, global_function_slots, &return_type);
+
+    // Recursive calls assumed an integer result
+    if (return_type == VALUE_UNSET || (compiled->is_called_recursively && return_type != VALUE_INTEGER)) {
+        fits = false;
+    }
+
+    compiled->return_type = return_type == VALUE_INTEGER ? RUNTIME_TYPE_INTEGER : RUNTIME_TYPE_BOOLEAN;
+    compiled->status = fits ? JIT_ANALYZED : JIT_REJECTED;
+
+    return fits;
+}
+
+struct jump_patch {
+    // Position of the 32-bit displacement
+    size_t position;
+    int target;
+};
+
+struct assembler {
+    unsigned char* code;
+    struct jump_patch* jumps;
+};
+
+static void emit_byte(struct assembler* assembler, unsigned char byte) {
+    arrpush(assembler->code, byte);
+}
+
+static void emit_bytes(struct assembler* assembler, const unsigned char* bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        arrpush(assembler->code, bytes[i]);
+    }
+}
+
+#define EMIT(assembler, ...)                                                    \
+    do {                                                                        \
+        static const unsigned char bytes_[] = {__VA_ARGS__};                    \
+        emit_bytes(assembler, bytes_, sizeof(bytes_));                          \
+    } while (0)
+
+static void emit_int32(struct assembler* assembler, int value) {
+    unsigned int bits = (unsigned int) value;
+
+    for (int i = 0; i < 4; i++) {
+        emit_byte(assembler, (bits >> (8 * i)) & 0xff);
+    }
+}
+
+static void emit_int64(struct assembler* assembler, unsigned long value) {
+    for (int i = 0; i < 8; i++) {
+        emit_byte(assembler, (value >> (8 * i)) & 0xff);
+    }
+}
+
+static int register_offset(int reg) {
+    return -8 * (reg + 1);
+}
+
+// mov reg, [rbp + offset of the bytecode register]
+static void emit_load(struct assembler* assembler, enum x86_register reg, int bytecode_register) {
+    emit_byte(assembler, 0x48 | (reg >= 8 ? 0x04 : 0));
+    emit_byte(assembler, 0x8b);
+    emit_byte(assembler, 0x85 | ((reg & 7) << 3));
+    emit_int32(assembler, register_offset(bytecode_register));
+}
+
+// mov [rbp + offset of the bytecode register], reg
+static void emit_store(struct assembler* assembler, int bytecode_register, enum x86_register reg) {
+    emit_byte(assembler, 0x48 | (reg >= 8 ? 0x04 : 0));
+    emit_byte(assembler, 0x89);
+    emit_byte(assembler, 0x85 | ((reg & 7) << 3));
+    emit_int32(assembler, register_offset(bytecode_register));
+}
+
+// mov reg, imm64
+static void emit_load_immediate(struct assembler* assembler, enum x86_register reg, unsigned long value) {
+    emit_byte(assembler, 0x48 | (reg >= 8 ? 0x01 : 0));
+    emit_byte(assembler, 0xb8 + (reg & 7));
+    emit_int64(assembler, value);
+}
+
+static void emit_load_constant(struct assembler* assembler, enum x86_register reg, const struct runtime_value* constant) {
+    emit_load_immediate(assembler, reg, constant->type == RUNTIME_TYPE_INTEGER ? (unsigned long) constant->value.integer : constant->value.boolean);
+}
+
+// Calls a panic helper, 12 bytes
+static void emit_call_helper(struct assembler* assembler, void (*helper)(void)) {
+    emit_load_immediate(assembler, RAX, (unsigned long) helper);
+    EMIT(assembler, 0xff, 0xd0); // call rax
+}
+
+// Jump to a bytecode instruction, the instruction count being the epilogue
+static void emit_jump(struct assembler* assembler, const unsigned char* opcode, size_t opcode_size, int target) {
+    emit_bytes(assembler, opcode, opcode_size);
+
+    struct jump_patch jump = {
+            .position = arrlen(assembler->code),
+            .target = target,
+    };
+    arrpush(assembler->jumps, jump);
+
+    emit_int32(assembler, 0);
+}
+
+static void patch_jump(struct assembler* assembler, size_t position, size_t destination) {
+    int displacement = (int) (destination - (position + 4));
+    memcpy(assembler->code + position, &displacement, sizeof(int));
+}
+
+// Copies the code to executable memory
+static void* install_code(const struct assembler* assembler, size_t* code_size) {
+    *code_size = arrlen(assembler->code);
+    void* code = mmap(NULL, *code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED) {
+        panic("ERROR: cannot allocate executable memory\n");
+    }
+
+    memcpy(code, assembler->code, *code_size);
+
+    if (mprotect(code, *code_size, PROT_READ | PROT_EXEC) != 0) {
+        panic("ERROR: cannot allocate executable memory\n");
+    }
+
+    return code;
+}
+
+static const unsigned char JMP[] = {0xe9};
+static const unsigned char JZ[] = {0x0f, 0x84};
+static const unsigned char JNZ[] = {0x0f, 0x85};
+
+// eax = arm of an integer match selected by rax, -1 for the else branch
+static void emit_select_arm(struct assembler* assembler, const struct statement* match) {
+    const int* jump_table = match->op.match.jump_table;
+
+    if (jump_table == NULL) {
+        EMIT(assembler, 0x48, 0x89, 0xc6); // mov rsi, rax
+        emit_load_immediate(assembler, RDI, (unsigned long) match);
+        emit_load_immediate(assembler, RAX, (unsigned long) find_match_integer_arm);
+        EMIT(assembler, 0xff, 0xd0); // call rax
+        return;
+    }
+
+    emit_load_immediate(assembler, RCX, (unsigned long) match->op.match.table_min);
+    EMIT(assembler, 0x48, 0x29, 0xc8); // sub rax, rcx
+    emit_load_immediate(assembler, RCX, (unsigned long) arrlen(jump_table));
+    EMIT(assembler, 0x48, 0x39, 0xc8); // cmp rax, rcx
+    EMIT(assembler, 0x73, 0x10);       // jae to the else branch
+    emit_load_immediate(assembler, RCX, (unsigned long) jump_table);
+    EMIT(assembler, 0x48, 0x63, 0x04, 0x81); // movsxd rax, dword [rcx + rax * 4]
+    EMIT(assembler, 0xeb, 0x05);             // jmp over the else branch
+    EMIT(assembler, 0xb8, 0xff, 0xff, 0xff, 0xff); // mov eax, -1
+}
+
+// 8 bytes jump of a table indexed by a register
+static void emit_jump_stub(struct assembler* assembler, int target) {
+    emit_jump(assembler, JMP, sizeof(JMP), target);
+    EMIT(assembler, 0x0f, 0x1f, 0x00); // nop
+}
+
+// rax = rax <op> rcx, divisors being checked by the caller
+static void emit_binary_op_template(struct assembler* assembler, enum binary_op_type op_type) {
+    switch (op_type) {
+        case BINARY_OP_ADD:
+            EMIT(assembler, 0x48, 0x01, 0xc8); // add rax, rcx
+            break;
+        case BINARY_OP_SUB:
+            EMIT(assembler, 0x48, 0x29, 0xc8); // sub rax, rcx
+            break;
+        case BINARY_OP_MUL:
+            EMIT(assembler, 0x48, 0x0f, 0xaf, 0xc1); // imul rax, rcx
+            break;
+        case BINARY_OP_DIV:
+            EMIT(assembler, 0x48, 0x99);       // cqo
+            EMIT(assembler, 0x48, 0xf7, 0xf9); // idiv rcx
+            break;
+        case BINARY_OP_MODULO:
+            EMIT(assembler, 0x48, 0x99);       // cqo
+            EMIT(assembler, 0x48, 0xf7, 0xf9); // idiv rcx
+            EMIT(assembler, 0x48, 0x89, 0xd0); // mov rax, rdx
+            break;
+        case BINARY_OP_AND:
+            EMIT(assembler, 0x48, 0x21, 0xc8); // and rax, rcx
+            break;
+        case BINARY_OP_OR:
+            EMIT(assembler, 0x48, 0x09, 0xc8); // or rax, rcx
+            break;
+        default: {
+            unsigned char condition;
+
+            switch (op_type) {
+                case BINARY_OP_EQUAL:
+                    condition = 0x94;
+                    break;
+                case BINARY_OP_NOT_EQUAL:
+                    condition = 0x95;
+                    break;
+                case BINARY_OP_GREATER:
+                    condition = 0x9f;
+                    break;
+                case BINARY_OP_GREATER_EQUAL:
+                    condition = 0x9d;
+                    break;
+                case BINARY_OP_LESS:
+                    condition = 0x9c;
+                    break;
+                default:
+                    condition = 0x9e;
+                    break;
+            }
+
+            EMIT(assembler, 0x48, 0x39, 0xc8);            // cmp rax, rcx
+            emit_byte(assembler, 0x0f);                   // setcc al
+            emit_byte(assembler, condition);
+            emit_byte(assembler, 0xc0);
+            EMIT(assembler, 0x0f, 0xb6, 0xc0);            // movzx eax, al
+            break;
+        }
+    }
+}
+
+static void emit_binary_op(struct assembler* assembler, const struct bytecode_function* function, const struct instruction* instruction, enum binary_op_type op_type, bool is_immediate) {
+    emit_load(assembler, RAX, instruction->b);
+
+    if (is_immediate) {
+        emit_load_constant(assembler, RCX, &function->constants[instruction->c]);
+    } else {
+        emit_load(assembler, RCX, instruction->c);
+    }
+
+    // Modulo by zero faults like in the interpreters
+    if (op_type == BINARY_OP_DIV) {
+        EMIT(assembler, 0x48, 0x85, 0xc9); // test rcx, rcx
+        EMIT(assembler, 0x75, 0x0c);       // jnz over the helper call
+        emit_call_helper(assembler, jit_panic_division);
+    }
+
+    emit_binary_op_template(assembler, op_type);
+    emit_store(assembler, instruction->a, RAX);
+}
+
+static void emit_instruction(struct assembler* assembler, struct jit* jit, const struct bytecode_function* function, const struct instruction* instruction, const struct bytecode_function** global_function_slots) {
+    bool is_immediate;
+    enum binary_op_type op_type = opcode_to_binary_op(instruction->opcode, &is_immediate);
+
+    if (op_type != (enum binary_op_type) -1) {
+        emit_binary_op(assembler, function, instruction, op_type, is_immediate);
+        return;
+    }
+
+    switch (instruction->opcode) {
+        case OPCODE_LOAD_CONST:
+            emit_load_constant(assembler, RAX, &function->constants[instruction->b]);
+            emit_store(assembler, instruction->a, RAX);
+            break;
+        case OPCODE_MOVE:
+        case OPCODE_DECLARE:
+        case OPCODE_ASSIGN:
+            emit_load(assembler, RAX, instruction->b);
+            emit_store(assembler, instruction->a, RAX);
+            break;
+        case OPCODE_NEG:
+            emit_load(assembler, RAX, instruction->b);
+            EMIT(assembler, 0x48, 0xf7, 0xd8); // neg rax
+            emit_store(assembler, instruction->a, RAX);
+            break;
+        case OPCODE_NOT:
+            emit_load(assembler, RAX, instruction->b);
+            EMIT(assembler, 0x48, 0x83, 0xf0, 0x01); // xor rax, 1
+            emit_store(assembler, instruction->a, RAX);
+            break;
+        case OPCODE_CHECK_LOGICAL:
+            // Proven by the type analysis
+            break;
+        case OPCODE_JUMP:
+            emit_jump(assembler, JMP, sizeof(JMP), instruction->a);
+            break;
+        case OPCODE_JUMP_IF_TRUE:
+        case OPCODE_JUMP_IF_FALSE:
+            emit_load(assembler, RAX, instruction->a);
+            EMIT(assembler, 0x48, 0x85, 0xc0); // test rax, rax
+            if (instruction->opcode == OPCODE_JUMP_IF_TRUE) {
+                emit_jump(assembler, JNZ, sizeof(JNZ), instruction->b);
+            } else {
+                emit_jump(assembler, JZ, sizeof(JZ), instruction->b);
+            }
+            break;
+        case OPCODE_MATCH: {
+            const struct match_site* site = &function->match_sites[instruction->b];
+
+            emit_load(assembler, RAX, instruction->a);
+            emit_select_arm(assembler, site->statement);
+
+            // Stubs indexed by arm + 1, the else branch first
+            EMIT(assembler, 0xff, 0xc0);                               // inc eax
+            EMIT(assembler, 0x48, 0x8d, 0x0d, 0x06, 0x00, 0x00, 0x00); // lea rcx, [rip + 6]
+            EMIT(assembler, 0x48, 0x8d, 0x04, 0xc1);                   // lea rax, [rcx + rax * 8]
+            EMIT(assembler, 0xff, 0xe0);                               // jmp rax
+
+            emit_jump_stub(assembler, site->else_target);
+
+            FOR_EACH(int, target, site->arm_targets) {
+                emit_jump_stub(assembler, *target);
+            }
+            break;
+        }
+        case OPCODE_CALL: {
+            const struct call_site* site = &function->call_sites[instruction->b];
+            const struct bytecode_function* callee = global_callee(site, global_function_slots);
+
+            for (size_t i = 0; i < arrlen(site->arguments); i++) {
+                emit_load(assembler, parameter_registers[i], site->arguments[i]);
+            }
+
+            // The callee may not be compiled yet, its entry is read at each call
+            emit_load_immediate(assembler, RAX, (unsigned long) &jit->functions[callee->index].entry);
+            EMIT(assembler, 0xff, 0x10); // call [rax]
+            emit_store(assembler, instruction->a, RAX);
+            break;
+        }
+        case OPCODE_RETURN:
+            emit_load(assembler, RAX, instruction->a);
+            emit_jump(assembler, JMP, sizeof(JMP), (int) arrlen(function->code));
+            break;
+        default:
+            // Slots are never seen by other frames and callees are resolved
+            // when compiling, so KILL and RESOLVE_FUNCTION have nothing to do
+            break;
+    }
+}
+
+static void compile_function(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots) {
+    struct jit_function* compiled = &jit->functions[function->index];
+    struct assembler assembler = {
+            .code = NULL,
+            .jumps = NULL,
+    };
+    size_t* instruction_offsets = NULL;
+    int frame_size = (function->register_count * 8 + 15) & ~15;
+
+    EMIT(&assembler, 0x55);             // push rbp
+    EMIT(&assembler, 0x48, 0x89, 0xe5); // mov rbp, rsp
+    EMIT(&assembler, 0x48, 0x81, 0xec); // sub rsp, frame size
+    emit_int32(&assembler, frame_size);
+
+    for (size_t i = 0; i < arrlen(function->parameter_slots); i++) {
+        emit_store(&assembler, function->parameter_slots[i], parameter_registers[i]);
+    }
+
+    emit_load_immediate(&assembler, RAX, (unsigned long) &jit_recursion_depth);
+    EMIT(&assembler, 0x48, 0xff, 0x00); // inc qword [rax]
+    EMIT(&assembler, 0x48, 0x81, 0x38); // cmp qword [rax], MAX_RECURSION_DEPTH
+    emit_int32(&assembler, MAX_RECURSION_DEPTH);
+    EMIT(&assembler, 0x7c, 0x0c);       // jl over the helper call
+    emit_call_helper(&assembler, jit_panic_recursion);
+
+    for (size_t i = 0; i < arrlen(function->code); i++) {
+        arrpush(instruction_offsets, arrlen(assembler.code));
+        emit_instruction(&assembler, jit, function, &function->code[i], global_function_slots);
+    }
+
+    // Epilogue, the result being in rax
+    arrpush(instruction_offsets, arrlen(assembler.code));
+    emit_load_immediate(&assembler, RCX, (unsigned long) &jit_recursion_depth);
+    EMIT(&assembler, 0x48, 0xff, 0x09); // dec qword [rcx]
+    EMIT(&assembler, 0xc9);             // leave
+    EMIT(&assembler, 0xc3);             // ret
+
+    FOR_EACH(struct jump_patch, jump, assembler.jumps) {
+        patch_jump(&assembler, jump->position, instruction_offsets[jump->target]);
+    }
+
+    compiled->code = install_code(&assembler, &compiled->code_size);
+    compiled->entry = (jit_entry_t) compiled->code;
+    compiled->status = JIT_COMPILED;
+
+    arrfree(assembler.code);
+    arrfree(assembler.jumps);
+    arrfree(instruction_offsets);
+}
+
+bool jit_compile_function(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots) {
+    bool fits = analyze_function(jit, function, global_function_slots);
+
+    for (size_t i = 0; i < arrlen(jit->program->functions); i++) {
+        struct jit_function* compiled = &jit->functions[i];
+
+        if (compiled->status != JIT_ANALYZED) continue;
+
+        if (fits) {
+            compile_function(jit, jit->program->functions[i], global_function_slots);
+        } else {
+            // Callees checked on the way may still be compiled on their own
+            compiled->status = JIT_NOT_COMPILED;
+            compiled->is_called_recursively = false;
+        }
+    }
+
+    return fits;
+}
+
+// Traces of hot loops run on the registers of the virtual machine, which
+// stay up to date at each instruction so that a guard failing anywhere can
+// resume the interpreter there. rbx holds the registers, r13 the slot flags.
+
+enum register_guard {
+    GUARD_NONE,
+    // Read before being written, checked to keep the type seen when recording
+    GUARD_TYPE,
+    // Only written, checked not to hold a string that would need a release
+    GUARD_NOT_STRING,
+};
+
+struct trace_compiler {
+    struct jit* jit;
+    const struct bytecode_function* function;
+    const struct bytecode_function** global_function_slots;
+    // Body of the loop, the guards are only known once it is compiled
+    struct assembler body;
+    // Types at the current step of the trace
+    enum runtime_type* types;
+    enum register_guard* guards;
+    bool* is_written;
+};
+
+static const int JIT_MAX_TRACE_LENGTH = 1000;
+
+static bool is_traceable(enum opcode opcode) {
+    bool is_immediate;
+
+    if (opcode_to_binary_op(opcode, &is_immediate) != (enum binary_op_type) -1) return true;
+
+    switch (opcode) {
+        case OPCODE_LOAD_CONST:
+        case OPCODE_MOVE:
+        case OPCODE_DECLARE:
+        case OPCODE_ASSIGN:
+        case OPCODE_NEG:
+        case OPCODE_NOT:
+        case OPCODE_CHECK_LOGICAL:
+        case OPCODE_JUMP:
+        case OPCODE_JUMP_IF_TRUE:
+        case OPCODE_JUMP_IF_FALSE:
+        case OPCODE_MATCH:
+        case OPCODE_KILL:
+        case OPCODE_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static enum value_type to_value_type(enum runtime_type type) {
+    switch (type) {
+        case RUNTIME_TYPE_INTEGER:
+            return VALUE_INTEGER;
+        case RUNTIME_TYPE_BOOLEAN:
+            return VALUE_BOOLEAN;
+        default:
+            return VALUE_CONFLICT;
+    }
+}
+
+static bool is_native_type(enum runtime_type type) {
+    return type == RUNTIME_TYPE_INTEGER || type == RUNTIME_TYPE_BOOLEAN;
+}
+
+static enum runtime_type read_register(struct trace_compiler* compiler, int reg) {
+    if (!compiler->is_written[reg]) compiler->guards[reg] = GUARD_TYPE;
+
+    return compiler->types[reg];
+}
+
+static void write_register(struct trace_compiler* compiler, int reg, enum runtime_type type) {
+    if (compiler->guards[reg] == GUARD_NONE) compiler->guards[reg] = GUARD_NOT_STRING;
+
+    compiler->is_written[reg] = true;
+    compiler->types[reg] = type;
+}
+
+static int value_offset(int reg) {
+    return reg * (int) sizeof(struct runtime_value) + (int) offsetof(struct runtime_value, value);
+}
+
+static int type_offset(int reg) {
+    return reg * (int) sizeof(struct runtime_value) + (int) offsetof(struct runtime_value, type);
+}
+
+// reg = value of a virtual machine register
+static void emit_load_value(struct assembler* assembler, enum x86_register reg, int vm_register, enum runtime_type type) {
+    if (type == RUNTIME_TYPE_BOOLEAN) {
+        // movzx reg, byte [rbx + offset]
+        if (reg >= 8) emit_byte(assembler, 0x44);
+        EMIT(assembler, 0x0f, 0xb6);
+    } else {
+        // mov reg, [rbx + offset]
+        emit_byte(assembler, 0x48 | (reg >= 8 ? 0x04 : 0));
+        emit_byte(assembler, 0x8b);
+    }
+
+    emit_byte(assembler, 0x83 | ((reg & 7) << 3));
+    emit_int32(assembler, value_offset(vm_register));
+}
+
+static void emit_store_type(struct assembler* assembler, int vm_register, enum runtime_type type) {
+    EMIT(assembler, 0xc7, 0x83); // mov dword [rbx + offset], type
+    emit_int32(assembler, type_offset(vm_register));
+    emit_int32(assembler, type);
+}
+
+// Virtual machine register = rax
+static void emit_store_value(struct assembler* assembler, int vm_register, enum runtime_type type) {
+    if (type == RUNTIME_TYPE_BOOLEAN) {
+        EMIT(assembler, 0x88, 0x83); // mov [rbx + offset], al
+    } else {
+        EMIT(assembler, 0x48, 0x89, 0x83); // mov [rbx + offset], rax
+    }
+
+    emit_int32(assembler, value_offset(vm_register));
+    emit_store_type(assembler, vm_register, type);
+}
+
+static void emit_store_flags(struct assembler* assembler, int vm_register, unsigned char flags) {
+    EMIT(assembler, 0x41, 0xc6, 0x85); // mov byte [r13 + register], flags
+    emit_int32(assembler, vm_register);
+    emit_byte(assembler, flags);
+}
+
+static const struct bytecode_function* trace_callee(struct trace_compiler* compiler, const struct call_site* site) {
+    const struct bytecode_function* callee;
+
+    switch (site->resolution) {
+        case CALL_DIRECT:
+            callee = compiler->jit->program->functions[site->target];
+            break;
+        case CALL_GLOBAL:
+            callee = compiler->global_function_slots[site->target];
+            break;
+        default:
+            return NULL;
+    }
+
+    if (callee == NULL || arrlen(callee->parameter_slots) != arrlen(site->arguments)) return NULL;
+
+    // Only compiled functions can be called without a frame of the virtual machine
+    return compiler->jit->functions[callee->index].status == JIT_COMPILED ? callee : NULL;
+}
+
+// Emits an instruction of the trace, false if it cannot be compiled
+static bool compile_trace_step(struct trace_compiler* compiler, const struct trace_step* step) {
+    const struct instruction* instruction = &compiler->function->code[step->index];
+    const struct runtime_value* constants = compiler->function->constants;
+    struct assembler* assembler = &compiler->body;
+    bool is_immediate;
+    enum binary_op_type op_type = opcode_to_binary_op(instruction->opcode, &is_immediate);
+
+    if (op_type != (enum binary_op_type) -1) {
+        enum runtime_type lhs = read_register(compiler, instruction->b);
+        enum runtime_type rhs = is_immediate ? constants[instruction->c].type : read_register(compiler, instruction->c);
+        enum value_type result = binary_op_result(op_type, to_value_type(lhs), to_value_type(rhs));
+
+        if (result == VALUE_CONFLICT) return false;
+
+        emit_load_value(assembler, RAX, instruction->b, lhs);
+
+        if (is_immediate) {
+            emit_load_constant(assembler, RCX, &constants[instruction->c]);
+        } else {
+            emit_load_value(assembler, RCX, instruction->c, rhs);
+        }
+
+        // The interpreter reports divisions by zero
+        if (op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO) {
+            EMIT(assembler, 0x48, 0x85, 0xc9); // test rcx, rcx
+            emit_jump(assembler, JZ, sizeof(JZ), step->index);
+        }
+
+        emit_binary_op_template(assembler, op_type);
+
+        enum runtime_type type = result == VALUE_INTEGER ? RUNTIME_TYPE_INTEGER : RUNTIME_TYPE_BOOLEAN;
+        write_register(compiler, instruction->a, type);
+        emit_store_value(assembler, instruction->a, type);
+        return true;
+    }
+
+    switch (instruction->opcode) {
+        case OPCODE_LOAD_CONST: {
+            enum runtime_type type = constants[instruction->b].type;
+
+            if (!is_native_type(type)) return false;
+
+            emit_load_constant(assembler, RAX, &constants[instruction->b]);
+            write_register(compiler, instruction->a, type);
+            emit_store_value(assembler, instruction->a, type);
+            return true;
+        }
+        case OPCODE_MOVE:
+        case OPCODE_DECLARE:
+        case OPCODE_ASSIGN: {
+            enum runtime_type type = read_register(compiler, instruction->b);
+
+            if (!is_native_type(type)) return false;
+
+            // A change of type fails in the interpreter
+            if (instruction->opcode == OPCODE_ASSIGN && read_register(compiler, instruction->a) != type) return false;
+
+            emit_load_value(assembler, RAX, instruction->b, type);
+            write_register(compiler, instruction->a, type);
+            emit_store_value(assembler, instruction->a, type);
+
+            if (instruction->opcode == OPCODE_DECLARE) {
+                emit_store_flags(assembler, instruction->a, SLOT_DECLARED | (instruction->c ? SLOT_CONSTANT : 0));
+            }
+            return true;
+        }
+        case OPCODE_NEG:
+        case OPCODE_NOT: {
+            enum runtime_type type = read_register(compiler, instruction->b);
+
+            if (type != (instruction->opcode == OPCODE_NEG ? RUNTIME_TYPE_INTEGER : RUNTIME_TYPE_BOOLEAN)) return false;
+
+            emit_load_value(assembler, RAX, instruction->b, type);
+
+            if (instruction->opcode == OPCODE_NEG) {
+                EMIT(assembler, 0x48, 0xf7, 0xd8); // neg rax
+            } else {
+                EMIT(assembler, 0x48, 0x83, 0xf0, 0x01); // xor rax, 1
+            }
+
+            write_register(compiler, instruction->a, type);
+            emit_store_value(assembler, instruction->a, type);
+            return true;
+        }
+        case OPCODE_CHECK_LOGICAL:
+            return read_register(compiler, instruction->a) == RUNTIME_TYPE_BOOLEAN;
+        case OPCODE_JUMP:
+            // The trace is a straight line
+            return true;
+        case OPCODE_JUMP_IF_TRUE:
+        case OPCODE_JUMP_IF_FALSE: {
+            if (read_register(compiler, instruction->a) != RUNTIME_TYPE_BOOLEAN) return false;
+
+            emit_load_value(assembler, RAX, instruction->a, RUNTIME_TYPE_BOOLEAN);
+            EMIT(assembler, 0x48, 0x85, 0xc0); // test rax, rax
+
+            // Side exit to the path that was not recorded
+            bool jumps_when_true = instruction->opcode == OPCODE_JUMP_IF_TRUE;
+            bool exits_when_true = step->is_taken != jumps_when_true;
+            int resume = step->is_taken ? step->index + 1 : instruction->b;
+
+            if (exits_when_true) {
+                emit_jump(assembler, JNZ, sizeof(JNZ), resume);
+            } else {
+                emit_jump(assembler, JZ, sizeof(JZ), resume);
+            }
+            return true;
+        }
+        case OPCODE_MATCH: {
+            const struct statement* match = compiler->function->match_sites[instruction->b].statement;
+
+            if (is_string_match(match) || read_register(compiler, instruction->a) != RUNTIME_TYPE_INTEGER) return false;
+
+            emit_load_value(assembler, RAX, instruction->a, RUNTIME_TYPE_INTEGER);
+            emit_select_arm(assembler, match);
+
+            // Side exit to the match itself when another arm is selected
+            emit_byte(assembler, 0x3d); // cmp eax, arm
+            emit_int32(assembler, step->arm);
+            emit_jump(assembler, JNZ, sizeof(JNZ), step->index);
+            return true;
+        }
+        case OPCODE_KILL:
+            for (int i = instruction->a; i < instruction->a + instruction->b; i++) {
+                write_register(compiler, i, RUNTIME_TYPE_NULL);
+                emit_store_type(assembler, i, RUNTIME_TYPE_NULL);
+                emit_store_flags(assembler, i, 0);
+            }
+            return true;
+        case OPCODE_CALL: {
+            const struct call_site* site = &compiler->function->call_sites[instruction->b];
+            const struct bytecode_function* callee = trace_callee(compiler, site);
+
+            // Callees resolved early are kept on a stack of the virtual machine
+            if (callee == NULL || site->is_resolved_early) return false;
+
+            for (size_t i = 0; i < arrlen(site->arguments); i++) {
+                if (read_register(compiler, site->arguments[i]) != RUNTIME_TYPE_INTEGER) return false;
+
+                emit_load_value(assembler, parameter_registers[i], site->arguments[i], RUNTIME_TYPE_INTEGER);
+            }
+
+            struct jit_function* compiled = &compiler->jit->functions[callee->index];
+
+            emit_load_immediate(assembler, RAX, (unsigned long) &compiled->entry);
+            EMIT(assembler, 0xff, 0x10); // call [rax]
+            write_register(compiler, instruction->a, compiled->return_type);
+            emit_store_value(assembler, instruction->a, compiled->return_type);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static void emit_trace_exit(struct assembler* assembler, struct jump_patch** exits, const unsigned char* opcode, size_t opcode_size, int resume) {
+    emit_bytes(assembler, opcode, opcode_size);
+
+    struct jump_patch exit = {
+            .position = arrlen(assembler->code),
+            .target = resume,
+    };
+    arrpush(*exits, exit);
+
+    emit_int32(assembler, 0);
+}
+
+static bool compile_trace(struct jit* jit, struct jit_loop* loop, const struct bytecode_function** global_function_slots) {
+    struct trace_recorder* recorder = &jit->recorder;
+    int register_count = recorder->function->register_count;
+    struct trace_compiler compiler = {
+            .jit = jit,
+            .function = recorder->function,
+            .global_function_slots = global_function_slots,
+            .body = {
+                    .code = NULL,
+                    .jumps = NULL,
+            },
+            .types = xmalloc((register_count + 1) * sizeof(enum runtime_type)),
+            .guards = xcalloc(register_count + 1, sizeof(enum register_guard)),
+            .is_written = xcalloc(register_count + 1, sizeof(bool)),
+    };
+    bool fits = true;
+
+    memcpy(compiler.types, recorder->entry_types, register_count * sizeof(enum runtime_type));
+
+    FOR_EACH(struct trace_step, step, recorder->steps) {
+        if (!compile_trace_step(&compiler, step)) {
+            fits = false;
+            break;
+        }
+    }
+
+    if (fits) {
+        struct assembler assembler = {
+                .code = NULL,
+                .jumps = NULL,
+        };
+        struct jump_patch* exits = NULL;
+        // The loop skips the guards when it keeps the types of the registers
+        bool is_type_stable = true;
+
+        EMIT(&assembler, 0x55);             // push rbp
+        EMIT(&assembler, 0x48, 0x89, 0xe5); // mov rbp, rsp
+        EMIT(&assembler, 0x53);             // push rbx
+        EMIT(&assembler, 0x41, 0x55);       // push r13
+        EMIT(&assembler, 0x48, 0x89, 0xfb); // mov rbx, rdi
+        EMIT(&assembler, 0x49, 0x89, 0xf5); // mov r13, rsi
+
+        size_t guards_start = arrlen(assembler.code);
+
+        for (int i = 0; i < register_count; i++) {
+            if (compiler.guards[i] == GUARD_NONE) continue;
+
+            bool is_type_guard = compiler.guards[i] == GUARD_TYPE;
+
+            EMIT(&assembler, 0x81, 0xbb); // cmp dword [rbx + offset], type
+            emit_int32(&assembler, type_offset(i));
+            emit_int32(&assembler, is_type_guard ? recorder->entry_types[i] : RUNTIME_TYPE_STRING);
+
+            if (is_type_guard) {
+                emit_trace_exit(&assembler, &exits, JNZ, sizeof(JNZ), recorder->anchor);
+                is_type_stable &= compiler.types[i] == recorder->entry_types[i];
+            } else {
+                emit_trace_exit(&assembler, &exits, JZ, sizeof(JZ), recorder->anchor);
+            }
+        }
+
+        size_t body_start = arrlen(assembler.code);
+        emit_bytes(&assembler, compiler.body.code, arrlen(compiler.body.code));
+
+        FOR_EACH(struct jump_patch, jump, compiler.body.jumps) {
+            struct jump_patch exit = {
+                    .position = body_start + jump->position,
+                    .target = jump->target,
+            };
+            arrpush(exits, exit);
+        }
+
+        EMIT(&assembler, 0xe9); // jmp to the next iteration
+        emit_int32(&assembler, 0);
+        patch_jump(&assembler, arrlen(assembler.code) - 4, is_type_stable ? body_start : guards_start);
+
+        // Each exit returns the instruction to resume at
+        size_t* epilogue_jumps = NULL;
+
+        FOR_EACH(struct jump_patch, exit, exits) {
+            patch_jump(&assembler, exit->position, arrlen(assembler.code));
+
+            EMIT(&assembler, 0xb8); // mov eax, instruction
+            emit_int32(&assembler, exit->target);
+            EMIT(&assembler, 0xe9); // jmp to the epilogue
+            arrpush(epilogue_jumps, arrlen(assembler.code));
+            emit_int32(&assembler, 0);
+        }
+
+        FOR_EACH(size_t, jump, epilogue_jumps) {
+            patch_jump(&assembler, *jump, arrlen(assembler.code));
+        }
+
+        EMIT(&assembler, 0x41, 0x5d); // pop r13
+        EMIT(&assembler, 0x5b);       // pop rbx
+        EMIT(&assembler, 0x5d);       // pop rbp
+        EMIT(&assembler, 0xc3);       // ret
+
+        loop->code = install_code(&assembler, &loop->code_size);
+        loop->trace = (jit_trace_t) loop->code;
+
+        arrfree(assembler.code);
+        arrfree(exits);
+        arrfree(epilogue_jumps);
+    }
+
+    free(compiler.types);
+    free(compiler.guards);
+    free(compiler.is_written);
+    arrfree(compiler.body.code);
+    arrfree(compiler.body.jumps);
+
+    return fits;
+}
+
+struct jit_loop* jit_get_loop(struct jit* jit, const struct bytecode_function* function, int anchor) {
+    struct jit_function* compiled = &jit->functions[function->index];
+
+    if (compiled->loops == NULL) {
+        compiled->loops = xcalloc(arrlen(function->code), sizeof(struct jit_loop));
+    }
+
+    return &compiled->loops[anchor];
+}
+
+void jit_start_recording(struct jit* jit, const struct bytecode_function* function, int anchor, size_t frame_count, const struct runtime_value* registers) {
+    struct trace_recorder* recorder = &jit->recorder;
+
+    recorder->function = function;
+    recorder->anchor = anchor;
+    recorder->frame_count = frame_count;
+
+    arrsetlen(recorder->entry_types, 0);
+    arrsetlen(recorder->steps, 0);
+
+    for (int i = 0; i < function->register_count; i++) {
+        arrpush(recorder->entry_types, registers[i].type);
+    }
+}
+
+bool jit_record_instruction(struct jit* jit, int index, const struct runtime_value* registers) {
+    struct trace_recorder* recorder = &jit->recorder;
+    const struct instruction* instruction = &recorder->function->code[index];
+
+    if (!is_traceable(instruction->opcode) || arrlen(recorder->steps) >= JIT_MAX_TRACE_LENGTH) {
+        jit_abort_recording(jit);
+        return false;
+    }
+
+    struct trace_step step = {
+            .index = index,
+            .is_taken = false,
+            .arm = -1,
+    };
+
+    if (instruction->opcode == OPCODE_JUMP_IF_TRUE) {
+        step.is_taken = registers[instruction->a].value.boolean;
+    } else if (instruction->opcode == OPCODE_JUMP_IF_FALSE) {
+        step.is_taken = !registers[instruction->a].value.boolean;
+    } else if (instruction->opcode == OPCODE_MATCH) {
+        const struct statement* match = recorder->function->match_sites[instruction->b].statement;
+        const struct runtime_value* value = &registers[instruction->a];
+
+        // Other matches are not compiled
+        if (!is_string_match(match) && value->type == RUNTIME_TYPE_INTEGER)
+            step.arm = find_match_integer_arm(match, value->value.integer);
+    }
+
+    arrpush(recorder->steps, step);
+
+    return true;
+}
+
+void jit_finish_recording(struct jit* jit, const struct bytecode_function** global_function_slots) {
+    struct trace_recorder* recorder = &jit->recorder;
+    struct jit_loop* loop = jit_get_loop(jit, recorder->function, recorder->anchor);
+
+    if (!compile_trace(jit, loop, global_function_slots)) {
+        jit_abort_recording(jit);
+        return;
+    }
+
+    recorder->function = NULL;
+}
+
+void jit_abort_recording(struct jit* jit) {
+    struct trace_recorder* recorder = &jit->recorder;
+    struct jit_loop* loop = jit_get_loop(jit, recorder->function, recorder->anchor);
+
+    // The loop is recorded again once it gets hot again
+    loop->abort_count++;
+    loop->iteration_count = 0;
+
+    recorder->function = NULL;
+}
+
+struct jit* create_jit(const struct bytecode_program* program) {
+    struct jit* jit = xmalloc(sizeof(struct jit));
+    jit->program = program;
+    jit->functions = xcalloc(arrlen(program->functions), sizeof(struct jit_function));
+    jit->recorder.function = NULL;
+    jit->recorder.entry_types = NULL;
+    jit->recorder.steps = NULL;
+
+    return jit;
+}
+
+void destroy_jit(struct jit* jit) {
+    for (size_t i = 0; i < arrlen(jit->program->functions); i++) {
+        struct jit_function* compiled = &jit->functions[i];
+
+        if (compiled->code != NULL) {
+            munmap(compiled->code, compiled->code_size);
+        }
+
+        if (compiled->loops != NULL) {
+            for (size_t j = 0; j < arrlen(jit->program->functions[i]->code); j++) {
+                if (compiled->loops[j].code != NULL) {
+                    munmap(compiled->loops[j].code, compiled->loops[j].code_size);
+                }
+            }
+
+            free(compiled->loops);
+        }
+    }
+
+    arrfree(jit->recorder.entry_types);
+    arrfree(jit->recorder.steps);
+    free(jit->functions);
+    free(jit);
+}
@@ -0,0 +1,108 @@
+#ifndef CHAD_INTERPRETER_JIT_H
+#define CHAD_INTERPRETER_JIT_H
+
+#include "bytecode.h"
+
+// Maximum number of integer parameters passed in registers to compiled code
+#define JIT_MAX_PARAMETERS 6
+
+typedef long (*jit_entry_t)(long, long, long, long, long, long);
+
+// Runs a loop on the registers and slot flags of the current frame, returns
+// the instruction at which the virtual machine resumes
+typedef int (*jit_trace_t)(struct runtime_value* registers, unsigned char* flags);
+
+enum jit_status {
+    JIT_NOT_COMPILED,
+    JIT_IN_PROGRESS,
+    // Checked, waiting for the code of its callers to be checked too
+    JIT_ANALYZED,
+    JIT_COMPILED,
+    // Interpreted for the rest of the program
+    JIT_REJECTED,
+};
+
+// Loop whose body starts at an instruction targeted by a backward jump
+struct jit_loop {
+    int iteration_count;
+    // Traces failing to record or compile, the loop is never traced again
+    // after JIT_MAX_TRACE_ABORTS
+    int abort_count;
+    // NULL until a trace is compiled
+    jit_trace_t trace;
+    void* code;
+    size_t code_size;
+};
+
+struct jit_function {
+    enum jit_status status;
+    // Address called by compiled code, NULL until the function is compiled
+    jit_entry_t entry;
+    enum runtime_type return_type;
+    int call_count;
+    bool is_called_recursively;
+    void* code;
+    size_t code_size;
+    // One per instruction, allocated when a loop of the function first runs
+    struct jit_loop* loops;
+};
+
+struct trace_step {
+    int index;
+    // Direction of conditional jumps
+    bool is_taken;
+    // Arm selected by a match, -1 for its else branch
+    int arm;
+};
+
+// Instructions run by one iteration of a hot loop
+struct trace_recorder {
+    // NULL when not recording
+    const struct bytecode_function* function;
+    int anchor;
+    // Frames of the virtual machine, the loop being in the last one
+    size_t frame_count;
+    enum runtime_type* entry_types;
+    struct trace_step* steps;
+};
+
+struct jit {
+    const struct bytecode_program* program;
+    // One per function of the program, never reallocated as compiled code
+    // calls through their entry
+    struct jit_function* functions;
+    struct trace_recorder recorder;
+};
+
+// Iterations after which a loop is recorded
+static const int JIT_LOOP_THRESHOLD = 50;
+
+static const int JIT_MAX_TRACE_ABORTS = 3;
+
+// Calls in progress, checked against MAX_RECURSION_DEPTH by compiled code
+extern long jit_recursion_depth;
+
+struct jit* create_jit(const struct bytecode_program* program);
+
+void destroy_jit(struct jit* jit);
+
+// Compiles a function whose parameters are integers, along with the functions
+// it calls. global_function_slots are the function slots of the main frame.
+// Returns false when the function does not fit, it is then never compiled.
+bool jit_compile_function(struct jit* jit, const struct bytecode_function* function, const struct bytecode_function** global_function_slots);
+
+struct jit_loop* jit_get_loop(struct jit* jit, const struct bytecode_function* function, int anchor);
+
+// Records the instructions run from the start of a loop body until the loop
+// jumps back to it
+void jit_start_recording(struct jit* jit, const struct bytecode_function* function, int anchor, size_t frame_count, const struct runtime_value* registers);
+
+// Records an instruction about to run, returns false if the trace is aborted
+bool jit_record_instruction(struct jit* jit, int index, const struct runtime_value* registers);
+
+// Compiles the recorded trace once the loop jumps back to its start
+void jit_finish_recording(struct jit* jit, const struct bytecode_function** global_function_slots);
+
+void jit_abort_recording(struct jit* jit);
+
+#endif
@@ -216,6 +216,8 @@ struct token* tokenize(const char* input) {
                 token.type = TOKEN_NULL;
             } else if (strcmp(substr, "for") == 0) {
                 token.type = TOKEN_FOR;
+            } else if (strcmp(substr, "match") == 0) {
+                token.type = TOKEN_MATCH;
             } else {
                 token.type = TOKEN_IDENTIFIER;
                 token.value.str = substr;
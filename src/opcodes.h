@@ -0,0 +1,51 @@
+#if !defined(CHAD_INTERPRETER_OPCODE)
+#error You must define CHAD_INTERPRETER_OPCODE before including this file
+#endif
+
+// Operands a, b and c are registers of the current frame unless noted
+// otherwise, variable slots being the lowest registers of the frame
+
+CHAD_INTERPRETER_OPCODE(LOAD_CONST)          // a = constants[b]
+CHAD_INTERPRETER_OPCODE(MOVE)                // a = b
+CHAD_INTERPRETER_OPCODE(LOAD_NAME)           // a = variable symbols[b], looked up through every frame
+CHAD_INTERPRETER_OPCODE(LOAD_GLOBAL)         // a = slot b of the main frame
+CHAD_INTERPRETER_OPCODE(CHECK_SHADOW)        // fail if the visible variable symbols[a] is constant
+CHAD_INTERPRETER_OPCODE(DECLARE)             // declare slot a = b, constant if c
+CHAD_INTERPRETER_OPCODE(DECLARE_NULL)        // declare slot a = null, constant if c
+CHAD_INTERPRETER_OPCODE(CHECK_MUTABLE)       // fail if slot a is constant
+CHAD_INTERPRETER_OPCODE(ASSIGN)              // slot a = b, which must keep its type
+CHAD_INTERPRETER_OPCODE(CHECK_ASSIGN_NAME)   // fail if variable symbols[a] is missing or constant
+CHAD_INTERPRETER_OPCODE(STORE_NAME)          // variable symbols[a] = b
+CHAD_INTERPRETER_OPCODE(CHECK_ASSIGN_GLOBAL) // fail if slot a of the main frame is missing or constant
+CHAD_INTERPRETER_OPCODE(STORE_GLOBAL)        // slot a of the main frame = b
+
+// a = b <op> c, and a = b <op> constants[c] for the _IMM variants
+#define CHAD_INTERPRETER_BINARY_OP(X, Y) \
+    CHAD_INTERPRETER_OPCODE(X)           \
+    CHAD_INTERPRETER_OPCODE(X##_IMM)
+#include "binary_ops.h"
+
+CHAD_INTERPRETER_OPCODE(CONCAT)              // a = sum of the c registers from b, into a single string
+CHAD_INTERPRETER_OPCODE(APPEND)              // slot a = a + sum of the c registers from b, in place when unshared
+CHAD_INTERPRETER_OPCODE(NEG)                 // a = -b
+CHAD_INTERPRETER_OPCODE(NOT)                 // a = !b
+CHAD_INTERPRETER_OPCODE(CHECK_LOGICAL)       // fail if a, an operand of && or ||, is not a boolean
+
+CHAD_INTERPRETER_OPCODE(JUMP)                // jump to instruction a
+CHAD_INTERPRETER_OPCODE(JUMP_IF_TRUE)        // jump to instruction b if a, type checked as condition c
+CHAD_INTERPRETER_OPCODE(JUMP_IF_FALSE)       // jump to instruction b if !a, type checked as condition c
+CHAD_INTERPRETER_OPCODE(MATCH)               // jump to the arm of match site b selected by a
+CHAD_INTERPRETER_OPCODE(KILL)                // undeclare slots a to a + b
+CHAD_INTERPRETER_OPCODE(KILL_FUNCTIONS)      // undeclare function slots a to a + b
+
+CHAD_INTERPRETER_OPCODE(DECLARE_FUNCTION)    // function slot a = functions[b]
+CHAD_INTERPRETER_OPCODE(RESOLVE_FUNCTION)    // resolve call site a before its arguments are evaluated
+CHAD_INTERPRETER_OPCODE(CALL)                // a = call site b
+CHAD_INTERPRETER_OPCODE(CHECK_BUILTIN)       // fail if call site a has a wrong arity
+CHAD_INTERPRETER_OPCODE(CALL_BUILTIN)        // a = builtin call site b
+CHAD_INTERPRETER_OPCODE(PRINT)               // print a followed by a space
+CHAD_INTERPRETER_OPCODE(PRINT_NEWLINE)       // print a newline, a = null
+CHAD_INTERPRETER_OPCODE(RETURN)              // return a
+CHAD_INTERPRETER_OPCODE(RETURN_NULL)
+
+#undef CHAD_INTERPRETER_OPCODE
@@ -0,0 +1,2091 @@
+#include <string.h>
+
+#include "optimizer.h"
+#include "builtins.h"
+#include "interpreter.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "str.h"
+#include "timing.h"
+
+// Bigger return expressions are not worth duplicating at every call site
+static const int MAX_INLINE_EXPR_SIZE = 32;
+
+struct name_count_entry {
+    char* key;
+    int value;
+};
+
+struct function_decl_entry {
+    char* key;
+    struct statement* value;
+};
+
+struct inliner {
+    struct name_count_entry* declaration_counts;
+    struct function_decl_entry* candidates;
+    // Variables certainly declared at the current point, innermost last
+    char** declared;
+    // How many of them are top-level variables, visible to any function body
+    size_t global_count;
+};
+
+static bool is_pure_builtin(const char* fn_name) {
+    builtin_fn_t fn_type = is_builtin_fn(fn_name);
+
+    return fn_type == BUILTIN_FN_TYPE || fn_type == BUILTIN_FN_LEN || fn_type == BUILTIN_FN_AT || fn_type == BUILTIN_FN_FORMAT || fn_type == BUILTIN_FN_SUBSTR;
+}
+
+// Pure expressions have no side effects, but they can still fail at runtime
+static bool expr_is_pure(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return expr_is_pure(expr->op.binary.lhs) && expr_is_pure(expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return expr_is_pure(expr->op.unary.arg);
+        case EXPR_FUNCTION_CALL:
+            if (!is_pure_builtin(expr->op.function_call.name)) return false;
+
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                if (!expr_is_pure(*arg)) return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+static bool expr_is_trivial(const struct expr* expr) {
+    return expr->type != EXPR_BINARY_OPT && expr->type != EXPR_UNARY_OPT && expr->type != EXPR_FUNCTION_CALL;
+}
+
+static int expr_size(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return 1 + expr_size(expr->op.binary.lhs) + expr_size(expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return 1 + expr_size(expr->op.unary.arg);
+        case EXPR_FUNCTION_CALL: {
+            int size = 1;
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                size += expr_size(*arg);
+            }
+            return size;
+        }
+        default:
+            return 1;
+    }
+}
+
+static int count_variable_uses(const struct expr* expr, const char* variable_name) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return count_variable_uses(expr->op.binary.lhs, variable_name) + count_variable_uses(expr->op.binary.rhs, variable_name);
+        case EXPR_UNARY_OPT:
+            return count_variable_uses(expr->op.unary.arg, variable_name);
+        case EXPR_VARIABLE_USE:
+            return strcmp(expr->op.variable_use.name, variable_name) == 0;
+        case EXPR_FUNCTION_CALL: {
+            int count = 0;
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                count += count_variable_uses(*arg, variable_name);
+            }
+            return count;
+        }
+        default:
+            return 0;
+    }
+}
+
+static void count_function_declarations(struct inliner* inliner, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                count_function_declarations(inliner, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            count_function_declarations(inliner, statement->op.if_condition.body);
+            count_function_declarations(inliner, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                count_function_declarations(inliner, *arm);
+            }
+            count_function_declarations(inliner, statement->op.match.body_else);
+            break;
+        case STATEMENT_FUNCTION_DECL: {
+            char* fn_name = statement->op.function_declaration.fn_name;
+            int count = shget(inliner->declaration_counts, fn_name);
+            shput(inliner->declaration_counts, fn_name, count + 1);
+            count_function_declarations(inliner, statement->op.function_declaration.body);
+            break;
+        }
+        case STATEMENT_WHILE_LOOP:
+            count_function_declarations(inliner, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            count_function_declarations(inliner, statement->op.for_loop.initializer);
+            count_function_declarations(inliner, statement->op.for_loop.increment);
+            count_function_declarations(inliner, statement->op.for_loop.body);
+            break;
+        default:
+            break;
+    }
+}
+
+// A function can be inlined when its body is a single `return <pure expr>;` and
+// its name always resolves to this declaration
+static bool is_inlinable_function(struct inliner* inliner, struct statement* fn) {
+    char* fn_name = fn->op.function_declaration.fn_name;
+    char** parameters = fn->op.function_declaration.arguments;
+    struct statement** body = fn->op.function_declaration.body->op.block.statements;
+
+    if (shget(inliner->declaration_counts, fn_name) != 1 || is_builtin_fn(fn_name) != -1)
+        return false;
+
+    if (arrlen(body) != 1 || body[0]->type != STATEMENT_RETURN || body[0]->op.return_statement.value == NULL)
+        return false;
+
+    struct expr* value = body[0]->op.return_statement.value;
+
+    if (!expr_is_pure(value) || expr_size(value) > MAX_INLINE_EXPR_SIZE)
+        return false;
+
+    // Duplicated parameter names make the last argument win, keep the call
+    for (size_t i = 0; i < arrlen(parameters); i++) {
+        for (size_t j = i + 1; j < arrlen(parameters); j++) {
+            if (strcmp(parameters[i], parameters[j]) == 0) return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_declared(struct inliner* inliner, const char* variable_name) {
+    for (size_t i = arrlen(inliner->declared); i > 0; i--) {
+        if (strcmp(inliner->declared[i - 1], variable_name) == 0) return true;
+    }
+
+    return false;
+}
+
+static bool argument_can_fail(struct inliner* inliner, const struct expr* argument) {
+    switch (argument->type) {
+        case EXPR_BOOL_LITERAL:
+        case EXPR_INT_LITERAL:
+        case EXPR_FLOAT_LITERAL:
+        case EXPR_STRING_LITERAL:
+        case EXPR_NULL:
+            return false;
+        case EXPR_VARIABLE_USE:
+            return !is_declared(inliner, argument->op.variable_use.name);
+        default:
+            return true;
+    }
+}
+
+// Follows the evaluation order of the inlined body. The arguments that can
+// fail must each be evaluated exactly once, in call order, and before anything
+// else in the body can fail, so that the first error is still the same
+struct evaluation_order {
+    struct inliner* inliner;
+    char** parameters;
+    bool* can_fail;
+    size_t* failing;
+    size_t next;
+    bool valid;
+};
+
+static int find_parameter(char** parameters, const char* variable_name) {
+    for (size_t i = 0; i < arrlen(parameters); i++) {
+        if (strcmp(parameters[i], variable_name) == 0) return (int) i;
+    }
+
+    return -1;
+}
+
+static bool uses_failing_argument(struct evaluation_order* order, const struct expr* expr) {
+    for (size_t i = 0; i < arrlen(order->parameters); i++) {
+        if (order->can_fail[i] && count_variable_uses(expr, order->parameters[i]) > 0) return true;
+    }
+
+    return false;
+}
+
+static void check_may_fail(struct evaluation_order* order) {
+    if (order->next != arrlen(order->failing)) order->valid = false;
+}
+
+static void check_evaluation_order(struct evaluation_order* order, const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+        case EXPR_INT_LITERAL:
+        case EXPR_FLOAT_LITERAL:
+        case EXPR_STRING_LITERAL:
+        case EXPR_NULL:
+            break;
+        case EXPR_VARIABLE_USE: {
+            int parameter = find_parameter(order->parameters, expr->op.variable_use.name);
+
+            if (parameter < 0) {
+                if (!is_declared(order->inliner, expr->op.variable_use.name)) check_may_fail(order);
+            } else if (order->can_fail[parameter]) {
+                if (order->next < arrlen(order->failing) && order->failing[order->next] == (size_t) parameter) {
+                    order->next++;
+                } else {
+                    order->valid = false;
+                }
+            }
+            break;
+        }
+        case EXPR_BINARY_OPT:
+            check_evaluation_order(order, expr->op.binary.lhs);
+
+            // The right-hand side may be skipped, don't move an argument there
+            if (is_logical_binary_op(expr->op.binary.type) && uses_failing_argument(order, expr->op.binary.rhs)) {
+                order->valid = false;
+                break;
+            }
+
+            if (!is_logical_binary_op(expr->op.binary.type))
+                check_evaluation_order(order, expr->op.binary.rhs);
+            check_may_fail(order);
+            break;
+        case EXPR_UNARY_OPT:
+            check_evaluation_order(order, expr->op.unary.arg);
+            check_may_fail(order);
+            break;
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                check_evaluation_order(order, *arg);
+            }
+            check_may_fail(order);
+            break;
+        default:
+            check_may_fail(order);
+            break;
+    }
+}
+
+static bool can_inline_call(struct inliner* inliner, struct statement* fn, struct expr* function_call) {
+    char** parameters = fn->op.function_declaration.arguments;
+    struct expr** arguments = function_call->op.function_call.arguments;
+    struct expr* value = fn->op.function_declaration.body->op.block.statements[0]->op.return_statement.value;
+
+    if (arrlen(parameters) != arrlen(arguments)) return false;
+
+    struct evaluation_order order = {
+            .inliner = inliner,
+            .parameters = parameters,
+            .can_fail = NULL,
+            .failing = NULL,
+            .next = 0,
+            .valid = true,
+    };
+
+    // Arguments are evaluated before the body: an argument that can't fail
+    // may be dropped, reordered or duplicated, the others must stay in place
+    for (size_t i = 0; i < arrlen(arguments); i++) {
+        if (!expr_is_pure(arguments[i])) {
+            order.valid = false;
+            break;
+        }
+
+        bool can_fail = argument_can_fail(inliner, arguments[i]);
+        arrpush(order.can_fail, can_fail);
+        if (can_fail) arrpush(order.failing, i);
+    }
+
+    if (order.valid) {
+        check_evaluation_order(&order, value);
+        check_may_fail(&order);
+    }
+
+    arrfree(order.can_fail);
+    arrfree(order.failing);
+
+    return order.valid;
+}
+
+static struct expr* substitute_parameters(const struct expr* expr, char** parameters, struct expr** arguments) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return make_binary_op(expr->op.binary.type, substitute_parameters(expr->op.binary.lhs, parameters, arguments), substitute_parameters(expr->op.binary.rhs, parameters, arguments));
+        case EXPR_UNARY_OPT:
+            return make_unary_op(expr->op.unary.type, substitute_parameters(expr->op.unary.arg, parameters, arguments));
+        case EXPR_VARIABLE_USE:
+            for (size_t i = 0; i < arrlen(parameters); i++) {
+                if (strcmp(expr->op.variable_use.name, parameters[i]) == 0) {
+                    return clone_expr(arguments[i]);
+                }
+            }
+            return clone_expr(expr);
+        case EXPR_FUNCTION_CALL: {
+            struct expr* function_call = make_function_call(expr->op.function_call.name);
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                arrpush(function_call->op.function_call.arguments, substitute_parameters(*arg, parameters, arguments));
+            }
+            return function_call;
+        }
+        default:
+            return clone_expr(expr);
+    }
+}
+
+static void inline_expr(struct inliner* inliner, struct expr** slot) {
+    struct expr* expr = *slot;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            inline_expr(inliner, &expr->op.binary.lhs);
+            inline_expr(inliner, &expr->op.binary.rhs);
+            break;
+        case EXPR_UNARY_OPT:
+            inline_expr(inliner, &expr->op.unary.arg);
+            break;
+        case EXPR_FUNCTION_CALL: {
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                inline_expr(inliner, arg);
+            }
+
+            if (inliner->candidates == NULL) break;
+
+            struct statement* fn = shget(inliner->candidates, expr->op.function_call.name);
+
+            if (fn == NULL || !can_inline_call(inliner, fn, expr)) break;
+
+            struct expr* value = fn->op.function_declaration.body->op.block.statements[0]->op.return_statement.value;
+
+            *slot = substitute_parameters(value, fn->op.function_declaration.arguments, expr->op.function_call.arguments);
+            destroy_expr(expr);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void inline_statement(struct inliner* inliner, struct statement* statement);
+
+// Names declared in the statement are forgotten at the end of its scope
+static void inline_scoped_statement(struct inliner* inliner, struct statement* statement) {
+    size_t declared_count = arrlen(inliner->declared);
+
+    inline_statement(inliner, statement);
+    arrsetlen(inliner->declared, declared_count);
+}
+
+static void inline_statement(struct inliner* inliner, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                inline_statement(inliner, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            inline_expr(inliner, &statement->op.if_condition.condition);
+            inline_scoped_statement(inliner, statement->op.if_condition.body);
+            inline_scoped_statement(inliner, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            inline_expr(inliner, &statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                inline_scoped_statement(inliner, *arm);
+            }
+            inline_scoped_statement(inliner, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            if (statement->op.variable_declaration.value != NULL)
+                inline_expr(inliner, &statement->op.variable_declaration.value);
+            arrpush(inliner->declared, statement->op.variable_declaration.variable_name);
+            break;
+        case STATEMENT_FUNCTION_DECL: {
+            // The body may run anywhere after the declaration, where only the
+            // top-level variables and the parameters are known to exist
+            char** declared = inliner->declared;
+            inliner->declared = NULL;
+
+            for (size_t i = 0; i < inliner->global_count; i++) {
+                arrpush(inliner->declared, declared[i]);
+            }
+            FOR_EACH(char*, arg, statement->op.function_declaration.arguments) {
+                arrpush(inliner->declared, *arg);
+            }
+
+            inline_statement(inliner, statement->op.function_declaration.body);
+
+            arrfree(inliner->declared);
+            inliner->declared = declared;
+            break;
+        }
+        case STATEMENT_VARIABLE_ASSIGN:
+            inline_expr(inliner, &statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            // Keep the call itself, a discarded pure expression is not a statement
+            FOR_EACH(struct expr*, arg, statement->op.naked_fn_call.function_call->op.function_call.arguments) {
+                inline_expr(inliner, arg);
+            }
+            break;
+        case STATEMENT_WHILE_LOOP:
+            inline_expr(inliner, &statement->op.while_loop.condition);
+            inline_scoped_statement(inliner, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP: {
+            size_t declared_count = arrlen(inliner->declared);
+
+            inline_statement(inliner, statement->op.for_loop.initializer);
+            inline_expr(inliner, &statement->op.for_loop.condition);
+            inline_scoped_statement(inliner, statement->op.for_loop.increment);
+            inline_scoped_statement(inliner, statement->op.for_loop.body);
+            arrsetlen(inliner->declared, declared_count);
+            break;
+        }
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL)
+                inline_expr(inliner, &statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+void inline_functions(struct statement* program) {
+    struct inliner inliner = {
+            .declaration_counts = NULL,
+            .candidates = NULL,
+            .declared = NULL,
+            .global_count = 0,
+    };
+
+    count_function_declarations(&inliner, program);
+
+    // Only top-level declarations are candidates, and only for the code that
+    // follows them: a call placed before the declaration must still fail
+    FOR_EACH(struct statement*, it, program->op.block.statements) {
+        inline_statement(&inliner, *it);
+        inliner.global_count = arrlen(inliner.declared);
+
+        if ((*it)->type == STATEMENT_FUNCTION_DECL && is_inlinable_function(&inliner, *it)) {
+            shput(inliner.candidates, (*it)->op.function_declaration.fn_name, *it);
+        }
+    }
+
+    shfree(inliner.declaration_counts);
+    shfree(inliner.candidates);
+    arrfree(inliner.declared);
+}
+
+struct literal_entry {
+    char* key;
+    struct expr* value;
+};
+
+struct constant_folder {
+    struct name_count_entry* declaration_counts;
+    struct literal_entry* constants;
+};
+
+static bool is_literal(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BOOL_LITERAL:
+        case EXPR_INT_LITERAL:
+        case EXPR_FLOAT_LITERAL:
+        case EXPR_STRING_LITERAL:
+        case EXPR_NULL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static struct expr* make_literal(const struct runtime_value* value) {
+    switch (value->type) {
+        case RUNTIME_TYPE_STRING:
+            return make_string_literal(get_string_chars(value));
+        case RUNTIME_TYPE_INTEGER:
+            return make_integer_literal(value->value.integer);
+        case RUNTIME_TYPE_FLOAT:
+            return make_float_literal(value->value.floating);
+        case RUNTIME_TYPE_BOOLEAN:
+            return make_bool_literal(value->value.boolean);
+        case RUNTIME_TYPE_NULL:
+            return make_null();
+    }
+
+    return NULL;
+}
+
+// Variable declarations and function parameters, which both bind a name, and
+// when constant_counts isn't NULL the constant declarations
+static void count_declarations(struct name_count_entry** counts, struct name_count_entry** constant_counts, const struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                count_declarations(counts, constant_counts, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+        case STATEMENT_SIMPLE_IF:
+            count_declarations(counts, constant_counts, statement->op.if_condition.body);
+            count_declarations(counts, constant_counts, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                count_declarations(counts, constant_counts, *arm);
+            }
+            count_declarations(counts, constant_counts, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL: {
+            int count = shget(*counts, statement->op.variable_declaration.variable_name);
+            shput(*counts, statement->op.variable_declaration.variable_name, count + 1);
+
+            if (constant_counts != NULL && statement->op.variable_declaration.is_constant) {
+                int constant_count = shget(*constant_counts, statement->op.variable_declaration.variable_name);
+                shput(*constant_counts, statement->op.variable_declaration.variable_name, constant_count + 1);
+            }
+            break;
+        }
+        case STATEMENT_FUNCTION_DECL:
+            FOR_EACH(char*, arg, statement->op.function_declaration.arguments) {
+                int count = shget(*counts, *arg);
+                shput(*counts, *arg, count + 1);
+            }
+            count_declarations(counts, constant_counts, statement->op.function_declaration.body);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            count_declarations(counts, constant_counts, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            count_declarations(counts, constant_counts, statement->op.for_loop.initializer);
+            count_declarations(counts, constant_counts, statement->op.for_loop.increment);
+            count_declarations(counts, constant_counts, statement->op.for_loop.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static void count_variable_declarations(struct name_count_entry** counts, const struct statement* statement) {
+    count_declarations(counts, NULL, statement);
+}
+
+// Only operations that can't fail at runtime are folded, the others are kept
+// so that the error is still reported when (and if) they are executed
+static bool can_fold_binary_op(enum binary_op_type op_type, const struct expr* lhs, const struct expr* rhs) {
+    if (!is_literal(lhs) || lhs->type != rhs->type) return false;
+
+    if (is_arithmetic_binary_op(op_type)) {
+        switch (lhs->type) {
+            case EXPR_INT_LITERAL:
+                // Also skip -1, LONG_MIN / -1 traps
+                if (op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO)
+                    return rhs->op.integer_literal != 0 && rhs->op.integer_literal != -1;
+                return true;
+            case EXPR_FLOAT_LITERAL:
+                return op_type != BINARY_OP_MODULO && !(op_type == BINARY_OP_DIV && rhs->op.float_literal == 0);
+            case EXPR_STRING_LITERAL:
+                return op_type == BINARY_OP_ADD;
+            default:
+                return false;
+        }
+    } else if (is_logical_binary_op(op_type)) {
+        return lhs->type == EXPR_BOOL_LITERAL;
+    } else {
+        return lhs->type == EXPR_STRING_LITERAL || lhs->type == EXPR_INT_LITERAL || lhs->type == EXPR_FLOAT_LITERAL;
+    }
+}
+
+static bool can_fold_unary_op(enum unary_op_type op_type, const struct expr* arg) {
+    if (op_type == UNARY_OP_NOT) return arg->type == EXPR_BOOL_LITERAL;
+
+    return arg->type == EXPR_INT_LITERAL || arg->type == EXPR_FLOAT_LITERAL;
+}
+
+static void fold_expr(struct constant_folder* folder, struct expr** slot) {
+    struct expr* expr = *slot;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            fold_expr(folder, &expr->op.binary.lhs);
+            fold_expr(folder, &expr->op.binary.rhs);
+
+            if (can_fold_binary_op(expr->op.binary.type, expr->op.binary.lhs, expr->op.binary.rhs)) {
+                // Literals don't need a context to be evaluated
+                struct runtime_value value = evaluate_binary_op(NULL, expr->op.binary.type, expr->op.binary.lhs, expr->op.binary.rhs);
+                *slot = make_literal(&value);
+                destroy_value(&value);
+                destroy_expr(expr);
+            }
+            break;
+        case EXPR_UNARY_OPT:
+            fold_expr(folder, &expr->op.unary.arg);
+
+            if (can_fold_unary_op(expr->op.unary.type, expr->op.unary.arg)) {
+                struct runtime_value value = evaluate_unary_op(NULL, expr->op.unary.type, expr->op.unary.arg);
+                *slot = make_literal(&value);
+                destroy_expr(expr);
+            }
+            break;
+        case EXPR_VARIABLE_USE: {
+            if (folder->constants == NULL) break;
+
+            struct expr* constant = shget(folder->constants, expr->op.variable_use.name);
+
+            if (constant != NULL) {
+                *slot = clone_expr(constant);
+                destroy_expr(expr);
+            }
+            break;
+        }
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                fold_expr(folder, arg);
+            }
+            break;
+        case EXPR_LOOP_INVARIANT:
+            fold_expr(folder, &expr->op.loop_invariant.value);
+            break;
+        default:
+            break;
+    }
+}
+
+static void fold_statement(struct constant_folder* folder, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                fold_statement(folder, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            fold_expr(folder, &statement->op.if_condition.condition);
+            fold_statement(folder, statement->op.if_condition.body);
+            fold_statement(folder, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            fold_expr(folder, &statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                fold_statement(folder, *arm);
+            }
+            fold_statement(folder, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            if (statement->op.variable_declaration.value != NULL)
+                fold_expr(folder, &statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            fold_statement(folder, statement->op.function_declaration.body);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            fold_expr(folder, &statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            FOR_EACH(struct expr*, arg, statement->op.naked_fn_call.function_call->op.function_call.arguments) {
+                fold_expr(folder, arg);
+            }
+            break;
+        case STATEMENT_WHILE_LOOP:
+            fold_expr(folder, &statement->op.while_loop.condition);
+            fold_statement(folder, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            fold_statement(folder, statement->op.for_loop.initializer);
+            fold_expr(folder, &statement->op.for_loop.condition);
+            fold_statement(folder, statement->op.for_loop.increment);
+            fold_statement(folder, statement->op.for_loop.body);
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL)
+                fold_expr(folder, &statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+void fold_constants(struct statement* program) {
+    struct constant_folder folder = {
+            .declaration_counts = NULL,
+            .constants = NULL,
+    };
+
+    count_variable_declarations(&folder.declaration_counts, program);
+
+    // Top-level constants initialized with a literal are propagated into the
+    // code that follows them, as long as nothing else binds the same name.
+    // Strings are left alone as a literal is copied each time it is evaluated.
+    FOR_EACH(struct statement*, it, program->op.block.statements) {
+        struct statement* statement = *it;
+
+        fold_statement(&folder, statement);
+
+        if (statement->type != STATEMENT_VARIABLE_DECL || !statement->op.variable_declaration.is_constant)
+            continue;
+
+        char* variable_name = statement->op.variable_declaration.variable_name;
+        struct expr* value = statement->op.variable_declaration.value;
+
+        if (value != NULL && is_literal(value) && value->type != EXPR_STRING_LITERAL && shget(folder.declaration_counts, variable_name) == 1) {
+            shput(folder.constants, variable_name, value);
+        }
+    }
+
+    shfree(folder.declaration_counts);
+    shfree(folder.constants);
+}
+
+struct dead_code_eliminator {
+    struct name_count_entry* reads;
+    struct name_count_entry* writes;
+    struct name_count_entry* constants;
+};
+
+static void count_reads(struct dead_code_eliminator* eliminator, const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            count_reads(eliminator, expr->op.binary.lhs);
+            count_reads(eliminator, expr->op.binary.rhs);
+            break;
+        case EXPR_UNARY_OPT:
+            count_reads(eliminator, expr->op.unary.arg);
+            break;
+        case EXPR_VARIABLE_USE:
+            shput(eliminator->reads, expr->op.variable_use.name, 1);
+            break;
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                count_reads(eliminator, *arg);
+            }
+            break;
+        case EXPR_LOOP_INVARIANT:
+            count_reads(eliminator, expr->op.loop_invariant.value);
+            break;
+        default:
+            break;
+    }
+}
+
+static void count_accesses(struct dead_code_eliminator* eliminator, const struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                count_accesses(eliminator, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            count_reads(eliminator, statement->op.if_condition.condition);
+            count_accesses(eliminator, statement->op.if_condition.body);
+            count_accesses(eliminator, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            count_reads(eliminator, statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                count_accesses(eliminator, *arm);
+            }
+            count_accesses(eliminator, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            if (statement->op.variable_declaration.is_constant)
+                shput(eliminator->constants, statement->op.variable_declaration.variable_name, 1);
+            if (statement->op.variable_declaration.value != NULL)
+                count_reads(eliminator, statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            count_accesses(eliminator, statement->op.function_declaration.body);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            shput(eliminator->writes, statement->op.variable_assignment.variable_name, 1);
+            count_reads(eliminator, statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            count_reads(eliminator, statement->op.naked_fn_call.function_call);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            count_reads(eliminator, statement->op.while_loop.condition);
+            count_accesses(eliminator, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            count_accesses(eliminator, statement->op.for_loop.initializer);
+            count_reads(eliminator, statement->op.for_loop.condition);
+            count_accesses(eliminator, statement->op.for_loop.increment);
+            count_accesses(eliminator, statement->op.for_loop.body);
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL)
+                count_reads(eliminator, statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+// Blocks don't open a scope, only `if` and loops do
+static bool block_declares_names(const struct statement* block) {
+    FOR_EACH(struct statement*, it, block->op.block.statements) {
+        struct statement* statement = *it;
+
+        if (statement->type == STATEMENT_VARIABLE_DECL || statement->type == STATEMENT_FUNCTION_DECL)
+            return true;
+
+        if (statement->type == STATEMENT_BLOCK && block_declares_names(statement))
+            return true;
+    }
+
+    return false;
+}
+
+static bool statement_terminates(const struct statement* statement) {
+    switch (statement->type) {
+        case STATEMENT_RETURN:
+        case STATEMENT_BREAK:
+        case STATEMENT_CONTINUE:
+            return true;
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                if (statement_terminates(*it)) return true;
+            }
+            return false;
+        case STATEMENT_IF_CONDITION:
+            return statement->op.if_condition.body_else != NULL && statement_terminates(statement->op.if_condition.body) && statement_terminates(statement->op.if_condition.body_else);
+        case STATEMENT_MATCH:
+            if (statement->op.match.body_else == NULL || !statement_terminates(statement->op.match.body_else))
+                return false;
+
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                if (!statement_terminates(*arm)) return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The variable is never read nor assigned anywhere in the program (any
+// function could see it through dynamic scoping), and dropping it can't hide
+// an error: its initializer is a literal and the name is never a constant
+static bool is_dead_declaration(struct dead_code_eliminator* eliminator, const struct statement* statement) {
+    char* variable_name = statement->op.variable_declaration.variable_name;
+    struct expr* value = statement->op.variable_declaration.value;
+
+    if (statement->op.variable_declaration.is_constant || (value != NULL && !is_literal(value)))
+        return false;
+
+    return shgeti(eliminator->reads, variable_name) < 0 && shgeti(eliminator->writes, variable_name) < 0 && shgeti(eliminator->constants, variable_name) < 0;
+}
+
+static void eliminate_in_block(struct dead_code_eliminator* eliminator, struct statement* block);
+
+// Returns the statement replacing the given one: NULL if it was removed, or a
+// block whose statements must be spliced into the enclosing block
+static struct statement* eliminate_in_statement(struct dead_code_eliminator* eliminator, struct statement* statement) {
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            eliminate_in_block(eliminator, statement);
+            return statement;
+        case STATEMENT_IF_CONDITION: {
+            eliminate_in_block(eliminator, statement->op.if_condition.body);
+
+            if (statement->op.if_condition.body_else != NULL)
+                statement->op.if_condition.body_else = eliminate_in_statement(eliminator, statement->op.if_condition.body_else);
+
+            struct expr* condition = statement->op.if_condition.condition;
+
+            if (condition->type != EXPR_BOOL_LITERAL) return statement;
+
+            struct statement* taken;
+
+            if (condition->op.bool_literal) {
+                taken = statement->op.if_condition.body;
+                statement->op.if_condition.body = NULL;
+            } else {
+                taken = statement->op.if_condition.body_else;
+                statement->op.if_condition.body_else = NULL;
+            }
+
+            destroy_statement(statement);
+
+            if (taken == NULL || taken->type == STATEMENT_IF_CONDITION) return taken;
+
+            if (block_declares_names(taken)) {
+                // Keep the scope the branch was executed in
+                return make_if_condition_statement(make_bool_literal(true), taken);
+            }
+
+            return taken;
+        }
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                eliminate_in_block(eliminator, *arm);
+            }
+
+            if (statement->op.match.body_else != NULL)
+                statement->op.match.body_else = eliminate_in_statement(eliminator, statement->op.match.body_else);
+            return statement;
+        case STATEMENT_VARIABLE_DECL:
+            if (is_dead_declaration(eliminator, statement)) {
+                destroy_statement(statement);
+                return NULL;
+            }
+            return statement;
+        case STATEMENT_FUNCTION_DECL:
+            eliminate_in_block(eliminator, statement->op.function_declaration.body);
+            return statement;
+        case STATEMENT_WHILE_LOOP: {
+            struct expr* condition = statement->op.while_loop.condition;
+
+            if (condition->type == EXPR_BOOL_LITERAL && !condition->op.bool_literal) {
+                destroy_statement(statement);
+                return NULL;
+            }
+
+            eliminate_in_block(eliminator, statement->op.while_loop.body);
+            return statement;
+        }
+        case STATEMENT_FOR_LOOP:
+            eliminate_in_block(eliminator, statement->op.for_loop.body);
+            return statement;
+        default:
+            return statement;
+    }
+}
+
+static void eliminate_in_block(struct dead_code_eliminator* eliminator, struct statement* block) {
+    struct statement** statements = block->op.block.statements;
+    struct statement** kept = NULL;
+    size_t i = 0;
+
+    while (i < arrlen(statements)) {
+        struct statement* statement = eliminate_in_statement(eliminator, statements[i++]);
+
+        if (statement == NULL) continue;
+
+        if (statement->type == STATEMENT_BLOCK) {
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                arrpush(kept, *it);
+            }
+            arrfree(statement->op.block.statements);
+            free(statement);
+        } else {
+            arrpush(kept, statement);
+        }
+
+        // Everything after a return, break or continue is unreachable
+        if (arrlen(kept) > 0 && statement_terminates(kept[arrlen(kept) - 1])) break;
+    }
+
+    for (; i < arrlen(statements); i++) {
+        destroy_statement(statements[i]);
+    }
+
+    arrfree(statements);
+    block->op.block.statements = kept;
+}
+
+void eliminate_dead_code(struct statement* program) {
+    struct dead_code_eliminator eliminator = {
+            .reads = NULL,
+            .writes = NULL,
+            .constants = NULL,
+    };
+
+    // The maps copy their keys: eliminating a statement frees the names it
+    // holds while the maps are still read
+    sh_new_strdup(eliminator.reads);
+    sh_new_strdup(eliminator.writes);
+    sh_new_strdup(eliminator.constants);
+
+    count_accesses(&eliminator, program);
+    eliminate_in_block(&eliminator, program);
+
+    shfree(eliminator.reads);
+    shfree(eliminator.writes);
+    shfree(eliminator.constants);
+}
+
+static bool expr_has_user_calls(const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return expr_has_user_calls(expr->op.binary.lhs) || expr_has_user_calls(expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return expr_has_user_calls(expr->op.unary.arg);
+        case EXPR_LOOP_INVARIANT:
+            return expr_has_user_calls(expr->op.loop_invariant.value);
+        case EXPR_FUNCTION_CALL:
+            if (is_builtin_fn(expr->op.function_call.name) == -1) return true;
+
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                if (expr_has_user_calls(*arg)) return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Bodies of nested function declarations are skipped: they can only run
+// through a call, which the callers of these helpers check for
+static bool statement_has_user_calls(const struct statement* statement) {
+    if (statement == NULL) return false;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                if (statement_has_user_calls(*it)) return true;
+            }
+            return false;
+        case STATEMENT_IF_CONDITION:
+            return expr_has_user_calls(statement->op.if_condition.condition) || statement_has_user_calls(statement->op.if_condition.body) || statement_has_user_calls(statement->op.if_condition.body_else);
+        case STATEMENT_MATCH:
+            if (expr_has_user_calls(statement->op.match.value) || statement_has_user_calls(statement->op.match.body_else))
+                return true;
+
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                if (statement_has_user_calls(*arm)) return true;
+            }
+            return false;
+        case STATEMENT_VARIABLE_DECL:
+            return statement->op.variable_declaration.value != NULL && expr_has_user_calls(statement->op.variable_declaration.value);
+        case STATEMENT_VARIABLE_ASSIGN:
+            return expr_has_user_calls(statement->op.variable_assignment.value);
+        case STATEMENT_NAKED_FN_CALL:
+            return expr_has_user_calls(statement->op.naked_fn_call.function_call);
+        case STATEMENT_WHILE_LOOP:
+            return expr_has_user_calls(statement->op.while_loop.condition) || statement_has_user_calls(statement->op.while_loop.body);
+        case STATEMENT_FOR_LOOP:
+            return statement_has_user_calls(statement->op.for_loop.initializer) || expr_has_user_calls(statement->op.for_loop.condition) || statement_has_user_calls(statement->op.for_loop.increment) || statement_has_user_calls(statement->op.for_loop.body);
+        case STATEMENT_RETURN:
+            return statement->op.return_statement.value != NULL && expr_has_user_calls(statement->op.return_statement.value);
+        default:
+            return false;
+    }
+}
+
+static void collect_written_variables(const struct statement* statement, struct name_count_entry** written) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                collect_written_variables(*it, written);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            collect_written_variables(statement->op.if_condition.body, written);
+            collect_written_variables(statement->op.if_condition.body_else, written);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                collect_written_variables(*arm, written);
+            }
+            collect_written_variables(statement->op.match.body_else, written);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            shput(*written, statement->op.variable_declaration.variable_name, 1);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            shput(*written, statement->op.variable_assignment.variable_name, 1);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            collect_written_variables(statement->op.while_loop.body, written);
+            break;
+        case STATEMENT_FOR_LOOP:
+            collect_written_variables(statement->op.for_loop.initializer, written);
+            collect_written_variables(statement->op.for_loop.increment, written);
+            collect_written_variables(statement->op.for_loop.body, written);
+            break;
+        default:
+            break;
+    }
+}
+
+struct loop_optimizer {
+    struct name_count_entry* written;
+    struct expr*** invariants;
+};
+
+static bool expr_is_loop_invariant(struct loop_optimizer* optimizer, const struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            return expr_is_loop_invariant(optimizer, expr->op.binary.lhs) && expr_is_loop_invariant(optimizer, expr->op.binary.rhs);
+        case EXPR_UNARY_OPT:
+            return expr_is_loop_invariant(optimizer, expr->op.unary.arg);
+        case EXPR_VARIABLE_USE:
+            return shgeti(optimizer->written, expr->op.variable_use.name) < 0;
+        case EXPR_FUNCTION_CALL:
+            if (!is_pure_builtin(expr->op.function_call.name)) return false;
+
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                if (!expr_is_loop_invariant(optimizer, *arg)) return false;
+            }
+            return true;
+        case EXPR_LOOP_INVARIANT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void hoist_invariants_in_expr(struct loop_optimizer* optimizer, struct expr** slot) {
+    struct expr* expr = *slot;
+
+    if (expr->type == EXPR_LOOP_INVARIANT) return;
+
+    if (!expr_is_trivial(expr) && expr_is_loop_invariant(optimizer, expr)) {
+        *slot = make_loop_invariant(expr);
+        arrpush(*optimizer->invariants, *slot);
+        return;
+    }
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+            hoist_invariants_in_expr(optimizer, &expr->op.binary.lhs);
+            hoist_invariants_in_expr(optimizer, &expr->op.binary.rhs);
+            break;
+        case EXPR_UNARY_OPT:
+            hoist_invariants_in_expr(optimizer, &expr->op.unary.arg);
+            break;
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                hoist_invariants_in_expr(optimizer, arg);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void hoist_invariants_in_statement(struct loop_optimizer* optimizer, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                hoist_invariants_in_statement(optimizer, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            hoist_invariants_in_expr(optimizer, &statement->op.if_condition.condition);
+            hoist_invariants_in_statement(optimizer, statement->op.if_condition.body);
+            hoist_invariants_in_statement(optimizer, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            hoist_invariants_in_expr(optimizer, &statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                hoist_invariants_in_statement(optimizer, *arm);
+            }
+            hoist_invariants_in_statement(optimizer, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            if (statement->op.variable_declaration.value != NULL)
+                hoist_invariants_in_expr(optimizer, &statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            hoist_invariants_in_expr(optimizer, &statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            FOR_EACH(struct expr*, arg, statement->op.naked_fn_call.function_call->op.function_call.arguments) {
+                hoist_invariants_in_expr(optimizer, arg);
+            }
+            break;
+        case STATEMENT_WHILE_LOOP:
+            hoist_invariants_in_expr(optimizer, &statement->op.while_loop.condition);
+            hoist_invariants_in_statement(optimizer, statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            hoist_invariants_in_statement(optimizer, statement->op.for_loop.initializer);
+            hoist_invariants_in_expr(optimizer, &statement->op.for_loop.condition);
+            hoist_invariants_in_statement(optimizer, statement->op.for_loop.increment);
+            hoist_invariants_in_statement(optimizer, statement->op.for_loop.body);
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL)
+                hoist_invariants_in_expr(optimizer, &statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool detect_counted_loop(struct statement* loop) {
+    struct statement* initializer = loop->op.for_loop.initializer;
+    struct expr* condition = loop->op.for_loop.condition;
+    struct statement* increment = loop->op.for_loop.increment;
+
+    if (initializer == NULL || initializer->type != STATEMENT_VARIABLE_DECL || initializer->op.variable_declaration.is_constant || initializer->op.variable_declaration.value == NULL)
+        return false;
+
+    char* counter_name = initializer->op.variable_declaration.variable_name;
+
+    if (condition->type != EXPR_BINARY_OPT || condition->op.binary.lhs->type != EXPR_VARIABLE_USE || strcmp(condition->op.binary.lhs->op.variable_use.name, counter_name) != 0)
+        return false;
+
+    enum binary_op_type comparison = condition->op.binary.type;
+
+    if (comparison != BINARY_OP_LESS && comparison != BINARY_OP_LESS_EQUAL && comparison != BINARY_OP_GREATER && comparison != BINARY_OP_GREATER_EQUAL)
+        return false;
+
+    if (increment == NULL || increment->type != STATEMENT_VARIABLE_ASSIGN || strcmp(increment->op.variable_assignment.variable_name, counter_name) != 0)
+        return false;
+
+    struct expr* step_expr = increment->op.variable_assignment.value;
+
+    if (step_expr->type != EXPR_BINARY_OPT || (step_expr->op.binary.type != BINARY_OP_ADD && step_expr->op.binary.type != BINARY_OP_SUB))
+        return false;
+
+    if (step_expr->op.binary.lhs->type != EXPR_VARIABLE_USE || strcmp(step_expr->op.binary.lhs->op.variable_use.name, counter_name) != 0 || step_expr->op.binary.rhs->type != EXPR_INT_LITERAL)
+        return false;
+
+    long step = step_expr->op.binary.rhs->op.integer_literal;
+
+    if (step_expr->op.binary.type == BINARY_OP_SUB) step = -step;
+
+    // The counter must move toward the bound
+    bool ascending = comparison == BINARY_OP_LESS || comparison == BINARY_OP_LESS_EQUAL;
+
+    if ((ascending && step <= 0) || (!ascending && step >= 0))
+        return false;
+
+    // Any call could write the counter or the bound through dynamic scoping
+    if (statement_has_user_calls(loop->op.for_loop.body) || expr_has_user_calls(condition))
+        return false;
+
+    struct loop_optimizer optimizer = {
+            .written = NULL,
+            .invariants = NULL,
+    };
+
+    collect_written_variables(loop->op.for_loop.body, &optimizer.written);
+    bool counter_written = shgeti(optimizer.written, counter_name) >= 0;
+    shput(optimizer.written, counter_name, 1);
+    bool bound_invariant = expr_is_loop_invariant(&optimizer, condition->op.binary.rhs);
+    shfree(optimizer.written);
+
+    if (counter_written || !bound_invariant)
+        return false;
+
+    loop->op.for_loop.is_counted = true;
+    loop->op.for_loop.counted_step = step;
+
+    return true;
+}
+
+static void optimize_loops_in_statement(struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                optimize_loops_in_statement(*it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            optimize_loops_in_statement(statement->op.if_condition.body);
+            optimize_loops_in_statement(statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                optimize_loops_in_statement(*arm);
+            }
+            optimize_loops_in_statement(statement->op.match.body_else);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            optimize_loops_in_statement(statement->op.function_declaration.body);
+            break;
+        case STATEMENT_WHILE_LOOP: {
+            // Hoisting is done from the outermost loop so that an expression is
+            // computed once per entry in the widest loop it is invariant in
+            if (!statement_has_user_calls(statement)) {
+                struct loop_optimizer optimizer = {
+                        .written = NULL,
+                        .invariants = &statement->op.while_loop.invariants,
+                };
+
+                collect_written_variables(statement, &optimizer.written);
+                hoist_invariants_in_expr(&optimizer, &statement->op.while_loop.condition);
+                hoist_invariants_in_statement(&optimizer, statement->op.while_loop.body);
+                shfree(optimizer.written);
+            }
+
+            optimize_loops_in_statement(statement->op.while_loop.body);
+            break;
+        }
+        case STATEMENT_FOR_LOOP: {
+            detect_counted_loop(statement);
+
+            if (!statement_has_user_calls(statement)) {
+                struct loop_optimizer optimizer = {
+                        .written = NULL,
+                        .invariants = &statement->op.for_loop.invariants,
+                };
+
+                collect_written_variables(statement, &optimizer.written);
+                hoist_invariants_in_expr(&optimizer, &statement->op.for_loop.condition);
+                hoist_invariants_in_statement(&optimizer, statement->op.for_loop.increment);
+                hoist_invariants_in_statement(&optimizer, statement->op.for_loop.body);
+                shfree(optimizer.written);
+            }
+
+            optimize_loops_in_statement(statement->op.for_loop.body);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void optimize_loops(struct statement* program) {
+    optimize_loops_in_statement(program);
+}
+
+static bool is_addition(const struct expr* expr) {
+    return expr->type == EXPR_BINARY_OPT && expr->op.binary.type == BINARY_OP_ADD;
+}
+
+// A chain of additions holding a string literal only succeeds if all its
+// operands are strings, it is then concatenated into a single allocation
+static struct expr* fuse_concat(struct expr* chain) {
+    struct expr** operands = NULL;
+    bool has_string_literal = false;
+
+    for (struct expr* it = chain; is_addition(it); it = it->op.binary.lhs) {
+        arrpush(operands, it->op.binary.rhs);
+        if (!is_addition(it->op.binary.lhs)) arrpush(operands, it->op.binary.lhs);
+    }
+
+    FOR_EACH(struct expr*, operand, operands) {
+        has_string_literal |= (*operand)->type == EXPR_STRING_LITERAL;
+    }
+
+    if (arrlen(operands) < 3 || !has_string_literal) {
+        arrfree(operands);
+        return NULL;
+    }
+
+    struct expr* concat = make_concat();
+
+    // Collected from the last operand
+    for (ptrdiff_t i = arrlen(operands) - 1; i >= 0; i--) {
+        if (arrlen(concat->op.concat.operands) == MAX_CONCAT_OPERANDS) {
+            struct expr* head = concat;
+            concat = make_concat();
+            arrpush(concat->op.concat.operands, head);
+        }
+
+        arrpush(concat->op.concat.operands, operands[i]);
+    }
+
+    arrfree(operands);
+
+    while (is_addition(chain)) {
+        struct expr* lhs = chain->op.binary.lhs;
+        chain->op.binary.lhs = NULL;
+        chain->op.binary.rhs = NULL;
+        destroy_expr(chain);
+        chain = lhs;
+    }
+
+    return concat;
+}
+
+static void select_in_expr(struct expr** slot) {
+    struct expr* expr = *slot;
+
+    switch (expr->type) {
+        case EXPR_BINARY_OPT: {
+            struct expr* concat = fuse_concat(expr);
+
+            if (concat != NULL) {
+                *slot = concat;
+                select_in_expr(slot);
+                break;
+            }
+
+            select_in_expr(&expr->op.binary.lhs);
+            select_in_expr(&expr->op.binary.rhs);
+
+            enum binary_op_type op_type = expr->op.binary.type;
+            struct expr* lhs = expr->op.binary.lhs;
+            struct expr* rhs = expr->op.binary.rhs;
+
+            if (rhs->type != EXPR_INT_LITERAL || is_logical_binary_op(op_type)) break;
+
+            long constant = rhs->op.integer_literal;
+
+            if ((op_type == BINARY_OP_EQUAL || op_type == BINARY_OP_NOT_EQUAL) && lhs->type == EXPR_VARIABLE_CONSTANT_OPT && lhs->op.variable_constant.type == BINARY_OP_MODULO) {
+                *slot = make_modulo_test(lhs->op.variable_constant.name, lhs->op.variable_constant.constant, constant, op_type == BINARY_OP_EQUAL);
+                destroy_expr(expr);
+                break;
+            }
+
+            if (lhs->type != EXPR_VARIABLE_USE) break;
+
+            // Keep the generic node to report the error
+            if ((op_type == BINARY_OP_DIV || op_type == BINARY_OP_MODULO) && constant == 0) break;
+
+            *slot = make_variable_constant_op(op_type, lhs->op.variable_use.name, constant);
+            destroy_expr(expr);
+            break;
+        }
+        case EXPR_UNARY_OPT:
+            select_in_expr(&expr->op.unary.arg);
+            break;
+        case EXPR_FUNCTION_CALL:
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                select_in_expr(arg);
+            }
+            break;
+        case EXPR_LOOP_INVARIANT:
+            select_in_expr(&expr->op.loop_invariant.value);
+            break;
+        case EXPR_CONCAT:
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                select_in_expr(operand);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// A branch made of a single statement that declares nothing doesn't need the
+// scope an if opens for it
+static struct statement* unwrap_single_statement(struct statement* block) {
+    if (block->type != STATEMENT_BLOCK || arrlen(block->op.block.statements) != 1) return NULL;
+
+    struct statement* statement = block->op.block.statements[0];
+
+    if (statement->type == STATEMENT_BLOCK || statement->type == STATEMENT_VARIABLE_DECL || statement->type == STATEMENT_FUNCTION_DECL)
+        return NULL;
+
+    return statement;
+}
+
+static void free_block_shell(struct statement* block) {
+    arrfree(block->op.block.statements);
+    free(block);
+}
+
+static struct statement* select_in_statement(struct statement* statement) {
+    if (statement == NULL) return NULL;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                *it = select_in_statement(*it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION: {
+            select_in_expr(&statement->op.if_condition.condition);
+            statement->op.if_condition.body = select_in_statement(statement->op.if_condition.body);
+            statement->op.if_condition.body_else = select_in_statement(statement->op.if_condition.body_else);
+
+            struct statement* body = unwrap_single_statement(statement->op.if_condition.body);
+            struct statement* body_else = statement->op.if_condition.body_else;
+
+            if (body == NULL) break;
+
+            if (body_else != NULL && body_else->type == STATEMENT_BLOCK) {
+                body_else = unwrap_single_statement(body_else);
+
+                if (body_else == NULL) break;
+
+                free_block_shell(statement->op.if_condition.body_else);
+            }
+
+            free_block_shell(statement->op.if_condition.body);
+
+            statement->type = STATEMENT_SIMPLE_IF;
+            statement->op.if_condition.body = body;
+            statement->op.if_condition.body_else = body_else;
+            break;
+        }
+        case STATEMENT_MATCH:
+            select_in_expr(&statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                select_in_statement(*arm);
+            }
+            statement->op.match.body_else = select_in_statement(statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL:
+            if (statement->op.variable_declaration.value != NULL)
+                select_in_expr(&statement->op.variable_declaration.value);
+            break;
+        case STATEMENT_FUNCTION_DECL:
+            select_in_statement(statement->op.function_declaration.body);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN: {
+            select_in_expr(&statement->op.variable_assignment.value);
+
+            char* variable_name = statement->op.variable_assignment.variable_name;
+            struct expr* value = statement->op.variable_assignment.value;
+
+            if (value->type == EXPR_VARIABLE_CONSTANT_OPT && is_arithmetic_binary_op(value->op.variable_constant.type) && strcmp(value->op.variable_constant.name, variable_name) == 0) {
+                struct statement* update = make_variable_update(value->op.variable_constant.type, variable_name, value->op.variable_constant.constant);
+                destroy_statement(statement);
+                return update;
+            }
+            break;
+        }
+        case STATEMENT_NAKED_FN_CALL:
+            FOR_EACH(struct expr*, arg, statement->op.naked_fn_call.function_call->op.function_call.arguments) {
+                select_in_expr(arg);
+            }
+            break;
+        case STATEMENT_WHILE_LOOP:
+            select_in_expr(&statement->op.while_loop.condition);
+            select_in_statement(statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            // A counted loop reads its bound from the original condition
+            if (!statement->op.for_loop.is_counted)
+                select_in_expr(&statement->op.for_loop.condition);
+            statement->op.for_loop.increment = select_in_statement(statement->op.for_loop.increment);
+            select_in_statement(statement->op.for_loop.body);
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL)
+                select_in_expr(&statement->op.return_statement.value);
+            break;
+        default:
+            break;
+    }
+
+    return statement;
+}
+
+void select_superinstructions(struct statement* program) {
+    select_in_statement(program);
+}
+
+// Shortest chain of comparisons worth a match statement
+static const int MIN_MATCH_CHAIN_LENGTH = 4;
+
+// `if (name == constant)`, with the variable first: it is the operand whose
+// type is reported on a mismatch, which the match statement also does
+static bool is_match_link(const struct statement* statement, const char* variable_name, enum expr_type constant_type) {
+    if (statement == NULL || statement->type != STATEMENT_IF_CONDITION) return false;
+
+    struct expr* condition = statement->op.if_condition.condition;
+
+    if (condition->type != EXPR_BINARY_OPT || condition->op.binary.type != BINARY_OP_EQUAL)
+        return false;
+
+    struct expr* lhs = condition->op.binary.lhs;
+    struct expr* rhs = condition->op.binary.rhs;
+
+    return lhs->type == EXPR_VARIABLE_USE && strcmp(lhs->op.variable_use.name, variable_name) == 0 && rhs->type == constant_type;
+}
+
+static struct statement* lower_chains_in_statement(struct statement* statement);
+
+// Turns `if (v == 1) {...} else if (v == 2) {...} else ...` into a match
+// statement on v, reusing the constants and the bodies of the chain
+static struct statement* lower_if_chain(struct statement* statement) {
+    struct expr* first = statement->op.if_condition.condition;
+
+    if (first->type != EXPR_BINARY_OPT || first->op.binary.lhs->type != EXPR_VARIABLE_USE)
+        return NULL;
+
+    char* variable_name = first->op.binary.lhs->op.variable_use.name;
+    enum expr_type constant_type = first->op.binary.rhs->type;
+
+    if (constant_type != EXPR_INT_LITERAL && constant_type != EXPR_STRING_LITERAL)
+        return NULL;
+
+    int length = 0;
+    struct statement* rest = statement;
+
+    while (is_match_link(rest, variable_name, constant_type)) {
+        length++;
+        rest = rest->op.if_condition.body_else;
+    }
+
+    if (length < MIN_MATCH_CHAIN_LENGTH) return NULL;
+
+    struct statement* match = make_match_statement(make_variable_use(variable_name));
+    struct statement* link = statement;
+
+    while (link != rest) {
+        struct expr* condition = link->op.if_condition.condition;
+        struct statement* next = link->op.if_condition.body_else;
+
+        int arm = add_match_arm(match, lower_chains_in_statement(link->op.if_condition.body));
+        add_match_constant(match, condition->op.binary.rhs, arm);
+
+        destroy_expr(condition->op.binary.lhs);
+        free(condition);
+        free(link);
+        link = next;
+    }
+
+    match->op.match.body_else = lower_chains_in_statement(rest);
+    finish_match_statement(match);
+
+    return match;
+}
+
+static struct statement* lower_chains_in_statement(struct statement* statement) {
+    if (statement == NULL) return NULL;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                *it = lower_chains_in_statement(*it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION: {
+            struct statement* match = lower_if_chain(statement);
+
+            if (match != NULL) return match;
+
+            statement->op.if_condition.body = lower_chains_in_statement(statement->op.if_condition.body);
+            statement->op.if_condition.body_else = lower_chains_in_statement(statement->op.if_condition.body_else);
+            break;
+        }
+        case STATEMENT_FUNCTION_DECL:
+            lower_chains_in_statement(statement->op.function_declaration.body);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            lower_chains_in_statement(statement->op.while_loop.body);
+            break;
+        case STATEMENT_FOR_LOOP:
+            lower_chains_in_statement(statement->op.for_loop.body);
+            break;
+        case STATEMENT_MATCH:
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                *arm = lower_chains_in_statement(*arm);
+            }
+            statement->op.match.body_else = lower_chains_in_statement(statement->op.match.body_else);
+            break;
+        default:
+            break;
+    }
+
+    return statement;
+}
+
+void lower_if_chains(struct statement* program) {
+    lower_chains_in_statement(program);
+}
+
+// Names bound by a frame, in the order of their slots
+struct resolver_scope {
+    char** names;
+    // False for the names a loop frame only declares on some runs of the
+    // code being resolved, which are looked up by name there
+    bool* is_declared;
+    // Set when the declarations of the frame may run out of order, all its
+    // names are then looked up by name
+    bool is_opaque;
+};
+
+struct slot_resolver {
+    struct name_count_entry* declaration_counts;
+    struct name_count_entry* constant_counts;
+    // Index of the variables declared once, by the frame of the program
+    struct name_count_entry* global_slots;
+    // Frames of the function being resolved, innermost last
+    struct resolver_scope* scopes;
+    // Frames pushed by the calls whose arguments are being resolved
+    int call_depth;
+};
+
+// Names declared in the frame a statement runs in, in the order of their
+// first declaration, which is the order of their slots
+static void collect_frame_declarations(char*** names, const struct statement* statement) {
+    if (statement == NULL) return;
+
+    if (statement->type == STATEMENT_BLOCK) {
+        FOR_EACH(struct statement*, it, statement->op.block.statements) {
+            collect_frame_declarations(names, *it);
+        }
+    } else if (statement->type == STATEMENT_VARIABLE_DECL) {
+        char* name = statement->op.variable_declaration.variable_name;
+
+        FOR_EACH(char*, it, *names) {
+            if (strcmp(*it, name) == 0) return;
+        }
+        arrput(*names, name);
+    }
+}
+
+// The last one, parameters may repeat a name
+static int find_scope_name(const struct resolver_scope* scope, const char* name) {
+    for (int i = (int) arrlen(scope->names) - 1; i >= 0; i--) {
+        if (strcmp(scope->names[i], name) == 0) return i;
+    }
+
+    return -1;
+}
+
+static int add_scope_name(struct resolver_scope* scope, char* name, bool is_declared) {
+    int index = find_scope_name(scope, name);
+
+    if (index >= 0) {
+        scope->is_declared[index] |= is_declared;
+        return index;
+    }
+
+    arrput(scope->names, name);
+    arrput(scope->is_declared, is_declared);
+
+    return (int) arrlen(scope->names) - 1;
+}
+
+static void push_resolver_scope(struct slot_resolver* resolver) {
+    struct resolver_scope scope = {
+            .names = NULL,
+            .is_declared = NULL,
+            .is_opaque = false,
+    };
+
+    arrput(resolver->scopes, scope);
+}
+
+static void pop_resolver_scope(struct slot_resolver* resolver) {
+    struct resolver_scope scope = arrpop(resolver->scopes);
+
+    arrfree(scope.names);
+    arrfree(scope.is_declared);
+}
+
+static struct variable_slot resolve_variable(struct slot_resolver* resolver, const char* name) {
+    int depth = resolver->call_depth;
+
+    for (int i = (int) arrlen(resolver->scopes) - 1; i >= 0; i--, depth++) {
+        const struct resolver_scope* scope = &resolver->scopes[i];
+        int index = find_scope_name(scope, name);
+
+        if (index < 0) continue;
+
+        if (scope->is_opaque || !scope->is_declared[index]) return UNRESOLVED_SLOT;
+
+        struct variable_slot slot = {
+                .kind = SLOT_LOCAL,
+                .depth = depth,
+                .index = index,
+        };
+
+        return slot;
+    }
+
+    // Any other frame is a caller's, which can't declare a name declared once
+    ptrdiff_t global = shgeti(resolver->global_slots, name);
+
+    if (global < 0) return UNRESOLVED_SLOT;
+
+    struct variable_slot slot = {
+            .kind = SLOT_GLOBAL,
+            .depth = 0,
+            .index = resolver->global_slots[global].value,
+    };
+
+    return slot;
+}
+
+static void resolve_in_expr(struct slot_resolver* resolver, struct expr* expr) {
+    switch (expr->type) {
+        case EXPR_BINARY_OPT:
+        case EXPR_INT_BINARY_OPT:
+        case EXPR_STRING_BINARY_OPT:
+            resolve_in_expr(resolver, expr->op.binary.lhs);
+            resolve_in_expr(resolver, expr->op.binary.rhs);
+            break;
+        case EXPR_UNARY_OPT:
+            resolve_in_expr(resolver, expr->op.unary.arg);
+            break;
+        case EXPR_VARIABLE_USE:
+        case EXPR_INT_VARIABLE_USE:
+            expr->op.variable_use.slot = resolve_variable(resolver, expr->op.variable_use.name);
+            break;
+        case EXPR_FUNCTION_CALL: {
+            // The arguments of a user function are evaluated in its frame
+            bool pushes_frame = is_builtin_fn(expr->op.function_call.name) == -1;
+
+            if (pushes_frame) resolver->call_depth++;
+            FOR_EACH(struct expr*, arg, expr->op.function_call.arguments) {
+                resolve_in_expr(resolver, *arg);
+            }
+            if (pushes_frame) resolver->call_depth--;
+            break;
+        }
+        case EXPR_LOOP_INVARIANT:
+            resolve_in_expr(resolver, expr->op.loop_invariant.value);
+            break;
+        case EXPR_VARIABLE_CONSTANT_OPT:
+            expr->op.variable_constant.slot = resolve_variable(resolver, expr->op.variable_constant.name);
+            break;
+        case EXPR_MODULO_TEST:
+            expr->op.modulo_test.slot = resolve_variable(resolver, expr->op.modulo_test.name);
+            break;
+        case EXPR_CONCAT:
+            FOR_EACH(struct expr*, operand, expr->op.concat.operands) {
+                resolve_in_expr(resolver, *operand);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void resolve_in_statement(struct slot_resolver* resolver, struct statement* statement);
+
+static void resolve_in_scope(struct slot_resolver* resolver, struct statement* statement) {
+    if (statement == NULL) return;
+
+    push_resolver_scope(resolver);
+    resolve_in_statement(resolver, statement);
+    pop_resolver_scope(resolver);
+}
+
+// The frame of a loop keeps the variables of previous iterations, the body
+// may see them before declaring them again
+static void add_loop_declarations(struct slot_resolver* resolver, const struct statement* body) {
+    char** names = NULL;
+    collect_frame_declarations(&names, body);
+
+    FOR_EACH(char*, name, names) {
+        add_scope_name(&arrlast(resolver->scopes), *name, false);
+    }
+
+    arrfree(names);
+}
+
+static void resolve_function_declaration(struct slot_resolver* resolver, struct statement* statement) {
+    struct resolver_scope* outer_scopes = resolver->scopes;
+    int outer_call_depth = resolver->call_depth;
+
+    resolver->scopes = NULL;
+    resolver->call_depth = 0;
+
+    push_resolver_scope(resolver);
+    FOR_EACH(char*, arg, statement->op.function_declaration.arguments) {
+        // Not add_scope_name, a repeated parameter has a slot of its own
+        arrput(arrlast(resolver->scopes).names, *arg);
+        arrput(arrlast(resolver->scopes).is_declared, true);
+    }
+    resolve_in_statement(resolver, statement->op.function_declaration.body);
+    pop_resolver_scope(resolver);
+
+    arrfree(resolver->scopes);
+    resolver->scopes = outer_scopes;
+    resolver->call_depth = outer_call_depth;
+}
+
+static void resolve_for_loop(struct slot_resolver* resolver, struct statement* statement) {
+    push_resolver_scope(resolver);
+
+    // Declarations run after the body could take the slots of the ones it
+    // skipped
+    char** increment_names = NULL;
+    collect_frame_declarations(&increment_names, statement->op.for_loop.increment);
+    arrlast(resolver->scopes).is_opaque = arrlen(increment_names) > 0;
+    arrfree(increment_names);
+
+    resolve_in_statement(resolver, statement->op.for_loop.initializer);
+
+    size_t initializer_count = arrlen(arrlast(resolver->scopes).names);
+
+    add_loop_declarations(resolver, statement->op.for_loop.body);
+    resolve_in_expr(resolver, statement->op.for_loop.condition);
+    resolve_in_statement(resolver, statement->op.for_loop.body);
+
+    // A continue may have skipped the declarations of the body
+    struct resolver_scope* scope = &arrlast(resolver->scopes);
+
+    for (size_t i = initializer_count; i < arrlen(scope->names); i++) {
+        scope->is_declared[i] = false;
+    }
+
+    resolve_in_statement(resolver, statement->op.for_loop.increment);
+    pop_resolver_scope(resolver);
+}
+
+static void resolve_in_statement(struct slot_resolver* resolver, struct statement* statement) {
+    if (statement == NULL) return;
+
+    switch (statement->type) {
+        case STATEMENT_BLOCK:
+            FOR_EACH(struct statement*, it, statement->op.block.statements) {
+                resolve_in_statement(resolver, *it);
+            }
+            break;
+        case STATEMENT_IF_CONDITION:
+            resolve_in_expr(resolver, statement->op.if_condition.condition);
+            resolve_in_scope(resolver, statement->op.if_condition.body);
+            resolve_in_scope(resolver, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_SIMPLE_IF:
+            resolve_in_expr(resolver, statement->op.if_condition.condition);
+            resolve_in_statement(resolver, statement->op.if_condition.body);
+            resolve_in_statement(resolver, statement->op.if_condition.body_else);
+            break;
+        case STATEMENT_MATCH:
+            resolve_in_expr(resolver, statement->op.match.value);
+            FOR_EACH(struct statement*, arm, statement->op.match.arms) {
+                resolve_in_scope(resolver, *arm);
+            }
+            resolve_in_scope(resolver, statement->op.match.body_else);
+            break;
+        case STATEMENT_VARIABLE_DECL: {
+            char* name = statement->op.variable_declaration.variable_name;
+
+            if (statement->op.variable_declaration.value != NULL) {
+                resolve_in_expr(resolver, statement->op.variable_declaration.value);
+            }
+
+            struct resolver_scope* scope = &arrlast(resolver->scopes);
+            int index = add_scope_name(scope, name, true);
+
+            if (!scope->is_opaque) {
+                statement->op.variable_declaration.slot.kind = SLOT_LOCAL;
+                statement->op.variable_declaration.slot.index = index;
+            }
+
+            statement->op.variable_declaration.can_shadow_constant = shget(resolver->constant_counts, name) > 0;
+            break;
+        }
+        case STATEMENT_FUNCTION_DECL:
+            resolve_function_declaration(resolver, statement);
+            break;
+        case STATEMENT_VARIABLE_ASSIGN:
+            statement->op.variable_assignment.slot = resolve_variable(resolver, statement->op.variable_assignment.variable_name);
+            resolve_in_expr(resolver, statement->op.variable_assignment.value);
+            break;
+        case STATEMENT_NAKED_FN_CALL:
+            resolve_in_expr(resolver, statement->op.naked_fn_call.function_call);
+            break;
+        case STATEMENT_WHILE_LOOP:
+            // The condition is evaluated in the frame of the loop
+            push_resolver_scope(resolver);
+            add_loop_declarations(resolver, statement->op.while_loop.body);
+            resolve_in_expr(resolver, statement->op.while_loop.condition);
+            resolve_in_statement(resolver, statement->op.while_loop.body);
+            pop_resolver_scope(resolver);
+            break;
+        case STATEMENT_FOR_LOOP:
+            resolve_for_loop(resolver, statement);
+            break;
+        case STATEMENT_RETURN:
+            if (statement->op.return_statement.value != NULL) {
+                resolve_in_expr(resolver, statement->op.return_statement.value);
+            }
+            break;
+        case STATEMENT_VARIABLE_UPDATE:
+            statement->op.variable_update.slot = resolve_variable(resolver, statement->op.variable_update.variable_name);
+            break;
+        default:
+            break;
+    }
+}
+
+// Points the variables of the program to the slot of the frame declaring
+// them wherever the frames between the use and the declaration are known
+// from the code, instead of a search by name through the whole stack
+void resolve_variable_slots(struct statement* program) {
+    struct slot_resolver resolver = {
+            .declaration_counts = NULL,
+            .constant_counts = NULL,
+            .global_slots = NULL,
+            .scopes = NULL,
+            .call_depth = 0,
+    };
+
+    count_declarations(&resolver.declaration_counts, &resolver.constant_counts, program);
+
+    char** globals = NULL;
+    collect_frame_declarations(&globals, program);
+
+    for (int i = 0; i < (int) arrlen(globals); i++) {
+        if (shget(resolver.declaration_counts, globals[i]) == 1) {
+            shput(resolver.global_slots, globals[i], i);
+        }
+    }
+
+    arrfree(globals);
+
+    resolve_in_scope(&resolver, program);
+
+    arrfree(resolver.scopes);
+    shfree(resolver.declaration_counts);
+    shfree(resolver.constant_counts);
+    shfree(resolver.global_slots);
+}
+
+struct optimization_pass {
+    const char* name;
+    int min_level;
+    void (*run)(struct statement* program);
+};
+
+// Folding can reduce a body to a single return, and inlining exposes new
+// constant expressions, hence the second round after inlining
+static const struct optimization_pass simplification_passes[] = {
+        {"constant folding", 1, fold_constants},
+        {"dead code elimination", 1, eliminate_dead_code},
+        {"inlining", 2, inline_functions},
+        {"constant folding", 2, fold_constants},
+        {"dead code elimination", 2, eliminate_dead_code},
+};
+
+// Last, the other passes only know about the generic nodes
+static const struct optimization_pass lowering_passes[] = {
+        {"match lowering", 1, lower_if_chains},
+        {"loop optimization", 2, optimize_loops},
+        {"superinstructions", 1, select_superinstructions},
+        {"variable slots", 1, resolve_variable_slots},
+};
+
+static const int MAX_SIMPLIFICATION_ROUNDS = 4;
+
+static void run_passes(const struct optimization_pass* passes, size_t pass_count, struct statement* program, int level, bool time_passes) {
+    for (size_t i = 0; i < pass_count; i++) {
+        if (level < passes[i].min_level) continue;
+
+        if (!time_passes) {
+            passes[i].run(program);
+            continue;
+        }
+
+        size_t nodes_before = count_statement_nodes(program);
+        double start = current_time_ms();
+        passes[i].run(program);
+        double elapsed = current_time_ms() - start;
+
+        print_pass_timing(passes[i].name, elapsed, "nodes", nodes_before, count_statement_nodes(program));
+    }
+}
+
+void optimize_program(struct statement* program, int level, bool time_passes) {
+    size_t simplification_count = sizeof(simplification_passes) / sizeof(simplification_passes[0]);
+    size_t lowering_count = sizeof(lowering_passes) / sizeof(lowering_passes[0]);
+
+    run_passes(simplification_passes, simplification_count, program, level, time_passes);
+
+    // -O3 keeps simplifying as long as the program shrinks
+    if (level >= 3) {
+        size_t nodes = count_statement_nodes(program);
+
+        for (int round = 1; round < MAX_SIMPLIFICATION_ROUNDS; round++) {
+            run_passes(simplification_passes, simplification_count, program, level, time_passes);
+
+            size_t new_nodes = count_statement_nodes(program);
+            if (new_nodes >= nodes) break;
+            nodes = new_nodes;
+        }
+    }
+
+    run_passes(lowering_passes, lowering_count, program, level, time_passes);
+}
@@ -0,0 +1,19 @@
+#ifndef CHAD_INTERPRETER_OPTIMIZER_H
+#define CHAD_INTERPRETER_OPTIMIZER_H
+
+#include "ast.h"
+
+static const int DEFAULT_OPTIMIZATION_LEVEL = 2;
+static const int MAX_OPTIMIZATION_LEVEL = 3;
+
+void optimize_program(struct statement* program, int level, bool time_passes);
+
+void inline_functions(struct statement* program);
+void fold_constants(struct statement* program);
+void eliminate_dead_code(struct statement* program);
+void optimize_loops(struct statement* program);
+void select_superinstructions(struct statement* program);
+void lower_if_chains(struct statement* program);
+void resolve_variable_slots(struct statement* program);
+
+#endif
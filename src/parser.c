@@ -59,6 +59,9 @@ struct statement* parse_statement(struct parser* parser) {
         case TOKEN_IF:
             statement = parse_if_condition(parser);
             break;
+        case TOKEN_MATCH:
+            statement = parse_match_statement(parser);
+            break;
         case TOKEN_WHILE:
             statement = parse_while_loop(parser);
             break;
@@ -132,6 +135,73 @@ struct statement* parse_if_condition(struct parser* parser) {
     return if_condition;
 }
 
+// Integer or string literal, integers may be negative
+static struct expr* parse_match_constant(struct parser* parser) {
+    struct token* token = advance(parser);
+
+    switch (token->type) {
+        case TOKEN_INT_LITERAL:
+            return make_integer_literal(token->value.integer);
+        case TOKEN_MINUS:
+            return make_integer_literal(-expect(parser, advance(parser), TOKEN_INT_LITERAL)->value.integer);
+        case TOKEN_STR_LITERAL:
+            return make_string_literal(token->value.str);
+        default:
+            panic("ERROR: invalid match constant line %d, expected an integer or a string but got %s\n", token->line_nb, token_type_to_string(token->type));
+    }
+}
+
+struct statement* parse_match_statement(struct parser* parser) {
+    struct token* match_token = expect(parser, advance(parser), TOKEN_MATCH);
+
+    expect(parser, advance(parser), TOKEN_OPEN_PAREN);
+    struct statement* match = make_match_statement(parse_expression(parser));
+    expect(parser, advance(parser), TOKEN_CLOSE_PAREN);
+
+    expect(parser, advance(parser), TOKEN_OPEN_BRACE);
+
+    while (peek(parser, 0)->type != TOKEN_CLOSE_BRACE && peek(parser, 0)->type != TOKEN_ELSE) {
+        int arm = add_match_arm(match, NULL);
+
+        for (;;) {
+            struct token* token = peek(parser, 0);
+            struct expr* constant = parse_match_constant(parser);
+
+            if (arrlen(match->op.match.constants) > 0 && constant->type != match->op.match.constants[0]->type) {
+                panic("ERROR: invalid match constant line %d, constants must all be integers or all strings\n", token->line_nb);
+            }
+
+            add_match_constant(match, constant, arm);
+
+            if (peek(parser, 0)->type != TOKEN_COMMA) break;
+            consume(parser, 1);
+        }
+
+        expect(parser, advance(parser), TOKEN_ARROW);
+        expect(parser, advance(parser), TOKEN_OPEN_BRACE);
+        match->op.match.arms[arm] = parse_block(parser);
+        expect(parser, advance(parser), TOKEN_CLOSE_BRACE);
+    }
+
+    if (peek(parser, 0)->type == TOKEN_ELSE) {
+        consume(parser, 1);
+        expect(parser, advance(parser), TOKEN_ARROW);
+        expect(parser, advance(parser), TOKEN_OPEN_BRACE);
+        match->op.match.body_else = parse_block(parser);
+        expect(parser, advance(parser), TOKEN_CLOSE_BRACE);
+    }
+
+    expect(parser, advance(parser), TOKEN_CLOSE_BRACE);
+
+    if (arrlen(match->op.match.arms) == 0) {
+        panic("ERROR: match statement line %d without any constant\n", match_token->line_nb);
+    }
+
+    finish_match_statement(match);
+
+    return match;
+}
+
 struct statement* parse_variable_declaration(struct parser* parser) {
     struct token* decl_op = advance(parser);
     bool constant = decl_op->type == TOKEN_CONST;
@@ -19,6 +19,7 @@ struct statement* parse_function_declaration(struct parser* parser);
 struct statement* parse_variable_assignment(struct parser* parser);
 struct statement* parse_while_loop(struct parser* parser);
 struct statement* parse_for_loop(struct parser* parser);
+struct statement* parse_match_statement(struct parser* parser);
 struct statement* parse_return_statement(struct parser* parser);
 
 struct expr* parse_expression(struct parser* parser);
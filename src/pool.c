@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include "mem.h"
+#include "pool.h"
+#include "stb_ds.h"
+
+// Precedes the bytes of each block
+struct pool_header {
+    // Bytes the block can hold, excluding the header
+    size_t size;
+};
+
+// Written over the bytes of a free block
+struct pool_free_block {
+    struct pool_free_block* next;
+};
+
+static struct pool_free_block* free_lists[POOL_SIZE_CLASS_COUNT];
+// Kept to be reachable, chunks are never returned to malloc
+static char** chunks = NULL;
+static struct pool_stats stats;
+
+static inline size_t get_size_class(size_t size) {
+    return (size + sizeof(struct pool_header) - 1) / POOL_GRANULARITY;
+}
+
+static inline size_t get_block_size(size_t size_class) {
+    return (size_class + 1) * POOL_GRANULARITY;
+}
+
+static void allocate_chunk(size_t size_class) {
+    size_t block_size = get_block_size(size_class);
+    char* chunk = xmalloc(POOL_CHUNK_SIZE);
+
+    arrpush(chunks, chunk);
+    stats.size_classes[size_class].chunk_count++;
+
+    // Pushed from the end, so that blocks are handed out in address order
+    for (size_t offset = POOL_CHUNK_SIZE / block_size * block_size; offset > 0; offset -= block_size) {
+        struct pool_free_block* block = (struct pool_free_block*) (chunk + offset - block_size);
+
+        block->next = free_lists[size_class];
+        free_lists[size_class] = block;
+    }
+}
+
+void* pool_malloc(size_t size) {
+    struct pool_header* header;
+
+    if (size + sizeof(struct pool_header) > MAX_POOL_BLOCK_SIZE) {
+        header = xmalloc(sizeof(struct pool_header) + size);
+        header->size = size;
+
+        stats.large_allocation_count++;
+        stats.large_live_count++;
+
+        return header + 1;
+    }
+
+    size_t size_class = get_size_class(size);
+
+    if (free_lists[size_class] == NULL) {
+        allocate_chunk(size_class);
+    }
+
+    header = (struct pool_header*) free_lists[size_class];
+    free_lists[size_class] = free_lists[size_class]->next;
+    header->size = get_block_size(size_class) - sizeof(struct pool_header);
+
+    stats.size_classes[size_class].allocation_count++;
+    stats.size_classes[size_class].live_count++;
+
+    return header + 1;
+}
+
+void pool_free(void* ptr) {
+    if (ptr == NULL) return;
+
+    struct pool_header* header = (struct pool_header*) ptr - 1;
+
+    if (header->size + sizeof(struct pool_header) > MAX_POOL_BLOCK_SIZE) {
+        stats.large_live_count--;
+        free(header);
+        return;
+    }
+
+    size_t size_class = get_size_class(header->size);
+    struct pool_free_block* block = (struct pool_free_block*) header;
+
+    block->next = free_lists[size_class];
+    free_lists[size_class] = block;
+
+    stats.size_classes[size_class].live_count--;
+}
+
+void* pool_realloc(void* ptr, size_t size) {
+    if (ptr == NULL) return pool_malloc(size);
+
+    struct pool_header* header = (struct pool_header*) ptr - 1;
+
+    if (size <= header->size) return ptr;
+
+    // Large blocks stay with malloc, which may grow them where they are
+    if (header->size + sizeof(struct pool_header) > MAX_POOL_BLOCK_SIZE) {
+        header = xrealloc(header, sizeof(struct pool_header) + size);
+        header->size = size;
+
+        stats.large_allocation_count++;
+
+        return header + 1;
+    }
+
+    void* grown = pool_malloc(size);
+
+    memcpy(grown, ptr, header->size);
+    pool_free(ptr);
+
+    return grown;
+}
+
+const struct pool_stats* get_pool_stats() {
+    return &stats;
+}
+
+void print_pool_stats(FILE* file) {
+    fprintf(file, "%-12s %12s %10s %8s\n", "block size", "allocations", "live", "chunks");
+
+    for (size_t i = 0; i < POOL_SIZE_CLASS_COUNT; i++) {
+        const struct pool_size_class_stats* size_class = &stats.size_classes[i];
+
+        if (size_class->allocation_count == 0) continue;
+
+        fprintf(file, "%-12zu %12zu %10zu %8zu\n", get_block_size(i), size_class->allocation_count, size_class->live_count, size_class->chunk_count);
+    }
+
+    fprintf(file, "%-12s %12zu %10zu %8s\n", "large", stats.large_allocation_count, stats.large_live_count, "-");
+}
@@ -0,0 +1,39 @@
+#ifndef CHAD_INTERPRETER_POOL_H
+#define CHAD_INTERPRETER_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Allocator of the runtime objects, the strings and their reference counts.
+// Blocks of up to MAX_POOL_BLOCK_SIZE bytes are carved out of large chunks,
+// a free list per size class taking them back to be reused, so allocating
+// them is a pop rather than a call to malloc. Larger blocks are left to
+// malloc. Each block starts with its size, so it is freed without it.
+
+// Block sizes are multiples of this, header included
+#define POOL_GRANULARITY 16
+#define MAX_POOL_BLOCK_SIZE 256
+#define POOL_SIZE_CLASS_COUNT (MAX_POOL_BLOCK_SIZE / POOL_GRANULARITY)
+#define POOL_CHUNK_SIZE (64 * 1024)
+
+struct pool_size_class_stats {
+    size_t allocation_count;
+    size_t live_count;
+    size_t chunk_count;
+};
+
+struct pool_stats {
+    struct pool_size_class_stats size_classes[POOL_SIZE_CLASS_COUNT];
+    // Blocks too large for any size class
+    size_t large_allocation_count;
+    size_t large_live_count;
+};
+
+void* pool_malloc(size_t size);
+void* pool_realloc(void* ptr, size_t size);
+void pool_free(void* ptr);
+
+const struct pool_stats* get_pool_stats();
+void print_pool_stats(FILE* file);
+
+#endif
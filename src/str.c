@@ -0,0 +1,464 @@
+#include "str.h"
+#include "errors.h"
+#include "pool.h"
+#include "stb_ds.h"
+
+static struct ref_counted allocate_counted_string(size_t length) {
+    struct string* string = pool_malloc(sizeof(struct string) + length + 1);
+
+    string->length = length;
+    string->chars = string->inline_chars;
+    string->capacity = length;
+    string->chars[length] = '\0';
+    string->lhs.data = NULL;
+    string->hash = 0;
+
+    struct ref_counted counted;
+    init_ref_counted(&counted, string);
+
+    return counted;
+}
+
+// Sets value to a new string of the given length, stored in the value itself
+// when it is short enough, and returns its characters to fill
+static char* allocate_string_value(struct runtime_value* value, size_t length) {
+    value->type = RUNTIME_TYPE_STRING;
+    value->is_short = length <= MAX_SHORT_STRING_LENGTH;
+
+    if (value->is_short) {
+        value->short_length = (unsigned char) length;
+        value->value.short_string[length] = '\0';
+        return value->value.short_string;
+    }
+
+    value->value.string = allocate_counted_string(length);
+
+    return ((struct string*) value->value.string.data)->chars;
+}
+
+struct runtime_value make_string_value(const char* chars, size_t length) {
+    struct runtime_value value;
+
+    memcpy(allocate_string_value(&value, length), chars, length);
+
+    return value;
+}
+
+struct runtime_value copy_string_value(const char* chars) {
+    return make_string_value(chars, strlen(chars));
+}
+
+static inline bool is_string_view(const struct string* string) {
+    return string->chars != NULL && string->lhs.data != NULL;
+}
+
+// Queues the operands of a rope node, or the string a view points into, for
+// release
+static void free_string_content(struct ref_counted string, struct ref_counted** pending) {
+    struct string* content = string.data;
+
+    if (content->chars == NULL) {
+        arrpush(*pending, content->lhs);
+        arrpush(*pending, content->rhs);
+    } else if (is_string_view(content)) {
+        arrpush(*pending, content->lhs);
+    } else if (content->chars != content->inline_chars) {
+        pool_free(content->chars);
+    }
+
+    pool_free(content);
+    pool_free(string.reference_count);
+}
+
+// Done in a loop rather than recursively, since a string appended to in a
+// loop is a chain of as many rope nodes as iterations
+static void release_operands(struct ref_counted* pending) {
+    while (arrlen(pending) > 0) {
+        struct ref_counted operand = arrpop(pending);
+
+        if (--(*operand.reference_count) <= 0) {
+            free_string_content(operand, &pending);
+        }
+    }
+
+    arrfree(pending);
+}
+
+void free_string(struct ref_counted string) {
+    struct ref_counted* pending = NULL;
+
+    free_string_content(string, &pending);
+    release_operands(pending);
+}
+
+static void flatten_string(struct string* rope) {
+    char* chars = pool_malloc(rope->length + 1);
+    size_t position = 0;
+    struct string** pending = NULL;
+
+    arrpush(pending, rope);
+
+    while (arrlen(pending) > 0) {
+        struct string* it = arrpop(pending);
+
+        if (it->chars == NULL) {
+            arrpush(pending, it->rhs.data);
+            arrpush(pending, it->lhs.data);
+        } else {
+            memcpy(chars + position, it->chars, it->length);
+            position += it->length;
+        }
+    }
+
+    arrfree(pending);
+    chars[rope->length] = '\0';
+
+    struct ref_counted* operands = NULL;
+    arrpush(operands, rope->lhs);
+    arrpush(operands, rope->rhs);
+    release_operands(operands);
+
+    rope->chars = chars;
+    rope->capacity = rope->length;
+    rope->lhs.data = NULL;
+}
+
+// Copies the characters of a view to a buffer of its own, releasing the
+// string it pointed into
+static void detach_view(struct string* view) {
+    char* chars = pool_malloc(view->length + 1);
+
+    memcpy(chars, view->chars, view->length);
+    chars[view->length] = '\0';
+
+    struct ref_counted* parent = NULL;
+    arrpush(parent, view->lhs);
+    release_operands(parent);
+
+    view->chars = chars;
+    view->capacity = view->length;
+    view->lhs.data = NULL;
+}
+
+const char* get_string_data(const struct runtime_value* value) {
+    if (value->is_short) return value->value.short_string;
+
+    struct string* string = value->value.string.data;
+
+    if (string->chars == NULL) {
+        flatten_string(string);
+    }
+
+    return string->chars;
+}
+
+const char* get_string_chars(const struct runtime_value* value) {
+    const char* chars = get_string_data(value);
+
+    if (value->is_short) return chars;
+
+    struct string* string = value->value.string.data;
+
+    if (is_string_view(string)) {
+        const struct string* parent = string->lhs.data;
+
+        if (string->chars + string->length != parent->chars + parent->length) {
+            detach_view(string);
+        }
+    }
+
+    return string->chars;
+}
+
+static inline bool is_same_counted_string(const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    return !lhs->is_short && !rhs->is_short && lhs->value.string.data == rhs->value.string.data;
+}
+
+int compare_strings(const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    if (is_same_counted_string(lhs, rhs)) return 0;
+
+    size_t lhs_length = get_string_length(lhs);
+    size_t rhs_length = get_string_length(rhs);
+    int result = memcmp(get_string_data(lhs), get_string_data(rhs), lhs_length < rhs_length ? lhs_length : rhs_length);
+
+    if (result != 0) return result;
+
+    return (lhs_length > rhs_length) - (lhs_length < rhs_length);
+}
+
+static size_t get_string_hash(const struct runtime_value* value) {
+    struct string* string = value->value.string.data;
+
+    if (string->hash == 0) {
+        size_t hash = stbds_hash_bytes((void*) get_string_data(value), string->length, 0);
+        // 0 is left to strings not hashed yet
+        string->hash = hash == 0 ? 1 : hash;
+    }
+
+    return string->hash;
+}
+
+bool is_equal_string(const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    if (is_same_counted_string(lhs, rhs)) return true;
+
+    size_t length = get_string_length(lhs);
+
+    if (length != get_string_length(rhs)) return false;
+
+    if (!lhs->is_short && !rhs->is_short && get_string_hash(lhs) != get_string_hash(rhs)) return false;
+
+    return memcmp(get_string_data(lhs), get_string_data(rhs), length) == 0;
+}
+
+static void reserve_string(struct string* string, size_t capacity) {
+    if (capacity <= string->capacity) return;
+
+    if (capacity < string->capacity * 2) {
+        capacity = string->capacity * 2;
+    }
+
+    if (string->chars == string->inline_chars) {
+        string->chars = pool_malloc(capacity + 1);
+        memcpy(string->chars, string->inline_chars, string->length + 1);
+    } else {
+        string->chars = pool_realloc(string->chars, capacity + 1);
+    }
+
+    string->capacity = capacity;
+}
+
+// A short string growing past MAX_SHORT_STRING_LENGTH moves to a buffer held
+// by the value alone
+static void append_short_string(struct runtime_value* string, const struct runtime_value* suffix) {
+    size_t length = string->short_length;
+    size_t suffix_length = get_string_length(suffix);
+    const char* suffix_chars = get_string_data(suffix);
+
+    if (length + suffix_length <= MAX_SHORT_STRING_LENGTH) {
+        memcpy(string->value.short_string + length, suffix_chars, suffix_length);
+        string->short_length = (unsigned char) (length + suffix_length);
+        string->value.short_string[length + suffix_length] = '\0';
+        return;
+    }
+
+    struct runtime_value grown;
+    char* chars = allocate_string_value(&grown, length + suffix_length);
+
+    memcpy(chars, string->value.short_string, length);
+    memcpy(chars + length, suffix_chars, suffix_length);
+
+    retain_value(&grown);
+    *string = grown;
+}
+
+bool append_string(struct runtime_value* string, const struct runtime_value* suffix) {
+    if (string->type != RUNTIME_TYPE_STRING || suffix->type != RUNTIME_TYPE_STRING) return false;
+
+    if (string->is_short) {
+        append_short_string(string, suffix);
+        return true;
+    }
+
+    if (*string->value.string.reference_count != 1) return false;
+
+    struct string* target = string->value.string.data;
+    size_t suffix_length = get_string_length(suffix);
+
+    get_string_data(string);
+    get_string_data(suffix);
+
+    // The characters of a view belong to the string it points into
+    if (is_string_view(target)) {
+        detach_view(target);
+    }
+
+    // Read after growing, the suffix may be the string itself
+    reserve_string(target, target->length + suffix_length);
+    memcpy(target->chars + target->length, get_string_data(suffix), suffix_length);
+
+    target->length += suffix_length;
+    target->chars[target->length] = '\0';
+    target->hash = 0;
+
+    return true;
+}
+
+// Reference counted string of a value, a short string being copied into one
+// to be held by a rope node
+static struct ref_counted get_counted_string(const struct runtime_value* value) {
+    if (!value->is_short) return value->value.string;
+
+    struct ref_counted counted = allocate_counted_string(value->short_length);
+    memcpy(((struct string*) counted.data)->chars, value->value.short_string, value->short_length);
+
+    return counted;
+}
+
+struct runtime_value concat_strings(const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    size_t lhs_length = get_string_length(lhs);
+    size_t rhs_length = get_string_length(rhs);
+    size_t length = lhs_length + rhs_length;
+
+    // Both operands are flat, being shorter than any rope node
+    if (length < MIN_ROPE_LENGTH) {
+        struct runtime_value result;
+        char* chars = allocate_string_value(&result, length);
+
+        memcpy(chars, get_string_data(lhs), lhs_length);
+        memcpy(chars + lhs_length, get_string_data(rhs), rhs_length);
+
+        return result;
+    }
+
+    struct string* rope = pool_malloc(sizeof(struct string));
+
+    rope->length = length;
+    rope->chars = NULL;
+    rope->capacity = 0;
+    rope->hash = 0;
+    rope->lhs = get_counted_string(lhs);
+    rope->rhs = get_counted_string(rhs);
+
+    (*rope->lhs.reference_count)++;
+    (*rope->rhs.reference_count)++;
+
+    struct runtime_value result = {
+            .type = RUNTIME_TYPE_STRING,
+            .is_short = false,
+    };
+
+    init_ref_counted(&result.value.string, rope);
+
+    return result;
+}
+
+struct runtime_value concat_string_values(const struct runtime_value* first, const struct runtime_value* rest, size_t count) {
+    if (count > 1 && get_string_length(first) >= MIN_ROPE_LENGTH) {
+        struct runtime_value tail = concat_string_values(&rest[0], rest + 1, count - 1);
+        return concat_strings(first, &tail);
+    }
+
+    size_t length = get_string_length(first);
+
+    for (size_t i = 0; i < count; i++) {
+        length += get_string_length(&rest[i]);
+    }
+
+    struct runtime_value result;
+    char* chars = allocate_string_value(&result, length);
+    // Flat, being shorter than any rope node
+    size_t position = get_string_length(first);
+
+    memcpy(chars, get_string_data(first), position);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t operand_length = get_string_length(&rest[i]);
+
+        memcpy(chars + position, get_string_data(&rest[i]), operand_length);
+        position += operand_length;
+    }
+
+    return result;
+}
+
+struct runtime_value make_substring(const struct runtime_value* string, size_t start, size_t length) {
+    const char* chars = get_string_data(string) + start;
+
+    if (length <= MAX_SHORT_STRING_LENGTH) return make_string_value(chars, length);
+
+    // A view of a view points into the string the latter does
+    struct ref_counted parent = string->value.string;
+    struct string* parent_content = parent.data;
+
+    if (is_string_view(parent_content)) {
+        parent = parent_content->lhs;
+    }
+
+    struct string* view = pool_malloc(sizeof(struct string));
+
+    view->length = length;
+    view->chars = (char*) chars;
+    view->capacity = length;
+    view->lhs = parent;
+    view->hash = 0;
+
+    (*parent.reference_count)++;
+
+    struct runtime_value result = {
+            .type = RUNTIME_TYPE_STRING,
+            .is_short = false,
+    };
+
+    init_ref_counted(&result.value.string, view);
+
+    return result;
+}
+
+// Writes the value as print shows it to a buffer of size bytes, unless size
+// is 0, returns its length
+static size_t format_value(char* buffer, size_t size, const struct runtime_value* value) {
+    switch (value->type) {
+        case RUNTIME_TYPE_STRING: {
+            size_t length = get_string_length(value);
+            if (size > 0) memcpy(buffer, get_string_data(value), length);
+            return length;
+        }
+        case RUNTIME_TYPE_INTEGER:
+            return snprintf(buffer, size, "%ld", value->value.integer);
+        case RUNTIME_TYPE_FLOAT:
+            return snprintf(buffer, size, "%f", value->value.floating);
+        case RUNTIME_TYPE_BOOLEAN:
+            return snprintf(buffer, size, "%s", value->value.boolean ? "true" : "false");
+        case RUNTIME_TYPE_NULL:
+            return snprintf(buffer, size, "(null)");
+    }
+
+    return 0;
+}
+
+// The template may be a view, whose characters go on past its length
+static inline bool is_placeholder(const char* chars, size_t index, size_t length) {
+    return index + 1 < length && chars[index] == '{' && chars[index + 1] == '}';
+}
+
+struct runtime_value format_string(const struct runtime_value* template_value, const struct runtime_value* values, size_t count) {
+    const char* chars = get_string_data(template_value);
+    size_t template_length = get_string_length(template_value);
+    size_t placeholder_count = 0;
+    size_t length = 0;
+
+    for (size_t i = 0; i < template_length; i++) {
+        if (!is_placeholder(chars, i, template_length)) {
+            length++;
+            continue;
+        }
+
+        if (placeholder_count < count) {
+            length += format_value(NULL, 0, &values[placeholder_count]);
+        }
+
+        placeholder_count++;
+        i++;
+    }
+
+    if (placeholder_count != count) {
+        panic("ERROR: 'format' template has %zu placeholder(s) but got %zu value(s)\n", placeholder_count, count);
+    }
+
+    struct runtime_value result;
+    char* output = allocate_string_value(&result, length);
+    size_t position = 0;
+    const struct runtime_value* value = values;
+
+    for (size_t i = 0; i < template_length; i++) {
+        if (is_placeholder(chars, i, template_length)) {
+            // Has room for the NUL written by snprintf
+            position += format_value(output + position, length - position + 1, value++);
+            i++;
+        } else {
+            output[position++] = chars[i];
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,107 @@
+#ifndef CHAD_INTERPRETER_STR_H
+#define CHAD_INTERPRETER_STR_H
+
+#include <string.h>
+
+#include "interpreter.h"
+
+// Content of the reference-counted strings, those no longer than
+// MAX_SHORT_STRING_LENGTH being stored in the runtime values themselves. A
+// long concatenation is kept as a rope node holding its operands, and only
+// copied into a single buffer when its characters are first read, so
+// appending to a string in a loop takes linear instead of quadratic time. A
+// substring is kept as a view pointing into the characters of the string it
+// was taken from, which it holds until it is released. Strings are not
+// modified once built, except by appending to one referenced by a single
+// variable.
+
+// Concatenations shorter than this are copied right away
+static const size_t MIN_ROPE_LENGTH = 128;
+
+struct string {
+    size_t length;
+    // NUL-terminated, NULL for a rope node until it is flattened, and only
+    // terminated for a view ending where the string it points into does
+    char* chars;
+    // Characters chars can hold before it must grow, NUL excluded
+    size_t capacity;
+    // Operands of a rope node, held until it is flattened. The string a view
+    // points into is held in lhs, whose data is NULL for any other string.
+    struct ref_counted lhs;
+    struct ref_counted rhs;
+    // Hash of the characters, computed the first time the string is compared
+    // for equality, 0 until then
+    size_t hash;
+    // Characters of the strings built flat
+    char inline_chars[];
+};
+
+// A string held by no variable yet, copied from length characters
+struct runtime_value make_string_value(const char* chars, size_t length);
+struct runtime_value copy_string_value(const char* chars);
+
+static inline size_t get_string_length(const struct runtime_value* value) {
+    if (value->is_short) return value->short_length;
+
+    return ((const struct string*) value->value.string.data)->length;
+}
+
+// Whether both values hold the same string, short strings being compared by
+// value since they are copied with the values holding them
+static inline bool is_same_string(const struct runtime_value* lhs, const struct runtime_value* rhs) {
+    if (lhs->type != RUNTIME_TYPE_STRING || rhs->type != RUNTIME_TYPE_STRING || lhs->is_short != rhs->is_short) return false;
+
+    if (lhs->is_short) {
+        return lhs->short_length == rhs->short_length && memcmp(lhs->value.short_string, rhs->value.short_string, lhs->short_length) == 0;
+    }
+
+    return lhs->value.string.data == rhs->value.string.data;
+}
+
+// Flattens a rope node the first time it is read. The characters of a short
+// string are those of the value passed. They are not NUL-terminated for a
+// view, get_string_length of them being read.
+const char* get_string_data(const struct runtime_value* value);
+
+// Same as get_string_data, but NUL-terminated, a view not ending where the
+// string it points into does being copied out of it first
+const char* get_string_chars(const struct runtime_value* value);
+
+// Negative, zero or positive as lhs sorts before, equal to or after rhs,
+// comparing their bytes lexicographically
+int compare_strings(const struct runtime_value* lhs, const struct runtime_value* rhs);
+
+// Whether both strings have the same characters. Strings of different lengths
+// or hashes are told apart without reading their characters, the hash of a
+// long string being kept once computed.
+bool is_equal_string(const struct runtime_value* lhs, const struct runtime_value* rhs);
+
+// The result holds a reference to the operands if it is a rope node, they
+// are still destroyed by the caller
+struct runtime_value concat_strings(const struct runtime_value* lhs, const struct runtime_value* rhs);
+
+// Concatenation of first and count strings after it, copied into a single
+// allocation. A first operand as long as a rope node is not copied but held
+// by the result, so that appending to a string in a loop stays linear.
+struct runtime_value concat_string_values(const struct runtime_value* first, const struct runtime_value* rest, size_t count);
+
+// Substring of length characters from start, which must be in bounds. A
+// substring too long to be short is a view holding the string it is taken
+// from, even once that string is not used anymore.
+struct runtime_value make_substring(const struct runtime_value* string, size_t start, size_t length);
+
+// Template with each `{}` replaced by one of the values, written as print
+// shows them. The result is measured first, to be allocated once.
+struct runtime_value format_string(const struct runtime_value* template_value, const struct runtime_value* values, size_t count);
+
+// Appends suffix to a string in place, growing its buffer geometrically, if
+// the single reference to it is held by the caller, which a short string
+// always is. Returns false, leaving the concatenation to apply_binary_op, if
+// either is not a string or the string is shared.
+bool append_string(struct runtime_value* string, const struct runtime_value* suffix);
+
+// Called once the string is not referenced anymore, releases the operands of
+// a rope node
+void free_string(struct ref_counted string);
+
+#endif
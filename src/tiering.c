@@ -0,0 +1,562 @@
+#include "tiering.h"
+#include "closure.h"
+#include "errors.h"
+#include "mem.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "timing.h"
+
+#ifdef HAVE_JIT
+#include "compiler.h"
+#include "jit.h"
+#endif
+
+enum tier {
+    TIER_TREE,
+    TIER_CLOSURE,
+    TIER_NATIVE,
+};
+
+// Outermost calls of a function or runs of a loop timed in each tier, at most
+// the closure threshold, before the closures are kept or dropped for being
+// slower
+static const int MEASURED_RUNS = 8;
+
+// Time spent by the measured runs of a tier, and the calls or iterations they
+// made
+struct tier_measure {
+    double time_ms;
+    long count;
+    int runs;
+};
+
+struct tier_state {
+    enum tier tier;
+    // Calls of a function or iterations of a loop
+    long count;
+    // Function body or whole loop, NULL until warm
+    struct statement_closure* closure;
+    // Set once the function was found not to fit the JIT compiler
+    bool is_native_rejected;
+    // Calls or loop runs in progress, only the outermost ones are measured
+    // and the tier only changes between them
+    int active_runs;
+    struct tier_measure tree_measure;
+    struct tier_measure closure_measure;
+    // Set once the closures measured slower than the tree-walking interpreter
+    bool is_closure_rejected;
+    // Outermost run of a loop by the tree-walking interpreter, timed from its
+    // start and then from the first iteration of on-stack replacement
+    bool is_run_measured;
+    double run_start_ms;
+    bool is_probing;
+    double probe_start_ms;
+};
+
+// Keyed by function body or loop statement
+struct tier_entry {
+    const struct statement* key;
+    struct tier_state* value;
+};
+
+#ifdef HAVE_JIT
+struct bytecode_function_entry {
+    const struct statement* key;
+    const struct bytecode_function* value;
+};
+#endif
+
+struct tier_manager {
+    struct tier_options options;
+    struct statement* program;
+    struct tier_entry* states;
+    // State found by the last lookup, recursive calls asking for it again
+    const struct statement* last_statement;
+    struct tier_state* last_state;
+    // Closures of the warm functions and loops
+    struct closure_program* closures;
+    double closure_time_ms;
+    // Loops replaced while running, and the time spent compiling them
+    size_t replaced_loop_count;
+    double replacement_time_ms;
+#ifdef HAVE_JIT
+    // Compiled when the first function gets hot, NULL until then
+    struct bytecode_program* bytecode;
+    struct jit* jit;
+    // Keyed by function body
+    struct bytecode_function_entry* bytecode_functions;
+    // Function slots of the main frame for the JIT, taken from the global frame
+    const struct bytecode_function** global_function_slots;
+    size_t native_function_count;
+    double native_time_ms;
+#endif
+};
+
+// States are allocated one by one, the returned pointer stays valid
+static struct tier_state* get_tier_state(struct tier_manager* tiers, const struct statement* statement) {
+    if (statement == tiers->last_statement) return tiers->last_state;
+
+    struct tier_state* state = hmget(tiers->states, statement);
+
+    if (state == NULL) {
+        state = xmalloc(sizeof(struct tier_state));
+        state->tier = TIER_TREE;
+        state->count = 0;
+        state->closure = NULL;
+        state->is_native_rejected = false;
+        state->active_runs = 0;
+        state->tree_measure = (struct tier_measure) {0};
+        state->closure_measure = (struct tier_measure) {0};
+        state->is_closure_rejected = false;
+        state->is_run_measured = false;
+        state->run_start_ms = 0;
+        state->is_probing = false;
+        state->probe_start_ms = 0;
+
+        hmput(tiers->states, statement, state);
+    }
+
+    tiers->last_statement = statement;
+    tiers->last_state = state;
+
+    return state;
+}
+
+static int get_measured_runs(const struct tier_manager* tiers) {
+    return tiers->options.closure_threshold < MEASURED_RUNS ? tiers->options.closure_threshold : MEASURED_RUNS;
+}
+
+static inline bool is_running_closure(const struct tier_state* state) {
+    return state->closure != NULL && !state->is_closure_rejected;
+}
+
+// The closures are only built once the tree-walking interpreter was measured
+static bool can_compile_closure(const struct tier_manager* tiers, const struct tier_state* state) {
+    return state->closure == NULL && !state->is_closure_rejected && state->active_runs == 0 && state->count >= tiers->options.closure_threshold && state->tree_measure.runs >= get_measured_runs(tiers);
+}
+
+// Whether the run about to start is timed. The first run of the tree-walking
+// interpreter quickens its nodes and is left out.
+static bool is_measured_run(const struct tier_manager* tiers, const struct tier_state* state, long previous_count) {
+    if (state->active_runs > 0) return false;
+
+    if (is_running_closure(state)) {
+        return state->closure_measure.runs < get_measured_runs(tiers);
+    }
+
+    return previous_count > 0 && state->tree_measure.runs < get_measured_runs(tiers);
+}
+
+static void add_measure(struct tier_measure* measure, double time_ms, long count) {
+    measure->time_ms += time_ms;
+    measure->count += count;
+    measure->runs++;
+}
+
+// Drops the closures if their time per call or iteration is not lower
+static bool reject_slower_closure(struct tier_state* state, const struct tier_measure* closure, const struct tier_measure* tree) {
+    if (closure->time_ms * tree->count < tree->time_ms * closure->count) return false;
+
+    state->is_closure_rejected = true;
+
+    if (state->tier == TIER_CLOSURE) {
+        state->tier = TIER_TREE;
+    }
+
+    return true;
+}
+
+// Compares the closures with the tree-walking interpreter once both were
+// measured
+static void record_run(const struct tier_manager* tiers, struct tier_state* state, double time_ms, long count) {
+    struct tier_measure* measure = is_running_closure(state) ? &state->closure_measure : &state->tree_measure;
+
+    add_measure(measure, time_ms, count);
+
+    if (measure == &state->closure_measure && measure->runs >= get_measured_runs(tiers)) {
+        reject_slower_closure(state, &state->closure_measure, &state->tree_measure);
+    }
+}
+
+// Returns the time spent building the closures
+static double compile_closure(struct tier_manager* tiers, struct tier_state* state, struct statement* statement) {
+    double start = current_time_ms();
+
+    state->closure = build_statement_closure(tiers->closures, statement);
+
+    if (state->tier == TIER_TREE) {
+        state->tier = TIER_CLOSURE;
+    }
+
+    double elapsed_ms = current_time_ms() - start;
+    tiers->closure_time_ms += elapsed_ms;
+
+    return elapsed_ms;
+}
+
+#ifdef HAVE_JIT
+static void compile_bytecode(struct tier_manager* tiers) {
+    tiers->bytecode = compile_program(tiers->program);
+    tiers->jit = create_jit(tiers->bytecode);
+
+    FOR_EACH(struct bytecode_function*, it, tiers->bytecode->functions) {
+        hmput(tiers->bytecode_functions, (*it)->body, *it);
+    }
+
+    arrsetlen(tiers->global_function_slots, tiers->bytecode->functions[0]->function_slot_count);
+}
+
+// A function slot of the main frame holds the function of its declaration if
+// that declaration is the one currently found in the global frame
+static void update_global_function_slots(struct tier_manager* tiers, struct context* context) {
+    const struct bytecode_function* main_function = tiers->bytecode->functions[0];
+
+    for (int i = 0; i < main_function->function_slot_count; i++) {
+        tiers->global_function_slots[i] = NULL;
+    }
+
+    FOR_EACH(struct instruction, it, main_function->code) {
+        if (it->opcode != OPCODE_DECLARE_FUNCTION) continue;
+
+        const struct bytecode_function* function = tiers->bytecode->functions[it->b];
+        const struct statement* declared = get_global_function(context, tiers->bytecode->symbols[function->symbol]);
+
+        if (declared != NULL && declared->op.function_declaration.body == function->body) {
+            tiers->global_function_slots[it->a] = function;
+        }
+    }
+}
+
+// Compiles a hot function along with its callees, returns NULL if it does not fit
+static const struct bytecode_function* compile_native_function(struct tier_manager* tiers, struct context* context, const struct statement* body) {
+    double start = current_time_ms();
+
+    if (tiers->bytecode == NULL) {
+        compile_bytecode(tiers);
+    }
+
+    const struct bytecode_function* function = hmget(tiers->bytecode_functions, body);
+
+    update_global_function_slots(tiers, context);
+
+    if (!jit_compile_function(tiers->jit, function, tiers->global_function_slots)) {
+        get_tier_state(tiers, body)->is_native_rejected = true;
+        tiers->native_time_ms += current_time_ms() - start;
+        return NULL;
+    }
+
+    // Callees compiled on the way are hot too
+    FOR_EACH(struct bytecode_function*, it, tiers->bytecode->functions) {
+        if (tiers->jit->functions[(*it)->index].status != JIT_COMPILED) continue;
+
+        struct tier_state* state = get_tier_state(tiers, (*it)->body);
+
+        if (state->tier != TIER_NATIVE) {
+            state->tier = TIER_NATIVE;
+            tiers->native_function_count++;
+        }
+    }
+
+    tiers->native_time_ms += current_time_ms() - start;
+
+    return function;
+}
+
+// Runs the machine code of a function whose arguments are all integers, once
+// it is hot. Returns false if it must be interpreted.
+static bool call_native_function(struct tier_manager* tiers, struct context* context, const struct statement* fn, struct tier_state* state, size_t parameters, struct runtime_value* return_value) {
+    const struct statement* body = fn->op.function_declaration.body;
+    long integers[JIT_MAX_PARAMETERS] = {0};
+
+    if (state->is_native_rejected || (state->tier != TIER_NATIVE && state->count < tiers->options.native_threshold))
+        return false;
+
+    for (size_t i = 0; i < arrlen(fn->op.function_declaration.arguments); i++) {
+        const struct runtime_value* argument = &context->variables[parameters + i].content;
+
+        if (argument->type != RUNTIME_TYPE_INTEGER) return false;
+        if (i < JIT_MAX_PARAMETERS) integers[i] = argument->value.integer;
+    }
+
+    const struct bytecode_function* function;
+
+    if (state->tier == TIER_NATIVE) {
+        function = hmget(tiers->bytecode_functions, body);
+    } else if ((function = compile_native_function(tiers, context, body)) == NULL) {
+        return false;
+    }
+
+    struct jit_function* compiled = &tiers->jit->functions[function->index];
+
+    jit_recursion_depth = context->recursion_depth;
+    long result = compiled->entry(integers[0], integers[1], integers[2], integers[3], integers[4], integers[5]);
+
+    return_value->type = compiled->return_type;
+
+    if (compiled->return_type == RUNTIME_TYPE_INTEGER) {
+        return_value->value.integer = result;
+    } else {
+        return_value->value.boolean = result != 0;
+    }
+
+    return true;
+}
+#endif
+
+struct runtime_value call_tiered_function(struct tier_manager* tiers, struct context* context, const struct statement* fn, size_t parameters) {
+    struct statement* body = fn->op.function_declaration.body;
+    struct tier_state* state = get_tier_state(tiers, body);
+    long previous_count = state->count++;
+
+#ifdef HAVE_JIT
+    struct runtime_value return_value;
+
+    if (call_native_function(tiers, context, fn, state, parameters, &return_value)) {
+        pop_stack_frame(context);
+        return return_value;
+    }
+#endif
+
+    if (can_compile_closure(tiers, state)) {
+        compile_closure(tiers, state, body);
+    }
+
+    // Chosen for the whole call, recursive calls included
+    struct statement_closure* closure = is_running_closure(state) ? state->closure : NULL;
+    bool is_measured = is_measured_run(tiers, state, previous_count);
+    double start = is_measured ? current_time_ms() : 0;
+
+    enter_function(context, fn, parameters);
+
+    enum completion completion;
+
+    state->active_runs++;
+    if (closure != NULL) {
+        completion = execute_statement_closure(context, closure);
+    } else {
+        completion = execute_statement(context, body);
+    }
+    state->active_runs--;
+
+    if (is_measured) {
+        record_run(tiers, state, current_time_ms() - start, state->count - previous_count);
+    }
+
+    return leave_function(context, completion);
+}
+
+bool execute_tiered_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* osr_iteration, enum completion* completion) {
+    struct tier_state* state = get_tier_state(tiers, loop);
+
+    if (can_compile_closure(tiers, state)) {
+        compile_closure(tiers, state, loop);
+    }
+
+    bool is_measured = is_measured_run(tiers, state, state->count);
+
+    if (is_running_closure(state)) {
+        struct loop_run run = UNLIMITED_LOOP_RUN;
+        double start = is_measured ? current_time_ms() : 0;
+
+        state->active_runs++;
+        *completion = run_loop_closure(context, state->closure, &run);
+        state->active_runs--;
+        state->count += run.iteration_count;
+
+        if (is_measured) {
+            record_run(tiers, state, current_time_ms() - start, run.iteration_count + 1);
+        }
+
+        return true;
+    }
+
+    // Nested runs and loops whose closures were slower are never replaced
+    if (state->active_runs == 0 && !state->is_closure_rejected) {
+        long threshold = tiers->options.closure_threshold;
+
+        state->is_run_measured = is_measured;
+        state->run_start_ms = is_measured ? current_time_ms() : 0;
+        state->is_probing = false;
+        *osr_iteration = state->count < threshold ? threshold - state->count : 1;
+    }
+
+    state->active_runs++;
+
+    return false;
+}
+
+void record_loop_iterations(struct tier_manager* tiers, struct statement* loop, long iteration_count) {
+    struct tier_state* state = get_tier_state(tiers, loop);
+
+    state->count += iteration_count;
+    state->active_runs--;
+
+    if (state->active_runs == 0 && state->is_run_measured) {
+        state->is_run_measured = false;
+        record_run(tiers, state, current_time_ms() - state->run_start_ms, iteration_count + 1);
+    }
+}
+
+// Iterations timed in each tier before a loop is replaced
+static long get_probe_iterations(const struct tier_manager* tiers) {
+    return tiers->options.closure_threshold > 0 ? tiers->options.closure_threshold : 1;
+}
+
+// On-stack replacement first times the next iterations of the tree-walking
+// interpreter, the earlier ones having quickened its nodes. Returns false
+// when that starts, moving osr_iteration to the end of those iterations.
+static bool start_probe(struct tier_manager* tiers, struct tier_state* state, long* osr_iteration) {
+    if (state->is_probing) return true;
+
+    state->is_probing = true;
+    state->probe_start_ms = current_time_ms();
+    *osr_iteration += get_probe_iterations(tiers);
+
+    return false;
+}
+
+// The closures of a loop may already exist, when a recursive call ran it
+// while this run was in progress
+static struct statement_closure* get_replacement_closure(struct tier_manager* tiers, struct tier_state* state, struct statement* loop) {
+    if (state->closure == NULL) {
+        tiers->replacement_time_ms += compile_closure(tiers, state, loop);
+    }
+
+    return state->closure;
+}
+
+// Counted loops continue from their counter, which is moved to the last
+// iteration run when the closures stop
+static enum completion resume_replacement(struct context* context, const struct statement_closure* closure, long* counter, long bound, struct loop_run* run) {
+    if (counter == NULL) {
+        return resume_loop_closure(context, closure, run);
+    }
+
+    enum completion completion = resume_counted_loop_closure(context, closure, *counter, bound, run);
+
+    if (run->is_stopped) {
+        *counter = run->counter;
+    }
+
+    return completion;
+}
+
+// Once the tree-walking interpreter was timed, the closures run as many
+// iterations and keep the loop only if they were faster
+static bool probe_replacement(struct tier_manager* tiers, struct context* context, struct statement* loop, long* counter, long bound, long* osr_iteration, enum completion* completion) {
+    struct tier_state* state = get_tier_state(tiers, loop);
+
+    if (!start_probe(tiers, state, osr_iteration)) return false;
+
+    struct tier_measure tree = {0};
+    struct tier_measure closure = {0};
+
+    add_measure(&tree, current_time_ms() - state->probe_start_ms, get_probe_iterations(tiers));
+
+    struct statement_closure* replacement = get_replacement_closure(tiers, state, loop);
+    struct loop_run run = UNLIMITED_LOOP_RUN;
+    run.iteration_limit = get_probe_iterations(tiers);
+
+    double start = current_time_ms();
+    *completion = resume_replacement(context, replacement, counter, bound, &run);
+    add_measure(&closure, current_time_ms() - start, run.iteration_count);
+
+    // The tree-walking interpreter only ran part of this run
+    state->is_run_measured = false;
+    add_measure(&state->tree_measure, tree.time_ms, tree.count);
+
+    // The loop ended at once, the closures are timed by its next runs
+    if (run.iteration_count == 0) {
+        tiers->replaced_loop_count++;
+        return true;
+    }
+
+    add_measure(&state->closure_measure, closure.time_ms, closure.count);
+
+    if (reject_slower_closure(state, &closure, &tree)) {
+        state->count += run.iteration_count;
+        *osr_iteration = -1;
+
+        return !run.is_stopped;
+    }
+
+    tiers->replaced_loop_count++;
+
+    if (run.is_stopped) {
+        run.iteration_limit = -1;
+        *completion = resume_replacement(context, replacement, counter, bound, &run);
+    }
+
+    state->count += run.iteration_count;
+
+    return true;
+}
+
+bool replace_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* osr_iteration, enum completion* completion) {
+    return probe_replacement(tiers, context, loop, NULL, 0, osr_iteration, completion);
+}
+
+bool replace_counted_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* counter, long bound, long* osr_iteration, enum completion* completion) {
+    return probe_replacement(tiers, context, loop, counter, bound, osr_iteration, completion);
+}
+
+void run_tiered_program(struct statement* program, const struct tier_options* options, bool should_time_passes) {
+    struct tier_manager tiers = {
+            .options = *options,
+            .program = program,
+            .states = NULL,
+            .last_statement = NULL,
+            .last_state = NULL,
+            .closures = create_closure_program(),
+            .closure_time_ms = 0,
+            .replaced_loop_count = 0,
+            .replacement_time_ms = 0,
+#ifdef HAVE_JIT
+            .bytecode = NULL,
+            .jit = NULL,
+            .bytecode_functions = NULL,
+            .global_function_slots = NULL,
+            .native_function_count = 0,
+            .native_time_ms = 0,
+#endif
+    };
+
+    struct context context;
+    init_context(&context);
+    context.tiers = &tiers;
+
+    push_stack_frame(&context);
+    execute_statement(&context, program);
+    pop_stack_frame(&context);
+
+    destroy_context(&context);
+
+    if (should_time_passes) {
+        // After the output of the program
+        fflush(stdout);
+        fprintf(stderr, "--- Tier-up timing ---\n");
+        print_pass_timing("closure tier", tiers.closure_time_ms, "closures", 0, count_closures(tiers.closures));
+        print_pass_timing("on-stack replacement", tiers.replacement_time_ms, "loops", 0, tiers.replaced_loop_count);
+#ifdef HAVE_JIT
+        print_pass_timing("native tier", tiers.native_time_ms, "functions", 0, tiers.native_function_count);
+#endif
+        fprintf(stderr, "----------------------\n");
+    }
+
+    for (size_t i = 0; i < hmlen(tiers.states); i++) {
+        free(tiers.states[i].value);
+    }
+
+    hmfree(tiers.states);
+    destroy_closure_program(tiers.closures);
+
+#ifdef HAVE_JIT
+    if (tiers.jit != NULL) {
+        destroy_jit(tiers.jit);
+        destroy_bytecode_program(tiers.bytecode);
+    }
+
+    hmfree(tiers.bytecode_functions);
+    arrfree(tiers.global_function_slots);
+#endif
+}
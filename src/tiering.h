@@ -0,0 +1,50 @@
+#ifndef CHAD_INTERPRETER_TIERING_H
+#define CHAD_INTERPRETER_TIERING_H
+
+#include "ast.h"
+#include "interpreter.h"
+
+// Functions and loops start in the tree-walking interpreter, move to closures
+// once warm if they measure faster there and, for functions taking integers,
+// to machine code once hot
+
+// Default number of calls of a function or iterations of a loop after which
+// it is compiled to closures
+static const int DEFAULT_CLOSURE_THRESHOLD = 20;
+
+struct tier_options {
+    int closure_threshold;
+    // Calls after which a function is compiled to machine code, only used
+    // when built with HAVE_JIT
+    int native_threshold;
+};
+
+// Runs a program with a fresh context, printing the time spent moving code
+// between tiers when should_time_passes is set
+void run_tiered_program(struct statement* program, const struct tier_options* options, bool should_time_passes);
+
+// Calls a function from the frame pushed for it once its arguments are
+// evaluated into the parameters reserved there, in the tier its call count
+// reached
+struct runtime_value call_tiered_function(struct tier_manager* tiers, struct context* context, const struct statement* fn, size_t parameters);
+
+// Runs a loop compiled to closures, storing its completion, and returns true,
+// or returns false if it is still cold and must be run by the tree-walking
+// interpreter, which may run osr_iteration iterations before replacing it
+bool execute_tiered_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* osr_iteration, enum completion* completion);
+
+// Called by the tree-walking interpreter when a cold loop exits
+void record_loop_iterations(struct tier_manager* tiers, struct statement* loop, long iteration_count);
+
+// On-stack replacement of a loop of the tree-walking interpreter reaching
+// osr_iteration: the loop is compiled to closures which continue it from the
+// end of that iteration, in the frame pushed for the loop. Counted loops
+// carry their counter and bound over. Returns true once the loop ran to its
+// end, storing its completion, or false with a new osr_iteration if the
+// tree-walking interpreter must go on from the end of the last iteration run,
+// the counter being moved to it. That happens while the interpreter is timed
+// and when the closures were slower.
+bool replace_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* osr_iteration, enum completion* completion);
+bool replace_counted_loop(struct tier_manager* tiers, struct context* context, struct statement* loop, long* counter, long bound, long* osr_iteration, enum completion* completion);
+
+#endif
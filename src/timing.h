@@ -0,0 +1,17 @@
+#ifndef CHAD_INTERPRETER_TIMING_H
+#define CHAD_INTERPRETER_TIMING_H
+
+#include <stdio.h>
+#include <time.h>
+
+static inline double current_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec * 1000.0 + (double) now.tv_nsec / 1000000.0;
+}
+
+static inline void print_pass_timing(const char* pass_name, double elapsed_ms, const char* unit, size_t before, size_t after) {
+    fprintf(stderr, "%-26s %10.3f ms  %8zu -> %8zu %s\n", pass_name, elapsed_ms, before, after, unit);
+}
+
+#endif
@@ -50,6 +50,7 @@ CHAD_INTERPRETER_TOKEN(COLON)
 CHAD_INTERPRETER_TOKEN(COMMA)
 CHAD_INTERPRETER_TOKEN(ARROW)
 CHAD_INTERPRETER_TOKEN(FOR)
+CHAD_INTERPRETER_TOKEN(MATCH)
 CHAD_INTERPRETER_TOKEN(EOS)
 
 #undef CHAD_INTERPRETER_TOKEN
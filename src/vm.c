@@ -0,0 +1,686 @@
+#include "vm.h"
+#include "errors.h"
+#include "stb_ds.h"
+#include "stb_extra.h"
+#include "str.h"
+
+#ifdef HAVE_JIT
+#include "jit.h"
+#endif
+
+struct vm_frame {
+    const struct bytecode_function* function;
+    size_t register_base;
+    size_t function_slot_base;
+    const struct instruction* return_address;
+    int return_register;
+};
+
+struct vm {
+    const struct bytecode_program* program;
+    // Registers of every frame, each frame owning a reference to the strings
+    // held by its registers
+    struct runtime_value* registers;
+    unsigned char* slot_flags;
+    const struct bytecode_function** function_slots;
+    struct vm_frame* frames;
+    // Callees resolved before their arguments are evaluated
+    const struct bytecode_function** pending_callees;
+    size_t register_top;
+    size_t function_slot_top;
+#ifdef HAVE_JIT
+    // NULL when functions are only interpreted
+    struct jit* jit;
+    int jit_call_threshold;
+#endif
+};
+
+static inline void set_register(struct runtime_value* reg, struct runtime_value value) {
+    retain_value(&value);
+    release_value(reg);
+    *reg = value;
+}
+
+static inline void set_integer(struct runtime_value* reg, long integer) {
+    release_value(reg);
+    reg->type = RUNTIME_TYPE_INTEGER;
+    reg->value.integer = integer;
+}
+
+static inline void set_boolean(struct runtime_value* reg, bool boolean) {
+    release_value(reg);
+    reg->type = RUNTIME_TYPE_BOOLEAN;
+    reg->value.boolean = boolean;
+}
+
+static void push_frame(struct vm* vm, const struct bytecode_function* function, const struct instruction* return_address, int return_register) {
+    struct vm_frame frame = {
+            .function = function,
+            .register_base = vm->register_top,
+            .function_slot_base = vm->function_slot_top,
+            .return_address = return_address,
+            .return_register = return_register,
+    };
+
+    vm->register_top += function->register_count;
+    vm->function_slot_top += function->function_slot_count;
+
+    if (arrlen(vm->registers) < vm->register_top) {
+        arrsetlen(vm->registers, vm->register_top);
+        arrsetlen(vm->slot_flags, vm->register_top);
+    }
+
+    if (arrlen(vm->function_slots) < vm->function_slot_top) {
+        arrsetlen(vm->function_slots, vm->function_slot_top);
+    }
+
+    for (size_t i = frame.register_base; i < vm->register_top; i++) {
+        vm->registers[i].type = RUNTIME_TYPE_NULL;
+        vm->slot_flags[i] = 0;
+    }
+
+    for (size_t i = frame.function_slot_base; i < vm->function_slot_top; i++) {
+        vm->function_slots[i] = NULL;
+    }
+
+    arrpush(vm->frames, frame);
+}
+
+static void pop_frame(struct vm* vm) {
+    struct vm_frame frame = arrpop(vm->frames);
+
+    for (size_t i = frame.register_base; i < vm->register_top; i++) {
+        release_value(&vm->registers[i]);
+    }
+
+    vm->register_top = frame.register_base;
+    vm->function_slot_top = frame.function_slot_base;
+}
+
+static const char* symbol_name(struct vm* vm, int symbol) {
+    return vm->program->symbols[symbol];
+}
+
+// Innermost declaration of a variable through every frame, as done by the
+// tree-walking interpreter
+static size_t find_variable(struct vm* vm, int symbol) {
+    REVERSE_FOR_EACH(struct vm_frame, frame, vm->frames) {
+        int** slots_by_symbol = frame->function->slots_by_symbol;
+
+        if (symbol >= arrlen(slots_by_symbol)) continue;
+
+        FOR_EACH(int, slot, slots_by_symbol[symbol]) {
+            size_t index = frame->register_base + *slot;
+
+            if (vm->slot_flags[index] & SLOT_DECLARED) return index;
+        }
+    }
+
+    return (size_t) -1;
+}
+
+static size_t get_variable_index(struct vm* vm, int symbol) {
+    size_t index = find_variable(vm, symbol);
+
+    if (index == (size_t) -1) {
+        panic("ERROR: cannot find variable '%s'\n", symbol_name(vm, symbol));
+    }
+
+    return index;
+}
+
+static const struct bytecode_function* find_function(struct vm* vm, int symbol) {
+    REVERSE_FOR_EACH(struct vm_frame, frame, vm->frames) {
+        int** slots_by_symbol = frame->function->function_slots_by_symbol;
+
+        if (symbol >= arrlen(slots_by_symbol)) continue;
+
+        FOR_EACH(int, slot, slots_by_symbol[symbol]) {
+            const struct bytecode_function* function = vm->function_slots[frame->function_slot_base + *slot];
+
+            if (function != NULL) return function;
+        }
+    }
+
+    return NULL;
+}
+
+static const struct bytecode_function* resolve_call(struct vm* vm, const struct call_site* site) {
+    const struct bytecode_function* callee;
+
+    switch (site->resolution) {
+        case CALL_DIRECT:
+            callee = vm->program->functions[site->target];
+            break;
+        case CALL_GLOBAL:
+            // The main frame comes first
+            callee = vm->function_slots[site->target];
+            break;
+        default:
+            callee = find_function(vm, site->symbol);
+            break;
+    }
+
+    if (callee == NULL) {
+        panic("ERROR: cannot find function %s\n", symbol_name(vm, site->symbol));
+    }
+
+    size_t fn_decl_argument_size = arrlen(callee->parameter_slots);
+    size_t fn_call_argument_size = arrlen(site->arguments);
+
+    if (fn_decl_argument_size != fn_call_argument_size) {
+        panic("ERROR: '%s' expects %zu arguments, but %zu were given\n", symbol_name(vm, site->symbol), fn_decl_argument_size, fn_call_argument_size);
+    }
+
+    return callee;
+}
+
+static void check_assignment(struct vm* vm, const struct runtime_value* variable, struct runtime_value new_content, int symbol) {
+    if (variable->type != new_content.type) {
+        panic("ERROR: cannot assign value of type %s to variable '%s' of type %s\n", runtime_type_to_string(new_content.type), symbol_name(vm, symbol), runtime_type_to_string(variable->type));
+    }
+}
+
+static void check_mutable(struct vm* vm, unsigned char flags, int symbol) {
+    if (flags & SLOT_CONSTANT) {
+        panic("ERROR: variable '%s' is constant\n", symbol_name(vm, symbol));
+    }
+}
+
+static inline void execute_binary_op(enum binary_op_type op_type, struct runtime_value* destination, struct runtime_value lhs, struct runtime_value rhs) {
+    if (lhs.type == RUNTIME_TYPE_INTEGER && rhs.type == RUNTIME_TYPE_INTEGER) {
+        long lhs_integer = lhs.value.integer;
+        long rhs_integer = rhs.value.integer;
+
+        switch (op_type) {
+            case BINARY_OP_ADD:
+                set_integer(destination, lhs_integer + rhs_integer);
+                return;
+            case BINARY_OP_SUB:
+                set_integer(destination, lhs_integer - rhs_integer);
+                return;
+            case BINARY_OP_MUL:
+                set_integer(destination, lhs_integer * rhs_integer);
+                return;
+            case BINARY_OP_DIV:
+                if (rhs_integer == 0) {
+                    panic("ERROR: cannot divide by zero\n");
+                }
+                set_integer(destination, lhs_integer / rhs_integer);
+                return;
+            case BINARY_OP_MODULO:
+                set_integer(destination, lhs_integer % rhs_integer);
+                return;
+            case BINARY_OP_EQUAL:
+                set_boolean(destination, lhs_integer == rhs_integer);
+                return;
+            case BINARY_OP_NOT_EQUAL:
+                set_boolean(destination, lhs_integer != rhs_integer);
+                return;
+            case BINARY_OP_GREATER:
+                set_boolean(destination, lhs_integer > rhs_integer);
+                return;
+            case BINARY_OP_GREATER_EQUAL:
+                set_boolean(destination, lhs_integer >= rhs_integer);
+                return;
+            case BINARY_OP_LESS:
+                set_boolean(destination, lhs_integer < rhs_integer);
+                return;
+            case BINARY_OP_LESS_EQUAL:
+                set_boolean(destination, lhs_integer <= rhs_integer);
+                return;
+            default:
+                break;
+        }
+    }
+
+    // A string only held by the destination, from `s = s + x`, is extended
+    // in place
+    if (op_type == BINARY_OP_ADD && is_same_string(destination, &lhs) && append_string(destination, &rhs))
+        return;
+
+    // Operands are never freed here as registers hold a reference to them
+    set_register(destination, apply_binary_op(op_type, lhs, rhs));
+}
+
+// A string only held by the variable is extended in place
+static void append_registers(struct runtime_value* variable, const struct runtime_value* operands, int count) {
+    if (variable->type != RUNTIME_TYPE_STRING) {
+        set_register(variable, apply_concat(variable, operands, count));
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        check_concat_operand(variable, &operands[i]);
+    }
+
+    struct runtime_value suffix = apply_concat(&operands[0], operands + 1, count - 1);
+
+    if (!append_string(variable, &suffix)) {
+        set_register(variable, concat_strings(variable, &suffix));
+    }
+
+    destroy_value(&suffix);
+}
+
+static inline void check_condition(const struct runtime_value* condition, enum condition_check check) {
+    if (check == CONDITION_UNCHECKED || condition->type == RUNTIME_TYPE_BOOLEAN) return;
+
+    const char* statement_name = "for";
+
+    switch (check) {
+        case CONDITION_LOGICAL:
+            panic("ERROR: cannot use logical operator on type %s\n", runtime_type_to_string(condition->type));
+        case CONDITION_IF:
+            statement_name = "if";
+            break;
+        case CONDITION_WHILE:
+            statement_name = "while";
+            break;
+        default:
+            break;
+    }
+
+    panic("ERROR: found a value of type %s in a %s condition\n", runtime_type_to_string(condition->type), statement_name);
+}
+
+#ifdef HAVE_JIT
+// Runs the machine code of a callee whose arguments are all integers, compiling
+// it once it is called often enough. Returns false if it must be interpreted.
+static bool call_compiled_function(struct vm* vm, const struct bytecode_function* callee, const struct call_site* site, struct runtime_value* registers, int destination) {
+    struct jit_function* compiled = &vm->jit->functions[callee->index];
+    long arguments[JIT_MAX_PARAMETERS] = {0};
+
+    if (compiled->status == JIT_REJECTED) return false;
+
+    for (size_t i = 0; i < arrlen(site->arguments); i++) {
+        const struct runtime_value* argument = &registers[site->arguments[i]];
+
+        if (argument->type != RUNTIME_TYPE_INTEGER) return false;
+        if (i < JIT_MAX_PARAMETERS) arguments[i] = argument->value.integer;
+    }
+
+    if (compiled->status != JIT_COMPILED) {
+        if (++compiled->call_count < vm->jit_call_threshold) return false;
+        // The main frame comes first
+        if (!jit_compile_function(vm->jit, callee, vm->function_slots)) return false;
+    }
+
+    // The main program is not a call
+    jit_recursion_depth = arrlen(vm->frames) - 1;
+    long result = compiled->entry(arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5]);
+
+    if (compiled->return_type == RUNTIME_TYPE_INTEGER) {
+        set_integer(&registers[destination], result);
+    } else {
+        set_boolean(&registers[destination], result != 0);
+    }
+
+    return true;
+}
+
+// Counts the iterations of the loop starting at anchor, recording it once it
+// is hot and running its trace once compiled. Returns the instruction to
+// continue at.
+static int take_back_edge(struct vm* vm, const struct bytecode_function* function, int anchor, struct runtime_value* registers, unsigned char* flags) {
+    struct jit* jit = vm->jit;
+    struct trace_recorder* recorder = &jit->recorder;
+
+    if (recorder->function != NULL) {
+        if (recorder->function == function && recorder->anchor == anchor && recorder->frame_count == arrlen(vm->frames)) {
+            jit_finish_recording(jit, vm->function_slots);
+        } else {
+            // Inner loops are traced on their own
+            jit_abort_recording(jit);
+        }
+    }
+
+    struct jit_loop* loop = jit_get_loop(jit, function, anchor);
+
+    if (loop->trace != NULL) {
+        jit_recursion_depth = arrlen(vm->frames) - 1;
+        return loop->trace(registers, flags);
+    }
+
+    if (loop->abort_count < JIT_MAX_TRACE_ABORTS && ++loop->iteration_count >= JIT_LOOP_THRESHOLD) {
+        jit_start_recording(jit, function, anchor, arrlen(vm->frames), registers);
+    }
+
+    return anchor;
+}
+
+static void record_instruction(struct vm* vm, const struct bytecode_function* function, int index, const struct runtime_value* registers) {
+    struct trace_recorder* recorder = &vm->jit->recorder;
+
+    // Calls to interpreted functions are not traced
+    if (recorder->function != function || recorder->frame_count != arrlen(vm->frames)) {
+        jit_abort_recording(vm->jit);
+        return;
+    }
+
+    jit_record_instruction(vm->jit, index, registers);
+}
+#endif
+
+static void execute(struct vm* vm) {
+    struct vm_frame* frame;
+    const struct instruction* code;
+    const struct instruction* pc;
+    const struct runtime_value* constants;
+    struct runtime_value* registers;
+    unsigned char* flags;
+    const struct bytecode_function** function_slots;
+
+    // Registers may move when a frame is pushed
+#define LOAD_FRAME()                                                   \
+    do {                                                               \
+        frame = &arrlast(vm->frames);                                  \
+        code = frame->function->code;                                  \
+        constants = frame->function->constants;                        \
+        registers = vm->registers + frame->register_base;              \
+        flags = vm->slot_flags + frame->register_base;                 \
+        function_slots = vm->function_slots + frame->function_slot_base; \
+    } while (0)
+
+    LOAD_FRAME();
+    pc = code;
+
+    for (;;) {
+        const struct instruction* instruction = pc++;
+
+#ifdef HAVE_JIT
+        if (vm->jit != NULL && vm->jit->recorder.function != NULL)
+            record_instruction(vm, frame->function, (int) (instruction - code), registers);
+#endif
+
+        switch (instruction->opcode) {
+            case OPCODE_LOAD_CONST:
+                set_register(&registers[instruction->a], constants[instruction->b]);
+                break;
+            case OPCODE_MOVE:
+                set_register(&registers[instruction->a], registers[instruction->b]);
+                break;
+            case OPCODE_LOAD_NAME: {
+                size_t index = get_variable_index(vm, instruction->b);
+                set_register(&registers[instruction->a], vm->registers[index]);
+                break;
+            }
+            case OPCODE_LOAD_GLOBAL: {
+                if (!(vm->slot_flags[instruction->b] & SLOT_DECLARED)) {
+                    panic("ERROR: cannot find variable '%s'\n", symbol_name(vm, vm->program->functions[0]->slot_symbols[instruction->b]));
+                }
+                set_register(&registers[instruction->a], vm->registers[instruction->b]);
+                break;
+            }
+            case OPCODE_CHECK_SHADOW: {
+                size_t index = find_variable(vm, instruction->a);
+
+                if (index != (size_t) -1 && (vm->slot_flags[index] & SLOT_CONSTANT)) {
+                    panic("ERROR: declaration of '%s' is shadowing a constant variable\n", symbol_name(vm, instruction->a));
+                }
+                break;
+            }
+            case OPCODE_DECLARE:
+                set_register(&registers[instruction->a], registers[instruction->b]);
+                flags[instruction->a] = SLOT_DECLARED | (instruction->c ? SLOT_CONSTANT : 0);
+                break;
+            case OPCODE_DECLARE_NULL:
+                release_value(&registers[instruction->a]);
+                registers[instruction->a].type = RUNTIME_TYPE_NULL;
+                flags[instruction->a] = SLOT_DECLARED | (instruction->c ? SLOT_CONSTANT : 0);
+                break;
+            case OPCODE_CHECK_MUTABLE:
+                check_mutable(vm, flags[instruction->a], frame->function->slot_symbols[instruction->a]);
+                break;
+            case OPCODE_ASSIGN:
+                check_assignment(vm, &registers[instruction->a], registers[instruction->b], frame->function->slot_symbols[instruction->a]);
+                set_register(&registers[instruction->a], registers[instruction->b]);
+                break;
+            case OPCODE_CHECK_ASSIGN_NAME: {
+                size_t index = get_variable_index(vm, instruction->a);
+                check_mutable(vm, vm->slot_flags[index], instruction->a);
+                break;
+            }
+            case OPCODE_STORE_NAME: {
+                size_t index = get_variable_index(vm, instruction->a);
+                check_assignment(vm, &vm->registers[index], registers[instruction->b], instruction->a);
+                set_register(&vm->registers[index], registers[instruction->b]);
+                break;
+            }
+            case OPCODE_CHECK_ASSIGN_GLOBAL: {
+                int symbol = vm->program->functions[0]->slot_symbols[instruction->a];
+
+                if (!(vm->slot_flags[instruction->a] & SLOT_DECLARED)) {
+                    panic("ERROR: cannot find variable '%s'\n", symbol_name(vm, symbol));
+                }
+                check_mutable(vm, vm->slot_flags[instruction->a], symbol);
+                break;
+            }
+            case OPCODE_STORE_GLOBAL: {
+                int symbol = vm->program->functions[0]->slot_symbols[instruction->a];
+
+                check_assignment(vm, &vm->registers[instruction->a], registers[instruction->b], symbol);
+                set_register(&vm->registers[instruction->a], registers[instruction->b]);
+                break;
+            }
+#define CHAD_INTERPRETER_BINARY_OP(X, Y)                                                                                 \
+    case OPCODE_##X:                                                                                                     \
+        execute_binary_op(BINARY_OP_##X, &registers[instruction->a], registers[instruction->b], registers[instruction->c]); \
+        break;                                                                                                           \
+    case OPCODE_##X##_IMM:                                                                                               \
+        execute_binary_op(BINARY_OP_##X, &registers[instruction->a], registers[instruction->b], constants[instruction->c]); \
+        break;
+#include "binary_ops.h"
+            case OPCODE_CONCAT:
+                set_register(&registers[instruction->a], apply_concat(&registers[instruction->b], &registers[instruction->b + 1], instruction->c - 1));
+                break;
+            case OPCODE_APPEND:
+                append_registers(&registers[instruction->a], &registers[instruction->b], instruction->c);
+                break;
+            case OPCODE_NEG: {
+                struct runtime_value arg = registers[instruction->b];
+
+                if (arg.type == RUNTIME_TYPE_INTEGER) {
+                    set_integer(&registers[instruction->a], -arg.value.integer);
+                } else {
+                    set_register(&registers[instruction->a], apply_unary_op(UNARY_OP_NEG, arg));
+                }
+                break;
+            }
+            case OPCODE_NOT: {
+                struct runtime_value arg = registers[instruction->b];
+
+                if (arg.type == RUNTIME_TYPE_BOOLEAN) {
+                    set_boolean(&registers[instruction->a], !arg.value.boolean);
+                } else {
+                    set_register(&registers[instruction->a], apply_unary_op(UNARY_OP_NOT, arg));
+                }
+                break;
+            }
+            case OPCODE_CHECK_LOGICAL:
+                get_logical_operand(registers[instruction->a]);
+                break;
+            case OPCODE_JUMP:
+                pc = code + instruction->a;
+#ifdef HAVE_JIT
+                if (vm->jit != NULL && pc <= instruction)
+                    pc = code + take_back_edge(vm, frame->function, instruction->a, registers, flags);
+#endif
+                break;
+            case OPCODE_JUMP_IF_TRUE: {
+                const struct runtime_value* condition = &registers[instruction->a];
+
+                check_condition(condition, instruction->c);
+
+                if (condition->value.boolean) {
+                    pc = code + instruction->b;
+#ifdef HAVE_JIT
+                    // Loops jump back to the start of their body
+                    if (vm->jit != NULL && pc <= instruction)
+                        pc = code + take_back_edge(vm, frame->function, instruction->b, registers, flags);
+#endif
+                }
+                break;
+            }
+            case OPCODE_JUMP_IF_FALSE: {
+                const struct runtime_value* condition = &registers[instruction->a];
+
+                check_condition(condition, instruction->c);
+
+                if (!condition->value.boolean) {
+                    pc = code + instruction->b;
+#ifdef HAVE_JIT
+                    if (vm->jit != NULL && pc <= instruction)
+                        pc = code + take_back_edge(vm, frame->function, instruction->b, registers, flags);
+#endif
+                }
+                break;
+            }
+            case OPCODE_MATCH: {
+                const struct match_site* site = &frame->function->match_sites[instruction->b];
+                int arm = select_match_arm(site->statement, registers[instruction->a]);
+
+                pc = code + (arm >= 0 ? site->arm_targets[arm] : site->else_target);
+                break;
+            }
+            case OPCODE_KILL:
+                for (int i = instruction->a; i < instruction->a + instruction->b; i++) {
+                    release_value(&registers[i]);
+                    registers[i].type = RUNTIME_TYPE_NULL;
+                    flags[i] = 0;
+                }
+                break;
+            case OPCODE_KILL_FUNCTIONS:
+                for (int i = instruction->a; i < instruction->a + instruction->b; i++) {
+                    function_slots[i] = NULL;
+                }
+                break;
+            case OPCODE_DECLARE_FUNCTION:
+                function_slots[instruction->a] = vm->program->functions[instruction->b];
+                break;
+            case OPCODE_RESOLVE_FUNCTION: {
+                const struct bytecode_function* callee = resolve_call(vm, &frame->function->call_sites[instruction->a]);
+                arrpush(vm->pending_callees, callee);
+                break;
+            }
+            case OPCODE_CALL: {
+                const struct call_site* site = &frame->function->call_sites[instruction->b];
+                const struct bytecode_function* callee = site->is_resolved_early ? arrpop(vm->pending_callees) : resolve_call(vm, site);
+                size_t caller_base = frame->register_base;
+
+#ifdef HAVE_JIT
+                if (vm->jit != NULL && call_compiled_function(vm, callee, site, registers, instruction->a))
+                    break;
+#endif
+
+                push_frame(vm, callee, pc, instruction->a);
+
+                struct runtime_value* caller_registers = vm->registers + caller_base;
+                size_t callee_base = arrlast(vm->frames).register_base;
+
+                for (size_t i = 0; i < arrlen(site->arguments); i++) {
+                    size_t slot = callee_base + callee->parameter_slots[i];
+
+                    set_register(&vm->registers[slot], caller_registers[site->arguments[i]]);
+                    vm->slot_flags[slot] = SLOT_DECLARED;
+                }
+
+                // The main program is not a call
+                if (arrlen(vm->frames) - 1 >= MAX_RECURSION_DEPTH) {
+                    panic("ERROR: max recursion depth exceeded\n");
+                }
+
+                LOAD_FRAME();
+                pc = code;
+                break;
+            }
+            case OPCODE_CHECK_BUILTIN: {
+                const struct call_site* site = &frame->function->call_sites[instruction->a];
+                check_builtin_arity(site->builtin, arrlen(site->arguments));
+                break;
+            }
+            case OPCODE_CALL_BUILTIN: {
+                const struct call_site* site = &frame->function->call_sites[instruction->b];
+                struct runtime_value arguments[MAX_BUILTIN_ARGUMENTS];
+
+                for (size_t i = 0; i < arrlen(site->arguments); i++) {
+                    arguments[i] = registers[site->arguments[i]];
+                }
+
+                set_register(&registers[instruction->a], call_builtin(site->builtin, arguments, arrlen(site->arguments)));
+                break;
+            }
+            case OPCODE_PRINT:
+                print_value(&registers[instruction->a]);
+                printf(" ");
+                break;
+            case OPCODE_PRINT_NEWLINE:
+                printf("\n");
+                release_value(&registers[instruction->a]);
+                registers[instruction->a].type = RUNTIME_TYPE_NULL;
+                break;
+            case OPCODE_RETURN:
+            case OPCODE_RETURN_NULL: {
+                struct runtime_value return_value = { .type = RUNTIME_TYPE_NULL };
+
+                if (instruction->opcode == OPCODE_RETURN) {
+                    return_value = registers[instruction->a];
+                    retain_value(&return_value);
+                }
+
+                // Returning from the main program ends it
+                if (arrlen(vm->frames) == 1) {
+                    release_value(&return_value);
+                    return;
+                }
+
+                struct vm_frame finished = arrlast(vm->frames);
+                pop_frame(vm);
+                LOAD_FRAME();
+
+                release_value(&registers[finished.return_register]);
+                registers[finished.return_register] = return_value;
+
+                pc = finished.return_address;
+                break;
+            }
+            default:
+                fprintf(stderr, "ERROR: unknown opcode\n");
+                abort();
+        }
+    }
+
+#undef LOAD_FRAME
+}
+
+void run_bytecode_program(const struct bytecode_program* program, const struct vm_options* options) {
+    struct vm vm = {
+            .program = program,
+            .registers = NULL,
+            .slot_flags = NULL,
+            .function_slots = NULL,
+            .frames = NULL,
+            .pending_callees = NULL,
+            .register_top = 0,
+            .function_slot_top = 0,
+    };
+
+#ifdef HAVE_JIT
+    vm.jit = options->is_jit_enabled ? create_jit(program) : NULL;
+    vm.jit_call_threshold = options->jit_call_threshold;
+#endif
+
+    push_frame(&vm, program->functions[0], NULL, -1);
+    execute(&vm);
+    pop_frame(&vm);
+
+    arrfree(vm.registers);
+    arrfree(vm.slot_flags);
+    arrfree(vm.function_slots);
+    arrfree(vm.frames);
+    arrfree(vm.pending_callees);
+
+#ifdef HAVE_JIT
+    if (vm.jit != NULL) destroy_jit(vm.jit);
+#endif
+}
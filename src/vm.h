@@ -0,0 +1,18 @@
+#ifndef CHAD_INTERPRETER_VM_H
+#define CHAD_INTERPRETER_VM_H
+
+#include "bytecode.h"
+
+// Default number of calls after which a function is compiled
+static const int DEFAULT_JIT_CALL_THRESHOLD = 50;
+
+struct vm_options {
+    // Compile hot functions to machine code, only available when built with
+    // HAVE_JIT
+    bool is_jit_enabled;
+    int jit_call_threshold;
+};
+
+void run_bytecode_program(const struct bytecode_program* program, const struct vm_options* options);
+
+#endif
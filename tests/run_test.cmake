@@ -0,0 +1,43 @@
+# Runs PROGRAM with the reference configuration (tree engine at -O0) and with
+# the tested OPTIONS, then checks that the reference prints EXPECTED and that
+# the tested configuration prints the same and exits with the same status.
+# The output compared is what was printed, followed by the error if any.
+# With MODE=build the program is compiled with --build into EXECUTABLE first.
+
+function(run_command output_var status_var)
+    execute_process(COMMAND ${ARGN}
+            OUTPUT_VARIABLE output
+            ERROR_VARIABLE error
+            RESULT_VARIABLE status)
+    set(${output_var} "${output}${error}" PARENT_SCOPE)
+    set(${status_var} "${status}" PARENT_SCOPE)
+endfunction()
+
+run_command(reference_output reference_status ${CHADEVAL} -O0 --engine=tree ${PROGRAM})
+
+file(READ ${EXPECTED} expected_output)
+
+if (NOT reference_output STREQUAL expected_output)
+    message(FATAL_ERROR "Reference output differs from ${EXPECTED}:\n${reference_output}")
+endif ()
+
+if (MODE STREQUAL "build")
+    run_command(build_output build_status ${CHADEVAL} --build ${EXECUTABLE} ${PROGRAM})
+
+    if (NOT build_status EQUAL 0)
+        message(FATAL_ERROR "Cannot build ${PROGRAM}:\n${build_output}")
+    endif ()
+
+    run_command(output status ${EXECUTABLE})
+else ()
+    separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+    run_command(output status ${CHADEVAL} ${options} ${PROGRAM})
+endif ()
+
+if (NOT output STREQUAL reference_output)
+    message(FATAL_ERROR "Output differs from the reference:\n${output}\nExpected:\n${reference_output}")
+endif ()
+
+if (NOT status STREQUAL reference_status)
+    message(FATAL_ERROR "Exit status ${status} differs from the reference ${reference_status}")
+endif ()